@@ -0,0 +1,102 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+
+#ifndef _MB_BENCH_ALLOC_COUNT_H_
+#define _MB_BENCH_ALLOC_COUNT_H_
+
+/*
+    Counting allocator, to be included by a single file of a benchmark: it replaces the
+    libc allocation functions, module and libraries included, and counts the calls made
+    while `mb_bench_counting' is set.
+*/
+
+extern void *__libc_malloc(size_t);
+extern void *__libc_calloc(size_t, size_t);
+extern void *__libc_realloc(void *, size_t);
+extern void *__libc_memalign(size_t, size_t);
+extern void __libc_free(void *);
+
+static volatile bool            mb_bench_counting = false;
+static volatile unsigned long   mb_bench_allocations = 0;
+
+void *malloc(size_t size) {
+/* {{{ */
+    if (mb_bench_counting)
+        __atomic_add_fetch(&mb_bench_allocations, 1, __ATOMIC_RELAXED);
+
+    return (__libc_malloc(size));
+/* }}} */
+}
+
+void *calloc(size_t count, size_t size) {
+/* {{{ */
+    if (mb_bench_counting)
+        __atomic_add_fetch(&mb_bench_allocations, 1, __ATOMIC_RELAXED);
+
+    return (__libc_calloc(count, size));
+/* }}} */
+}
+
+void *realloc(void *ptr, size_t size) {
+/* {{{ */
+    if (mb_bench_counting)
+        __atomic_add_fetch(&mb_bench_allocations, 1, __ATOMIC_RELAXED);
+
+    return (__libc_realloc(ptr, size));
+/* }}} */
+}
+
+void *memalign(size_t alignment, size_t size) {
+/* {{{ */
+    if (mb_bench_counting)
+        __atomic_add_fetch(&mb_bench_allocations, 1, __ATOMIC_RELAXED);
+
+    return (__libc_memalign(alignment, size));
+/* }}} */
+}
+
+int posix_memalign(void **ptr, size_t alignment, size_t size) {
+/* {{{ */
+    if (!(*ptr = memalign(alignment, size)))
+        return (ENOMEM);
+
+    return (0);
+/* }}} */
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+/* {{{ */
+    return (memalign(alignment, size));
+/* }}} */
+}
+
+void free(void *ptr) {
+/* {{{ */
+    __libc_free(ptr);
+/* }}} */
+}
+
+#endif
+
+// vim: ft=c ts=4 et foldmethod=marker
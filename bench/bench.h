@@ -0,0 +1,56 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+
+#ifndef _MB_BENCH_H_
+#define _MB_BENCH_H_
+
+/* Iterations run by default, overridden by the first command line argument */
+#define MB_BENCH_ITERATIONS     1000000
+
+static inline uint64_t mb_bench_now_ns(void) {
+/* {{{ */
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec);
+/* }}} */
+}
+
+static inline long mb_bench_iterations(int argc, char **argv, long iterations) {
+/* {{{ */
+    if (argc > 1 && atol(argv[1]) > 0)
+        return (atol(argv[1]));
+
+    return (iterations);
+/* }}} */
+}
+
+/* nagios.c */
+extern unsigned long nagios_reaped_results;
+extern unsigned long nagios_macro_calls;
+
+#endif
+
+// vim: ft=c ts=4 et foldmethod=marker
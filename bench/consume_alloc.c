@@ -0,0 +1,170 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+
+#include "mod_bunny.c"
+#include "alloc_count.h"
+#include "bench.h"
+
+/*
+    Count the allocations made by mb_amqp_consume() and the check result decoding for each
+    message received, librabbitmq frame reading being replaced with a fake broker handing
+    out single-result JSON deliveries. Results are reaped as Nagios would, so what's left
+    are the check results and strings Nagios takes ownership of.
+*/
+
+#define MB_BENCH_DELIVERIES     200000
+#define MB_BENCH_WARMUP         100
+
+static const char *mb_bench_body = "{\"host_name\":\"web01\",\"service_description\":\"HTTP\","
+    "\"return_code\":0,\"start_time\":1700000000.5,\"finish_time\":1700000001.25,\"output\":\"HTTP OK: 200\"}";
+
+static amqp_basic_deliver_t     mb_bench_deliver;
+static amqp_basic_properties_t  mb_bench_props;
+static int                      mb_bench_frame;
+static long                     mb_bench_remaining;
+static long                     mb_bench_results;
+
+/* Fake broker: each delivery comes as its method, header and single body frame */
+int amqp_simple_wait_frame(amqp_connection_state_t conn, amqp_frame_t *frame) {
+/* {{{ */
+    (void)conn;
+
+    memset(frame, 0, sizeof(amqp_frame_t));
+
+    switch (mb_bench_frame) {
+    case 0:
+        frame->frame_type = AMQP_FRAME_METHOD;
+        frame->payload.method.id = AMQP_BASIC_DELIVER_METHOD;
+        frame->payload.method.decoded = &mb_bench_deliver;
+        mb_bench_deliver.delivery_tag++;
+        break;
+    case 1:
+        frame->frame_type = AMQP_FRAME_HEADER;
+        frame->payload.properties.body_size = strlen(mb_bench_body);
+        frame->payload.properties.decoded = &mb_bench_props;
+        break;
+    default:
+        frame->frame_type = AMQP_FRAME_BODY;
+        frame->payload.body_fragment.bytes = (void *)mb_bench_body;
+        frame->payload.body_fragment.len = strlen(mb_bench_body);
+        break;
+    }
+
+    mb_bench_frame = (mb_bench_frame + 1) % 3;
+
+    return (0);
+/* }}} */
+}
+
+void amqp_maybe_release_buffers(amqp_connection_state_t conn) {
+/* {{{ */
+    (void)conn;
+/* }}} */
+}
+
+amqp_boolean_t amqp_frames_enqueued(amqp_connection_state_t conn) {
+/* {{{ */
+    (void)conn;
+
+    return (1);
+/* }}} */
+}
+
+amqp_boolean_t amqp_data_in_buffer(amqp_connection_state_t conn) {
+/* {{{ */
+    (void)conn;
+
+    return (1);
+/* }}} */
+}
+
+/* Hand the delivery over as the consumer thread does, then reap its results as Nagios would */
+static void mb_bench_handler(mb_delivery_t *delivery) {
+/* {{{ */
+    check_result *cr = NULL;
+
+    mb_process_check_result(delivery);
+
+    while ((cr = mb_queue_pop(mod_bunny_config.results))) {
+        free_check_result(cr);
+        free(cr);
+        mb_bench_results++;
+    }
+
+    if (--mb_bench_remaining == 0)
+        mod_bunny_config.consumer_connected = false;
+/* }}} */
+}
+
+static uint64_t mb_bench_consume(long deliveries) {
+/* {{{ */
+    uint64_t start_ns;
+
+    mb_bench_remaining = deliveries;
+    mb_bench_results = 0;
+    mod_bunny_config.consumer_connected = true;
+
+    start_ns = mb_bench_now_ns();
+    mb_amqp_consume(&mod_bunny_config, mb_bench_handler, NULL);
+
+    return (mb_bench_now_ns() - start_ns);
+/* }}} */
+}
+
+int main(int argc, char **argv) {
+/* {{{ */
+    long        deliveries = mb_bench_iterations(argc, argv, MB_BENCH_DELIVERIES);
+    uint64_t    elapsed_ns;
+
+    mb_bench_props._flags = AMQP_BASIC_CONTENT_TYPE_FLAG | AMQP_BASIC_CORRELATION_ID_FLAG;
+    mb_bench_props.content_type = amqp_cstring_bytes(MB_CONTENT_TYPE_JSON);
+    mb_bench_props.correlation_id = amqp_cstring_bytes("0123456789abcdef0123456789abcdef");
+
+    if (!(mod_bunny_config.results = mb_queue_new(16))
+        || !(mod_bunny_config.deliveries = mb_delivery_pool_new()))
+        return (1);
+
+    mod_bunny_config.fast_result_decoder = true;
+
+    /* Let the delivery pool and arenas reach their steady state */
+    mb_bench_consume(MB_BENCH_WARMUP);
+
+    mb_bench_counting = true;
+    elapsed_ns = mb_bench_consume(deliveries);
+    mb_bench_counting = false;
+
+    printf("consume_alloc: %ld deliveries, %.2f allocations per delivery, %.0f ns per delivery%s\n",
+        deliveries,
+        (double)mb_bench_allocations / deliveries,
+        (double)elapsed_ns / deliveries,
+        (mb_bench_results != deliveries ? ", results missing" : ""));
+
+    mb_delivery_pool_free(mod_bunny_config.deliveries);
+    mb_queue_free(mod_bunny_config.results);
+
+    return (mb_bench_results != deliveries);
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
@@ -0,0 +1,157 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+
+#include "mod_bunny.c"
+#include "mb_decoder.h"
+#include "bench.h"
+
+/*
+    Feed check result messages to mb_process_check_result() the way the consumer thread
+    does, decoded on the consumer thread itself then on decoder pools of growing size.
+    Results of a same host must be submitted in delivery order whatever the pool size.
+*/
+
+#define MB_BENCH_MESSAGES       200000
+#define MB_BENCH_HOSTS          100
+#define MB_BENCH_OUTPUT_LEN     1024
+
+static int mb_bench_workers[] = { 0, 1, 2, 4 };
+
+static char     mb_bench_output[MB_BENCH_OUTPUT_LEN + 1];
+static int      mb_bench_last_seq[MB_BENCH_HOSTS];
+static long     mb_bench_submitted;
+static long     mb_bench_reordered;
+
+/* What the Nagios thread would do: take submitted results off the queue, checking their order */
+static void mb_bench_reap_results(void) {
+/* {{{ */
+    check_result    *cr = NULL;
+    int             host;
+
+    while ((cr = mb_queue_pop(mod_bunny_config.results))) {
+        host = atoi(cr->host_name + 3);
+
+        if (cr->return_code <= mb_bench_last_seq[host])
+            mb_bench_reordered++;
+
+        mb_bench_last_seq[host] = cr->return_code;
+        mb_bench_submitted++;
+
+        free_check_result(cr);
+        free(cr);
+    }
+/* }}} */
+}
+
+/* A delivery as mb_amqp_consume() hands it over, the check result sequence number in `return_code' */
+static mb_delivery_t *mb_bench_delivery(int seq) {
+/* {{{ */
+    mb_delivery_t   *delivery = NULL;
+    char            *cid = NULL;
+    char            msg[MB_BENCH_OUTPUT_LEN + 256];
+    int             len;
+
+    len = snprintf(msg, sizeof(msg),
+        "{\"host_name\":\"web%d\",\"service_description\":\"HTTP\",\"check_type\":1,"
+        "\"return_code\":%d,\"start_time\":1700000000.25,\"finish_time\":1700000001.5,"
+        "\"exited_ok\":1,\"early_timeout\":0,\"output\":\"%s\"}",
+        seq % MB_BENCH_HOSTS,
+        seq,
+        mb_bench_output);
+
+    if (!(delivery = mb_delivery_new(mod_bunny_config.deliveries))
+        || !(cid = mb_arena_alloc(&delivery->arena, MB_CID_BUF_LEN))
+        || !(delivery->content_type = mb_arena_strndup(&delivery->arena, MB_CONTENT_TYPE_JSON,
+            strlen(MB_CONTENT_TYPE_JSON)))
+        || !(delivery->body = mb_arena_strndup(&delivery->arena, msg, len))) {
+        fprintf(stderr, "decoder_pool: unable to allocate memory\n");
+        exit(1);
+    }
+
+    snprintf(cid, MB_CID_BUF_LEN, "bench-%d", seq);
+    delivery->cid = cid;
+    delivery->body_len = len;
+    delivery->tag = seq;
+
+    return (delivery);
+/* }}} */
+}
+
+int main(int argc, char **argv) {
+/* {{{ */
+    long        messages = mb_bench_iterations(argc, argv, MB_BENCH_MESSAGES);
+    uint64_t    start_ns;
+    uint64_t    elapsed_ns;
+    int         rc = 0;
+
+    memset(mb_bench_output, 'x', MB_BENCH_OUTPUT_LEN);
+
+    /* Room for a whole decoder window of results, they're reaped after each message */
+    if (!(mod_bunny_config.results = mb_queue_new(MB_DECODER_WINDOW * 4))
+        || !(mod_bunny_config.deliveries = mb_delivery_pool_new()))
+        return (1);
+
+    mod_bunny_config.fast_result_decoder = true;
+
+    for (size_t w = 0; w < sizeof(mb_bench_workers) / sizeof(mb_bench_workers[0]); w++) {
+        memset(mb_bench_last_seq, 0, sizeof(mb_bench_last_seq));
+        mb_bench_submitted = 0;
+        mb_bench_reordered = 0;
+
+        if (mb_bench_workers[w] > 0 && !(mod_bunny_config.decoders = mb_decoder_pool_new(mb_bench_workers[w])))
+            return (1);
+
+        start_ns = mb_bench_now_ns();
+
+        for (long i = 1; i <= messages; i++) {
+            mb_process_check_result(mb_bench_delivery(i));
+            mb_bench_reap_results();
+        }
+
+        mb_flush_check_results();
+        mb_bench_reap_results();
+        elapsed_ns = mb_bench_now_ns() - start_ns;
+
+        printf("decoder_pool: %ld messages, %d decoder threads: %.0f results/s%s%s\n",
+            messages,
+            mb_bench_workers[w],
+            (double)mb_bench_submitted * 1000000000 / elapsed_ns,
+            (mb_bench_submitted != messages ? ", results missing" : ""),
+            (mb_bench_reordered > 0 ? ", results reordered" : ""));
+
+        if (mb_bench_submitted != messages || mb_bench_reordered > 0)
+            rc = 1;
+
+        mb_decoder_pool_free(mod_bunny_config.decoders);
+        mod_bunny_config.decoders = NULL;
+    }
+
+    mb_delivery_pool_free(mod_bunny_config.deliveries);
+    mb_queue_free(mod_bunny_config.results);
+
+    return (rc);
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
@@ -0,0 +1,149 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+
+#include <jansson.h>
+
+#include "mod_bunny.c"
+#include "mb_json.h"
+#include "bench.h"
+
+/*
+    Compare the hand-written encoder of check messages with the json_pack()/json_dumps()
+    path it replaced: messages must be byte-for-byte identical, the encoder faster.
+*/
+
+#define MB_BENCH_CHECKS 4
+
+/* Check messages as they were encoded before mb_json_pack_service_check() was hand-written */
+static char *mb_bench_jansson_pack_service_check(nebstruct_service_check_data *svc_check, int check_options,
+    char *command_line) {
+/* {{{ */
+    json_t  *json_svc_check = NULL;
+    char    *json_buf = NULL;
+
+    json_svc_check = json_pack(
+        "{s:s s:s s:s s:s s:i s:f s:f s:i}",
+        "type", "service",
+        "host_name", (svc_check->host_name ? svc_check->host_name : ""),
+        "service_description", (svc_check->service_description ? svc_check->service_description : ""),
+        "command_line", command_line,
+        "check_options", check_options,
+        "start_time", TIMEVAL_TO_FLOAT(svc_check->start_time),
+        "latency", svc_check->latency,
+        "timeout", svc_check->timeout
+    );
+
+    if (!json_svc_check)
+        return (NULL);
+
+    json_buf = json_dumps(json_svc_check, JSON_COMPACT);
+    json_decref(json_svc_check);
+
+    return (json_buf);
+/* }}} */
+}
+
+int main(int argc, char **argv) {
+/* {{{ */
+    nebstruct_service_check_data    checks[MB_BENCH_CHECKS];
+    mb_check_command_t              commands[MB_BENCH_CHECKS];
+    const char                      *msg = NULL;
+    char                            *expected = NULL;
+    size_t                          len;
+    size_t                          total = 0;
+    long                            iterations = mb_bench_iterations(argc, argv, MB_BENCH_ITERATIONS);
+    uint64_t                        start_ns;
+    uint64_t                        jansson_ns;
+    uint64_t                        encoder_ns;
+
+    char *lines[MB_BENCH_CHECKS] = {
+        "/usr/lib/nagios/plugins/check_http -H web01.example.com -u /health -w 5 -c 10",
+        "/usr/lib/nagios/plugins/check_disk -w 20% -c 10% -p \"/var/lib/my data\"",
+        "/usr/lib/nagios/plugins/check_by_ssh -H db01 -C 'echo \\\\ok\\ttab'",
+        "/usr/local/bin/check_caf\xc3\xa9 --name \"d\xc3\xa9j\xc3\xa0 vu\" --ctl \x01\x1f",
+    };
+
+    memset(checks, 0, sizeof(checks));
+    memset(commands, 0, sizeof(commands));
+
+    for (int i = 0; i < MB_BENCH_CHECKS; i++) {
+        checks[i].host_name = (i % 2 ? "db01.example.com" : "web01");
+        checks[i].service_description = (i % 2 ? "Disk \"/var\"" : "HTTP");
+        checks[i].start_time.tv_sec = 1700000000 + i;
+        checks[i].start_time.tv_usec = i * 123457;
+        checks[i].latency = 0.001 * i + 0.25;
+        checks[i].timeout = 60;
+        commands[i].line = lines[i];
+    }
+
+    for (int i = 0; i < MB_BENCH_CHECKS; i++) {
+        expected = mb_bench_jansson_pack_service_check(&checks[i], CHECK_OPTION_NONE, lines[i]);
+        msg = mb_json_pack_service_check(&checks[i], CHECK_OPTION_NONE, &commands[i], &len);
+
+        if (!expected || !msg || len != strlen(expected) || memcmp(msg, expected, len) != 0) {
+            fprintf(stderr, "json_encode: messages differ:\n  jansson: %s\n  encoder: %.*s\n",
+                (expected ? expected : "(null)"),
+                (int)(msg ? len : 6),
+                (msg ? msg : "(null)"));
+            return (1);
+        }
+
+        free(expected);
+    }
+
+    start_ns = mb_bench_now_ns();
+
+    for (long i = 0; i < iterations; i++) {
+        expected = mb_bench_jansson_pack_service_check(&checks[i % MB_BENCH_CHECKS], CHECK_OPTION_NONE,
+            lines[i % MB_BENCH_CHECKS]);
+        total += strlen(expected);
+        free(expected);
+    }
+
+    jansson_ns = mb_bench_now_ns() - start_ns;
+    start_ns = mb_bench_now_ns();
+
+    for (long i = 0; i < iterations; i++) {
+        mb_json_pack_service_check(&checks[i % MB_BENCH_CHECKS], CHECK_OPTION_NONE,
+            &commands[i % MB_BENCH_CHECKS], &len);
+        total -= len;
+    }
+
+    encoder_ns = mb_bench_now_ns() - start_ns;
+
+    printf("json_encode: %ld service checks, json_pack()/json_dumps(): %.0f ns per check, "
+        "encoder: %.0f ns per check (%.1fx)%s\n",
+        iterations,
+        (double)jansson_ns / iterations,
+        (double)encoder_ns / iterations,
+        (double)jansson_ns / encoder_ns,
+        (total != 0 ? ", length mismatch" : ""));
+
+    mb_json_free_buffers();
+
+    return (total != 0);
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
@@ -0,0 +1,206 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+
+#include <stdarg.h>
+
+#include "mod_bunny.h"
+#include "bench.h"
+
+/*
+    Stand-ins for the Nagios core symbols the module links against, for benchmarks to run
+    outside of Nagios. They only do what benchmarks need: check results are kept in a list
+    sorted the way Nagios does it, macros are not expanded.
+*/
+
+check_result    *check_result_list = NULL;
+host            *host_list = NULL;
+service         *service_list = NULL;
+char            *macro_user[MAX_USER_MACROS];
+int             currently_running_host_checks = 0;
+int             currently_running_service_checks = 0;
+int             event_broker_options = 0;
+int             host_check_timeout = 30;
+int             service_check_timeout = 60;
+int             max_check_reaper_time = 30;
+
+unsigned long   nagios_reaped_results = 0;
+unsigned long   nagios_macro_calls = 0;
+
+int logit(int data_type __attribute__((__unused__)), int display __attribute__((__unused__)),
+    const char *fmt, ...) {
+/* {{{ */
+    va_list ap;
+
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fputc('\n', stderr);
+
+    return (OK);
+/* }}} */
+}
+
+int init_check_result(check_result *cr) {
+/* {{{ */
+    memset(cr, 0, sizeof(check_result));
+
+    return (OK);
+/* }}} */
+}
+
+int free_check_result(check_result *cr) {
+/* {{{ */
+    free(cr->host_name);
+    free(cr->service_description);
+    free(cr->output_file);
+    free(cr->output);
+
+    return (OK);
+/* }}} */
+}
+
+/* Insert a check result in a list sorted by finish time, walking it from its head like Nagios 3 */
+#if NAGIOS_3_5_X
+int add_check_result_to_list(check_result **listp, check_result *new_cr) {
+#else
+int add_check_result_to_list(check_result *new_cr) {
+    check_result **listp = &check_result_list;
+#endif
+/* {{{ */
+    check_result *temp_cr = NULL;
+    check_result *last_cr = NULL;
+
+    last_cr = *listp;
+
+    for (temp_cr = *listp; temp_cr; temp_cr = temp_cr->next) {
+        if (temp_cr->finish_time.tv_sec > new_cr->finish_time.tv_sec
+            || (temp_cr->finish_time.tv_sec == new_cr->finish_time.tv_sec
+                && temp_cr->finish_time.tv_usec > new_cr->finish_time.tv_usec))
+            break;
+
+        last_cr = temp_cr;
+    }
+
+    if (!*listp || temp_cr == *listp) {
+        new_cr->next = *listp;
+        *listp = new_cr;
+    } else {
+        new_cr->next = temp_cr;
+        last_cr->next = new_cr;
+    }
+
+    return (OK);
+/* }}} */
+}
+
+int reap_check_results(void) {
+/* {{{ */
+    check_result *cr = NULL;
+
+    while ((cr = check_result_list)) {
+        check_result_list = cr->next;
+        free_check_result(cr);
+        free(cr);
+        nagios_reaped_results++;
+    }
+
+    return (OK);
+/* }}} */
+}
+
+int adjust_host_check_attempt_3x(host *hst __attribute__((__unused__)), int is_active __attribute__((__unused__))) {
+/* {{{ */
+    return (OK);
+/* }}} */
+}
+
+int schedule_new_event(int event_type __attribute__((__unused__)), int high_priority __attribute__((__unused__)),
+    time_t run_time __attribute__((__unused__)), int recurring __attribute__((__unused__)),
+    unsigned long event_interval __attribute__((__unused__)), void *timing_func __attribute__((__unused__)),
+    int compensate_for_time_change __attribute__((__unused__)), void *event_data __attribute__((__unused__)),
+    void *event_args __attribute__((__unused__)), int event_options __attribute__((__unused__))) {
+/* {{{ */
+    return (OK);
+/* }}} */
+}
+
+int neb_set_module_info(void *handle __attribute__((__unused__)), int type __attribute__((__unused__)),
+    char *data __attribute__((__unused__))) {
+/* {{{ */
+    return (OK);
+/* }}} */
+}
+
+int neb_register_callback(int callback_type __attribute__((__unused__)), void *mod_handle __attribute__((__unused__)),
+    int priority __attribute__((__unused__)), int (*callback_func)(int, void *) __attribute__((__unused__))) {
+/* {{{ */
+    return (OK);
+/* }}} */
+}
+
+int neb_deregister_callback(int callback_type __attribute__((__unused__)),
+    int (*callback_func)(int, void *) __attribute__((__unused__))) {
+/* {{{ */
+    return (OK);
+/* }}} */
+}
+
+int clear_volatile_macros(void) {
+/* {{{ */
+    return (OK);
+/* }}} */
+}
+
+int grab_host_macros(host *hst __attribute__((__unused__))) {
+/* {{{ */
+    return (OK);
+/* }}} */
+}
+
+int grab_service_macros(service *svc __attribute__((__unused__))) {
+/* {{{ */
+    return (OK);
+/* }}} */
+}
+
+int get_raw_command_line(command *cmd, char *cmd_args __attribute__((__unused__)), char **full_command,
+    int macro_options __attribute__((__unused__))) {
+/* {{{ */
+    *full_command = (cmd ? strdup(cmd->command_line) : NULL);
+    nagios_macro_calls++;
+
+    return (*full_command ? OK : ERROR);
+/* }}} */
+}
+
+int process_macros(char *input_buffer, char **output_buffer, int options __attribute__((__unused__))) {
+/* {{{ */
+    *output_buffer = (input_buffer ? strdup(input_buffer) : NULL);
+    nagios_macro_calls++;
+
+    return (*output_buffer ? OK : ERROR);
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
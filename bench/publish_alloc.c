@@ -0,0 +1,312 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+
+#include "mod_bunny.c"
+#include "alloc_count.h"
+#include "bench.h"
+
+/*
+    Make sure publishing checks doesn't allocate once buffers are recycled, with the module
+    set up as mb_init() does it: check commands expanded by mod_bunny, dispatch table,
+    checks in flight tracked and their deadlines armed. Host and service checks go through
+    mb_handle_*_check() on this thread, standing for the Nagios thread, then through
+    mb_amqp_publish() as a publisher thread would, amqp_basic_publish() being replaced with
+    a fake one. Their results come back right away, and the timers of their deadlines go
+    off within a couple of seconds. Fails on any allocation, or if Nagios had to expand a
+    command line, in both formats and with timed out checks failed or republished.
+*/
+
+#define MB_BENCH_CHECKS         500000
+#define MB_BENCH_WARMUP_SECONDS 3
+#define MB_BENCH_NS             1000000000ULL
+
+static char *mb_bench_configs[] = {
+    "{\"publisher_format\": \"json\", \"check_timeout_action\": \"fail\", \"check_timeout_slack\": 0}",
+    "{\"publisher_format\": \"msgpack\", \"check_timeout_action\": \"fail\", \"check_timeout_slack\": 0}",
+    "{\"publisher_format\": \"json\", \"check_timeout_action\": \"republish\", \"check_timeout_slack\": 0}",
+    "{\"publisher_format\": \"msgpack\", \"check_timeout_action\": \"republish\", \"check_timeout_slack\": 0}",
+};
+
+static char             mb_bench_config_file[] = "/tmp/publish_alloc.XXXXXX";
+static mb_publisher_t   mb_bench_publisher;
+static unsigned long    mb_bench_published = 0;
+static unsigned long    mb_bench_unmatched = 0;
+
+int amqp_basic_publish(amqp_connection_state_t state, amqp_channel_t channel, amqp_bytes_t exchange,
+    amqp_bytes_t routing_key, amqp_boolean_t mandatory, amqp_boolean_t immediate,
+    struct amqp_basic_properties_t_ const *properties, amqp_bytes_t body) {
+/* {{{ */
+    (void)state;
+    (void)channel;
+    (void)exchange;
+    (void)routing_key;
+    (void)mandatory;
+    (void)immediate;
+    (void)properties;
+    (void)body;
+
+    mb_bench_published++;
+
+    return (0);
+/* }}} */
+}
+
+/* Load one of the configurations above the way Nagios would, through a configuration file */
+static int mb_bench_init_config(char *config) {
+/* {{{ */
+    FILE    *f = NULL;
+    int     fd;
+    int     rc;
+
+    if ((fd = mkstemp(mb_bench_config_file)) < 0 || !(f = fdopen(fd, "w"))) {
+        fprintf(stderr, "publish_alloc: unable to create configuration file: %s\n", strerror(errno));
+        return (MB_NOK);
+    }
+
+    fputs(config, f);
+    fclose(f);
+
+    mod_bunny_args = mb_bench_config_file;
+    rc = mb_init_config();
+
+    unlink(mb_bench_config_file);
+    strcpy(mb_bench_config_file + strlen(mb_bench_config_file) - 6, "XXXXXX");
+
+    return (rc);
+/* }}} */
+}
+
+/* What the publisher and consumer threads would do: publish the check, take its result back */
+static void mb_bench_publisher_turn(host *hst, service *svc, int object_type) {
+/* {{{ */
+    mb_check_msg_t  *msg = NULL;
+    check_result    cr;
+    uint64_t        rtt_us;
+
+    while ((msg = mb_queue_pop(mb_bench_publisher.queue))) {
+        msg->channel = AMQP_CHANNEL;
+
+        if (!mb_amqp_publish(&mb_bench_publisher, msg)) {
+            fprintf(stderr, "publish_alloc: unable to publish check\n");
+            exit(1);
+        }
+
+        memset(&cr, 0, sizeof(check_result));
+        cr.object_check_type = object_type;
+        cr.host_name = hst->name;
+        cr.service_description = (object_type == SERVICE_CHECK ? svc->description : NULL);
+
+        if (mb_inflight_remove(mod_bunny_config.inflight, msg->cid, &cr, &rtt_us) != MB_INFLIGHT_RESULT_MATCHED)
+            mb_bench_unmatched++;
+
+        mb_free_check_msg(msg);
+    }
+
+    mb_timer_wheel_advance(mod_bunny_config.check_timeouts, mb_expire_check);
+/* }}} */
+}
+
+static void mb_bench_publish_check(host *hst, service *svc, long i) {
+/* {{{ */
+    nebstruct_host_check_data       hstdata = {
+        .object_ptr = hst,
+        .host_name = hst->name,
+    };
+    nebstruct_service_check_data    svcdata = {
+        .object_ptr = svc,
+        .host_name = svc->host_name,
+        .service_description = svc->description,
+    };
+
+    if ((i % 2 ? mb_handle_host_check(&hstdata) : mb_handle_service_check(&svcdata)) != MB_OK) {
+        fprintf(stderr, "publish_alloc: unable to handle check\n");
+        exit(1);
+    }
+
+    mb_bench_publisher_turn(hst, svc, (i % 2 ? HOST_CHECK : SERVICE_CHECK));
+/* }}} */
+}
+
+/*
+    Publish checks for a few seconds, for buffers and deadline timers to reach their steady
+    state. Returns the number of checks published in the slowest whole second.
+*/
+static long mb_bench_warm_up(host *hst, service *svc) {
+/* {{{ */
+    uint64_t    second = mb_bench_now_ns() / MB_BENCH_NS;
+    uint64_t    now;
+    long        checks = 0;
+    long        rate = 0;
+
+    for (int elapsed = 0; elapsed < MB_BENCH_WARMUP_SECONDS; ) {
+        if ((now = mb_bench_now_ns() / MB_BENCH_NS) != second) {
+            /* The first second is only partly spent publishing */
+            if (elapsed > 0 && (rate == 0 || checks < rate))
+                rate = checks;
+
+            second = now;
+            checks = 0;
+            elapsed++;
+            continue;
+        }
+
+        mb_bench_publish_check(hst, svc, checks++);
+    }
+
+    return (rate);
+/* }}} */
+}
+
+/*
+    Publish `checks' checks, at most half as many per second as during the warm-up: as
+    many deadline timers can't be armed at once as there were then, and recycled.
+    Returns the time spent publishing.
+*/
+static uint64_t mb_bench_publish_checks(host *hst, service *svc, long checks, long rate) {
+/* {{{ */
+    uint64_t    second = mb_bench_now_ns() / MB_BENCH_NS;
+    uint64_t    start_ns;
+    uint64_t    now_ns;
+    uint64_t    elapsed_ns = 0;
+    long        published = 0;
+
+    for (long i = 0; i < checks; ) {
+        start_ns = mb_bench_now_ns();
+
+        if (start_ns / MB_BENCH_NS != second) {
+            second = start_ns / MB_BENCH_NS;
+            published = 0;
+        }
+
+        if (published >= rate / 2) {
+            usleep(1000);
+            mb_bench_publisher_turn(hst, svc, SERVICE_CHECK);
+            continue;
+        }
+
+        mb_bench_publish_check(hst, svc, i++);
+        published++;
+
+        now_ns = mb_bench_now_ns();
+        elapsed_ns += now_ns - start_ns;
+    }
+
+    return (elapsed_ns);
+/* }}} */
+}
+
+int main(int argc, char **argv) {
+/* {{{ */
+    static command      cmd = {
+        .name = "check_http",
+        .command_line = "$USER1$/check_http -H $HOSTADDRESS$ $ARG1$",
+    };
+    static host         hst = {
+        .name = "web01",
+        .address = "10.0.0.1",
+        .host_check_command = "check_http!-u /",
+        .check_command_ptr = &cmd,
+    };
+    static service      svc = {
+        .host_name = "web01",
+        .description = "HTTP",
+        .service_check_command = "check_http!-u /health -w 5 -c 10",
+        .check_command_ptr = &cmd,
+        .host_ptr = &hst,
+    };
+    long                checks = mb_bench_iterations(argc, argv, MB_BENCH_CHECKS);
+    long                rate;
+    uint64_t            elapsed_ns;
+    int                 rc = 0;
+
+    /* Checks time out, and are then failed or republished, within a second */
+    macro_user[0] = "/usr/lib/nagios/plugins";
+    host_list = &hst;
+    service_list = &svc;
+    host_check_timeout = 1;
+    service_check_timeout = 1;
+
+    mb_nagios_thread = pthread_self();
+    mb_cid_init();
+
+    if (!(mb_bench_publisher.queue = mb_queue_new(16))
+        || !(mod_bunny_config.check_msgs = mb_queue_new(MB_CHECK_MSG_POOL_SIZE)))
+        return (1);
+
+    for (size_t c = 0; c < sizeof(mb_bench_configs) / sizeof(mb_bench_configs[0]); c++) {
+        if (!mb_bench_init_config(mb_bench_configs[c]))
+            return (1);
+
+        mod_bunny_config.publisher_connections = 1;
+        mod_bunny_config.publisher_channels = 1;
+        mod_bunny_config.publishers = &mb_bench_publisher;
+        mb_bench_publisher.config = &mod_bunny_config;
+        mb_bench_publisher.connected = true;
+
+        mb_init_dispatch();
+        mb_amqp_init_publisher_props(&mod_bunny_config);
+
+        if (!mod_bunny_config.dispatch
+            || !(mod_bunny_config.inflight = mb_inflight_new(mod_bunny_config.inflight_table_size,
+                mod_bunny_config.check_timeout_slack))
+            || !(mod_bunny_config.check_timeouts = mb_timer_wheel_new()))
+            return (1);
+
+        rate = mb_bench_warm_up(&hst, &svc);
+
+        mb_bench_published = 0;
+        mb_bench_unmatched = 0;
+        mb_bench_allocations = 0;
+        nagios_macro_calls = 0;
+
+        mb_bench_counting = true;
+        elapsed_ns = mb_bench_publish_checks(&hst, &svc, checks, rate);
+        mb_bench_counting = false;
+
+        printf("publish_alloc: %ld %s checks (timed out checks %sed), %.2f allocations per check, "
+            "%.0f ns per check%s%s%s\n",
+            checks,
+            (mod_bunny_config.publisher_format_mode == MB_PUBLISHER_FORMAT_MSGPACK ? "msgpack" : "JSON"),
+            mod_bunny_config.check_timeout_action,
+            (double)mb_bench_allocations / checks,
+            (double)elapsed_ns / checks,
+            (nagios_macro_calls > 0 ? ", command lines expanded by Nagios" : ""),
+            (mb_bench_published != (unsigned long)checks ? ", checks missing" : ""),
+            (mb_bench_unmatched > 0 ? ", results unmatched" : ""));
+
+        if (mb_bench_allocations > 0 || nagios_macro_calls > 0 || mb_bench_published != (unsigned long)checks
+            || mb_bench_unmatched > 0)
+            rc = 1;
+
+        mb_timer_wheel_free(mod_bunny_config.check_timeouts);
+        mod_bunny_config.check_timeouts = NULL;
+        mb_inflight_free(mod_bunny_config.inflight);
+        mod_bunny_config.inflight = NULL;
+    }
+
+    return (rc);
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
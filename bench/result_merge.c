@@ -0,0 +1,136 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+
+#include "mod_bunny.c"
+#include "bench.h"
+
+/*
+    Compare injecting a burst of check results into the Nagios check result list one by
+    one, as add_check_result_to_list() does it, with mb_drain_check_results() sorting the
+    burst on its own and merging it into the list in one pass. Both must give the same list.
+*/
+
+#define MB_BENCH_BURST_RESULTS  10000
+#define MB_BENCH_BURST_ROUNDS   10
+
+static uint32_t mb_bench_seed = 42;
+
+/* Workers finish their checks in any order, within a few seconds of each other */
+static void mb_bench_fill_burst(check_result **burst, int results) {
+/* {{{ */
+    for (int i = 0; i < results; i++) {
+        mb_bench_seed = mb_bench_seed * 1103515245 + 12345;
+
+        burst[i] = mb_new_check_result();
+        burst[i]->host_name = strdup("web01");
+        burst[i]->return_code = i;
+        burst[i]->finish_time.tv_sec = 1700000000 + (mb_bench_seed >> 16) % 5;
+        burst[i]->finish_time.tv_usec = (mb_bench_seed >> 4) % 1000 * 1000;
+    }
+/* }}} */
+}
+
+/* Fingerprint of the list order, to tell both injection paths agree */
+static uint64_t mb_bench_list_hash(check_result *list, int *count) {
+/* {{{ */
+    uint64_t h = 14695981039346656037ULL;
+
+    for (*count = 0; list; list = list->next, (*count)++)
+        h = (h ^ (uint64_t)list->return_code) * 1099511628211ULL;
+
+    return (h);
+/* }}} */
+}
+
+int main(int argc, char **argv) {
+/* {{{ */
+    check_result    **burst = NULL;
+    int             results = (int)mb_bench_iterations(argc, argv, MB_BENCH_BURST_RESULTS);
+    int             count;
+    uint64_t        start_ns;
+    uint64_t        list_ns = 0;
+    uint64_t        merge_ns = 0;
+    uint64_t        list_hash;
+    uint64_t        merge_hash;
+    bool            mismatch = false;
+
+    if (!(burst = calloc(results, sizeof(check_result *)))
+        || !(mod_bunny_config.results = mb_queue_new(results)))
+        return (1);
+
+    mod_bunny_config.pending_results_tail = &mod_bunny_config.pending_results;
+
+    for (int round = 0; round < MB_BENCH_BURST_ROUNDS; round++) {
+        uint32_t seed = mb_bench_seed;
+
+        mb_bench_fill_burst(burst, results);
+        start_ns = mb_bench_now_ns();
+
+        for (int i = 0; i < results; i++) {
+#if NAGIOS_3_5_X
+            add_check_result_to_list(&check_result_list, burst[i]);
+#else
+            add_check_result_to_list(burst[i]);
+#endif
+        }
+
+        list_ns += mb_bench_now_ns() - start_ns;
+        list_hash = mb_bench_list_hash(check_result_list, &count);
+        reap_check_results();
+
+        /* Same burst again, handed over by the consumer thread */
+        mb_bench_seed = seed;
+        mb_bench_fill_burst(burst, results);
+
+        for (int i = 0; i < results; i++)
+            mb_queue_push(mod_bunny_config.results, burst[i]);
+
+        start_ns = mb_bench_now_ns();
+        mb_drain_check_results(NULL);
+        merge_ns += mb_bench_now_ns() - start_ns;
+
+        merge_hash = mb_bench_list_hash(check_result_list, &count);
+        reap_check_results();
+
+        if (merge_hash != list_hash || count != results)
+            mismatch = true;
+    }
+
+    printf("result_merge: %d bursts of %d results, add_check_result_to_list(): %.2f ms per burst, "
+        "sorted merge: %.2f ms per burst (%.0fx)%s\n",
+        MB_BENCH_BURST_ROUNDS,
+        results,
+        (double)list_ns / MB_BENCH_BURST_ROUNDS / 1000000,
+        (double)merge_ns / MB_BENCH_BURST_ROUNDS / 1000000,
+        (double)list_ns / merge_ns,
+        (mismatch ? ", result lists differ" : ""));
+
+    mb_queue_free(mod_bunny_config.results);
+    free(burst);
+
+    return (mismatch);
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
@@ -164,16 +164,19 @@ static int mb_amqp_connect(mb_amqp_connection_t *amqp_conn, const char *context)
     if (amqp_conn->debug_level > 0)
         logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: %s: logged in", context);
 
-    amqp_channel_open(*amqp_conn->conn, AMQP_CHANNEL);
-    if (mb_amqp_error(amqp_get_rpc_reply(*amqp_conn->conn), context) == MB_NOK) {
-        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: error: %s",
-            context,
-            "amqp_channel_open() failed");
-        goto error;
-    }
+    /* Channels are numbered from AMQP_CHANNEL onwards */
+    for (int channel = AMQP_CHANNEL; channel < AMQP_CHANNEL + amqp_conn->channels; channel++) {
+        amqp_channel_open(*amqp_conn->conn, channel);
+        if (mb_amqp_error(amqp_get_rpc_reply(*amqp_conn->conn), context) == MB_NOK) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: error: %s",
+                context,
+                "amqp_channel_open() failed");
+            goto error;
+        }
 
-    if (amqp_conn->debug_level > 0)
-        logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: %s: opened channel", context);
+        if (amqp_conn->debug_level > 0)
+            logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: %s: opened channel %d", context, channel);
+    }
 
     amqp_exchange_declare(*amqp_conn->conn,             /* connection*/
         AMQP_CHANNEL,                                   /* channel */
@@ -211,16 +214,18 @@ static int mb_amqp_connect(mb_amqp_connection_t *amqp_conn, const char *context)
 
 static int mb_amqp_disconnect(mb_amqp_connection_t *amqp_conn, const char *context) {
 /* {{{ */
-    if (mb_amqp_error(amqp_channel_close(*amqp_conn->conn, AMQP_CHANNEL, AMQP_REPLY_SUCCESS),
-        context) == MB_NOK) {
-        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: error: %s",
-            context,
-            "amqp_channel_close() failed");
-        goto error;
-    }
+    for (int channel = AMQP_CHANNEL; channel < AMQP_CHANNEL + amqp_conn->channels; channel++) {
+        if (mb_amqp_error(amqp_channel_close(*amqp_conn->conn, channel, AMQP_REPLY_SUCCESS),
+            context) == MB_NOK) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: error: %s",
+                context,
+                "amqp_channel_close() failed");
+            goto error;
+        }
 
-    if (amqp_conn->debug_level > 0)
-        logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: %s: closed channel", context);
+        if (amqp_conn->debug_level > 0)
+            logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: %s: closed channel %d", context, channel);
+    }
 
     if (mb_amqp_error(amqp_connection_close(*amqp_conn->conn, AMQP_REPLY_SUCCESS), context) == MB_NOK) {
         logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: error: %s",
@@ -246,56 +251,69 @@ static int mb_amqp_disconnect(mb_amqp_connection_t *amqp_conn, const char *conte
 /* }}} */
 }
 
-static char *mb_amqp_get_header_field(amqp_frame_t *header, int field) {
+/* Get a copy of a header field allocated from `arena', the header frame only lives until buffers are released */
+static char *mb_amqp_get_header_field(amqp_frame_t *header, int field, mb_arena_t *arena) {
 /* {{{ */
    amqp_basic_properties_t  *msg_props = NULL;
+   amqp_bytes_t             *value = NULL;
 
    msg_props = header->payload.properties.decoded;
 
     switch (field) {
         case MB_AMQP_HEADER_FIELD_CONTENT_TYPE:
-            return (mb_amqp_bytes_to_cstring(&msg_props->content_type));
+            value = &msg_props->content_type;
+            break;
 
         case MB_AMQP_HEADER_FIELD_CORRELATION_ID:
-            return (mb_amqp_bytes_to_cstring(&msg_props->correlation_id));
+            value = &msg_props->correlation_id;
+            break;
+
+        case MB_AMQP_HEADER_FIELD_CONTENT_ENCODING:
+            if (!(msg_props->_flags & AMQP_BASIC_CONTENT_ENCODING_FLAG))
+                return (NULL);
+
+            value = &msg_props->content_encoding;
             break;
 
         default:
             return (NULL);
     }
+
+    if (!value->bytes)
+        return (NULL);
+
+    return (mb_arena_strndup(arena, (const char *)value->bytes, value->len));
 /* }}} */
 }
 
-static amqp_frame_t *mb_amqp_get_msg_header(amqp_connection_state_t *conn) {
+static int mb_amqp_get_msg_header(amqp_connection_state_t *conn, amqp_frame_t *header_frame) {
 /* {{{ */
-    amqp_frame_t    *header_frame = NULL;
-    int             rc;
-
-    if (!(header_frame = calloc(1, sizeof(amqp_frame_t)))) {
-        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_amqp_get_msg_header: error: "
-            "unable to allocate memory");
-        return (NULL);
-    }
+    int rc;
 
     if ((rc = amqp_simple_wait_frame(*conn, header_frame)) < 0) {
         logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_amqp_get_msg_header: error: "
             "amqp_simple_wait_frame() failed");
-        free(header_frame);
-        return (NULL);
+        return (MB_NOK);
     }
 
     if (header_frame->frame_type != AMQP_FRAME_HEADER) {
         logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_amqp_get_msg_header: error: "
             "invalid frame type, expected header");
-        free(header_frame);
-        return (NULL);
+        return (MB_NOK);
     }
 
-    return (header_frame);
+    return (MB_OK);
 /* }}} */
 }
 
-static char *mb_amqp_read_msg_body(amqp_connection_state_t *conn, size_t msg_body_full_size) {
+/*
+    Read the body frames of a message into `delivery'. If `in_place' is set, a body arriving
+    in a single frame is used right from the librabbitmq frame buffers, and must be done with
+    before they are released. Other bodies are gathered into the delivery arena, followed by
+    a NUL byte for the JSON decoders.
+*/
+static int mb_amqp_read_msg_body(amqp_connection_state_t *conn, size_t msg_body_full_size, mb_delivery_t *delivery,
+    bool in_place) {
 /* {{{ */
     amqp_frame_t    amqp_frame;
     char            *msg_body = NULL;
@@ -303,23 +321,19 @@ static char *mb_amqp_read_msg_body(amqp_connection_state_t *conn, size_t msg_bod
     size_t          msg_fragment_size;
     int             rc;
 
-    if (!(msg_body = calloc(1, msg_body_full_size + 1))) {
-        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_amqp_read_msg_body: error: "
-            "unable to allocate memory");
-        return (NULL);
-    }
+    delivery->body_len = msg_body_full_size;
 
     while (msg_body_received_size < msg_body_full_size) {
         if ((rc = amqp_simple_wait_frame(*conn, &amqp_frame)) < 0) {
             logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_amqp_read_msg_body: error: "
                 "amqp_simple_wait_frame() failed");
-            goto error;
+            return (MB_NOK);
         }
 
         if (amqp_frame.frame_type != AMQP_FRAME_BODY) {
             logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_amqp_read_msg_body: error: "
                 "invalid frame type, expected body");
-            goto error;
+            return (MB_NOK);
         }
 
         msg_fragment_size = amqp_frame.payload.body_fragment.len;
@@ -327,19 +341,103 @@ static char *mb_amqp_read_msg_body(amqp_connection_state_t *conn, size_t msg_bod
         if ((msg_body_full_size - msg_body_received_size) < msg_fragment_size) {
             logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_amqp_read_msg_body: error: "
                 "received message body is larger than indicated by the message header");
-            goto error;
+            return (MB_NOK);
+        }
+
+        if (in_place && msg_fragment_size == msg_body_full_size) {
+            delivery->body = amqp_frame.payload.body_fragment.bytes;
+            return (MB_OK);
+        }
+
+        if (!msg_body && !(msg_body = mb_arena_alloc(&delivery->arena, msg_body_full_size + 1))) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_amqp_read_msg_body: error: "
+                "unable to allocate memory");
+            return (MB_NOK);
         }
 
-        memcpy(msg_body, amqp_frame.payload.body_fragment.bytes, msg_fragment_size);
+        memcpy(msg_body + msg_body_received_size, amqp_frame.payload.body_fragment.bytes, msg_fragment_size);
 
         msg_body_received_size += msg_fragment_size;
     }
 
-    return (msg_body);
+    /* Empty bodies don't come with any body frame */
+    if (!msg_body && !(msg_body = mb_arena_alloc(&delivery->arena, 1))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_amqp_read_msg_body: error: "
+            "unable to allocate memory");
+        return (MB_NOK);
+    }
 
-    error:
-    free(msg_body);
-    return (NULL);
+    msg_body[msg_body_full_size] = '\0';
+    delivery->body = msg_body;
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline uint64_t mb_amqp_now_us(void) {
+/* {{{ */
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000000ULL + (uint64_t)now.tv_nsec / 1000);
+/* }}} */
+}
+
+/* Delivery tags are numbered per channel, deliveries of a previous connection are redelivered anyway */
+static void mb_amqp_acks_reset(mb_consumer_acks_t *acks) {
+/* {{{ */
+    acks->head = 0;
+    acks->tail = 0;
+    acks->ready_tag = 0;
+    acks->ready_count = 0;
+/* }}} */
+}
+
+/*
+    Acknowledge deliveries whose check results have all been handed over to Nagios, once
+    `consumer_ack_batch' of them are ready or the oldest ready one waited for
+    `consumer_ack_linger_ms'. A single acknowledgement covers all deliveries up to the
+    newest ready one.
+*/
+static int mb_amqp_send_acks(mb_config_t *config) {
+/* {{{ */
+    mb_consumer_acks_t  *acks = config->acks;
+    unsigned long       handed;
+    uint64_t            now_us;
+
+    handed = __atomic_load_n(&config->results_handed, __ATOMIC_ACQUIRE);
+    now_us = mb_amqp_now_us();
+
+    while (acks->head < acks->tail && acks->submitted[acks->head & acks->mask] <= handed) {
+        if (acks->ready_count == 0)
+            acks->ready_since_us = now_us;
+
+        acks->ready_tag = acks->tags[acks->head & acks->mask];
+        acks->ready_count++;
+        acks->head++;
+    }
+
+    if (acks->ready_count == 0
+        || (acks->ready_count < (unsigned long)config->consumer_ack_batch
+            && now_us - acks->ready_since_us < (uint64_t)config->consumer_ack_linger_ms * 1000))
+        return (MB_OK);
+
+    if (amqp_basic_ack(config->consumer_amqp_conn, AMQP_CHANNEL, acks->ready_tag, true) != 0) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_amqp_send_acks: error: "
+            "amqp_basic_ack() failed");
+        return (MB_NOK);
+    }
+
+    if (config->debug_level > 1)
+        logit(NSLOG_INFO_MESSAGE, TRUE,
+            "mod_bunny: mb_amqp_send_acks: acknowledged %lu messages up to delivery tag %llu",
+            acks->ready_count,
+            (unsigned long long)acks->ready_tag);
+
+    acks->ready_count = 0;
+
+    return (MB_OK);
 /* }}} */
 }
 
@@ -366,6 +464,7 @@ int mb_amqp_connect_consumer(mb_config_t *config) {
         .password       = config->password,
         .exchange       = config->consumer_exchange,
         .exchange_type  = config->consumer_exchange_type,
+        .channels       = 1,
         .debug_level    = config->debug_level
     };
 
@@ -430,12 +529,31 @@ int mb_amqp_connect_consumer(mb_config_t *config) {
             config->consumer_exchange,
             config->consumer_binding_key);
 
+    /* Bound the messages awaiting our acknowledgement, the broker holds back the others meanwhile */
+    if (config->consumer_acks) {
+        amqp_basic_qos(config->consumer_amqp_conn,  /* connection */
+            1,                                      /* channel */
+            0,                                      /* prefetch size */
+            (uint16_t)config->consumer_prefetch,    /* prefetch count */
+            false                                   /* global */
+        );
+        if (mb_amqp_error(amqp_get_rpc_reply(config->consumer_amqp_conn), "mb_amqp_connect_consumer") == MB_NOK) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_amqp_connect_consumer: error: "
+                "amqp_basic_qos() failed");
+
+            amqp_channel_close(config->consumer_amqp_conn, AMQP_CHANNEL, AMQP_REPLY_SUCCESS);
+            goto error;
+        }
+
+        mb_amqp_acks_reset(config->acks);
+    }
+
     amqp_basic_consume(config->consumer_amqp_conn,  /* connection */
         1,                                          /* channel */
         qd_rc->queue,                               /* queue */
         amqp_cstring_bytes("nagios/mod_bunny"),     /* consumer tag */
         false,                                      /* no_local */
-        true,                                       /* no_ack */
+        !config->consumer_acks,                     /* no_ack */
         false,                                      /* exclusive */
         amqp_empty_table                            /* arguments */
     );
@@ -464,14 +582,16 @@ int mb_amqp_connect_consumer(mb_config_t *config) {
 /* }}} */
 }
 
-int mb_amqp_connect_publisher(mb_config_t *config) {
+int mb_amqp_connect_publisher(mb_publisher_t *publisher) {
 /* {{{ */
+    mb_config_t *config = publisher->config;
+
     mb_amqp_connection_t conn = {
-        .conn           = &config->publisher_amqp_conn,
+        .conn           = &publisher->amqp_conn,
 #ifdef LIBRABBITMQ_LEGACY
-        .sockfd         = &config->publisher_amqp_sockfd,
+        .sockfd         = &publisher->amqp_sockfd,
 #else
-        .socket         = config->publisher_amqp_socket,
+        .socket         = publisher->amqp_socket,
 #endif
         .host           = config->host,
         .port           = config->port,
@@ -480,14 +600,64 @@ int mb_amqp_connect_publisher(mb_config_t *config) {
         .password       = config->password,
         .exchange       = config->publisher_exchange,
         .exchange_type  = config->publisher_exchange_type,
+        .channels       = config->publisher_channels,
         .debug_level    = config->debug_level
     };
 
-    if (mb_amqp_connect(&conn, "mb_amqp_connect_publisher")) {
-        config->publisher_connected = true;
-        return (MB_OK);
-    } else
+    if (!mb_amqp_connect(&conn, "mb_amqp_connect_publisher"))
         return (MB_NOK);
+
+    /* Command template definitions go to every worker bound to their exchange */
+    if (config->command_templates) {
+        amqp_exchange_declare(publisher->amqp_conn,         /* connection*/
+            AMQP_CHANNEL,                                   /* channel */
+            config->command_templates_exchange_bytes,       /* exchange */
+            amqp_cstring_bytes("fanout"),                   /* type */
+            false,                                          /* passive */
+            true,                                           /* durable */
+            amqp_empty_table                                /* arguments */
+        );
+        if (mb_amqp_error(amqp_get_rpc_reply(publisher->amqp_conn), "mb_amqp_connect_publisher") == MB_NOK) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_amqp_connect_publisher: error: "
+                "amqp_exchange_declare() failed for command templates exchange \"%s\"",
+                config->command_templates_exchange);
+
+            amqp_connection_close(publisher->amqp_conn, AMQP_REPLY_SUCCESS);
+            amqp_destroy_connection(publisher->amqp_conn);
+#ifdef LIBRABBITMQ_LEGACY
+            close(publisher->amqp_sockfd);
+#endif
+
+            return (MB_NOK);
+        }
+    }
+
+#ifndef LIBRABBITMQ_LEGACY
+    /* Have the broker acknowledge (or reject) every message we publish on our channels */
+    if (config->publisher_confirms) {
+        for (int channel = AMQP_CHANNEL; channel < AMQP_CHANNEL + config->publisher_channels; channel++) {
+            amqp_confirm_select(publisher->amqp_conn, channel);
+            if (mb_amqp_error(amqp_get_rpc_reply(publisher->amqp_conn),
+                "mb_amqp_connect_publisher") == MB_NOK) {
+                logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_amqp_connect_publisher: error: "
+                    "amqp_confirm_select() failed");
+
+                amqp_connection_close(publisher->amqp_conn, AMQP_REPLY_SUCCESS);
+                amqp_destroy_connection(publisher->amqp_conn);
+
+                return (MB_NOK);
+            }
+        }
+
+        if (config->debug_level > 0)
+            logit(NSLOG_INFO_MESSAGE, TRUE,
+                "mod_bunny: mb_amqp_connect_publisher: enabled publisher confirms");
+    }
+#endif
+
+    MB_ATOMIC_STORE(&publisher->connected, true);
+
+    return (MB_OK);
 /* }}} */
 }
 
@@ -507,6 +677,7 @@ int mb_amqp_disconnect_consumer(mb_config_t *config) {
         .password       = config->password,
         .exchange       = config->consumer_exchange,
         .exchange_type  = config->consumer_exchange_type,
+        .channels       = 1,
         .debug_level    = config->debug_level
     };
 
@@ -520,14 +691,16 @@ int mb_amqp_disconnect_consumer(mb_config_t *config) {
 /* }}} */
 }
 
-int mb_amqp_disconnect_publisher(mb_config_t *config) {
+int mb_amqp_disconnect_publisher(mb_publisher_t *publisher) {
 /* {{{ */
+    mb_config_t *config = publisher->config;
+
     mb_amqp_connection_t conn = {
-        .conn           = &config->publisher_amqp_conn,
+        .conn           = &publisher->amqp_conn,
 #ifdef LIBRABBITMQ_LEGACY
-        .sockfd         = &config->publisher_amqp_sockfd,
+        .sockfd         = &publisher->amqp_sockfd,
 #else
-        .socket         = config->publisher_amqp_socket,
+        .socket         = publisher->amqp_socket,
 #endif
         .host           = config->host,
         .port           = config->port,
@@ -536,50 +709,81 @@ int mb_amqp_disconnect_publisher(mb_config_t *config) {
         .password       = config->password,
         .exchange       = config->publisher_exchange,
         .exchange_type  = config->publisher_exchange_type,
+        .channels       = config->publisher_channels,
         .debug_level    = config->debug_level
     };
 
     /* Check if the publisher isn't already disconnected */
-    if (!config->publisher_connected)
+    if (!publisher->connected)
         return (MB_OK);
 
-    config->publisher_connected = false;
+    MB_ATOMIC_STORE(&publisher->connected, false);
 
     return mb_amqp_disconnect(&conn, "mb_amqp_disconnect_publisher");
 /* }}} */
 }
 
-int mb_amqp_publish(mb_config_t *config, char *cid, char *message, char *routing_key) {
+/* Fill in the message properties that are the same for all published checks */
+void mb_amqp_init_publisher_props(mb_config_t *config) {
 /* {{{ */
-    amqp_bytes_t            message_bytes;
-    amqp_basic_properties_t message_props;
-    int                     rc;
-    char                    *msg_content_type = "application/json";
-    char                    *reply_to = NULL;
-
-    reply_to = config->consumer_binding_key;
-
-    message_bytes.bytes = message;
-    message_bytes.len = strlen(message);
+    memset(&config->publisher_props, 0, sizeof(amqp_basic_properties_t));
 
-    message_props._flags =
+    config->publisher_props._flags =
         AMQP_BASIC_APP_ID_FLAG
         | AMQP_BASIC_CORRELATION_ID_FLAG
         | AMQP_BASIC_CONTENT_TYPE_FLAG
         | AMQP_BASIC_DELIVERY_MODE_FLAG
         | AMQP_BASIC_REPLY_TO_FLAG;
 
-    message_props.app_id = amqp_cstring_bytes("Nagios/mod_bunny");
-    message_props.correlation_id = amqp_cstring_bytes(cid);
-    message_props.content_type = amqp_cstring_bytes(msg_content_type);
-    message_props.delivery_mode = AMQP_DELIVERY_MODE_VOLATILE;
-    message_props.reply_to = amqp_cstring_bytes(reply_to);
-
-    rc = amqp_basic_publish(config->publisher_amqp_conn,    /* connection */
-        AMQP_CHANNEL,                                       /* channel */
-        amqp_cstring_bytes(config->publisher_exchange),     /* exchange */
-        amqp_cstring_bytes(routing_key),                    /* routing key */
-        false,                                              /* mandatory */
+    config->publisher_props.app_id = amqp_cstring_bytes("Nagios/mod_bunny");
+    config->publisher_props.delivery_mode = AMQP_DELIVERY_MODE_VOLATILE;
+    config->publisher_props.reply_to = amqp_cstring_bytes(config->consumer_binding_key);
+
+    config->publisher_exchange_bytes = amqp_cstring_bytes(config->publisher_exchange);
+    config->command_templates_exchange_bytes = amqp_cstring_bytes(config->command_templates_exchange);
+/* }}} */
+}
+
+int mb_amqp_publish(mb_publisher_t *publisher, mb_check_msg_t *msg) {
+/* {{{ */
+    mb_config_t             *config = publisher->config;
+    amqp_bytes_t            message_bytes;
+    amqp_bytes_t            exchange;
+    amqp_bytes_t            routing_key;
+    amqp_basic_properties_t message_props;
+    bool                    mandatory;
+    int                     rc;
+
+    message_bytes.bytes = msg->body;
+    message_bytes.len = msg->body_len;
+
+    routing_key.bytes = msg->routing_key;
+    routing_key.len = msg->routing_key_len;
+
+    message_props = config->publisher_props;
+    message_props.correlation_id.bytes = msg->cid;
+    message_props.correlation_id.len = msg->cid_len;
+    message_props.content_type = amqp_cstring_bytes(msg->content_type);
+
+    if (msg->content_encoding) {
+        message_props._flags |= AMQP_BASIC_CONTENT_ENCODING_FLAG;
+        message_props.content_encoding = amqp_cstring_bytes(msg->content_encoding);
+    }
+
+    /* Command templates may well be published before any worker is around, don't have them returned */
+    if (msg->command_template) {
+        exchange = config->command_templates_exchange_bytes;
+        mandatory = false;
+    } else {
+        exchange = config->publisher_exchange_bytes;
+        mandatory = config->publisher_confirms;
+    }
+
+    rc = amqp_basic_publish(publisher->amqp_conn,           /* connection */
+        msg->channel,                                       /* channel */
+        exchange,                                           /* exchange */
+        routing_key,                                        /* routing key */
+        mandatory,                                          /* mandatory */
         false,                                              /* immediate */
         &message_props,                                     /* properties */
         message_bytes                                       /* body */
@@ -590,29 +794,201 @@ int mb_amqp_publish(mb_config_t *config, char *cid, char *message, char *routing
 
     if (config->debug_level > 1)
         logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: %s: mb_amqp_publish: "
-            "sent message: [correlation_id=\"%s\" content_type=\"%s\" exchange=\"%s\" "
+            "sent message on publisher #%d channel %d: [correlation_id=\"%s\" content_type=\"%s\" exchange=\"%s\" "
             "routing_key=\"%s\" reply_to=\"%s\" body=\"%s\"]",
-            cid,
-            cid,
-            msg_content_type,
-            config->publisher_exchange,
-            routing_key,
-            reply_to,
-            message);
+            msg->cid,
+            publisher->id,
+            msg->channel,
+            msg->cid,
+            msg->content_type,
+            (msg->command_template ? config->command_templates_exchange : config->publisher_exchange),
+            msg->routing_key,
+            config->consumer_binding_key,
+            (mb_content_type_is_binary(msg->content_type) ? "<binary>" : msg->body));
 
     return (MB_OK);
 /* }}} */
 }
 
-void mb_amqp_consume(mb_config_t *config, void(* handler)(char *, char *)) {
+int mb_amqp_wait_confirms(mb_publisher_t *publisher, mb_confirm_window_t **windows, mb_check_msgs_t *retransmit,
+    int timeout_ms) {
 /* {{{ */
+#ifdef LIBRABBITMQ_LEGACY
+    (void)publisher;
+    (void)windows;
+    (void)retransmit;
+    (void)timeout_ms;
+
+    return (MB_OK);
+#else
     amqp_connection_state_t *conn = NULL;
     amqp_frame_t            frame;
-    amqp_frame_t            *header_frame = NULL;
-    size_t                  msg_body_size;
-    char                    *msg_content_type = NULL;
-    char                    *msg_correlation_id = NULL;
-    char                    *message = NULL;
+    amqp_frame_t            header_frame;
+    mb_confirm_window_t     *window = NULL;
+    struct timeval          timeout;
+    amqp_bytes_t            *returned_cid = NULL;
+    mb_delivery_t           returned = { 0 };
+    int                     rc;
+
+    conn = (amqp_connection_state_t *)&publisher->amqp_conn;
+
+    timeout.tv_sec = timeout_ms / 1000;
+    timeout.tv_usec = (timeout_ms % 1000) * 1000;
+
+    /* Wait up to the given timeout for a first frame, then only process what's already there */
+    while ((rc = amqp_simple_wait_frame_noblock(*conn, &frame, &timeout)) == AMQP_STATUS_OK) {
+        timeout.tv_sec = 0;
+        timeout.tv_usec = 0;
+
+        if (frame.frame_type != AMQP_FRAME_METHOD)
+            continue;
+
+        /* Delivery tags are numbered per channel, so each channel has its own window */
+        if (frame.channel < AMQP_CHANNEL || frame.channel >= AMQP_CHANNEL + publisher->config->publisher_channels)
+            continue;
+
+        window = windows[frame.channel - AMQP_CHANNEL];
+
+        switch (frame.payload.method.id) {
+        case AMQP_BASIC_ACK_METHOD: {
+            amqp_basic_ack_t *ack = (amqp_basic_ack_t *)frame.payload.method.decoded;
+
+            mb_confirm_window_ack(window, ack->delivery_tag, ack->multiple);
+            break;
+        }
+
+        case AMQP_BASIC_NACK_METHOD: {
+            amqp_basic_nack_t *nack = (amqp_basic_nack_t *)frame.payload.method.decoded;
+
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_amqp_wait_confirms: error: "
+                "broker rejected message%s with delivery tag %llu, publishing again",
+                (nack->multiple ? "s up to" : ""),
+                (unsigned long long)nack->delivery_tag);
+
+            mb_confirm_window_nack(window, nack->delivery_tag, nack->multiple, retransmit);
+            break;
+        }
+
+        case AMQP_BASIC_RETURN_METHOD: {
+            amqp_basic_return_t *ret = (amqp_basic_return_t *)frame.payload.method.decoded;
+
+            /* The returned message content follows, then the broker acknowledges it as usual */
+            if (!mb_amqp_get_msg_header(conn, &header_frame))
+                return (MB_NOK);
+
+            returned_cid = &((amqp_basic_properties_t *)header_frame.payload.properties.decoded)->correlation_id;
+
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %.*s: mb_amqp_wait_confirms: error: "
+                "message returned by broker (%d: %.*s), no queue bound with routing key \"%.*s\"?",
+                (int)(returned_cid->bytes ? returned_cid->len : 1),
+                (returned_cid->bytes ? (char *)returned_cid->bytes : "-"),
+                ret->reply_code,
+                (int)ret->reply_text.len,
+                (char *)ret->reply_text.bytes,
+                (int)ret->routing_key.len,
+                (char *)ret->routing_key.bytes);
+
+            /* The body is only read to get past it */
+            rc = mb_amqp_read_msg_body(conn, (size_t)header_frame.payload.properties.body_size, &returned, true);
+
+            mb_arena_free(&returned.arena);
+
+            if (!rc)
+                return (MB_NOK);
+            break;
+        }
+
+        case AMQP_CHANNEL_CLOSE_METHOD:
+        case AMQP_CONNECTION_CLOSE_METHOD:
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_amqp_wait_confirms: error: "
+                "broker closed the publisher channel");
+            return (MB_NOK);
+
+        default:
+            break;
+        }
+    }
+
+    amqp_maybe_release_buffers(*conn);
+
+    if (rc != AMQP_STATUS_TIMEOUT) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_amqp_wait_confirms: error: "
+            "amqp_simple_wait_frame_noblock() failed");
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+#endif
+/* }}} */
+}
+
+mb_consumer_acks_t *mb_amqp_acks_new(int prefetch) {
+/* {{{ */
+    mb_consumer_acks_t  *acks = NULL;
+    size_t              size = 1;
+
+    /* The broker never has more than `prefetch' deliveries awaiting an acknowledgement */
+    while (size < (size_t)prefetch)
+        size <<= 1;
+
+    if (!(acks = calloc(1, sizeof(mb_consumer_acks_t)))
+        || !(acks->tags = calloc(size, sizeof(uint64_t)))
+        || !(acks->submitted = calloc(size, sizeof(unsigned long)))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_amqp_acks_new: error: "
+            "unable to allocate memory");
+        mb_amqp_acks_free(acks);
+        return (NULL);
+    }
+
+    acks->mask = size - 1;
+
+    return (acks);
+/* }}} */
+}
+
+void mb_amqp_acks_free(mb_consumer_acks_t *acks) {
+/* {{{ */
+    if (!acks)
+        return;
+
+    free(acks->tags);
+    free(acks->submitted);
+    free(acks);
+/* }}} */
+}
+
+/* Called by the consumer thread, in delivery order, once all check results of a delivery are submitted */
+void mb_amqp_delivery_done(mb_config_t *config, uint64_t delivery_tag) {
+/* {{{ */
+    mb_consumer_acks_t *acks = config->acks;
+
+    /* Can't happen within the prefetch window, a later acknowledgement would cover the oldest one anyway */
+    if (acks->tail - acks->head > acks->mask)
+        acks->head++;
+
+    acks->tags[acks->tail & acks->mask] = delivery_tag;
+    acks->submitted[acks->tail & acks->mask] = config->results_submitted;
+    acks->tail++;
+/* }}} */
+}
+
+/*
+    Consume check result messages, passing them to `handler' which owns the delivery it
+    is given. `idle' is called before waiting for the broker whenever no received data is
+    left to process. Deliveries are handed back through mb_delivery_done() once their
+    check results are submitted, in delivery order.
+*/
+void mb_amqp_consume(mb_config_t *config, void(* handler)(mb_delivery_t *), void (*idle)(void)) {
+/* {{{ */
+    amqp_connection_state_t *conn = NULL;
+    amqp_frame_t            frame;
+    amqp_frame_t            header_frame;
+#ifndef LIBRABBITMQ_LEGACY
+    struct timeval          timeout;
+#endif
+    mb_delivery_t           *delivery = NULL;
+    bool                    compressed;
+    int                     cancel_state;
     int                     rc;
 
     conn = (amqp_connection_state_t *)&config->consumer_amqp_conn;
@@ -620,7 +996,36 @@ void mb_amqp_consume(mb_config_t *config, void(* handler)(char *, char *)) {
     while (config->consumer_connected) {
         amqp_maybe_release_buffers(*conn);
 
-        if ((rc = amqp_simple_wait_frame(*conn, &frame))) {
+        if (idle && !amqp_frames_enqueued(*conn) && !amqp_data_in_buffer(*conn))
+            idle();
+
+        if (config->consumer_acks && !mb_amqp_send_acks(config))
+            break;
+
+        /* The consumer thread may only be canceled here, never with a delivery half-read into its arena */
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, &cancel_state);
+
+#ifdef LIBRABBITMQ_LEGACY
+        rc = amqp_simple_wait_frame(*conn, &frame);
+#else
+        if (config->consumer_acks) {
+            /* Wake up now and then to acknowledge messages Nagios got results of in the meantime */
+            timeout.tv_sec = config->consumer_ack_linger_ms / 1000;
+            timeout.tv_usec = (config->consumer_ack_linger_ms % 1000) * 1000;
+
+            rc = amqp_simple_wait_frame_noblock(*conn, &frame, &timeout);
+        } else
+            rc = amqp_simple_wait_frame(*conn, &frame);
+#endif
+
+        pthread_setcancelstate(cancel_state, NULL);
+
+#ifndef LIBRABBITMQ_LEGACY
+        if (config->consumer_acks && rc == AMQP_STATUS_TIMEOUT)
+            continue;
+#endif
+
+        if (rc) {
             logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_amqp_consume: error: "
                 "amqp_simple_wait_frame() failed, skipping frame");
 
@@ -640,70 +1045,96 @@ void mb_amqp_consume(mb_config_t *config, void(* handler)(char *, char *)) {
             continue;
         }
 
-        if (!(header_frame = mb_amqp_get_msg_header(conn))) {
+        /* Without a delivery to read the message into, we can't go on consuming */
+        if (!(delivery = mb_delivery_new(config->deliveries)))
+            break;
+
+        delivery->tag = ((amqp_basic_deliver_t *)frame.payload.method.decoded)->delivery_tag;
+
+        if (!mb_amqp_get_msg_header(conn, &header_frame)) {
             logit(NSLOG_RUNTIME_ERROR, TRUE,
                 "mod_bunny: mb_amqp_consume: error while reading message header, skipping");
-            continue;
+            goto skip;
         }
 
-        if (!(msg_content_type = mb_amqp_get_header_field(header_frame, MB_AMQP_HEADER_FIELD_CONTENT_TYPE))) {
+        if (!(delivery->content_type = mb_amqp_get_header_field(&header_frame, MB_AMQP_HEADER_FIELD_CONTENT_TYPE,
+            &delivery->arena))) {
             logit(NSLOG_RUNTIME_ERROR, TRUE,
                 "mod_bunny: mb_amqp_consume: error: unable to get message content-type, skipping");
-
-            free(header_frame);
-
-            continue;
+            goto skip;
         }
 
-        if (!MB_STR_MATCH(msg_content_type, "application/json")) {
+        /* Workers may reply in any of the supported formats, each message says which one it uses */
+        if (!MB_STR_MATCH(delivery->content_type, MB_CONTENT_TYPE_JSON)
+            && !MB_STR_MATCH(delivery->content_type, MB_CONTENT_TYPE_JSON_BATCH)
+            && !MB_STR_MATCH(delivery->content_type, MB_CONTENT_TYPE_MSGPACK)
+            && !MB_STR_MATCH(delivery->content_type, MB_CONTENT_TYPE_MSGPACK_BATCH)) {
             logit(NSLOG_RUNTIME_ERROR, TRUE,
                 "mod_bunny: mb_amqp_consume: error: "
-                "invalid message content-type \"%s\" (expected \"application/json\"), skipping",
-                msg_content_type);
-
-            free(header_frame);
-            free(msg_content_type);
-
-            continue;
+                "unsupported message content-type \"%s\", skipping",
+                delivery->content_type);
+            goto skip;
         }
 
-        if (!(msg_correlation_id = mb_amqp_get_header_field(header_frame, MB_AMQP_HEADER_FIELD_CORRELATION_ID))) {
+        if (!(delivery->cid = mb_amqp_get_header_field(&header_frame, MB_AMQP_HEADER_FIELD_CORRELATION_ID,
+            &delivery->arena))) {
             logit(NSLOG_RUNTIME_ERROR, TRUE,
                 "mod_bunny: mb_amqp_consume: error: unable to get message correlation ID, skipping");
-
-            free(header_frame);
-            free(msg_content_type);
-
-            continue;
+            goto skip;
         }
 
-        msg_body_size = (size_t)header_frame->payload.properties.body_size;
+        delivery->content_encoding = mb_amqp_get_header_field(&header_frame, MB_AMQP_HEADER_FIELD_CONTENT_ENCODING,
+            &delivery->arena);
+
+        compressed = (delivery->content_encoding && strlen(delivery->content_encoding) > 0
+            && !MB_STR_MATCH(delivery->content_encoding, "identity"));
 
-        if (!(message = mb_amqp_read_msg_body(conn, msg_body_size))) {
+        /*
+            Bodies are only decoded straight from the frame buffers when it happens before
+            buffers are released, i.e. by this thread in the handler, and their decoder
+            doesn't need a terminating NUL byte. Compressed bodies are inflated right away.
+        */
+        if (!mb_amqp_read_msg_body(conn, (size_t)header_frame.payload.properties.body_size, delivery,
+            compressed || (!config->decoders && mb_content_type_is_binary(delivery->content_type)))) {
             logit(NSLOG_RUNTIME_ERROR, TRUE,
                 "mod_bunny: mb_amqp_consume: error while reading message body, skipping");
+            goto skip;
+        }
 
-            free(header_frame);
-            free(msg_content_type);
-            free(msg_correlation_id);
-
-            continue;
+        /* Inflate compressed bodies before they reach the decoders */
+        if (compressed) {
+            if (!mb_decompress(config->consumer_compressor, delivery->content_encoding, delivery->body,
+                delivery->body_len, &delivery->body_alloc, &delivery->body_len)) {
+                logit(NSLOG_RUNTIME_ERROR, TRUE,
+                    "mod_bunny: %s: mb_amqp_consume: error while decompressing message body, skipping",
+                    delivery->cid);
+                goto skip;
+            }
+
+            delivery->body = delivery->body_alloc;
         }
 
         if (config->debug_level > 1)
             logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: %s: mb_amqp_consume: received message: [%s]",
-                msg_correlation_id,
-                message);
+                delivery->cid,
+                (mb_content_type_is_binary(delivery->content_type) ? "<binary>" : delivery->body));
+
+        /* Pass the received message to the handler, which takes ownership of it */
+        handler(delivery);
+        continue;
 
-        /* Pass the received message to the handler */
-        handler(msg_correlation_id, message);
+        skip:
+        /* Messages we couldn't read are acknowledged too, but not before the ones received earlier */
+        if (config->consumer_acks && idle)
+            idle();
 
-        free(header_frame);
-        free(msg_content_type);
-        free(msg_correlation_id);
-        free(message);
+        mb_delivery_done(delivery);
     }
 
+    /* Submit what's left before deliveries of this connection are forgotten */
+    if (idle)
+        idle();
+
     if (config->debug_level > 0)
         logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: mb_amqp_consume: stopped consuming");
 /* }}} */
@@ -30,6 +30,7 @@
 enum mb_amqp_header_fields {
     MB_AMQP_HEADER_FIELD_CONTENT_TYPE,
     MB_AMQP_HEADER_FIELD_CORRELATION_ID,
+    MB_AMQP_HEADER_FIELD_CONTENT_ENCODING,
 };
 
 typedef struct mb_amqp_connection {
@@ -47,10 +48,31 @@ typedef struct mb_amqp_connection {
     char                    *password;
     char                    *exchange;
     char                    *exchange_type;
+    int                     channels;
     int                     debug_level;
 /* }}} */
 } mb_amqp_connection_t;
 
+/*
+    Deliveries awaiting a consumer acknowledgement, in delivery order. Each one records how
+    many check results the consumer thread had submitted once its own were, so it may be
+    acknowledged once Nagios has been handed over as many. Only used by the consumer thread.
+*/
+struct mb_consumer_acks_s {
+/* {{{ */
+    uint64_t        *tags;
+    unsigned long   *submitted;
+    size_t          mask;
+    size_t          head;
+    size_t          tail;
+
+    /* Newest delivery ready to be acknowledged, and how many are since the last acknowledgement */
+    uint64_t        ready_tag;
+    unsigned long   ready_count;
+    uint64_t        ready_since_us;
+/* }}} */
+};
+
 #endif
 
 // vim: ft=c ts=4 et foldmethod=marker
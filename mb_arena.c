@@ -0,0 +1,125 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+
+#include "mod_bunny.h"
+#include "mb_arena.h"
+
+/*
+    Bump allocator for data living as long as a received message. Allocations are never
+    moved nor freed one by one: the whole arena is reset once the message is done with,
+    keeping a single chunk large enough for everything it held so that the next messages
+    don't allocate at all.
+*/
+
+static mb_arena_chunk_t *mb_arena_new_chunk(size_t size) {
+/* {{{ */
+    mb_arena_chunk_t *chunk = NULL;
+
+    if (!(chunk = malloc(sizeof(mb_arena_chunk_t) + size))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_arena_new_chunk: error: "
+            "unable to allocate memory");
+        return (NULL);
+    }
+
+    chunk->next = NULL;
+    chunk->size = size;
+    chunk->used = 0;
+
+    return (chunk);
+/* }}} */
+}
+
+void *mb_arena_alloc(mb_arena_t *arena, size_t len) {
+/* {{{ */
+    mb_arena_chunk_t    *chunk = arena->chunks;
+    void                *ptr = NULL;
+
+    len = (len + MB_ARENA_ALIGN - 1) & ~((size_t)MB_ARENA_ALIGN - 1);
+
+    if (!chunk || chunk->size - chunk->used < len) {
+        if (!(chunk = mb_arena_new_chunk(len > MB_ARENA_CHUNK_SIZE ? len : MB_ARENA_CHUNK_SIZE)))
+            return (NULL);
+
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    ptr = chunk->data + chunk->used;
+    chunk->used += len;
+
+    return (ptr);
+/* }}} */
+}
+
+char *mb_arena_strndup(mb_arena_t *arena, const char *str, size_t len) {
+/* {{{ */
+    char *dup = NULL;
+
+    if (!(dup = mb_arena_alloc(arena, len + 1)))
+        return (NULL);
+
+    memcpy(dup, str, len);
+    dup[len] = '\0';
+
+    return (dup);
+/* }}} */
+}
+
+void mb_arena_reset(mb_arena_t *arena) {
+/* {{{ */
+    mb_arena_chunk_t    *chunk = NULL;
+    size_t              size = 0;
+
+    if (!arena->chunks)
+        return;
+
+    /* Everything fit in a single chunk, keep it as is */
+    if (!arena->chunks->next && arena->chunks->size <= MB_ARENA_MAX_KEPT) {
+        arena->chunks->used = 0;
+        return;
+    }
+
+    /* Otherwise replace the chunks by a single one holding as much */
+    for (chunk = arena->chunks; chunk; chunk = chunk->next)
+        size += chunk->size;
+
+    mb_arena_free(arena);
+
+    if (size <= MB_ARENA_MAX_KEPT)
+        arena->chunks = mb_arena_new_chunk(size);
+/* }}} */
+}
+
+void mb_arena_free(mb_arena_t *arena) {
+/* {{{ */
+    mb_arena_chunk_t *chunk = NULL;
+
+    while ((chunk = arena->chunks)) {
+        arena->chunks = chunk->next;
+        free(chunk);
+    }
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
@@ -0,0 +1,45 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+
+#ifndef _MB_ARENA_H_
+#define _MB_ARENA_H_
+
+#define MB_ARENA_CHUNK_SIZE     4096
+#define MB_ARENA_ALIGN          8
+
+/* Memory an arena keeps across resets, one-off large messages don't pin their memory */
+#define MB_ARENA_MAX_KEPT       (1024 * 1024)
+
+struct mb_arena_chunk_s {
+/* {{{ */
+    struct mb_arena_chunk_s *next;
+    size_t                  size;
+    size_t                  used;
+    char                    data[];
+/* }}} */
+};
+
+#endif
+
+// vim: ft=c ts=4 et foldmethod=marker
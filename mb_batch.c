@@ -0,0 +1,250 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#include "mod_bunny.h"
+
+/* Envelope wrapped around each check of a batch message: {"correlation_id":"<cid>","check":<check>} */
+#define MB_BATCH_ENTRY_HEAD     "{\"correlation_id\":\""
+#define MB_BATCH_ENTRY_MIDDLE   "\",\"check\":"
+#define MB_BATCH_ENTRY_TAIL     "}"
+
+static long mb_batch_age_ms(mb_check_batch_t *batch) {
+/* {{{ */
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((now.tv_sec - batch->opened.tv_sec) * 1000
+        + (now.tv_nsec - batch->opened.tv_nsec) / 1000000);
+/* }}} */
+}
+
+mb_check_batch_t *mb_batch_add(mb_check_batches_t *batches, mb_check_msg_t *msg, int max_batch_checks) {
+/* {{{ */
+    mb_check_batch_t *batch = NULL;
+
+    /*
+        Checks are grouped by routing key, channel and format, since a batch is published
+        as a single message
+    */
+    TAILQ_FOREACH(batch, batches, tq) {
+        if (batch->channel == msg->channel
+            && strcmp(batch->content_type, msg->content_type) == 0
+            && strcmp(batch->routing_key, msg->routing_key) == 0)
+            break;
+    }
+
+    if (!batch) {
+        if (!(batch = calloc(1, sizeof(mb_check_batch_t)))) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_batch_add: error: "
+                "unable to allocate memory, discarding check",
+                msg->cid);
+            mb_free_check_msg(msg);
+            return (NULL);
+        }
+
+        if (!(batch->msgs = calloc(max_batch_checks, sizeof(mb_check_msg_t *)))) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_batch_add: error: "
+                "unable to allocate memory, discarding check",
+                msg->cid);
+            mb_free_check_msg(msg);
+            free(batch);
+            return (NULL);
+        }
+
+        batch->routing_key = msg->routing_key;
+        batch->channel = msg->channel;
+        batch->content_type = msg->content_type;
+        clock_gettime(CLOCK_MONOTONIC, &batch->opened);
+
+        /* Keep batches ordered by creation time, the oldest one is always at the head */
+        TAILQ_INSERT_TAIL(batches, batch, tq);
+    }
+
+    batch->msgs[batch->count++] = msg;
+
+    return (batch->count >= max_batch_checks ? batch : NULL);
+/* }}} */
+}
+
+mb_check_batch_t *mb_batch_expired(mb_check_batches_t *batches, int max_batch_linger_ms) {
+/* {{{ */
+    mb_check_batch_t *batch = TAILQ_FIRST(batches);
+
+    if (batch && mb_batch_age_ms(batch) >= max_batch_linger_ms)
+        return (batch);
+
+    return (NULL);
+/* }}} */
+}
+
+int mb_batch_linger_left(mb_check_batches_t *batches, int max_batch_linger_ms) {
+/* {{{ */
+    mb_check_batch_t    *batch = TAILQ_FIRST(batches);
+    long                left;
+
+    if (!batch)
+        return (-1);
+
+    left = max_batch_linger_ms - mb_batch_age_ms(batch);
+
+    return (left > 0 ? (int)left : 0);
+/* }}} */
+}
+
+static int mb_batch_pack_json(mb_check_batch_t *batch, mb_check_msg_t *batch_msg) {
+/* {{{ */
+    size_t  len = 2; /* Enclosing brackets */
+    char    *p = NULL;
+
+    for (int i = 0; i < batch->count; i++)
+        len += sizeof(MB_BATCH_ENTRY_HEAD) - 1
+            + batch->msgs[i]->cid_len
+            + sizeof(MB_BATCH_ENTRY_MIDDLE) - 1
+            + batch->msgs[i]->body_len
+            + sizeof(MB_BATCH_ENTRY_TAIL) - 1
+            + 1; /* Separating comma */
+
+    if (!(batch_msg->body = malloc(len + 1)))
+        return (MB_NOK);
+
+    batch_msg->content_type = MB_CONTENT_TYPE_JSON_BATCH;
+
+    p = batch_msg->body;
+    *p++ = '[';
+
+    for (int i = 0; i < batch->count; i++) {
+        if (i > 0)
+            *p++ = ',';
+
+        p = stpcpy(p, MB_BATCH_ENTRY_HEAD);
+        memcpy(p, batch->msgs[i]->cid, batch->msgs[i]->cid_len);
+        p += batch->msgs[i]->cid_len;
+        p = stpcpy(p, MB_BATCH_ENTRY_MIDDLE);
+        memcpy(p, batch->msgs[i]->body, batch->msgs[i]->body_len);
+        p += batch->msgs[i]->body_len;
+        p = stpcpy(p, MB_BATCH_ENTRY_TAIL);
+    }
+
+    *p++ = ']';
+    *p = '\0';
+
+    batch_msg->body_len = p - batch_msg->body;
+
+    return (MB_OK);
+/* }}} */
+}
+
+static int mb_batch_pack_msgpack(mb_check_batch_t *batch, mb_check_msg_t *batch_msg) {
+/* {{{ */
+    mb_buf_t buf = { NULL, 0, 0 };
+
+    /* Same envelope as JSON batches: [{"correlation_id": "<cid>", "check": {<check>}}, ...] */
+    if (!mb_msgpack_write_array(&buf, batch->count))
+        goto error;
+
+    for (int i = 0; i < batch->count; i++) {
+        if (!mb_msgpack_write_map(&buf, 2)
+            || !mb_msgpack_write_str(&buf, "correlation_id", sizeof("correlation_id") - 1)
+            || !mb_msgpack_write_str(&buf, batch->msgs[i]->cid, batch->msgs[i]->cid_len)
+            || !mb_msgpack_write_str(&buf, "check", sizeof("check") - 1)
+            || !mb_buf_append(&buf, batch->msgs[i]->body, batch->msgs[i]->body_len))
+            goto error;
+    }
+
+    batch_msg->content_type = MB_CONTENT_TYPE_MSGPACK_BATCH;
+    batch_msg->body = buf.data;
+    batch_msg->body_len = buf.len;
+
+    return (MB_OK);
+
+    error:
+    mb_buf_free(&buf);
+    return (MB_NOK);
+/* }}} */
+}
+
+mb_check_msg_t *mb_batch_pack(mb_check_batches_t *batches, mb_check_batch_t *batch) {
+/* {{{ */
+    mb_check_msg_t  *batch_msg = NULL;
+    int             rc;
+
+    TAILQ_REMOVE(batches, batch, tq);
+
+    /* A single check doesn't need the batch envelope */
+    if (batch->count == 1) {
+        batch_msg = batch->msgs[0];
+        goto done;
+    }
+
+    if (!(batch_msg = calloc(1, sizeof(mb_check_msg_t))))
+        rc = MB_NOK;
+    else if (MB_STR_MATCH(batch->content_type, MB_CONTENT_TYPE_MSGPACK))
+        rc = mb_batch_pack_msgpack(batch, batch_msg);
+    else
+        rc = mb_batch_pack_json(batch, batch_msg);
+
+    if (!rc) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_batch_pack: error: "
+            "unable to allocate memory, discarding batch of %d checks",
+            batch->count);
+
+        free(batch_msg);
+        batch_msg = NULL;
+    } else {
+        /* The batch is identified by the correlation ID of its first check */
+        memcpy(batch_msg->cid, batch->msgs[0]->cid, MB_CID_BUF_LEN);
+        batch_msg->cid_len = batch->msgs[0]->cid_len;
+        batch_msg->routing_key = batch->routing_key;
+        batch_msg->routing_key_len = batch->msgs[0]->routing_key_len;
+        batch_msg->channel = batch->channel;
+    }
+
+    for (int i = 0; i < batch->count; i++)
+        mb_free_check_msg(batch->msgs[i]);
+
+    done:
+    free(batch->msgs);
+    free(batch);
+
+    return (batch_msg);
+/* }}} */
+}
+
+void mb_batch_free_all(mb_check_batches_t *batches) {
+/* {{{ */
+    mb_check_batch_t *batch = NULL;
+
+    while ((batch = TAILQ_FIRST(batches))) {
+        TAILQ_REMOVE(batches, batch, tq);
+
+        for (int i = 0; i < batch->count; i++)
+            mb_free_check_msg(batch->msgs[i]);
+
+        free(batch->msgs);
+        free(batch);
+    }
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
@@ -0,0 +1,85 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+
+#include "mod_bunny.h"
+
+int mb_buf_reserve(mb_buf_t *buf, size_t len) {
+/* {{{ */
+    char    *data = NULL;
+    size_t  size;
+
+    /* Always keep room for a trailing NUL byte */
+    if (buf->len + len + 1 <= buf->size)
+        return (MB_OK);
+
+    size = (buf->size > 0 ? buf->size : MB_BUF_MIN_SIZE);
+
+    while (size < buf->len + len + 1)
+        size <<= 1;
+
+    if (!(data = realloc(buf->data, size))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_buf_reserve: error: "
+            "unable to allocate memory");
+        return (MB_NOK);
+    }
+
+    buf->data = data;
+    buf->size = size;
+
+    return (MB_OK);
+/* }}} */
+}
+
+int mb_buf_append(mb_buf_t *buf, const char *data, size_t len) {
+/* {{{ */
+    if (!mb_buf_reserve(buf, len))
+        return (MB_NOK);
+
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+
+    return (MB_OK);
+/* }}} */
+}
+
+void mb_buf_reset(mb_buf_t *buf) {
+/* {{{ */
+    buf->len = 0;
+
+    if (buf->data)
+        buf->data[0] = '\0';
+/* }}} */
+}
+
+void mb_buf_free(mb_buf_t *buf) {
+/* {{{ */
+    free(buf->data);
+    buf->data = NULL;
+    buf->len = 0;
+    buf->size = 0;
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
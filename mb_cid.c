@@ -0,0 +1,145 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#include <fcntl.h>
+
+#include "mod_bunny.h"
+
+/*
+    Correlation IDs are 128-bit values written as 32 hexadecimal digits:
+
+        IIIIIIII TTTTTTTT SSSSSSSSSSSSSSSS
+        instance timestamp sequence
+
+    The instance ID is drawn at random when the module is loaded, the timestamp is the
+    (coarse) generation time in seconds and the sequence is a process-wide counter, so
+    IDs never collide within an instance and are very unlikely to across instances.
+    The sequence number can be decoded back to track checks in flight.
+*/
+
+static uint32_t         mb_cid_instance = 0;
+static uint64_t         mb_cid_seq = 0;
+static char             mb_cid_hex[256][2];
+static signed char      mb_cid_unhex[256];
+
+void mb_cid_init(void) {
+/* {{{ */
+    static const char   digits[] = "0123456789ABCDEF";
+    struct timespec     now;
+    uint64_t            seed = 0;
+    int                 fd;
+
+    for (int i = 0; i < 256; i++) {
+        mb_cid_hex[i][0] = digits[i >> 4];
+        mb_cid_hex[i][1] = digits[i & 0xf];
+        mb_cid_unhex[i] = -1;
+    }
+
+    for (int i = 0; i < 16; i++)
+        mb_cid_unhex[(unsigned char)digits[i]] = i;
+
+    /* Fall back on the clock and process ID if no random source is available */
+    if ((fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC)) < 0 || read(fd, &seed, sizeof(seed)) != sizeof(seed)) {
+        clock_gettime(CLOCK_REALTIME, &now);
+        seed = ((uint64_t)getpid() << 32) ^ (uint64_t)now.tv_sec ^ ((uint64_t)now.tv_nsec << 20);
+    }
+
+    if (fd >= 0)
+        close(fd);
+
+    mb_cid_instance = (uint32_t)mb_hash_ptr((void *)(uintptr_t)seed);
+    mb_cid_seq = 0;
+/* }}} */
+}
+
+static inline void mb_cid_put(char *p, uint64_t value, int bytes) {
+/* {{{ */
+    for (int i = bytes - 1; i >= 0; i--) {
+        memcpy(p + i * 2, mb_cid_hex[value & 0xff], 2);
+        value >>= 8;
+    }
+/* }}} */
+}
+
+static inline bool mb_cid_get(const char *p, uint64_t *value, int bytes) {
+/* {{{ */
+    int digit;
+
+    *value = 0;
+
+    for (int i = 0; i < bytes * 2; i++) {
+        if ((digit = mb_cid_unhex[(unsigned char)p[i]]) < 0)
+            return (false);
+
+        *value = (*value << 4) | (uint64_t)digit;
+    }
+
+    return (true);
+/* }}} */
+}
+
+/* Write a new correlation ID into cid_buf, which must hold MB_CID_BUF_LEN bytes */
+void mb_gen_cid(char *cid_buf) {
+/* {{{ */
+    struct timespec now;
+    uint64_t        seq;
+
+    seq = __atomic_add_fetch(&mb_cid_seq, 1, __ATOMIC_RELAXED);
+
+#ifdef CLOCK_REALTIME_COARSE
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+#else
+    clock_gettime(CLOCK_REALTIME, &now);
+#endif
+
+    mb_cid_put(cid_buf, mb_cid_instance, 4);
+    mb_cid_put(cid_buf + 8, (uint32_t)now.tv_sec, 4);
+    mb_cid_put(cid_buf + 16, seq, 8);
+    cid_buf[MB_CID_BUF_LEN - 1] = '\0';
+/* }}} */
+}
+
+/*
+    Extract the sequence number (and timestamp if not NULL) of a correlation ID generated
+    by this instance. Returns MB_NOK for malformed IDs and IDs from other instances.
+*/
+int mb_cid_decode(const char *cid, uint64_t *seq, time_t *timestamp) {
+/* {{{ */
+    uint64_t instance;
+    uint64_t ts;
+
+    if (strlen(cid) != MB_CID_BUF_LEN - 1 || !mb_cid_get(cid, &instance, 4) || !mb_cid_get(cid + 8, &ts, 4)
+        || !mb_cid_get(cid + 16, seq, 8))
+        return (MB_NOK);
+
+    if ((uint32_t)instance != mb_cid_instance)
+        return (MB_NOK);
+
+    if (timestamp)
+        *timestamp = (time_t)ts;
+
+    return (MB_OK);
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
@@ -0,0 +1,723 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+
+#include "mod_bunny.h"
+#include "mb_command.h"
+
+/*
+    Check command lines are expanded the way Nagios does it (get_raw_command_line() then
+    process_macros()), but only for the few macros referenced by most check commands:
+    $ARGn$, $USERn$, names and addresses of the checked host and service, and their custom
+    variables. Anything else, on-demand macros and unbalanced '$' included, leaves the
+    command to the Nagios macros machinery.
+*/
+
+#define MB_COMMAND_MACRO_IS(n, l, s) ((l) == sizeof(s) - 1 && memcmp(n, s, sizeof(s) - 1) == 0)
+#define MB_COMMAND_MACRO_HAS_PREFIX(n, l, s) ((l) > sizeof(s) - 1 && memcmp(n, s, sizeof(s) - 1) == 0)
+
+#define MB_COMMAND_SEGMENT_IS_STATIC(s) \
+    ((s)->type == MB_COMMAND_SEGMENT_TEXT || (s)->type == MB_COMMAND_SEGMENT_USER)
+
+#define MB_COMMAND_TEMPLATES_MIN_SIZE 64
+
+/* Only used from the Nagios event loop, so no locking needed */
+static mb_buf_t mb_command_buf;
+static mb_buf_t mb_command_arg_buf;
+static mb_buf_t mb_command_args_buf;
+static const char **mb_command_args;
+static size_t *mb_command_args_len;
+static int mb_command_args_size;
+
+static int mb_command_add_segment(mb_command_t *cmd, int type, size_t offset, size_t len, int index) {
+/* {{{ */
+    mb_command_segment_t    *segments = NULL;
+    int                     size;
+
+    if (cmd->count == cmd->size) {
+        size = (cmd->size > 0 ? cmd->size * 2 : 8);
+
+        if (!(segments = realloc(cmd->segments, size * sizeof(mb_command_segment_t))))
+            return (MB_NOK);
+
+        cmd->segments = segments;
+        cmd->size = size;
+    }
+
+    cmd->segments[cmd->count].type = type;
+    cmd->segments[cmd->count].offset = offset;
+    cmd->segments[cmd->count].len = len;
+    cmd->segments[cmd->count].index = index;
+    cmd->count++;
+
+    return (MB_OK);
+/* }}} */
+}
+
+/* Store some text, as a segment of its own unless it follows some text of the same argument */
+static int mb_command_add_text(mb_command_t *cmd, int type, const char *text, size_t len) {
+/* {{{ */
+    mb_command_segment_t *last = (cmd->count > cmd->args[cmd->nargs] ? &cmd->segments[cmd->count - 1] : NULL);
+
+    if (len == 0 && type == MB_COMMAND_SEGMENT_TEXT)
+        return (MB_OK);
+
+    if (!mb_buf_append(&cmd->text, text, len))
+        return (MB_NOK);
+
+    if (type == MB_COMMAND_SEGMENT_TEXT && last && last->type == MB_COMMAND_SEGMENT_TEXT
+        && last->offset + last->len == cmd->text.len - len) {
+        last->len += len;
+        return (MB_OK);
+    }
+
+    return (mb_command_add_segment(cmd, type, cmd->text.len - len, len, 0));
+/* }}} */
+}
+
+/* Index of $ARGn$ or $USERn$ macros, -1 if not a number within [1, max] */
+static int mb_command_macro_index(const char *digits, size_t len, int max) {
+/* {{{ */
+    int n = 0;
+
+    if (len == 0 || len > 9)
+        return (-1);
+
+    for (size_t i = 0; i < len; i++) {
+        if (digits[i] < '0' || digits[i] > '9')
+            return (-1);
+
+        n = n * 10 + (digits[i] - '0');
+    }
+
+    return ((n >= 1 && n <= max) ? n - 1 : -1);
+/* }}} */
+}
+
+/* Add the segment a macro expands to, MB_NOK if it isn't one handled here */
+static int mb_command_add_macro(mb_command_t *cmd, const char *name, size_t len, int object_type, bool in_arg) {
+/* {{{ */
+    int index;
+
+    /* Escaped '$' */
+    if (len == 0)
+        return (mb_command_add_text(cmd, MB_COMMAND_SEGMENT_TEXT, "$", 1));
+
+    if (MB_COMMAND_MACRO_IS(name, len, "HOSTNAME"))
+        return (mb_command_add_segment(cmd, MB_COMMAND_SEGMENT_HOST_NAME, 0, 0, 0));
+
+    if (MB_COMMAND_MACRO_IS(name, len, "HOSTALIAS"))
+        return (mb_command_add_segment(cmd, MB_COMMAND_SEGMENT_HOST_ALIAS, 0, 0, 0));
+
+    if (MB_COMMAND_MACRO_IS(name, len, "HOSTADDRESS"))
+        return (mb_command_add_segment(cmd, MB_COMMAND_SEGMENT_HOST_ADDRESS, 0, 0, 0));
+
+    if (MB_COMMAND_MACRO_IS(name, len, "HOSTDISPLAYNAME"))
+        return (mb_command_add_segment(cmd, MB_COMMAND_SEGMENT_HOST_DISPLAY_NAME, 0, 0, 0));
+
+    /* Arguments only expand in the command line, not in other arguments */
+    if (MB_COMMAND_MACRO_HAS_PREFIX(name, len, "ARG")) {
+        if (in_arg || (index = mb_command_macro_index(name + 3, len - 3, MAX_COMMAND_ARGUMENTS)) < 0)
+            return (MB_NOK);
+
+        return (mb_command_add_segment(cmd, MB_COMMAND_SEGMENT_ARG, 0, 0, index));
+    }
+
+    if (MB_COMMAND_MACRO_HAS_PREFIX(name, len, "USER")) {
+        if ((index = mb_command_macro_index(name + 4, len - 4, MAX_USER_MACROS)) < 0)
+            return (MB_NOK);
+
+        return (mb_command_add_segment(cmd, MB_COMMAND_SEGMENT_USER, 0, 0, index));
+    }
+
+    /* Custom variables may be changed at run time, so command lines using them aren't cached */
+    if (MB_COMMAND_MACRO_HAS_PREFIX(name, len, "_HOST")) {
+        cmd->cacheable = false;
+        return (mb_command_add_text(cmd, MB_COMMAND_SEGMENT_HOST_CUSTOM, name + 5, len - 5));
+    }
+
+    if (object_type != SERVICE_CHECK)
+        return (MB_NOK);
+
+    if (MB_COMMAND_MACRO_IS(name, len, "SERVICEDESC"))
+        return (mb_command_add_segment(cmd, MB_COMMAND_SEGMENT_SERVICE_DESC, 0, 0, 0));
+
+    if (MB_COMMAND_MACRO_IS(name, len, "SERVICEDISPLAYNAME"))
+        return (mb_command_add_segment(cmd, MB_COMMAND_SEGMENT_SERVICE_DISPLAY_NAME, 0, 0, 0));
+
+    if (MB_COMMAND_MACRO_HAS_PREFIX(name, len, "_SERVICE")) {
+        cmd->cacheable = false;
+        return (mb_command_add_text(cmd, MB_COMMAND_SEGMENT_SERVICE_CUSTOM, name + 8, len - 8));
+    }
+
+    return (MB_NOK);
+/* }}} */
+}
+
+/* Split some text into literal text and macro segments */
+static int mb_command_scan(mb_command_t *cmd, const char *text, size_t len, int object_type, bool in_arg) {
+/* {{{ */
+    const char  *p = text;
+    const char  *end = text + len;
+    const char  *start = NULL;
+    const char  *stop = NULL;
+
+    while (p < end) {
+        if (!(start = memchr(p, '$', end - p)))
+            return (mb_command_add_text(cmd, MB_COMMAND_SEGMENT_TEXT, p, end - p));
+
+        if (!mb_command_add_text(cmd, MB_COMMAND_SEGMENT_TEXT, p, start - p))
+            return (MB_NOK);
+
+        if (!(stop = memchr(start + 1, '$', end - start - 1))
+            || !mb_command_add_macro(cmd, start + 1, stop - start - 1, object_type, in_arg))
+            return (MB_NOK);
+
+        p = stop + 1;
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+/* Pre-scan the check command of a host or service, NULL if out of memory */
+mb_command_t *mb_command_compile(command *cmd_ptr, char *check_command, int object_type) {
+/* {{{ */
+    mb_command_t    *cmd = NULL;
+    mb_buf_t        *arg = &mb_command_arg_buf;
+    char            *p = NULL;
+    bool            escaped = false;
+
+    if (!(cmd = calloc(1, sizeof(mb_command_t))) || !(cmd->check_command = strdup(check_command))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_command_compile: error: "
+            "unable to allocate memory");
+        free(cmd);
+        return (NULL);
+    }
+
+    cmd->command = cmd_ptr;
+    cmd->cacheable = true;
+
+    /* Arguments follow the command name, separated by unescaped '!' */
+    for (p = check_command; *p; p++) {
+        if (*p == '!' && !escaped)
+            break;
+
+        escaped = (*p == '\\' && !escaped);
+    }
+
+    for (cmd->nargs = 0; *p && cmd->nargs < MAX_COMMAND_ARGUMENTS; cmd->nargs++) {
+        mb_buf_reset(arg);
+
+        /* Backslashes escape the next character */
+        for (p++, escaped = false; *p; p++) {
+            if (*p == '\\' && !escaped) {
+                escaped = true;
+                continue;
+            }
+
+            if (*p == '!' && !escaped)
+                break;
+
+            if (!mb_buf_append(arg, p, 1))
+                goto done;
+
+            escaped = false;
+        }
+
+        /* Nagios truncates overly long arguments */
+        if (arg->len >= MAX_COMMAND_BUFFER - 1)
+            goto done;
+
+        cmd->args[cmd->nargs] = cmd->count;
+
+        if (!mb_command_scan(cmd, arg->data, arg->len, object_type, true))
+            goto done;
+    }
+
+    cmd->args[cmd->nargs] = cmd->count;
+
+    if (!cmd_ptr->command_line
+        || !mb_command_scan(cmd, cmd_ptr->command_line, strlen(cmd_ptr->command_line), object_type, false))
+        goto done;
+
+    cmd->expandable = true;
+
+    done:
+    if (!cmd->expandable) {
+        free(cmd->segments);
+        cmd->segments = NULL;
+        cmd->count = 0;
+        mb_buf_free(&cmd->text);
+    }
+
+    return (cmd);
+/* }}} */
+}
+
+/* Whether the command line is expanded by mod_bunny rather than Nagios */
+bool mb_command_expandable(mb_command_t *cmd) {
+/* {{{ */
+    return (cmd && cmd->expandable);
+/* }}} */
+}
+
+/* Whether a compiled command is still the check command of its object */
+bool mb_command_matches(mb_command_t *cmd, command *cmd_ptr, char *check_command) {
+/* {{{ */
+    return (cmd && cmd->command == cmd_ptr && strcmp(cmd->check_command, check_command) == 0);
+/* }}} */
+}
+
+static const char *mb_command_custom_variable(customvariablesmember *vars, const char *name, size_t len) {
+/* {{{ */
+    for (; vars; vars = vars->next) {
+        if (vars->variable_name && strlen(vars->variable_name) == len
+            && memcmp(vars->variable_name, name, len) == 0)
+            return (vars->variable_value);
+    }
+
+    return (NULL);
+/* }}} */
+}
+
+static int mb_command_expand_segments(mb_command_t *cmd, int first, int last, host *hst, service *svc,
+    mb_buf_t *buf) {
+/* {{{ */
+    mb_command_segment_t    *segment = NULL;
+    const char              *value = NULL;
+
+    for (int i = first; i < last; i++) {
+        segment = &cmd->segments[i];
+        value = NULL;
+
+        switch (segment->type) {
+            case MB_COMMAND_SEGMENT_TEXT:
+                if (!mb_buf_append(buf, cmd->text.data + segment->offset, segment->len))
+                    return (MB_NOK);
+                continue;
+
+            /* Arguments not given expand to nothing */
+            case MB_COMMAND_SEGMENT_ARG:
+                if (segment->index < cmd->nargs && !mb_command_expand_segments(cmd, cmd->args[segment->index],
+                    cmd->args[segment->index + 1], hst, svc, buf))
+                    return (MB_NOK);
+                continue;
+
+            case MB_COMMAND_SEGMENT_USER:
+                value = macro_user[segment->index];
+                break;
+
+            case MB_COMMAND_SEGMENT_HOST_NAME:
+                value = hst->name;
+                break;
+
+            case MB_COMMAND_SEGMENT_HOST_ALIAS:
+                value = hst->alias;
+                break;
+
+            case MB_COMMAND_SEGMENT_HOST_ADDRESS:
+                value = hst->address;
+                break;
+
+            case MB_COMMAND_SEGMENT_HOST_DISPLAY_NAME:
+                value = hst->display_name;
+                break;
+
+            case MB_COMMAND_SEGMENT_SERVICE_DESC:
+                value = svc->description;
+                break;
+
+            case MB_COMMAND_SEGMENT_SERVICE_DISPLAY_NAME:
+                value = svc->display_name;
+                break;
+
+            /* Nagios leaves undefined custom variables alone, let it do so */
+            case MB_COMMAND_SEGMENT_HOST_CUSTOM:
+                if (!(value = mb_command_custom_variable(hst->custom_variables, cmd->text.data + segment->offset,
+                    segment->len)))
+                    return (MB_NOK);
+                break;
+
+            case MB_COMMAND_SEGMENT_SERVICE_CUSTOM:
+                if (!(value = mb_command_custom_variable(svc->custom_variables, cmd->text.data + segment->offset,
+                    segment->len)))
+                    return (MB_NOK);
+                break;
+
+            default:
+                return (MB_NOK);
+        }
+
+        if (value && !mb_buf_append(buf, value, strlen(value)))
+            return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+/*
+    Expand the command line of a pre-scanned check command, NULL if it has to be left to
+    Nagios. The returned command line is only valid until the next call.
+*/
+char *mb_command_expand(mb_command_t *cmd, host *hst, service *svc) {
+/* {{{ */
+    mb_buf_t *buf = &mb_command_buf;
+
+    if (!cmd || !cmd->expandable)
+        return (NULL);
+
+    if (cmd->expanded)
+        return (cmd->expanded);
+
+    mb_buf_reset(buf);
+
+    if (!mb_buf_reserve(buf, 0)
+        || !mb_command_expand_segments(cmd, cmd->args[cmd->nargs], cmd->count, hst, svc, buf))
+        return (NULL);
+
+    buf->data[buf->len] = '\0';
+
+    /* Static attributes only change along with the check command, which invalidates the whole command */
+    if (cmd->cacheable)
+        cmd->expanded = strndup(buf->data, buf->len);
+
+    return (buf->data);
+/* }}} */
+}
+
+static void mb_command_template_free(mb_command_template_t *tmpl) {
+/* {{{ */
+    if (!tmpl)
+        return;
+
+    free(tmpl->text);
+    free(tmpl->parts);
+    free(tmpl);
+/* }}} */
+}
+
+/* Total size of the template text, each part being followed by a NUL byte */
+static size_t mb_command_template_size(mb_command_template_t *tmpl) {
+/* {{{ */
+    size_t size = 0;
+
+    for (int i = 0; i <= tmpl->nargs; i++)
+        size += tmpl->parts[i] + 1;
+
+    return (size);
+/* }}} */
+}
+
+/*
+    Split the command line of a pre-scanned command around the segments expanded for each
+    object: literal text and $USERn$ macros, which only change along with the configuration,
+    make the template, while arguments, host and service attributes are sent along with
+    each check. The ID is a hash of the template text, so that it doesn't depend on which
+    object nor Nagios instance the template comes from.
+*/
+mb_command_template_t *mb_command_template(mb_command_t *cmd) {
+/* {{{ */
+    mb_command_template_t   *tmpl = NULL;
+    mb_command_segment_t    *segment = NULL;
+    mb_buf_t                text = { 0 };
+    const char              *value = NULL;
+    size_t                  part_start = 0;
+    uint64_t                hash = 0xcbf29ce484222325ULL;
+
+    if (!cmd || !cmd->expandable)
+        return (NULL);
+
+    if (cmd->template)
+        return (cmd->template);
+
+    if (!(tmpl = calloc(1, sizeof(mb_command_template_t))))
+        goto error;
+
+    for (int i = cmd->args[cmd->nargs]; i < cmd->count; i++) {
+        if (!MB_COMMAND_SEGMENT_IS_STATIC(&cmd->segments[i]))
+            tmpl->nargs++;
+    }
+
+    if (!(tmpl->parts = calloc(tmpl->nargs + 1, sizeof(size_t))) || !mb_buf_reserve(&text, 0))
+        goto error;
+
+    tmpl->nargs = 0;
+
+    for (int i = cmd->args[cmd->nargs]; i < cmd->count; i++) {
+        segment = &cmd->segments[i];
+
+        if (segment->type == MB_COMMAND_SEGMENT_TEXT) {
+            if (!mb_buf_append(&text, cmd->text.data + segment->offset, segment->len))
+                goto error;
+        } else if (segment->type == MB_COMMAND_SEGMENT_USER) {
+            if ((value = macro_user[segment->index]) && !mb_buf_append(&text, value, strlen(value)))
+                goto error;
+        } else {
+            /* Parts are NUL-terminated, so that they can be packed as strings */
+            tmpl->parts[tmpl->nargs++] = text.len - part_start;
+
+            if (!mb_buf_append(&text, "", 1))
+                goto error;
+
+            part_start = text.len;
+        }
+    }
+
+    tmpl->parts[tmpl->nargs] = text.len - part_start;
+
+    if (!mb_buf_append(&text, "", 1))
+        goto error;
+
+    tmpl->text = text.data;
+
+    /* FNV-1a, NUL bytes between parts keep their boundaries in the hash */
+    for (size_t i = 0; i < text.len; i++) {
+        hash ^= (unsigned char)text.data[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    tmpl->hash = hash;
+    snprintf(tmpl->id, sizeof(tmpl->id), "%016llx", (unsigned long long)hash);
+
+    cmd->template = tmpl;
+
+    return (tmpl);
+
+    error:
+    logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_command_template: error: "
+        "unable to allocate memory");
+
+    mb_buf_free(&text);
+    mb_command_template_free(tmpl);
+
+    return (NULL);
+/* }}} */
+}
+
+/*
+    Expand the arguments of the command template of a pre-scanned command, the values
+    referenced by `check_cmd' are only valid until the next call.
+*/
+int mb_command_expand_args(mb_command_t *cmd, host *hst, service *svc, mb_check_command_t *check_cmd) {
+/* {{{ */
+    mb_buf_t    *buf = &mb_command_args_buf;
+    const char  **args = NULL;
+    size_t      *args_len = NULL;
+    size_t      start;
+    const char  *p = NULL;
+    int         nargs = 0;
+
+    if (!cmd || !cmd->template)
+        return (MB_NOK);
+
+    if (cmd->template->nargs > mb_command_args_size) {
+        if (!(args = realloc(mb_command_args, cmd->template->nargs * sizeof(char *))))
+            return (MB_NOK);
+
+        mb_command_args = args;
+
+        if (!(args_len = realloc(mb_command_args_len, cmd->template->nargs * sizeof(size_t))))
+            return (MB_NOK);
+
+        mb_command_args_len = args_len;
+        mb_command_args_size = cmd->template->nargs;
+    }
+
+    mb_buf_reset(buf);
+
+    for (int i = cmd->args[cmd->nargs]; i < cmd->count; i++) {
+        if (MB_COMMAND_SEGMENT_IS_STATIC(&cmd->segments[i]))
+            continue;
+
+        start = buf->len;
+
+        if (!mb_command_expand_segments(cmd, i, i + 1, hst, svc, buf))
+            return (MB_NOK);
+
+        mb_command_args_len[nargs++] = buf->len - start;
+
+        if (!mb_buf_append(buf, "", 1))
+            return (MB_NOK);
+    }
+
+    /* Values are NUL-terminated one after the other, the buffer doesn't move anymore */
+    p = buf->data;
+
+    for (int i = 0; i < nargs; i++) {
+        mb_command_args[i] = p;
+        p += mb_command_args_len[i] + 1;
+    }
+
+    check_cmd->line = NULL;
+    check_cmd->template_id = cmd->template->id;
+    check_cmd->args = mb_command_args;
+    check_cmd->args_len = mb_command_args_len;
+    check_cmd->nargs = nargs;
+
+    return (MB_OK);
+/* }}} */
+}
+
+mb_command_templates_t *mb_command_templates_new(void) {
+/* {{{ */
+    mb_command_templates_t *templates = NULL;
+
+    if (!(templates = calloc(1, sizeof(mb_command_templates_t)))
+        || !(templates->entries = calloc(MB_COMMAND_TEMPLATES_MIN_SIZE, sizeof(mb_command_template_t *)))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_command_templates_new: error: "
+            "unable to allocate memory");
+        free(templates);
+        return (NULL);
+    }
+
+    templates->mask = MB_COMMAND_TEMPLATES_MIN_SIZE - 1;
+
+    return (templates);
+/* }}} */
+}
+
+void mb_command_templates_free(mb_command_templates_t *templates) {
+/* {{{ */
+    if (!templates)
+        return;
+
+    for (size_t i = 0; i <= templates->mask; i++)
+        mb_command_template_free(templates->entries[i]);
+
+    free(templates->entries);
+    free(templates);
+/* }}} */
+}
+
+static size_t mb_command_templates_slot(mb_command_template_t **entries, size_t mask, mb_command_template_t *tmpl) {
+/* {{{ */
+    size_t i = tmpl->hash & mask;
+
+    while (entries[i] && strcmp(entries[i]->id, tmpl->id) != 0)
+        i = (i + 1) & mask;
+
+    return (i);
+/* }}} */
+}
+
+bool mb_command_templates_has(mb_command_templates_t *templates, mb_command_template_t *tmpl) {
+/* {{{ */
+    return (templates->entries[mb_command_templates_slot(templates->entries, templates->mask, tmpl)] != NULL);
+/* }}} */
+}
+
+/* Keep a copy of a template, growing the table to keep the load factor under 1/2 */
+int mb_command_templates_add(mb_command_templates_t *templates, mb_command_template_t *tmpl) {
+/* {{{ */
+    mb_command_template_t   **entries = NULL;
+    mb_command_template_t   *copy = NULL;
+    size_t                  mask;
+    size_t                  size;
+
+    if (mb_command_templates_has(templates, tmpl))
+        return (MB_OK);
+
+    if ((templates->count + 1) * 2 > templates->mask + 1) {
+        mask = (templates->mask << 1) | 1;
+
+        if (!(entries = calloc(mask + 1, sizeof(mb_command_template_t *))))
+            goto error;
+
+        for (size_t i = 0; i <= templates->mask; i++) {
+            if (templates->entries[i])
+                entries[mb_command_templates_slot(entries, mask, templates->entries[i])] = templates->entries[i];
+        }
+
+        free(templates->entries);
+        templates->entries = entries;
+        templates->mask = mask;
+    }
+
+    size = mb_command_template_size(tmpl);
+
+    if (!(copy = calloc(1, sizeof(mb_command_template_t)))
+        || !(copy->text = malloc(size))
+        || !(copy->parts = malloc((tmpl->nargs + 1) * sizeof(size_t)))) {
+        mb_command_template_free(copy);
+        goto error;
+    }
+
+    memcpy(copy->id, tmpl->id, sizeof(copy->id));
+    copy->hash = tmpl->hash;
+    memcpy(copy->text, tmpl->text, size);
+    memcpy(copy->parts, tmpl->parts, (tmpl->nargs + 1) * sizeof(size_t));
+    copy->nargs = tmpl->nargs;
+
+    templates->entries[mb_command_templates_slot(templates->entries, templates->mask, copy)] = copy;
+    templates->count++;
+
+    return (MB_OK);
+
+    error:
+    logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_command_templates_add: error: "
+        "unable to allocate memory");
+
+    return (MB_NOK);
+/* }}} */
+}
+
+void mb_command_templates_foreach(mb_command_templates_t *templates, void (*handler)(mb_command_template_t *)) {
+/* {{{ */
+    for (size_t i = 0; i <= templates->mask; i++) {
+        if (templates->entries[i])
+            handler(templates->entries[i]);
+    }
+/* }}} */
+}
+
+void mb_command_free(mb_command_t *cmd) {
+/* {{{ */
+    if (!cmd)
+        return;
+
+    mb_command_template_free(cmd->template);
+    free(cmd->check_command);
+    free(cmd->segments);
+    free(cmd->expanded);
+    mb_buf_free(&cmd->text);
+    free(cmd);
+/* }}} */
+}
+
+void mb_command_free_buffers(void) {
+/* {{{ */
+    mb_buf_free(&mb_command_buf);
+    mb_buf_free(&mb_command_arg_buf);
+    mb_buf_free(&mb_command_args_buf);
+
+    free(mb_command_args);
+    free(mb_command_args_len);
+    mb_command_args = NULL;
+    mb_command_args_len = NULL;
+    mb_command_args_size = 0;
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
@@ -0,0 +1,91 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+
+#ifndef _MB_COMMAND_H_
+#define _MB_COMMAND_H_
+
+/* What a part of a check command line expands to */
+enum mb_command_segment_types {
+    MB_COMMAND_SEGMENT_TEXT,
+    MB_COMMAND_SEGMENT_ARG,
+    MB_COMMAND_SEGMENT_USER,
+    MB_COMMAND_SEGMENT_HOST_NAME,
+    MB_COMMAND_SEGMENT_HOST_ALIAS,
+    MB_COMMAND_SEGMENT_HOST_ADDRESS,
+    MB_COMMAND_SEGMENT_HOST_DISPLAY_NAME,
+    MB_COMMAND_SEGMENT_SERVICE_DESC,
+    MB_COMMAND_SEGMENT_SERVICE_DISPLAY_NAME,
+    MB_COMMAND_SEGMENT_HOST_CUSTOM,
+    MB_COMMAND_SEGMENT_SERVICE_CUSTOM,
+};
+
+/* Literal text or macro, text and custom variable names are stored in the command text */
+typedef struct mb_command_segment_s {
+/* {{{ */
+    int     type;
+    size_t  offset;
+    size_t  len;
+    int     index;
+/* }}} */
+} mb_command_segment_t;
+
+/*
+    Check command of a host or service, pre-scanned for the macros it references. The
+    segments of each argument come first, `args' telling where each one starts, followed
+    by the segments of the command line. Commands referencing macros that can't be
+    expanded here are kept too, not to be scanned again for each check.
+*/
+struct mb_command_s {
+/* {{{ */
+    command                 *command;
+    char                    *check_command;
+    bool                    expandable;
+    bool                    cacheable;
+    mb_buf_t                text;
+    mb_command_segment_t    *segments;
+    int                     count;
+    int                     size;
+    int                     args[MAX_COMMAND_ARGUMENTS + 1];
+    int                     nargs;
+
+    /* Command line of commands only referencing static attributes of their object */
+    char                    *expanded;
+
+    /* Command line split around the segments expanded for each object, built on demand */
+    mb_command_template_t   *template;
+/* }}} */
+};
+
+/* Command templates already published, by ID */
+struct mb_command_templates_s {
+/* {{{ */
+    mb_command_template_t   **entries;
+    size_t                  mask;
+    size_t                  count;
+/* }}} */
+};
+
+#endif
+
+// vim: ft=c ts=4 et foldmethod=marker
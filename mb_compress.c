@@ -0,0 +1,399 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+
+#include "mod_bunny.h"
+#include "mb_compress.h"
+
+#ifdef HAVE_ZSTD
+/* Optional trained dictionary, shared read-only by all threads */
+static ZSTD_CDict *mb_compress_zstd_cdict = NULL;
+static ZSTD_DDict *mb_compress_zstd_ddict = NULL;
+#endif
+
+int mb_compress_init(mb_config_t *config) {
+/* {{{ */
+#ifdef HAVE_ZSTD
+    FILE    *f = NULL;
+    char    *dict = NULL;
+    long    dict_size;
+
+    if (strlen(config->compression_dictionary) == 0)
+        return (MB_OK);
+
+    if (!(f = fopen(config->compression_dictionary, "r"))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_compress_init: error: "
+            "unable to open compression dictionary %s: %s",
+            config->compression_dictionary,
+            strerror(errno));
+        return (MB_NOK);
+    }
+
+    if (fseek(f, 0, SEEK_END) != 0 || (dict_size = ftell(f)) <= 0 || fseek(f, 0, SEEK_SET) != 0
+        || !(dict = malloc(dict_size)) || fread(dict, 1, dict_size, f) != (size_t)dict_size) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_compress_init: error: "
+            "unable to read compression dictionary %s",
+            config->compression_dictionary);
+        free(dict);
+        fclose(f);
+        return (MB_NOK);
+    }
+
+    fclose(f);
+
+    /* Dictionaries are digested once, then referenced by the per-thread contexts */
+    mb_compress_zstd_cdict = ZSTD_createCDict(dict, dict_size, ZSTD_CLEVEL_DEFAULT);
+    mb_compress_zstd_ddict = ZSTD_createDDict(dict, dict_size);
+    free(dict);
+
+    if (!mb_compress_zstd_cdict || !mb_compress_zstd_ddict) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_compress_init: error: "
+            "invalid compression dictionary %s",
+            config->compression_dictionary);
+        mb_compress_deinit();
+        return (MB_NOK);
+    }
+
+    if (config->debug_level > 0)
+        logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: mb_compress_init: loaded compression dictionary %s",
+            config->compression_dictionary);
+#else
+    if (strlen(config->compression_dictionary) > 0) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_compress_init: error: "
+            "compression dictionaries require zstd support, which is not compiled in");
+        return (MB_NOK);
+    }
+#endif
+
+    return (MB_OK);
+/* }}} */
+}
+
+void mb_compress_deinit(void) {
+/* {{{ */
+#ifdef HAVE_ZSTD
+    ZSTD_freeCDict(mb_compress_zstd_cdict);
+    ZSTD_freeDDict(mb_compress_zstd_ddict);
+    mb_compress_zstd_cdict = NULL;
+    mb_compress_zstd_ddict = NULL;
+#endif
+/* }}} */
+}
+
+mb_compressor_t *mb_compressor_new(void) {
+/* {{{ */
+    mb_compressor_t *compressor = NULL;
+
+    if (!(compressor = calloc(1, sizeof(mb_compressor_t)))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_compressor_new: error: "
+            "unable to allocate memory");
+        return (NULL);
+    }
+
+#ifdef HAVE_ZSTD
+    if (!(compressor->zstd_cctx = ZSTD_createCCtx()) || !(compressor->zstd_dctx = ZSTD_createDCtx())) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_compressor_new: error: "
+            "unable to create zstd contexts");
+        mb_compressor_free(compressor);
+        return (NULL);
+    }
+#endif
+
+#ifdef HAVE_LZ4
+    if (LZ4F_isError(LZ4F_createDecompressionContext(&compressor->lz4_dctx, LZ4F_VERSION))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_compressor_new: error: "
+            "unable to create lz4 context");
+        compressor->lz4_dctx = NULL;
+        mb_compressor_free(compressor);
+        return (NULL);
+    }
+#endif
+
+    return (compressor);
+/* }}} */
+}
+
+void mb_compressor_free(mb_compressor_t *compressor) {
+/* {{{ */
+    if (!compressor)
+        return;
+
+#ifdef HAVE_ZSTD
+    ZSTD_freeCCtx(compressor->zstd_cctx);
+    ZSTD_freeDCtx(compressor->zstd_dctx);
+#endif
+
+#ifdef HAVE_LZ4
+    if (compressor->lz4_dctx)
+        LZ4F_freeDecompressionContext(compressor->lz4_dctx);
+#endif
+
+    free(compressor);
+/* }}} */
+}
+
+bool mb_compression_supported(const char *algorithm) {
+/* {{{ */
+    if (MB_STR_MATCH(algorithm, "none"))
+        return (true);
+#ifdef HAVE_LZ4
+    if (MB_STR_MATCH(algorithm, MB_CONTENT_ENCODING_LZ4))
+        return (true);
+#endif
+#ifdef HAVE_ZSTD
+    if (MB_STR_MATCH(algorithm, MB_CONTENT_ENCODING_ZSTD))
+        return (true);
+#endif
+
+    return (false);
+/* }}} */
+}
+
+int mb_compress_msg(mb_compressor_t *compressor, mb_check_msg_t *msg, int algorithm, int threshold) {
+/* {{{ */
+    char        *compressed = NULL;
+    size_t      compressed_len = 0;
+    size_t      bound;
+    const char  *encoding = NULL;
+
+    /* Small messages don't compress well enough to be worth it, and retransmits already are */
+    if (algorithm == MB_COMPRESSION_NONE || msg->content_encoding || msg->body_len < (size_t)threshold)
+        return (MB_OK);
+
+    switch (algorithm) {
+#ifdef HAVE_ZSTD
+        case MB_COMPRESSION_ZSTD:
+            bound = ZSTD_compressBound(msg->body_len);
+
+            if (!(compressed = malloc(bound)))
+                break;
+
+            ZSTD_CCtx_reset(compressor->zstd_cctx, ZSTD_reset_session_only);
+            ZSTD_CCtx_refCDict(compressor->zstd_cctx, mb_compress_zstd_cdict);
+
+            compressed_len = ZSTD_compress2(compressor->zstd_cctx, compressed, bound, msg->body, msg->body_len);
+
+            if (ZSTD_isError(compressed_len)) {
+                logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_compress_msg: error: "
+                    "zstd compression failed: %s",
+                    msg->cid,
+                    ZSTD_getErrorName(compressed_len));
+                compressed_len = 0;
+            }
+
+            encoding = MB_CONTENT_ENCODING_ZSTD;
+            break;
+#endif
+
+#ifdef HAVE_LZ4
+        case MB_COMPRESSION_LZ4: {
+            LZ4F_preferences_t prefs;
+
+            memset(&prefs, 0, sizeof(prefs));
+            prefs.frameInfo.contentSize = msg->body_len;
+
+            bound = LZ4F_compressFrameBound(msg->body_len, &prefs);
+
+            if (!(compressed = malloc(bound)))
+                break;
+
+            compressed_len = LZ4F_compressFrame(compressed, bound, msg->body, msg->body_len, &prefs);
+
+            if (LZ4F_isError(compressed_len)) {
+                logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_compress_msg: error: "
+                    "lz4 compression failed: %s",
+                    msg->cid,
+                    LZ4F_getErrorName(compressed_len));
+                compressed_len = 0;
+            }
+
+            encoding = MB_CONTENT_ENCODING_LZ4;
+            break;
+        }
+#endif
+
+        default:
+            (void)compressor;
+            (void)bound;
+            return (MB_OK);
+    }
+
+    if (!compressed) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_compress_msg: error: "
+            "unable to allocate memory",
+            msg->cid);
+        return (MB_NOK);
+    }
+
+    /* Send the message as is if compression failed or didn't help */
+    if (compressed_len == 0 || compressed_len >= msg->body_len) {
+        free(compressed);
+        return (MB_OK);
+    }
+
+    free(msg->body);
+    msg->body = compressed;
+    msg->body_len = compressed_len;
+    msg->body_size = bound;
+    msg->content_encoding = encoding;
+
+    return (MB_OK);
+/* }}} */
+}
+
+#ifdef HAVE_ZSTD
+static int mb_decompress_zstd(mb_compressor_t *compressor, char *body, size_t body_len, mb_buf_t *out) {
+/* {{{ */
+    ZSTD_inBuffer       in = { body, body_len, 0 };
+    ZSTD_outBuffer      output;
+    unsigned long long  content_size;
+    size_t              rc;
+
+    content_size = ZSTD_getFrameContentSize(body, body_len);
+
+    if (content_size == ZSTD_CONTENTSIZE_ERROR || (content_size != ZSTD_CONTENTSIZE_UNKNOWN
+        && content_size > MB_MAX_DECOMPRESSED_SIZE))
+        return (MB_NOK);
+
+    ZSTD_DCtx_reset(compressor->zstd_dctx, ZSTD_reset_session_only);
+    ZSTD_DCtx_refDDict(compressor->zstd_dctx, mb_compress_zstd_ddict);
+
+    if (!mb_buf_reserve(out, (content_size != ZSTD_CONTENTSIZE_UNKNOWN ? content_size : body_len * 4)))
+        return (MB_NOK);
+
+    /* Stream into the buffer, growing it as needed for frames without a content size */
+    do {
+        if (out->size - out->len <= 1 && !mb_buf_reserve(out, out->size))
+            return (MB_NOK);
+
+        output.dst = out->data + out->len;
+        output.size = out->size - out->len - 1;
+        output.pos = 0;
+
+        rc = ZSTD_decompressStream(compressor->zstd_dctx, &output, &in);
+
+        if (ZSTD_isError(rc))
+            return (MB_NOK);
+
+        out->len += output.pos;
+
+        if (out->len > MB_MAX_DECOMPRESSED_SIZE)
+            return (MB_NOK);
+
+        /* Truncated frame */
+        if (rc != 0 && in.pos == in.size && output.pos < output.size)
+            return (MB_NOK);
+    } while (rc != 0);
+
+    return (in.pos == in.size ? MB_OK : MB_NOK);
+/* }}} */
+}
+#endif
+
+#ifdef HAVE_LZ4
+static int mb_decompress_lz4(mb_compressor_t *compressor, char *body, size_t body_len, mb_buf_t *out) {
+/* {{{ */
+    size_t  in_pos = 0;
+    size_t  src_size;
+    size_t  dst_size;
+    size_t  rc;
+
+    LZ4F_resetDecompressionContext(compressor->lz4_dctx);
+
+    if (!mb_buf_reserve(out, body_len * 4))
+        return (MB_NOK);
+
+    do {
+        if (out->size - out->len <= 1 && !mb_buf_reserve(out, out->size))
+            return (MB_NOK);
+
+        src_size = body_len - in_pos;
+        dst_size = out->size - out->len - 1;
+
+        rc = LZ4F_decompress(compressor->lz4_dctx, out->data + out->len, &dst_size,
+            body + in_pos, &src_size, NULL);
+
+        if (LZ4F_isError(rc))
+            return (MB_NOK);
+
+        in_pos += src_size;
+        out->len += dst_size;
+
+        if (out->len > MB_MAX_DECOMPRESSED_SIZE)
+            return (MB_NOK);
+
+        /* Truncated frame */
+        if (rc != 0 && in_pos == body_len && src_size == 0 && dst_size == 0)
+            return (MB_NOK);
+    } while (rc != 0);
+
+    return (in_pos == body_len ? MB_OK : MB_NOK);
+/* }}} */
+}
+#endif
+
+int mb_decompress(mb_compressor_t *compressor, const char *encoding, char *body, size_t body_len,
+    char **out, size_t *out_len) {
+/* {{{ */
+    mb_buf_t    buf = { NULL, 0, 0 };
+    int         rc = MB_NOK;
+
+#ifdef HAVE_ZSTD
+    if (MB_STR_MATCH(encoding, MB_CONTENT_ENCODING_ZSTD))
+        rc = mb_decompress_zstd(compressor, body, body_len, &buf);
+    else
+#endif
+#ifdef HAVE_LZ4
+    if (MB_STR_MATCH(encoding, MB_CONTENT_ENCODING_LZ4))
+        rc = mb_decompress_lz4(compressor, body, body_len, &buf);
+    else
+#endif
+    {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_decompress: error: "
+            "unsupported content encoding \"%s\"",
+            encoding);
+        (void)compressor;
+        (void)body;
+        (void)body_len;
+        return (MB_NOK);
+    }
+
+    if (!rc) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_decompress: error: "
+            "unable to decompress %s message body",
+            encoding);
+        mb_buf_free(&buf);
+        return (MB_NOK);
+    }
+
+    /* Decoders expect NUL-terminated text bodies */
+    buf.data[buf.len] = '\0';
+
+    *out = buf.data;
+    *out_len = buf.len;
+
+    return (MB_OK);
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
@@ -0,0 +1,54 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#ifndef _MB_COMPRESS_H_
+#define _MB_COMPRESS_H_
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+/* Refuse to inflate a message beyond this size, to protect against decompression bombs */
+#define MB_MAX_DECOMPRESSED_SIZE    (64 * 1024 * 1024)
+
+/* Compression contexts are reused from message to message, one per publisher/consumer thread */
+struct mb_compressor_s {
+/* {{{ */
+#ifdef HAVE_ZSTD
+    ZSTD_CCtx                   *zstd_cctx;
+    ZSTD_DCtx                   *zstd_dctx;
+#endif
+#ifdef HAVE_LZ4
+    LZ4F_decompressionContext_t lz4_dctx;
+#endif
+    int                         unused; /* Keep the structure non-empty without compression support */
+/* }}} */
+};
+
+#endif
+
+// vim: ft=c ts=4 et foldmethod=marker
@@ -0,0 +1,167 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#include "mod_bunny.h"
+
+/*
+    Sliding window of messages published on a channel in confirm mode, waiting for the
+    broker to acknowledge them. Delivery tags are assigned by the broker sequentially
+    from 1 after `confirm.select', so the message with tag T sits (T - first_tag) slots
+    after the oldest unconfirmed one.
+*/
+
+static inline int mb_confirm_window_index(mb_confirm_window_t *window, uint64_t tag) {
+/* {{{ */
+    return ((window->first + (int)(tag - window->first_tag)) % window->size);
+/* }}} */
+}
+
+static inline bool mb_confirm_window_holds(mb_confirm_window_t *window, uint64_t tag) {
+/* {{{ */
+    return (tag >= window->first_tag && tag < window->first_tag + (uint64_t)window->count);
+/* }}} */
+}
+
+/* Slide the window past confirmed slots */
+static void mb_confirm_window_advance(mb_confirm_window_t *window) {
+/* {{{ */
+    while (window->count > 0 && !window->msgs[window->first]) {
+        window->first = (window->first + 1) % window->size;
+        window->first_tag++;
+        window->count--;
+    }
+/* }}} */
+}
+
+static void mb_confirm_window_settle(mb_confirm_window_t *window, uint64_t tag, bool multiple,
+    mb_check_msgs_t *retransmit) {
+/* {{{ */
+    uint64_t    from;
+    int         idx;
+
+    if (!mb_confirm_window_holds(window, tag))
+        return;
+
+    from = (multiple ? window->first_tag : tag);
+
+    for (uint64_t t = from; t <= tag; t++) {
+        idx = mb_confirm_window_index(window, t);
+
+        if (!window->msgs[idx])
+            continue;
+
+        /* Negatively acknowledged messages are sent again, the others are done with */
+        if (retransmit)
+            TAILQ_INSERT_TAIL(retransmit, window->msgs[idx], tq);
+        else
+            mb_free_check_msg(window->msgs[idx]);
+
+        window->msgs[idx] = NULL;
+    }
+
+    mb_confirm_window_advance(window);
+/* }}} */
+}
+
+mb_confirm_window_t *mb_confirm_window_new(int size) {
+/* {{{ */
+    mb_confirm_window_t *window = NULL;
+
+    if (!(window = calloc(1, sizeof(mb_confirm_window_t)))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_confirm_window_new: error: "
+            "unable to allocate memory");
+        return (NULL);
+    }
+
+    if (!(window->msgs = calloc(size, sizeof(mb_check_msg_t *)))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_confirm_window_new: error: "
+            "unable to allocate memory");
+        free(window);
+        return (NULL);
+    }
+
+    window->size = size;
+    window->first = 0;
+    window->count = 0;
+    window->first_tag = 1;
+
+    return (window);
+/* }}} */
+}
+
+void mb_confirm_window_free(mb_confirm_window_t *window) {
+/* {{{ */
+    if (!window)
+        return;
+
+    for (int i = 0; i < window->size; i++)
+        mb_free_check_msg(window->msgs[i]);
+
+    free(window->msgs);
+    free(window);
+/* }}} */
+}
+
+bool mb_confirm_window_full(mb_confirm_window_t *window) {
+/* {{{ */
+    return (window->count == window->size);
+/* }}} */
+}
+
+uint64_t mb_confirm_window_add(mb_confirm_window_t *window, mb_check_msg_t *msg) {
+/* {{{ */
+    assert(!mb_confirm_window_full(window));
+
+    window->msgs[(window->first + window->count) % window->size] = msg;
+    window->count++;
+
+    return (window->first_tag + window->count - 1);
+/* }}} */
+}
+
+void mb_confirm_window_ack(mb_confirm_window_t *window, uint64_t tag, bool multiple) {
+/* {{{ */
+    mb_confirm_window_settle(window, tag, multiple, NULL);
+/* }}} */
+}
+
+void mb_confirm_window_nack(mb_confirm_window_t *window, uint64_t tag, bool multiple,
+    mb_check_msgs_t *retransmit) {
+/* {{{ */
+    mb_confirm_window_settle(window, tag, multiple, retransmit);
+/* }}} */
+}
+
+void mb_confirm_window_reset(mb_confirm_window_t *window, mb_check_msgs_t *retransmit) {
+/* {{{ */
+    /* We can't know which unconfirmed messages made it to the broker, send them all again */
+    if (window->count > 0)
+        mb_confirm_window_nack(window, window->first_tag + window->count - 1, true, retransmit);
+
+    window->first = 0;
+    window->count = 0;
+    window->first_tag = 1;
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
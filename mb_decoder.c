@@ -0,0 +1,226 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#include <sched.h>
+
+#include "mod_bunny.h"
+#include "mb_queue.h"
+#include "mb_decoder.h"
+
+/* Job the current worker thread is decoding, results are collected into it */
+static __thread mb_decode_job_t *mb_decoder_current_job;
+
+static void mb_decoder_collect(char *cid, check_result *cr) {
+/* {{{ */
+    mb_decode_job_t *job = mb_decoder_current_job;
+    mb_decoded_t    *results = NULL;
+    size_t          size;
+
+    if (job->results_count == job->results_size) {
+        size = (job->results_size > 0 ? job->results_size * 2 : 1);
+
+        if (!(results = realloc(job->results, size * sizeof(mb_decoded_t)))) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_decoder_collect: error: "
+                "unable to allocate memory, discarding check result",
+                cid);
+            free_check_result(cr);
+            free(cr);
+            return;
+        }
+
+        job->results = results;
+        job->results_size = size;
+    }
+
+    strncpy(job->results[job->results_count].cid, cid, MB_CID_BUF_LEN - 1);
+    job->results[job->results_count].cid[MB_CID_BUF_LEN - 1] = '\0';
+    job->results[job->results_count].cr = cr;
+    job->results_count++;
+/* }}} */
+}
+
+static void *mb_decoder_work(void *args) {
+/* {{{ */
+    mb_decoder_worker_t *worker = (mb_decoder_worker_t *)args;
+    mb_decode_job_t     *job = NULL;
+
+    /* Only stop while waiting for messages, never in the middle of one */
+    pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+    while (true) {
+        if (!(job = mb_queue_pop(worker->queue))) {
+            pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+            mb_queue_wait(worker->queue, MB_PUBLISHER_IDLE_WAIT);
+            pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+            continue;
+        }
+
+        mb_decoder_current_job = job;
+        mb_decode_check_result(job->delivery->cid, job->delivery->content_type, job->delivery->body,
+            job->delivery->body_len, mb_decoder_collect);
+        mb_decoder_current_job = NULL;
+
+        /* Inflated bodies may be large, don't keep them until the consumer thread gets to the results */
+        free(job->delivery->body_alloc);
+        job->delivery->body_alloc = NULL;
+        job->delivery->body = NULL;
+
+        __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+    }
+
+    return (NULL);
+/* }}} */
+}
+
+/* Submit decoded results in delivery order, waiting for deliveries numbered below `until' */
+static void mb_decoder_pool_flush_until(mb_decoder_pool_t *pool, uint64_t until) {
+/* {{{ */
+    mb_decode_job_t *job = NULL;
+
+    while (pool->next_submit < pool->next_seq) {
+        job = &pool->jobs[pool->next_submit & pool->mask];
+
+        if (!__atomic_load_n(&job->done, __ATOMIC_ACQUIRE)) {
+            if (pool->next_submit >= until)
+                break;
+
+            sched_yield();
+            continue;
+        }
+
+        for (size_t i = 0; i < job->results_count; i++)
+            mb_submit_check_result(job->results[i].cid, job->results[i].cr);
+
+        job->results_count = 0;
+
+        mb_delivery_done(job->delivery);
+        job->delivery = NULL;
+
+        pool->next_submit++;
+    }
+/* }}} */
+}
+
+mb_decoder_pool_t *mb_decoder_pool_new(int workers_count) {
+/* {{{ */
+    mb_decoder_pool_t *pool = NULL;
+
+    if (!(pool = calloc(1, sizeof(mb_decoder_pool_t)))
+        || !(pool->jobs = calloc(MB_DECODER_WINDOW, sizeof(mb_decode_job_t)))
+        || !(pool->workers = calloc(workers_count, sizeof(mb_decoder_worker_t)))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_decoder_pool_new: error: "
+            "unable to allocate memory");
+        goto error;
+    }
+
+    pool->mask = MB_DECODER_WINDOW - 1;
+    pool->workers_count = workers_count;
+
+    for (int i = 0; i < workers_count; i++) {
+        pool->workers[i].id = i;
+
+        if (!(pool->workers[i].queue = mb_queue_new(MB_DECODER_WINDOW)))
+            goto error;
+
+        if (pthread_create(&pool->workers[i].thread, NULL, mb_decoder_work, &pool->workers[i]) != 0) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_decoder_pool_new: error: "
+                "unable to start decoder thread #%d",
+                i);
+            goto error;
+        }
+
+        pool->workers[i].started = true;
+    }
+
+    return (pool);
+
+    error:
+    mb_decoder_pool_free(pool);
+    return (NULL);
+/* }}} */
+}
+
+void mb_decoder_pool_free(mb_decoder_pool_t *pool) {
+/* {{{ */
+    mb_decode_job_t *job = NULL;
+
+    if (!pool)
+        return;
+
+    for (int i = 0; pool->workers && i < pool->workers_count; i++) {
+        if (pool->workers[i].started) {
+            pthread_cancel(pool->workers[i].thread);
+            pthread_join(pool->workers[i].thread, NULL);
+        }
+
+        mb_queue_free(pool->workers[i].queue);
+    }
+
+    /* Discard messages and results the consumer thread didn't get a chance to submit */
+    for (size_t i = 0; pool->jobs && i <= pool->mask; i++) {
+        job = &pool->jobs[i];
+
+        for (size_t j = 0; j < job->results_count; j++) {
+            free_check_result(job->results[j].cr);
+            free(job->results[j].cr);
+        }
+
+        free(job->results);
+        mb_delivery_free(job->delivery);
+    }
+
+    free(pool->jobs);
+    free(pool->workers);
+    free(pool);
+/* }}} */
+}
+
+/* Hand a received message over to the next worker, until its results are submitted */
+void mb_decoder_pool_submit(mb_decoder_pool_t *pool, mb_delivery_t *delivery) {
+/* {{{ */
+    mb_decode_job_t *job = NULL;
+
+    /* Make room in the ring, waiting for the oldest delivery to be decoded if needed */
+    if (pool->next_seq > pool->mask)
+        mb_decoder_pool_flush_until(pool, pool->next_seq - pool->mask);
+
+    job = &pool->jobs[pool->next_seq & pool->mask];
+    job->done = 0;
+    job->delivery = delivery;
+
+    /* Queues can hold the whole ring, this never fails */
+    mb_queue_push(pool->workers[pool->next_seq % pool->workers_count].queue, job);
+
+    pool->next_seq++;
+/* }}} */
+}
+
+/* Submit the results decoded so far, waiting for all deliveries to be decoded if `wait' is set */
+void mb_decoder_pool_flush(mb_decoder_pool_t *pool, bool wait) {
+/* {{{ */
+    mb_decoder_pool_flush_until(pool, (wait ? pool->next_seq : 0));
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
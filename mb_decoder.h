@@ -0,0 +1,79 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#ifndef _MB_DECODER_H_
+#define _MB_DECODER_H_
+
+/* Deliveries decoded or waiting to be decoded at once, i.e. how far workers may run ahead */
+#define MB_DECODER_WINDOW       1024
+
+/* Check result decoded by a worker, waiting to be submitted in delivery order */
+typedef struct mb_decoded_s {
+/* {{{ */
+    char            cid[MB_CID_BUF_LEN];
+    check_result    *cr;
+/* }}} */
+} mb_decoded_t;
+
+/* Received message, owned by a worker until `done' is set, then by the consumer thread */
+typedef struct mb_decode_job_s {
+/* {{{ */
+    uint32_t        done;
+    mb_delivery_t   *delivery;
+    mb_decoded_t    *results;
+    size_t          results_count;
+    size_t          results_size;
+/* }}} */
+} mb_decode_job_t;
+
+typedef struct mb_decoder_worker_s {
+/* {{{ */
+    int                 id;
+    pthread_t           thread;
+    mb_queue_t          *queue;
+    bool                started;
+/* }}} */
+} mb_decoder_worker_t;
+
+/*
+    Pool of threads decoding check results on behalf of the consumer thread. Deliveries
+    are numbered and spread round-robin over workers, results are then submitted in
+    delivery order from a ring of jobs, so results of a same host/service are never
+    reordered whichever worker decoded them.
+*/
+struct mb_decoder_pool_s {
+/* {{{ */
+    mb_decoder_worker_t *workers;
+    int                 workers_count;
+    mb_decode_job_t     *jobs;
+    size_t              mask;
+
+    /* Only used by the consumer thread */
+    uint64_t            next_seq;
+    uint64_t            next_submit;
+/* }}} */
+};
+
+#endif
+
+// vim: ft=c ts=4 et foldmethod=marker
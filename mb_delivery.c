@@ -0,0 +1,116 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+
+#include "mod_bunny.h"
+#include "mb_delivery.h"
+
+mb_delivery_pool_t *mb_delivery_pool_new(void) {
+/* {{{ */
+    mb_delivery_pool_t *pool = NULL;
+
+    if (!(pool = calloc(1, sizeof(mb_delivery_pool_t)))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_delivery_pool_new: error: "
+            "unable to allocate memory");
+        return (NULL);
+    }
+
+    return (pool);
+/* }}} */
+}
+
+void mb_delivery_pool_free(mb_delivery_pool_t *pool) {
+/* {{{ */
+    mb_delivery_t *delivery = NULL;
+
+    if (!pool)
+        return;
+
+    while ((delivery = pool->free)) {
+        pool->free = delivery->next;
+        mb_delivery_free(delivery);
+    }
+
+    free(pool);
+/* }}} */
+}
+
+/* Get an empty delivery, recycling one done with if any */
+mb_delivery_t *mb_delivery_new(mb_delivery_pool_t *pool) {
+/* {{{ */
+    mb_delivery_t *delivery = NULL;
+
+    if ((delivery = pool->free)) {
+        pool->free = delivery->next;
+        pool->count--;
+        delivery->next = NULL;
+        return (delivery);
+    }
+
+    if (!(delivery = calloc(1, sizeof(mb_delivery_t)))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_delivery_new: error: "
+            "unable to allocate memory");
+        return (NULL);
+    }
+
+    return (delivery);
+/* }}} */
+}
+
+/* Hand a delivery done with back to the pool, its arena memory is kept for the next one */
+void mb_delivery_release(mb_delivery_pool_t *pool, mb_delivery_t *delivery) {
+/* {{{ */
+    if (pool->count >= MB_DELIVERY_POOL_SIZE) {
+        mb_delivery_free(delivery);
+        return;
+    }
+
+    free(delivery->body_alloc);
+    mb_arena_reset(&delivery->arena);
+
+    delivery->cid = NULL;
+    delivery->content_type = NULL;
+    delivery->content_encoding = NULL;
+    delivery->body = NULL;
+    delivery->body_alloc = NULL;
+    delivery->body_len = 0;
+    delivery->tag = 0;
+
+    delivery->next = pool->free;
+    pool->free = delivery;
+    pool->count++;
+/* }}} */
+}
+
+void mb_delivery_free(mb_delivery_t *delivery) {
+/* {{{ */
+    if (!delivery)
+        return;
+
+    free(delivery->body_alloc);
+    mb_arena_free(&delivery->arena);
+    free(delivery);
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
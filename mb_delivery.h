@@ -20,11 +20,21 @@
 ** SOFTWARE.
 */
 
-#ifndef _MB_HASH_H_
-#define _MB_HASH_H_
 
-/* Hash buffer sizing: (sizeof hash) bytes x 2 chars for hexadecimal representation */
-#define MB_HASH_BUF_LEN (sizeof(unsigned long) * 2)
+
+#ifndef _MB_DELIVERY_H_
+#define _MB_DELIVERY_H_
+
+/* Deliveries kept for reuse, as many as may be waiting for the decoder threads */
+#define MB_DELIVERY_POOL_SIZE   1024
+
+/* Deliveries done with, only used by the consumer thread */
+struct mb_delivery_pool_s {
+/* {{{ */
+    mb_delivery_t   *free;
+    size_t          count;
+/* }}} */
+};
 
 #endif
 
@@ -0,0 +1,100 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#include "mod_bunny.h"
+#include "mb_dispatch.h"
+
+mb_dispatch_t *mb_dispatch_new(size_t objects, unsigned long generation) {
+/* {{{ */
+    mb_dispatch_t   *dispatch = NULL;
+    size_t          capacity = 16;
+
+    /* Keep the load factor under 1/2 so that probe sequences stay short */
+    while (capacity < objects * 2)
+        capacity <<= 1;
+
+    if (!(dispatch = calloc(1, sizeof(mb_dispatch_t)))
+        || !(dispatch->entries = calloc(capacity, sizeof(mb_dispatch_entry_t)))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_dispatch_new: error: "
+            "unable to allocate memory");
+        free(dispatch);
+        return (NULL);
+    }
+
+    dispatch->mask = capacity - 1;
+    dispatch->generation = generation;
+
+    return (dispatch);
+/* }}} */
+}
+
+void mb_dispatch_free(mb_dispatch_t *dispatch) {
+/* {{{ */
+    if (!dispatch)
+        return;
+
+    for (size_t i = 0; i <= dispatch->mask; i++)
+        mb_command_free(dispatch->entries[i].command);
+
+    free(dispatch->entries);
+    free(dispatch);
+/* }}} */
+}
+
+int mb_dispatch_add(mb_dispatch_t *dispatch, mb_dispatch_entry_t *entry) {
+/* {{{ */
+    size_t i = mb_hash_ptr(entry->object) & dispatch->mask;
+
+    /* The table is sized for all objects upfront, refuse to fill it up */
+    if ((dispatch->count + 1) * 2 > dispatch->mask + 1)
+        return (MB_NOK);
+
+    while (dispatch->entries[i].object && dispatch->entries[i].object != entry->object)
+        i = (i + 1) & dispatch->mask;
+
+    if (!dispatch->entries[i].object)
+        dispatch->count++;
+
+    dispatch->entries[i] = *entry;
+
+    return (MB_OK);
+/* }}} */
+}
+
+mb_dispatch_entry_t *mb_dispatch_lookup(mb_dispatch_t *dispatch, void *object, unsigned long generation) {
+/* {{{ */
+    size_t i;
+
+    if (!dispatch || dispatch->generation != generation)
+        return (NULL);
+
+    for (i = mb_hash_ptr(object) & dispatch->mask; dispatch->entries[i].object; i = (i + 1) & dispatch->mask) {
+        if (dispatch->entries[i].object == object)
+            return (&dispatch->entries[i]);
+    }
+
+    return (NULL);
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
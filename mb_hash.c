@@ -21,7 +21,6 @@
 */
 
 #include "mod_bunny.h"
-#include "mb_hash.h"
 
 /* From http://www.cse.yorku.ca/~oz/hash.html */
 static unsigned long djb2_hash(unsigned char *str) {
@@ -36,22 +35,24 @@ static unsigned long djb2_hash(unsigned char *str) {
 /* }}} */
 }
 
-void mb_gen_cid(char *cid_buf, size_t cid_buf_len, char *host, char *service) {
+unsigned long mb_hash_str(const char *str) {
 /* {{{ */
-    char            buf[256] = {0};
-    struct timeval  now;
+    return (djb2_hash((unsigned char *)str));
+/* }}} */
+}
 
-    gettimeofday(&now, NULL);
+unsigned long mb_hash_ptr(void *ptr) {
+/* {{{ */
+    uint64_t h = (uint64_t)(uintptr_t)ptr;
 
-    /* Correlation ID = host + service + msec time */
-    snprintf(buf,
-        sizeof (buf) - 1,
-        "%s%s%ld.%ld",
-        host,
-        (service ? service : ""),
-        now.tv_sec, now.tv_usec);
+    /* Objects are allocated on aligned addresses, mix the bits so low bits are usable (murmur3 finalizer) */
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
 
-   snprintf(cid_buf, cid_buf_len, "%lX", djb2_hash((unsigned char *)buf));
+    return ((unsigned long)h);
 /* }}} */
 }
 
@@ -0,0 +1,491 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#include "mod_bunny.h"
+#include "mb_inflight.h"
+
+/*
+    Checks are added to the table by the Nagios thread when they are handed over to
+    publishers (or by the first publisher thread when they are republished), and taken
+    out by the consumer thread when their result comes back. Slots are protected by their
+    own spin lock, threads hardly ever contending.
+*/
+
+static inline uint64_t mb_inflight_now_us(void) {
+/* {{{ */
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000000ULL + (uint64_t)now.tv_nsec / 1000);
+/* }}} */
+}
+
+static inline mb_inflight_slot_t *mb_inflight_lock(mb_inflight_t *inflight, uint64_t seq, int probe) {
+/* {{{ */
+    mb_inflight_slot_t *slot = &inflight->slots[(seq + probe) & inflight->mask];
+
+    while (__atomic_exchange_n(&slot->lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&slot->lock, __ATOMIC_RELAXED))
+            ;
+    }
+
+    return (slot);
+/* }}} */
+}
+
+static inline void mb_inflight_unlock(mb_inflight_slot_t *slot) {
+/* {{{ */
+    __atomic_store_n(&slot->lock, 0, __ATOMIC_RELEASE);
+/* }}} */
+}
+
+static inline mb_inflight_object_t *mb_inflight_lock_object(mb_inflight_t *inflight, void *object, int probe) {
+/* {{{ */
+    mb_inflight_object_t *entry = &inflight->objects[(mb_hash_ptr(object) + probe) & inflight->mask];
+
+    while (__atomic_exchange_n(&entry->lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&entry->lock, __ATOMIC_RELAXED))
+            ;
+    }
+
+    return (entry);
+/* }}} */
+}
+
+static inline void mb_inflight_unlock_object(mb_inflight_object_t *entry) {
+/* {{{ */
+    __atomic_store_n(&entry->lock, 0, __ATOMIC_RELEASE);
+/* }}} */
+}
+
+/* Results must be for the object the check was published for */
+static bool mb_inflight_slot_matches(mb_inflight_slot_t *slot, check_result *cr) {
+/* {{{ */
+    if (cr->object_check_type != slot->object_type || !cr->host_name)
+        return (false);
+
+    if (slot->object_type == HOST_CHECK)
+        return (strcmp(cr->host_name, ((host *)slot->object)->name) == 0);
+
+    return (cr->service_description
+        && strcmp(cr->host_name, ((service *)slot->object)->host_name) == 0
+        && strcmp(cr->service_description, ((service *)slot->object)->description) == 0);
+/* }}} */
+}
+
+mb_inflight_t *mb_inflight_new(size_t size, int slack) {
+/* {{{ */
+    mb_inflight_t   *inflight = NULL;
+    size_t          capacity = MB_INFLIGHT_MAX_PROBES;
+
+    while (capacity < size)
+        capacity <<= 1;
+
+    if (!(inflight = calloc(1, sizeof(mb_inflight_t)))
+        || !(inflight->slots = calloc(capacity, sizeof(mb_inflight_slot_t)))
+        || !(inflight->objects = calloc(capacity, sizeof(mb_inflight_object_t)))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_inflight_new: error: "
+            "unable to allocate memory");
+        if (inflight)
+            free(inflight->slots);
+        free(inflight);
+        return (NULL);
+    }
+
+    inflight->mask = capacity - 1;
+    inflight->slack = slack;
+
+    return (inflight);
+/* }}} */
+}
+
+void mb_inflight_free(mb_inflight_t *inflight) {
+/* {{{ */
+    if (!inflight)
+        return;
+
+    if (inflight->tracked > 0)
+        logit(NSLOG_INFO_MESSAGE, TRUE,
+            "mod_bunny: mb_inflight_free: %lu checks tracked, %lu results matched "
+            "(round-trip avg %lu ms, max %lu ms), %lu unknown, %lu superseded, %lu late, %lu mismatched, "
+            "%lu checks expired without result, %lu timed out, %lu evicted",
+            inflight->tracked,
+            inflight->matched,
+            (unsigned long)(inflight->matched > 0 ? inflight->rtt_total_us / inflight->matched / 1000 : 0),
+            (unsigned long)(inflight->rtt_max_us / 1000),
+            inflight->unknown,
+            inflight->superseded,
+            inflight->late,
+            inflight->mismatched,
+            inflight->expired,
+            inflight->timed_out,
+            inflight->evicted);
+
+    for (size_t i = 0; i <= inflight->mask; i++)
+        mb_free_check_msg(inflight->slots[i].msg);
+
+    free(inflight->slots);
+    free(inflight->objects);
+    free(inflight);
+/* }}} */
+}
+
+/*
+    Start tracking a check. Returns the sequence number of the check, 0 if its correlation
+    ID can't be tracked.
+*/
+uint64_t mb_inflight_add(mb_inflight_t *inflight, const char *cid, void *object, int object_type,
+    char *routing_key, int attempt, int timeout) {
+/* {{{ */
+    mb_inflight_slot_t  *slot = NULL;
+    mb_check_msg_t      *stale_msg = NULL;
+    uint64_t            seq;
+    uint64_t            now_us;
+    uint64_t            oldest_us = UINT64_MAX;
+    int                 oldest = 0;
+
+    if (!mb_cid_decode(cid, &seq, NULL))
+        return (0);
+
+    now_us = mb_inflight_now_us();
+
+    /* Take the first free slot, reusing the ones of checks whose result never came back */
+    for (int i = 0; i < MB_INFLIGHT_MAX_PROBES; i++) {
+        slot = mb_inflight_lock(inflight, seq, i);
+
+        if (slot->state == MB_INFLIGHT_SLOT_EMPTY || slot->state == MB_INFLIGHT_SLOT_TIMED_OUT
+            || slot->expires_us < now_us) {
+            if (slot->state == MB_INFLIGHT_SLOT_ACTIVE || slot->state == MB_INFLIGHT_SLOT_SUPERSEDED)
+                __atomic_fetch_add(&inflight->expired, 1, __ATOMIC_RELAXED);
+
+            break;
+        }
+
+        if (slot->published_us < oldest_us) {
+            oldest_us = slot->published_us;
+            oldest = i;
+        }
+
+        mb_inflight_unlock(slot);
+        slot = NULL;
+    }
+
+    /* More checks in flight than the table can hold, the oldest one in the way goes */
+    if (!slot) {
+        slot = mb_inflight_lock(inflight, seq, oldest);
+        __atomic_fetch_add(&inflight->evicted, 1, __ATOMIC_RELAXED);
+    }
+
+    stale_msg = (slot->state != MB_INFLIGHT_SLOT_EMPTY ? slot->msg : NULL);
+
+    slot->state = MB_INFLIGHT_SLOT_ACTIVE;
+    slot->seq = seq;
+    slot->object = object;
+    slot->object_type = object_type;
+    slot->attempt = attempt;
+    slot->routing_key = routing_key;
+    slot->timeout = timeout;
+    slot->republished = 0;
+    slot->msg = NULL;
+    slot->published_us = now_us;
+    slot->expires_us = now_us + (uint64_t)(timeout + inflight->slack) * 1000000ULL;
+
+    mb_inflight_unlock(slot);
+
+    mb_free_check_msg(stale_msg);
+
+    __atomic_fetch_add(&inflight->tracked, 1, __ATOMIC_RELAXED);
+
+    return (seq);
+/* }}} */
+}
+
+/*
+    Record `seq' as the last check published for `object', whose previous check won't have
+    its result accepted anymore. Should the previous check be the newest, being published
+    concurrently by another thread, `seq' is the one superseded.
+*/
+void mb_inflight_supersede(mb_inflight_t *inflight, void *object, uint64_t seq) {
+/* {{{ */
+    mb_inflight_object_t    *entry = NULL;
+    mb_inflight_slot_t      *slot = NULL;
+    uint64_t                superseded = 0;
+
+    for (int i = 0; i < MB_INFLIGHT_MAX_PROBES; i++) {
+        entry = mb_inflight_lock_object(inflight, object, i);
+
+        if (entry->object == object || !entry->object)
+            break;
+
+        mb_inflight_unlock_object(entry);
+        entry = NULL;
+    }
+
+    /* More objects than the table can hold, the one in the way forgets its last check */
+    if (!entry)
+        entry = mb_inflight_lock_object(inflight, object, 0);
+
+    if (entry->object != object) {
+        entry->object = object;
+        entry->seq = 0;
+    }
+
+    if (seq > entry->seq) {
+        superseded = entry->seq;
+        entry->seq = seq;
+    } else
+        superseded = seq;
+
+    mb_inflight_unlock_object(entry);
+
+    for (int i = 0; superseded > 0 && i < MB_INFLIGHT_MAX_PROBES; i++) {
+        slot = mb_inflight_lock(inflight, superseded, i);
+
+        if (slot->state == MB_INFLIGHT_SLOT_ACTIVE && slot->seq == superseded) {
+            slot->state = MB_INFLIGHT_SLOT_SUPERSEDED;
+            mb_inflight_unlock(slot);
+            return;
+        }
+
+        mb_inflight_unlock(slot);
+    }
+/* }}} */
+}
+
+/* Stop tracking a check that couldn't be published */
+void mb_inflight_cancel(mb_inflight_t *inflight, uint64_t seq) {
+/* {{{ */
+    mb_inflight_slot_t  *slot = NULL;
+    mb_check_msg_t      *msg = NULL;
+
+    for (int i = 0; i < MB_INFLIGHT_MAX_PROBES; i++) {
+        slot = mb_inflight_lock(inflight, seq, i);
+
+        if (slot->state != MB_INFLIGHT_SLOT_EMPTY && slot->seq == seq) {
+            msg = slot->msg;
+            slot->state = MB_INFLIGHT_SLOT_EMPTY;
+            slot->msg = NULL;
+            mb_inflight_unlock(slot);
+            mb_free_check_msg(msg);
+            __atomic_fetch_sub(&inflight->tracked, 1, __ATOMIC_RELAXED);
+            return;
+        }
+
+        mb_inflight_unlock(slot);
+    }
+/* }}} */
+}
+
+/*
+    Keep the message of a check in flight, for it to be published again if its result
+    doesn't come back in time. The table owns `msg' from now on.
+*/
+void mb_inflight_retain(mb_inflight_t *inflight, uint64_t seq, mb_check_msg_t *msg, int republished) {
+/* {{{ */
+    mb_inflight_slot_t *slot = NULL;
+
+    for (int i = 0; i < MB_INFLIGHT_MAX_PROBES; i++) {
+        slot = mb_inflight_lock(inflight, seq, i);
+
+        if (slot->state == MB_INFLIGHT_SLOT_ACTIVE && slot->seq == seq) {
+            mb_free_check_msg(slot->msg);
+            slot->msg = msg;
+            slot->republished = republished;
+            mb_inflight_unlock(slot);
+            return;
+        }
+
+        mb_inflight_unlock(slot);
+    }
+
+    mb_free_check_msg(msg);
+/* }}} */
+}
+
+/*
+    Take a check whose deadline passed out of the table. Returns true if its result is
+    still awaited, `check' then tells what the check was about and owns its retained
+    message, if any.
+*/
+bool mb_inflight_expire(mb_inflight_t *inflight, uint64_t seq, mb_inflight_check_t *check) {
+/* {{{ */
+    mb_inflight_slot_t  *slot = NULL;
+    mb_check_msg_t      *msg = NULL;
+
+    for (int i = 0; i < MB_INFLIGHT_MAX_PROBES; i++) {
+        slot = mb_inflight_lock(inflight, seq, i);
+
+        if (slot->state == MB_INFLIGHT_SLOT_EMPTY || slot->seq != seq) {
+            mb_inflight_unlock(slot);
+            continue;
+        }
+
+        if (slot->state == MB_INFLIGHT_SLOT_TIMED_OUT) {
+            mb_inflight_unlock(slot);
+            return (false);
+        }
+
+        /* A newer check of the same object is on its way, the result of this one doesn't matter */
+        if (slot->state == MB_INFLIGHT_SLOT_SUPERSEDED) {
+            msg = slot->msg;
+            slot->state = MB_INFLIGHT_SLOT_EMPTY;
+            slot->msg = NULL;
+            mb_inflight_unlock(slot);
+            mb_free_check_msg(msg);
+            __atomic_fetch_add(&inflight->superseded, 1, __ATOMIC_RELAXED);
+            return (false);
+        }
+
+        check->object = slot->object;
+        check->object_type = slot->object_type;
+        check->attempt = slot->attempt;
+        check->routing_key = slot->routing_key;
+        check->timeout = slot->timeout;
+        check->republished = slot->republished;
+        check->msg = slot->msg;
+
+        /* Keep the slot around for the result of the check to be told late if it ever comes */
+        slot->state = MB_INFLIGHT_SLOT_TIMED_OUT;
+        slot->msg = NULL;
+        mb_inflight_unlock(slot);
+
+        __atomic_fetch_add(&inflight->timed_out, 1, __ATOMIC_RELAXED);
+
+        return (true);
+    }
+
+    return (false);
+/* }}} */
+}
+
+/*
+    Take the check a result is for out of the table. Only MB_INFLIGHT_RESULT_MATCHED
+    results should be submitted to Nagios, `rtt_us' is then set to the check round-trip
+    time, from its hand-over to publishers to the reception of its result.
+*/
+int mb_inflight_remove(mb_inflight_t *inflight, const char *cid, check_result *cr, uint64_t *rtt_us) {
+/* {{{ */
+    mb_inflight_slot_t  *slot = NULL;
+    mb_check_msg_t      *msg = NULL;
+    uint64_t            seq;
+    uint64_t            now_us;
+    uint64_t            published_us;
+    uint64_t            max_us;
+    uint32_t            state;
+
+    if (!mb_cid_decode(cid, &seq, NULL)) {
+        __atomic_fetch_add(&inflight->unknown, 1, __ATOMIC_RELAXED);
+        return (MB_INFLIGHT_RESULT_UNKNOWN);
+    }
+
+    now_us = mb_inflight_now_us();
+
+    for (int i = 0; i < MB_INFLIGHT_MAX_PROBES; i++) {
+        slot = mb_inflight_lock(inflight, seq, i);
+
+        if (slot->state == MB_INFLIGHT_SLOT_EMPTY || slot->seq != seq) {
+            mb_inflight_unlock(slot);
+            continue;
+        }
+
+        /* Leave the check in flight, its genuine result may still come */
+        if (!mb_inflight_slot_matches(slot, cr)) {
+            mb_inflight_unlock(slot);
+            __atomic_fetch_add(&inflight->mismatched, 1, __ATOMIC_RELAXED);
+            return (MB_INFLIGHT_RESULT_MISMATCHED);
+        }
+
+        /*
+            Past its deadline, the check is left for its timer to fail or republish it, if any,
+            or for its slot to be reused
+        */
+        if (slot->state == MB_INFLIGHT_SLOT_ACTIVE && now_us > slot->expires_us) {
+            mb_inflight_unlock(slot);
+            __atomic_fetch_add(&inflight->late, 1, __ATOMIC_RELAXED);
+            return (MB_INFLIGHT_RESULT_LATE);
+        }
+
+        if (slot->state == MB_INFLIGHT_SLOT_TIMED_OUT) {
+            slot->state = MB_INFLIGHT_SLOT_EMPTY;
+            mb_inflight_unlock(slot);
+            __atomic_fetch_add(&inflight->late, 1, __ATOMIC_RELAXED);
+            return (MB_INFLIGHT_RESULT_LATE);
+        }
+
+        state = slot->state;
+        published_us = slot->published_us;
+        msg = slot->msg;
+        slot->state = MB_INFLIGHT_SLOT_EMPTY;
+        slot->msg = NULL;
+        mb_inflight_unlock(slot);
+
+        mb_free_check_msg(msg);
+
+        if (state == MB_INFLIGHT_SLOT_SUPERSEDED) {
+            __atomic_fetch_add(&inflight->superseded, 1, __ATOMIC_RELAXED);
+            return (MB_INFLIGHT_RESULT_SUPERSEDED);
+        }
+
+        *rtt_us = now_us - published_us;
+
+        __atomic_fetch_add(&inflight->matched, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&inflight->rtt_total_us, *rtt_us, __ATOMIC_RELAXED);
+
+        max_us = __atomic_load_n(&inflight->rtt_max_us, __ATOMIC_RELAXED);
+
+        while (*rtt_us > max_us && !__atomic_compare_exchange_n(&inflight->rtt_max_us, &max_us, *rtt_us,
+            true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            ;
+
+        return (MB_INFLIGHT_RESULT_MATCHED);
+    }
+
+    __atomic_fetch_add(&inflight->unknown, 1, __ATOMIC_RELAXED);
+
+    return (MB_INFLIGHT_RESULT_UNKNOWN);
+/* }}} */
+}
+
+const char *mb_inflight_result_str(int result) {
+/* {{{ */
+    switch (result) {
+        case MB_INFLIGHT_RESULT_MATCHED:
+            return ("matched");
+
+        case MB_INFLIGHT_RESULT_UNKNOWN:
+            return ("unknown");
+
+        case MB_INFLIGHT_RESULT_SUPERSEDED:
+            return ("superseded");
+
+        case MB_INFLIGHT_RESULT_LATE:
+            return ("late");
+
+        default:
+            return ("mismatched");
+    }
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
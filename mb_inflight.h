@@ -0,0 +1,96 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#ifndef _MB_INFLIGHT_H_
+#define _MB_INFLIGHT_H_
+
+/* Slots probed from the home slot of a sequence number before evicting the oldest of them */
+#define MB_INFLIGHT_MAX_PROBES  16
+
+enum mb_inflight_slot_states {
+    MB_INFLIGHT_SLOT_EMPTY,
+    MB_INFLIGHT_SLOT_ACTIVE,
+    MB_INFLIGHT_SLOT_SUPERSEDED,
+    MB_INFLIGHT_SLOT_TIMED_OUT,
+};
+
+/* Check published and waiting for its result, protected by its own spin lock */
+typedef struct mb_inflight_slot_s {
+/* {{{ */
+    uint32_t    lock;
+    uint32_t    state;
+    uint64_t    seq;
+    void        *object;
+    int         object_type;
+    int         attempt;
+    char        *routing_key;
+    int         timeout;
+    int         republished;
+    mb_check_msg_t *msg;
+    uint64_t    published_us;
+    uint64_t    expires_us;
+/* }}} */
+} mb_inflight_slot_t;
+
+/* Sequence number of the last check published for a host or service */
+typedef struct mb_inflight_object_s {
+/* {{{ */
+    uint32_t    lock;
+    void        *object;
+    uint64_t    seq;
+/* }}} */
+} mb_inflight_object_t;
+
+/*
+    Open addressing table of checks in flight, keyed by the sequence number of their
+    correlation ID. Sequence numbers being consecutive, the home slot of a check is
+    simply its sequence number modulo the table size. The last check of each object is
+    kept in a second table of the same size, keyed by object.
+*/
+struct mb_inflight_s {
+/* {{{ */
+    mb_inflight_slot_t      *slots;
+    mb_inflight_object_t    *objects;
+    size_t                  mask;
+
+    /* Seconds results are awaited past the check timeout, same as check timers */
+    int                     slack;
+
+    /* Counters, updated atomically */
+    unsigned long           tracked;
+    unsigned long           matched;
+    unsigned long           unknown;
+    unsigned long           superseded;
+    unsigned long           late;
+    unsigned long           mismatched;
+    unsigned long           evicted;
+    unsigned long           expired;
+    unsigned long           timed_out;
+    uint64_t                rtt_total_us;
+    uint64_t                rtt_max_us;
+/* }}} */
+};
+
+#endif
+
+// vim: ft=c ts=4 et foldmethod=marker
@@ -22,6 +22,9 @@
 
 #include <jansson.h>
 
+#include <limits.h>
+#include <math.h>
+
 #include "mod_bunny.h"
 #include "mb_json.h"
 
@@ -53,6 +56,350 @@ static inline int mb_json_config_check_retry_wait_time(void *data) {
 /* }}} */
 }
 
+static inline int mb_json_config_check_publisher_queue_size(void *data) {
+/* {{{ */
+   int publisher_queue_size = *(int *)data;
+
+    if (publisher_queue_size <= 0 || publisher_queue_size > MB_MAX_PUBLISHER_QUEUE_SIZE) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `publisher_queue_size' setting value %d", publisher_queue_size);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_max_batch_checks(void *data) {
+/* {{{ */
+   int max_batch_checks = *(int *)data;
+
+    if (max_batch_checks <= 0 || max_batch_checks > MB_MAX_MAX_BATCH_CHECKS) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `max_batch_checks' setting value %d", max_batch_checks);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_max_batch_linger_ms(void *data) {
+/* {{{ */
+   int max_batch_linger_ms = *(int *)data;
+
+    if (max_batch_linger_ms <= 0 || max_batch_linger_ms > MB_MAX_MAX_BATCH_LINGER_MS) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `max_batch_linger_ms' setting value %d", max_batch_linger_ms);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_publisher_confirm_window(void *data) {
+/* {{{ */
+   int publisher_confirm_window = *(int *)data;
+
+    if (publisher_confirm_window <= 0 || publisher_confirm_window > MB_MAX_PUBLISHER_CONFIRM_WINDOW) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `publisher_confirm_window' setting value %d", publisher_confirm_window);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_consumer_prefetch(void *data) {
+/* {{{ */
+   int consumer_prefetch = *(int *)data;
+
+    if (consumer_prefetch <= 0 || consumer_prefetch > MB_MAX_CONSUMER_PREFETCH) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `consumer_prefetch' setting value %d", consumer_prefetch);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_consumer_ack_batch(void *data) {
+/* {{{ */
+   int consumer_ack_batch = *(int *)data;
+
+    if (consumer_ack_batch <= 0 || consumer_ack_batch > MB_MAX_CONSUMER_ACK_BATCH) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `consumer_ack_batch' setting value %d", consumer_ack_batch);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_consumer_ack_linger_ms(void *data) {
+/* {{{ */
+   int consumer_ack_linger_ms = *(int *)data;
+
+    if (consumer_ack_linger_ms <= 0 || consumer_ack_linger_ms > MB_MAX_CONSUMER_ACK_LINGER_MS) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `consumer_ack_linger_ms' setting value %d", consumer_ack_linger_ms);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_result_queue_size(void *data) {
+/* {{{ */
+   int result_queue_size = *(int *)data;
+
+    if (result_queue_size <= 0 || result_queue_size > MB_MAX_RESULT_QUEUE_SIZE) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `result_queue_size' setting value %d", result_queue_size);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_reaper_trigger_results(void *data) {
+/* {{{ */
+   int reaper_trigger_results = *(int *)data;
+
+    if (reaper_trigger_results <= 0 || reaper_trigger_results > MB_MAX_REAPER_TRIGGER_RESULTS) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `reaper_trigger_results' setting value %d", reaper_trigger_results);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_reaper_trigger_age(void *data) {
+/* {{{ */
+   int reaper_trigger_age = *(int *)data;
+
+    if (reaper_trigger_age < 0 || reaper_trigger_age > MB_MAX_REAPER_TRIGGER_AGE) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `reaper_trigger_age' setting value %d", reaper_trigger_age);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_decode_workers(void *data) {
+/* {{{ */
+   int decode_workers = *(int *)data;
+
+    if (decode_workers < 0 || decode_workers > MB_MAX_DECODE_WORKERS) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `decode_workers' setting value %d", decode_workers);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_publisher_connections(void *data) {
+/* {{{ */
+   int publisher_connections = *(int *)data;
+
+    if (publisher_connections <= 0 || publisher_connections > MB_MAX_PUBLISHER_CONNECTIONS) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `publisher_connections' setting value %d", publisher_connections);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_publisher_channels(void *data) {
+/* {{{ */
+   int publisher_channels = *(int *)data;
+
+    if (publisher_channels <= 0 || publisher_channels > MB_MAX_PUBLISHER_CHANNELS) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `publisher_channels' setting value %d", publisher_channels);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_publisher_sharding(void *data) {
+/* {{{ */
+   char *publisher_sharding = (char *)data;
+
+    if (!MB_STR_MATCH(publisher_sharding, "routing_key") && !MB_STR_MATCH(publisher_sharding, "object")) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `publisher_sharding' setting value \"%s\"", publisher_sharding);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_publisher_format(void *data) {
+/* {{{ */
+   char *publisher_format = (char *)data;
+
+    if (!MB_STR_MATCH(publisher_format, "json") && !MB_STR_MATCH(publisher_format, "msgpack")) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `publisher_format' setting value \"%s\"", publisher_format);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_publisher_compression(void *data) {
+/* {{{ */
+   char *publisher_compression = (char *)data;
+
+    if (!MB_STR_MATCH(publisher_compression, "none") && !MB_STR_MATCH(publisher_compression, "lz4")
+        && !MB_STR_MATCH(publisher_compression, "zstd")) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `publisher_compression' setting value \"%s\"", publisher_compression);
+        return (MB_NOK);
+    }
+
+    if (!mb_compression_supported(publisher_compression)) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "`publisher_compression' setting value \"%s\" is not compiled in", publisher_compression);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_compression_threshold(void *data) {
+/* {{{ */
+   int compression_threshold = *(int *)data;
+
+    if (compression_threshold < 0 || compression_threshold > MB_MAX_COMPRESSION_THRESHOLD) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `compression_threshold' setting value %d", compression_threshold);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_spool_max_size(void *data) {
+/* {{{ */
+   int spool_max_size = *(int *)data;
+
+    if (spool_max_size <= 0 || spool_max_size > MB_MAX_SPOOL_MAX_SIZE) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `spool_max_size' setting value %d", spool_max_size);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_spool_max_checks(void *data) {
+/* {{{ */
+   int spool_max_checks = *(int *)data;
+
+    if (spool_max_checks <= 0 || spool_max_checks > MB_MAX_SPOOL_MAX_CHECKS) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `spool_max_checks' setting value %d", spool_max_checks);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_spool_replay_rate(void *data) {
+/* {{{ */
+   int spool_replay_rate = *(int *)data;
+
+    if (spool_replay_rate < 0 || spool_replay_rate > MB_MAX_SPOOL_REPLAY_RATE) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `spool_replay_rate' setting value %d", spool_replay_rate);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_inflight_table_size(void *data) {
+/* {{{ */
+   int inflight_table_size = *(int *)data;
+
+    if (inflight_table_size <= 0 || inflight_table_size > MB_MAX_INFLIGHT_TABLE_SIZE) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `inflight_table_size' setting value %d", inflight_table_size);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_check_timeout_action(void *data) {
+/* {{{ */
+   char *check_timeout_action = (char *)data;
+
+    if (!MB_STR_MATCH(check_timeout_action, "none") && !MB_STR_MATCH(check_timeout_action, "fail")
+        && !MB_STR_MATCH(check_timeout_action, "republish")) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `check_timeout_action' setting value \"%s\"", check_timeout_action);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_check_timeout_slack(void *data) {
+/* {{{ */
+   int check_timeout_slack = *(int *)data;
+
+    if (check_timeout_slack < 0 || check_timeout_slack > MB_MAX_CHECK_TIMEOUT_SLACK) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `check_timeout_slack' setting value %d", check_timeout_slack);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_json_config_check_command_templates_interval(void *data) {
+/* {{{ */
+   int command_templates_interval = *(int *)data;
+
+    if (command_templates_interval < 1 || command_templates_interval > MB_MAX_COMMAND_TEMPLATES_INTERVAL) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_parse_config: error: "
+            "invalid `command_templates_interval' setting value %d", command_templates_interval);
+        return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
 static inline bool mb_json_is_string(json_t *obj) {
 /* {{{ */
     return json_is_string(obj);
@@ -407,6 +754,60 @@ int mb_json_parse_config(char *file, mb_config_t *mb_config) {
             mb_json_parse_string, NULL },
         { "publisher_routing_key", mb_config->publisher_routing_key, mb_json_is_string,
             mb_json_parse_string, NULL },
+        { "publisher_format", mb_config->publisher_format, mb_json_is_string,
+            mb_json_parse_string, mb_json_config_check_publisher_format },
+        { "publisher_compression", mb_config->publisher_compression, mb_json_is_string,
+            mb_json_parse_string, mb_json_config_check_publisher_compression },
+        { "compression_threshold", &mb_config->compression_threshold, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_compression_threshold },
+        { "compression_dictionary", mb_config->compression_dictionary, mb_json_is_string,
+            mb_json_parse_string, NULL },
+        { "publisher_queue_size", &mb_config->publisher_queue_size, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_publisher_queue_size },
+        { "max_batch_checks", &mb_config->max_batch_checks, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_max_batch_checks },
+        { "max_batch_linger_ms", &mb_config->max_batch_linger_ms, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_max_batch_linger_ms },
+        { "publisher_connections", &mb_config->publisher_connections, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_publisher_connections },
+        { "publisher_channels", &mb_config->publisher_channels, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_publisher_channels },
+        { "publisher_sharding", mb_config->publisher_sharding, mb_json_is_string,
+            mb_json_parse_string, mb_json_config_check_publisher_sharding },
+        { "publisher_confirms", &mb_config->publisher_confirms, mb_json_is_boolean,
+            mb_json_parse_bool, NULL },
+        { "publisher_confirm_window", &mb_config->publisher_confirm_window, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_publisher_confirm_window },
+        { "spool_file", mb_config->spool_file, mb_json_is_string,
+            mb_json_parse_string, NULL },
+        { "spool_max_size", &mb_config->spool_max_size, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_spool_max_size },
+        { "spool_max_checks", &mb_config->spool_max_checks, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_spool_max_checks },
+        { "spool_replay_rate", &mb_config->spool_replay_rate, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_spool_replay_rate },
+        { "fast_command_macros", &mb_config->fast_command_macros, mb_json_is_boolean,
+            mb_json_parse_bool, NULL },
+        { "command_templates", &mb_config->command_templates, mb_json_is_boolean,
+            mb_json_parse_bool, NULL },
+        { "command_templates_exchange", mb_config->command_templates_exchange, mb_json_is_string,
+            mb_json_parse_string, NULL },
+        { "command_templates_interval", &mb_config->command_templates_interval, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_command_templates_interval },
+        { "fast_result_decoder", &mb_config->fast_result_decoder, mb_json_is_boolean,
+            mb_json_parse_bool, NULL },
+        { "decode_workers", &mb_config->decode_workers, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_decode_workers },
+        { "inflight_tracking", &mb_config->inflight_tracking, mb_json_is_boolean,
+            mb_json_parse_bool, NULL },
+        { "inflight_table_size", &mb_config->inflight_table_size, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_inflight_table_size },
+        { "check_timeout_action", mb_config->check_timeout_action, mb_json_is_string,
+            mb_json_parse_string, mb_json_config_check_check_timeout_action },
+        { "check_timeout_slack", &mb_config->check_timeout_slack, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_check_timeout_slack },
+        { "check_timeout_routing_key", mb_config->check_timeout_routing_key, mb_json_is_string,
+            mb_json_parse_string, NULL },
         { "consumer_exchange", mb_config->consumer_exchange, mb_json_is_string,
             mb_json_parse_string, NULL },
         { "consumer_exchange_type", mb_config->consumer_exchange_type, mb_json_is_string,
@@ -415,6 +816,22 @@ int mb_json_parse_config(char *file, mb_config_t *mb_config) {
             mb_json_parse_string, NULL },
         { "consumer_binding_key", mb_config->consumer_binding_key, mb_json_is_string,
             mb_json_parse_string, NULL },
+        { "consumer_acks", &mb_config->consumer_acks, mb_json_is_boolean,
+            mb_json_parse_bool, NULL },
+        { "consumer_prefetch", &mb_config->consumer_prefetch, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_consumer_prefetch },
+        { "consumer_ack_batch", &mb_config->consumer_ack_batch, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_consumer_ack_batch },
+        { "consumer_ack_linger_ms", &mb_config->consumer_ack_linger_ms, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_consumer_ack_linger_ms },
+        { "result_queue_size", &mb_config->result_queue_size, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_result_queue_size },
+        { "reaper_trigger", &mb_config->reaper_trigger, mb_json_is_boolean,
+            mb_json_parse_bool, NULL },
+        { "reaper_trigger_results", &mb_config->reaper_trigger_results, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_reaper_trigger_results },
+        { "reaper_trigger_age", &mb_config->reaper_trigger_age, mb_json_is_integer,
+            mb_json_parse_int, mb_json_config_check_reaper_trigger_age },
         { "hostgroups_routing_table", &mb_config->hstgroups_routing_table, mb_json_is_object,
             mb_json_parse_hostgroups_routing_table, NULL },
         { "servicegroups_routing_table", &mb_config->svcgroups_routing_table, mb_json_is_object,
@@ -465,85 +882,477 @@ int mb_json_parse_config(char *file, mb_config_t *mb_config) {
 /* }}} */
 }
 
-char *mb_json_pack_host_check(nebstruct_host_check_data *hst_check, int check_options, char *command_line) {
-/* {{{ */
-    json_t  *json_hst_check = NULL;
-    char    *json_buf = NULL;
+/*
+    Check messages are encoded by hand rather than through json_pack()/json_dumps(): the
+    schema is fixed, and building a jansson tree costs several allocations per field on
+    the Nagios thread. The output is byte-for-byte what jansson produces with JSON_COMPACT.
+*/
 
-    if (!hst_check)
-        return (NULL);
+/* Only used from the Nagios event loop, so no locking needed */
+static mb_buf_t mb_json_check_buf;
 
-    json_hst_check = json_pack(
-        "{s:s s:s s:s s:i s:f s:f s:i}",
-        "type", "host",
-        "host_name", (hst_check->host_name ? hst_check->host_name : ""),
-        "command_line", command_line,
-        "check_options", check_options,
-        "start_time", TIMEVAL_TO_FLOAT(hst_check->start_time),
-        "latency", hst_check->latency,
-        "timeout", hst_check->timeout
-    );
-
-    if (!json_hst_check) {
-        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_pack_host_check: error: "
-            "json_pack() failed");
-        return (NULL);
+static const uint64_t mb_json_pow10[] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+    100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+    100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL,
+};
+
+static inline int mb_json_utf8_len(const unsigned char *str) {
+/* {{{ */
+    uint32_t    cp;
+    int         len;
+
+    if (str[0] < 0xC2 || str[0] > 0xF4)
+        return (0);
+    else if (str[0] < 0xE0) {
+        len = 2;
+        cp = str[0] & 0x1F;
+    } else if (str[0] < 0xF0) {
+        len = 3;
+        cp = str[0] & 0x0F;
+    } else {
+        len = 4;
+        cp = str[0] & 0x07;
+    }
+
+    for (int i = 1; i < len; i++) {
+        if ((str[i] & 0xC0) != 0x80)
+            return (0);
+
+        cp = (cp << 6) | (str[i] & 0x3F);
     }
 
-    json_buf = json_dumps(json_hst_check, JSON_COMPACT);
+    /* Reject overlong sequences, UTF-16 surrogates and out of range code points like jansson does */
+    if ((len == 3 && (cp < 0x800 || (cp >= 0xD800 && cp <= 0xDFFF)))
+        || (len == 4 && (cp < 0x10000 || cp > 0x10FFFF)))
+        return (0);
+
+    return (len);
+/* }}} */
+}
+
+static int mb_json_encode_string(mb_buf_t *buf, const char *str) {
+/* {{{ */
+    const unsigned char *p = (const unsigned char *)str;
+    const unsigned char *run = NULL;
+    char                esc[7];
+    int                 len;
+
+    if (!str)
+        return (MB_NOK);
+
+    if (!mb_buf_append(buf, "\"", 1))
+        return (MB_NOK);
+
+    while (*p) {
+        /* Copy runs of characters that need no escaping in one go */
+        run = p;
+        while (*p >= 0x20 && *p < 0x80 && *p != '"' && *p != '\\')
+            p++;
+
+        if (p > run && !mb_buf_append(buf, (const char *)run, p - run))
+            return (MB_NOK);
+
+        if (!*p)
+            break;
+
+        if (*p >= 0x80) {
+            if (!(len = mb_json_utf8_len(p)))
+                return (MB_NOK);
+
+            if (!mb_buf_append(buf, (const char *)p, len))
+                return (MB_NOK);
+
+            p += len;
+            continue;
+        }
+
+        switch (*p) {
+            case '"':   len = 2; memcpy(esc, "\\\"", 2); break;
+            case '\\':  len = 2; memcpy(esc, "\\\\", 2); break;
+            case '\b':  len = 2; memcpy(esc, "\\b", 2); break;
+            case '\f':  len = 2; memcpy(esc, "\\f", 2); break;
+            case '\n':  len = 2; memcpy(esc, "\\n", 2); break;
+            case '\r':  len = 2; memcpy(esc, "\\r", 2); break;
+            case '\t':  len = 2; memcpy(esc, "\\t", 2); break;
+            default:
+                len = 6;
+                memcpy(esc, "\\u00", 4);
+                esc[4] = "0123456789ABCDEF"[*p >> 4];
+                esc[5] = "0123456789ABCDEF"[*p & 0x0F];
+        }
+
+        if (!mb_buf_append(buf, esc, len))
+            return (MB_NOK);
+
+        p++;
+    }
+
+    return (mb_buf_append(buf, "\"", 1));
+/* }}} */
+}
+
+static int mb_json_encode_integer(mb_buf_t *buf, long long value) {
+/* {{{ */
+    char                tmp[24];
+    char                *p = tmp + sizeof(tmp);
+    unsigned long long  v = (value < 0 ? -(unsigned long long)value : (unsigned long long)value);
+
+    do {
+        *--p = '0' + (v % 10);
+        v /= 10;
+    } while (v);
+
+    if (value < 0)
+        *--p = '-';
+
+    return (mb_buf_append(buf, p, tmp + sizeof(tmp) - p));
+/* }}} */
+}
+
+/* Round (m * 2^e * 10^k) to the nearest integer, ties to even like printf() does */
+static int mb_json_scale_real(uint64_t m, int e, int k, unsigned __int128 *q) {
+/* {{{ */
+    unsigned __int128   num;
+    unsigned __int128   rem;
+    unsigned __int128   half;
+    unsigned __int128   div;
+
+    if (k >= 0) {
+        /* m < 2^53 and 10^22 < 2^74 so the product always fits */
+        if (k > 22)
+            return (MB_NOK);
+
+        num = (k > 19 ? (unsigned __int128)mb_json_pow10[19] * mb_json_pow10[k - 19] : mb_json_pow10[k]);
+        num *= m;
+
+        if (e >= 0) {
+            if (e > 127 || (num >> (127 - e)) != 0)
+                return (MB_NOK);
+
+            *q = num << e;
+            return (MB_OK);
+        }
+
+        if (-e > 127)
+            return (MB_NOK);
+
+        *q = num >> -e;
+        rem = num & ((((unsigned __int128)1) << -e) - 1);
+        half = ((unsigned __int128)1) << (-e - 1);
+
+        if (rem > half || (rem == half && (*q & 1)))
+            (*q)++;
+
+        return (MB_OK);
+    }
+
+    if (k < -38 || e < 0 || e > 74)
+        return (MB_NOK);
+
+    div = (-k > 19 ? (unsigned __int128)mb_json_pow10[19] * mb_json_pow10[-k - 19] : mb_json_pow10[-k]);
+    num = (unsigned __int128)m << e;
+    *q = num / div;
+    rem = num % div;
+
+    if (rem > div - rem || (rem == div - rem && (*q & 1)))
+        (*q)++;
 
-    if (!json_buf)
+    return (MB_OK);
+/* }}} */
+}
+
+/* Compute the 17 significant digits printf("%.17g") would output, and the decimal exponent */
+static int mb_json_real_digits(double value, uint64_t *digits, int *exp10) {
+/* {{{ */
+    unsigned __int128   q;
+    uint64_t            bits;
+    uint64_t            m;
+    int                 e;
+    int                 e10;
+
+    memcpy(&bits, &value, sizeof(bits));
+
+    /* Subnormals are left to printf() */
+    if (((bits >> 52) & 0x7FF) == 0)
+        return (MB_NOK);
+
+    m = (bits & ((1ULL << 52) - 1)) | (1ULL << 52);
+    e = (int)((bits >> 52) & 0x7FF) - 1075;
+
+    /* floor(log10(2^(e + 52))), which is either the decimal exponent or one less */
+    e10 = ((e + 52) * 78913) >> 18;
+
+    for (int i = 0; i < 3; i++) {
+        if (!mb_json_scale_real(m, e, 16 - e10, &q))
+            return (MB_NOK);
+
+        if (q >= mb_json_pow10[17])
+            e10++;
+        else if (q < mb_json_pow10[16])
+            e10--;
+        else {
+            *digits = (uint64_t)q;
+            *exp10 = e10;
+            return (MB_OK);
+        }
+    }
+
+    return (MB_NOK);
+/* }}} */
+}
+
+static int mb_json_encode_real_printf(mb_buf_t *buf, double value) {
+/* {{{ */
+    char    tmp[64];
+    char    *start = NULL;
+    char    *end = NULL;
+    int     len;
+
+    len = snprintf(tmp, sizeof(tmp), "%.17g", value);
+
+    /* Same fixups as jansson: keep it a real when decoded, and strip exponent padding */
+    if (!strchr(tmp, '.') && !strchr(tmp, 'e')) {
+        memcpy(tmp + len, ".0", 3);
+        len += 2;
+    }
+
+    if ((start = strchr(tmp, 'e'))) {
+        start++;
+        end = start + 1;
+
+        if (*start == '-')
+            start++;
+
+        while (*end == '0')
+            end++;
+
+        if (end != start) {
+            memmove(start, end, len - (end - tmp) + 1);
+            len -= end - start;
+        }
+    }
+
+    return (mb_buf_append(buf, tmp, len));
+/* }}} */
+}
+
+static int mb_json_encode_real(mb_buf_t *buf, double value) {
+/* {{{ */
+    char        tmp[40];
+    char        digits[17];
+    char        *p = tmp;
+    uint64_t    q;
+    int         exp10;
+    int         last;
+
+    /* jansson refuses to create NaN or infinite reals */
+    if (isnan(value) || isinf(value))
+        return (MB_NOK);
+
+    if (value == 0.0)
+        return (signbit(value) ? mb_buf_append(buf, "-0.0", 4) : mb_buf_append(buf, "0.0", 3));
+
+    if (!mb_json_real_digits(fabs(value), &q, &exp10))
+        return (mb_json_encode_real_printf(buf, value));
+
+    for (int i = 16; i >= 0; i--) {
+        digits[i] = '0' + (q % 10);
+        q /= 10;
+    }
+
+    /* %g strips trailing zeros */
+    for (last = 16; last > 0 && digits[last] == '0'; last--)
+        ;
+
+    if (value < 0)
+        *p++ = '-';
+
+    if (exp10 < -4 || exp10 >= 17) {
+        *p++ = digits[0];
+
+        if (last > 0) {
+            *p++ = '.';
+            memcpy(p, digits + 1, last);
+            p += last;
+        }
+
+        *p++ = 'e';
+
+        if (exp10 < 0) {
+            *p++ = '-';
+            exp10 = -exp10;
+        }
+
+        if (exp10 >= 100)
+            *p++ = '0' + exp10 / 100;
+        if (exp10 >= 10)
+            *p++ = '0' + (exp10 / 10) % 10;
+        *p++ = '0' + exp10 % 10;
+    } else if (exp10 >= 0) {
+        memcpy(p, digits, exp10 + 1);
+        p += exp10 + 1;
+        *p++ = '.';
+
+        if (last > exp10) {
+            memcpy(p, digits + exp10 + 1, last - exp10);
+            p += last - exp10;
+        } else
+            *p++ = '0';
+    } else {
+        *p++ = '0';
+        *p++ = '.';
+
+        for (int i = 0; i < -exp10 - 1; i++)
+            *p++ = '0';
+
+        memcpy(p, digits, last + 1);
+        p += last + 1;
+    }
+
+    return (mb_buf_append(buf, tmp, p - tmp));
+/* }}} */
+}
+
+/* Command line in full, or command template ID and arguments */
+static int mb_json_encode_check_command(mb_buf_t *buf, mb_check_command_t *check_cmd) {
+/* {{{ */
+    if (!check_cmd->template_id)
+        return (MB_BUF_APPEND_LITERAL(buf, ",\"command_line\":")
+            && mb_json_encode_string(buf, check_cmd->line));
+
+    if (!MB_BUF_APPEND_LITERAL(buf, ",\"command_template\":")
+        || !mb_json_encode_string(buf, check_cmd->template_id)
+        || !MB_BUF_APPEND_LITERAL(buf, ",\"command_args\":["))
+        return (MB_NOK);
+
+    for (int i = 0; i < check_cmd->nargs; i++) {
+        if ((i > 0 && !MB_BUF_APPEND_LITERAL(buf, ","))
+            || !mb_json_encode_string(buf, check_cmd->args[i]))
+            return (MB_NOK);
+    }
+
+    return (MB_BUF_APPEND_LITERAL(buf, "]"));
+/* }}} */
+}
+
+/*
+    Check packers write into a buffer reused from one check to the next, the message they
+    return is only valid until the next call.
+*/
+const char *mb_json_pack_host_check(nebstruct_host_check_data *hst_check, int check_options,
+    mb_check_command_t *check_cmd, size_t *len) {
+/* {{{ */
+    mb_buf_t *buf = &mb_json_check_buf;
+
+    if (!hst_check)
+        return (NULL);
+
+    mb_buf_reset(buf);
+
+    if (!MB_BUF_APPEND_LITERAL(buf, "{\"type\":\"host\",\"host_name\":")
+        || !mb_json_encode_string(buf, (hst_check->host_name ? hst_check->host_name : ""))
+        || !mb_json_encode_check_command(buf, check_cmd)
+        || !MB_BUF_APPEND_LITERAL(buf, ",\"check_options\":")
+        || !mb_json_encode_integer(buf, check_options)
+        || !MB_BUF_APPEND_LITERAL(buf, ",\"start_time\":")
+        || !mb_json_encode_real(buf, TIMEVAL_TO_FLOAT(hst_check->start_time))
+        || !MB_BUF_APPEND_LITERAL(buf, ",\"latency\":")
+        || !mb_json_encode_real(buf, hst_check->latency)
+        || !MB_BUF_APPEND_LITERAL(buf, ",\"timeout\":")
+        || !mb_json_encode_integer(buf, hst_check->timeout)
+        || !MB_BUF_APPEND_LITERAL(buf, "}")) {
         logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_pack_host_check: error: "
-            "json_dumps() failed");
+            "unable to encode host check");
+        return (NULL);
+    }
 
-    json_decref(json_hst_check);
+    *len = buf->len;
 
-    return (json_buf);
+    return (buf->data);
 /* }}} */
 }
 
-char *mb_json_pack_service_check(nebstruct_service_check_data *svc_check, int check_options, char *command_line) {
+const char *mb_json_pack_service_check(nebstruct_service_check_data *svc_check, int check_options,
+    mb_check_command_t *check_cmd, size_t *len) {
 /* {{{ */
-    json_t  *json_svc_check = NULL;
-    char    *json_buf = NULL;
+    mb_buf_t *buf = &mb_json_check_buf;
 
     if (!svc_check)
         return (NULL);
 
-    json_svc_check = json_pack(
-        "{s:s s:s s:s s:s s:i s:f s:f s:i}",
-        "type", "service",
-        "host_name", (svc_check->host_name ? svc_check->host_name : ""),
-        "service_description", (svc_check->service_description ? svc_check->service_description : ""),
-        "command_line", command_line,
-        "check_options", check_options,
-        "start_time", TIMEVAL_TO_FLOAT(svc_check->start_time),
-        "latency", svc_check->latency,
-        "timeout", svc_check->timeout
-    );
-
-    if (!json_svc_check) {
+    mb_buf_reset(buf);
+
+    if (!MB_BUF_APPEND_LITERAL(buf, "{\"type\":\"service\",\"host_name\":")
+        || !mb_json_encode_string(buf, (svc_check->host_name ? svc_check->host_name : ""))
+        || !MB_BUF_APPEND_LITERAL(buf, ",\"service_description\":")
+        || !mb_json_encode_string(buf,
+            (svc_check->service_description ? svc_check->service_description : ""))
+        || !mb_json_encode_check_command(buf, check_cmd)
+        || !MB_BUF_APPEND_LITERAL(buf, ",\"check_options\":")
+        || !mb_json_encode_integer(buf, check_options)
+        || !MB_BUF_APPEND_LITERAL(buf, ",\"start_time\":")
+        || !mb_json_encode_real(buf, TIMEVAL_TO_FLOAT(svc_check->start_time))
+        || !MB_BUF_APPEND_LITERAL(buf, ",\"latency\":")
+        || !mb_json_encode_real(buf, svc_check->latency)
+        || !MB_BUF_APPEND_LITERAL(buf, ",\"timeout\":")
+        || !mb_json_encode_integer(buf, svc_check->timeout)
+        || !MB_BUF_APPEND_LITERAL(buf, "}")) {
         logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_pack_service_check: error: "
-            "json_pack() failed");
+            "unable to encode service check");
         return (NULL);
     }
 
-    json_buf = json_dumps(json_svc_check, JSON_COMPACT);
+    *len = buf->len;
 
-    if (!json_buf)
-        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_pack_service_check: error: "
-            "json_dumps() failed");
+    return (buf->data);
+/* }}} */
+}
+
+/* Command template definition, its parts being joined with the values of the check arguments */
+const char *mb_json_pack_command_template(mb_command_template_t *tmpl, size_t *len) {
+/* {{{ */
+    mb_buf_t    *buf = &mb_json_check_buf;
+    const char  *part = tmpl->text;
+
+    mb_buf_reset(buf);
+
+    if (!MB_BUF_APPEND_LITERAL(buf, "{\"type\":\"command_template\",\"command_template\":")
+        || !mb_json_encode_string(buf, tmpl->id)
+        || !MB_BUF_APPEND_LITERAL(buf, ",\"command_parts\":["))
+        goto error;
+
+    for (int i = 0; i <= tmpl->nargs; part += tmpl->parts[i++] + 1) {
+        if ((i > 0 && !MB_BUF_APPEND_LITERAL(buf, ","))
+            || !mb_json_encode_string(buf, part))
+            goto error;
+    }
+
+    if (!MB_BUF_APPEND_LITERAL(buf, "]}"))
+        goto error;
+
+    *len = buf->len;
 
-    json_decref(json_svc_check);
+    return (buf->data);
 
-    return (json_buf);
+    error:
+    logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_pack_command_template: error: "
+        "unable to encode command template");
+
+    return (NULL);
 /* }}} */
 }
 
-check_result *mb_json_unpack_check_result(char *msg) {
+void mb_json_free_buffers(void) {
+/* {{{ */
+    mb_buf_free(&mb_json_check_buf);
+/* }}} */
+}
+
+static check_result *mb_json_unpack_check_result_object(json_t *json_cr) {
 /* {{{ */
     check_result    *cr = NULL;
-    json_t          *json_cr = NULL;
     json_t          *json_host_name = NULL;
     json_t          *json_service_description = NULL;
     json_t          *json_check_options = NULL;
@@ -560,13 +1369,13 @@ check_result *mb_json_unpack_check_result(char *msg) {
     const char      *service_description = NULL;
     const char      *output = NULL;
 
-    if (!(json_cr = json_loads(msg, 0, NULL))) {
+    if (!json_is_object(json_cr)) {
         logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_unpack_check_result: error: "
-        "unable to parse JSON data");
+        "received JSON data is not an object");
         return (NULL);
     }
 
-    if (!(cr = (check_result *)calloc(1, sizeof(check_result)))) {
+    if (!(cr = mb_new_check_result())) {
         logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: process_check_result: error: "
         "unable to allocate memory");
         return (NULL);
@@ -649,14 +1458,905 @@ check_result *mb_json_unpack_check_result(char *msg) {
         cr->latency = json_real_value(json_latency);
     }
 
+    return (cr);
+
+    error:
+    free_check_result(cr);
+    free(cr);
+    return (NULL);
+/* }}} */
+}
+
+check_result *mb_json_unpack_check_result(char *msg) {
+/* {{{ */
+    check_result    *cr = NULL;
+    json_t          *json_cr = NULL;
+
+    if (!(json_cr = json_loads(msg, 0, NULL))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_unpack_check_result: error: "
+        "unable to parse JSON data");
+        return (NULL);
+    }
+
+    cr = mb_json_unpack_check_result_object(json_cr);
+
     json_decref(json_cr);
 
     return (cr);
+/* }}} */
+}
+
+int mb_json_unpack_check_result_batch(char *msg, void (*handler)(char *, check_result *)) {
+/* {{{ */
+    check_result    *cr = NULL;
+    json_t          *json_batch = NULL;
+    json_t          *json_entry = NULL;
+    const char      *cid = NULL;
+    size_t          i;
+
+    if (!(json_batch = json_loads(msg, 0, NULL))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_unpack_check_result_batch: error: "
+        "unable to parse JSON data");
+        return (MB_NOK);
+    }
+
+    if (!json_is_array(json_batch)) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_unpack_check_result_batch: error: "
+        "received JSON data is not an array");
+        json_decref(json_batch);
+        return (MB_NOK);
+    }
+
+    /* Each batch entry is {"correlation_id": "<cid>", "result": {<check result>}} */
+    json_array_foreach(json_batch, i, json_entry) {
+        if (!(cid = json_string_value(json_object_get(json_entry, "correlation_id")))) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_unpack_check_result_batch: error: "
+            "missing `correlation_id` entry in batch entry #%zu, skipping", i);
+            continue;
+        }
+
+        if (!(cr = mb_json_unpack_check_result_object(json_object_get(json_entry, "result")))) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_json_unpack_check_result_batch: error: "
+            "unable to unpack check result in batch entry #%zu, skipping", cid, i);
+            continue;
+        }
+
+        handler((char *)cid, cr);
+    }
+
+    json_decref(json_batch);
+
+    return (MB_OK);
+/* }}} */
+}
+
+/*
+    Single-pass decoder specialized for the check result schema: fields are filled in
+    as they are met and strings are unescaped straight into their final allocation,
+    without building a jansson tree. It accepts exactly what json_loads() accepts; input
+    it doesn't handle itself (unexpected value types, deep nesting) goes through jansson.
+*/
+
+/* Required fields come first, in the order they are reported missing */
+static const mb_json_result_field_t mb_json_result_fields[] = {
+    { "host_name", 9, MB_JSON_FIELD_HOST_NAME, MB_JSON_TYPE_STRING },
+    { "return_code", 11, MB_JSON_FIELD_RETURN_CODE, MB_JSON_TYPE_INTEGER },
+    { "start_time", 10, MB_JSON_FIELD_START_TIME, MB_JSON_TYPE_REAL },
+    { "finish_time", 11, MB_JSON_FIELD_FINISH_TIME, MB_JSON_TYPE_REAL },
+    { "service_description", 19, MB_JSON_FIELD_SERVICE_DESCRIPTION, MB_JSON_TYPE_STRING },
+    { "output", 6, MB_JSON_FIELD_OUTPUT, MB_JSON_TYPE_STRING },
+    { "check_options", 13, MB_JSON_FIELD_CHECK_OPTIONS, MB_JSON_TYPE_INTEGER },
+    { "scheduled_check", 15, MB_JSON_FIELD_SCHEDULED_CHECK, MB_JSON_TYPE_INTEGER },
+    { "reschedule_check", 16, MB_JSON_FIELD_RESCHEDULE_CHECK, MB_JSON_TYPE_INTEGER },
+    { "exited_ok", 9, MB_JSON_FIELD_EXITED_OK, MB_JSON_TYPE_INTEGER },
+    { "early_timeout", 13, MB_JSON_FIELD_EARLY_TIMEOUT, MB_JSON_TYPE_INTEGER },
+    { "latency", 7, MB_JSON_FIELD_LATENCY, MB_JSON_TYPE_REAL },
+    { NULL, 0, 0, 0 },
+};
+
+/* Exact powers of ten representable as doubles */
+static const double mb_json_exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static inline const char *mb_json_skip_ws(const char *p) {
+/* {{{ */
+    while (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')
+        p++;
+
+    return (p);
+/* }}} */
+}
+
+static inline int mb_json_hex4(const unsigned char *p) {
+/* {{{ */
+    int value = 0;
+
+    for (int i = 0; i < 4; i++) {
+        value <<= 4;
+
+        if (p[i] >= '0' && p[i] <= '9')
+            value |= p[i] - '0';
+        else if (p[i] >= 'a' && p[i] <= 'f')
+            value |= p[i] - 'a' + 10;
+        else if (p[i] >= 'A' && p[i] <= 'F')
+            value |= p[i] - 'A' + 10;
+        else
+            return (-1);
+    }
+
+    return (value);
+/* }}} */
+}
+
+/* Unescape the string body [p, end) into out (if not NULL), return the unescaped length or -1 */
+static int mb_json_unescape(const unsigned char *p, const unsigned char *end, char *out) {
+/* {{{ */
+    char    *q = out;
+    int     len = 0;
+    int     cp;
+    int     lo;
+    char    c;
+
+    while (p < end) {
+        if (*p != '\\') {
+            if (q)
+                *q++ = *p;
+            p++;
+            len++;
+            continue;
+        }
+
+        switch (p[1]) {
+            case '"':   c = '"'; break;
+            case '\\':  c = '\\'; break;
+            case '/':   c = '/'; break;
+            case 'b':   c = '\b'; break;
+            case 'f':   c = '\f'; break;
+            case 'n':   c = '\n'; break;
+            case 'r':   c = '\r'; break;
+            case 't':   c = '\t'; break;
+            case 'u':   c = 0; break;
+            default:    return (-1);
+        }
+
+        if (c) {
+            if (q)
+                *q++ = c;
+            p += 2;
+            len++;
+            continue;
+        }
+
+        if ((cp = mb_json_hex4(p + 2)) < 0)
+            return (-1);
+
+        p += 6;
+
+        /* Like jansson, reject \u0000 and unpaired UTF-16 surrogates */
+        if (cp == 0 || (cp >= 0xDC00 && cp <= 0xDFFF))
+            return (-1);
+
+        if (cp >= 0xD800 && cp <= 0xDBFF) {
+            if (p + 6 > end || p[0] != '\\' || p[1] != 'u'
+                || (lo = mb_json_hex4(p + 2)) < 0 || lo < 0xDC00 || lo > 0xDFFF)
+                return (-1);
+
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+            p += 6;
+        }
+
+        if (cp < 0x80) {
+            if (q)
+                *q++ = cp;
+            len += 1;
+        } else if (cp < 0x800) {
+            if (q) {
+                *q++ = 0xC0 | (cp >> 6);
+                *q++ = 0x80 | (cp & 0x3F);
+            }
+            len += 2;
+        } else if (cp < 0x10000) {
+            if (q) {
+                *q++ = 0xE0 | (cp >> 12);
+                *q++ = 0x80 | ((cp >> 6) & 0x3F);
+                *q++ = 0x80 | (cp & 0x3F);
+            }
+            len += 3;
+        } else {
+            if (q) {
+                *q++ = 0xF0 | (cp >> 18);
+                *q++ = 0x80 | ((cp >> 12) & 0x3F);
+                *q++ = 0x80 | ((cp >> 6) & 0x3F);
+                *q++ = 0x80 | (cp & 0x3F);
+            }
+            len += 4;
+        }
+    }
+
+    if (q)
+        *q = '\0';
+
+    return (len);
+/* }}} */
+}
+
+/* Decode the string starting at the opening quote, into a new allocation if dst isn't NULL */
+static int mb_json_decode_string(const char **pp, char **dst, size_t *dst_len) {
+/* {{{ */
+    const unsigned char *start = (const unsigned char *)*pp + 1;
+    const unsigned char *p = start;
+    bool                escaped = false;
+    char                *out = NULL;
+    int                 len;
+
+    /* Find the closing quote, validating raw characters on the way */
+    while (*p != '"') {
+        if (*p == '\\') {
+            escaped = true;
+
+            if (!p[1])
+                return (MB_NOK);
+
+            p += 2;
+        } else if (*p < 0x20)
+            return (MB_NOK);
+        else if (*p < 0x80)
+            p++;
+        else {
+            if (!(len = mb_json_utf8_len(p)))
+                return (MB_NOK);
+
+            p += len;
+        }
+    }
+
+    *pp = (const char *)p + 1;
+
+    if (escaped && (len = mb_json_unescape(start, p, NULL)) < 0)
+        return (MB_NOK);
+    else if (!escaped)
+        len = p - start;
+
+    if (dst_len)
+        *dst_len = len;
+
+    if (!dst)
+        return (MB_OK);
+
+    if (!(out = malloc(len + 1))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_decode_string: error: "
+            "unable to allocate memory");
+        return (MB_NOK);
+    }
+
+    if (escaped)
+        mb_json_unescape(start, p, out);
+    else {
+        memcpy(out, start, len);
+        out[len] = '\0';
+    }
+
+    *dst = out;
+
+    return (MB_OK);
+/* }}} */
+}
+
+static int mb_json_decode_number(const char **pp, bool *is_real, long long *integer, double *real) {
+/* {{{ */
+    const char  *start = *pp;
+    const char  *p = *pp;
+    bool        negative = false;
+    bool        fraction = false;
+    bool        truncated = false;
+    uint64_t    mantissa = 0;
+    int         digits = 0;
+    int         exp10 = 0;
+    int         exp_value = 0;
+    bool        exp_negative = false;
+
+    *is_real = false;
+
+    if (*p == '-') {
+        negative = true;
+        p++;
+    }
+
+    /* JSON forbids leading zeros */
+    if (*p == '0' && p[1] >= '0' && p[1] <= '9')
+        return (MB_NOK);
+
+    if (*p < '0' || *p > '9')
+        return (MB_NOK);
+
+    /* Keep up to 19 significant digits, that's all an integer or a fast path real needs */
+    while (true) {
+        if (*p >= '0' && *p <= '9') {
+            if (mantissa == 0 && *p == '0') {
+                if (fraction)
+                    exp10--;
+            } else if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits++;
+
+                if (fraction)
+                    exp10--;
+            } else {
+                truncated = true;
+
+                if (!fraction)
+                    exp10++;
+            }
+
+            p++;
+        } else if (*p == '.' && !fraction) {
+            fraction = true;
+            *is_real = true;
+            p++;
+
+            if (*p < '0' || *p > '9')
+                return (MB_NOK);
+        } else
+            break;
+    }
+
+    if (*p == 'e' || *p == 'E') {
+        *is_real = true;
+        p++;
+
+        if (*p == '+' || *p == '-')
+            exp_negative = (*p++ == '-');
+
+        if (*p < '0' || *p > '9')
+            return (MB_NOK);
+
+        while (*p >= '0' && *p <= '9') {
+            if (exp_value < 100000)
+                exp_value = exp_value * 10 + (*p - '0');
+            p++;
+        }
+
+        exp10 += (exp_negative ? -exp_value : exp_value);
+    }
+
+    *pp = p;
+
+    if (!*is_real) {
+        /* Same range as jansson's json_int_t */
+        if (truncated || mantissa > (uint64_t)LLONG_MAX + (negative ? 1 : 0))
+            return (MB_NOK);
+
+        *integer = (negative ? (long long)(0 - mantissa) : (long long)mantissa);
+        return (MB_OK);
+    }
+
+    /* Exact when both the mantissa and the power of ten are exact doubles, else use strtod() */
+    if (!truncated && mantissa <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+        *real = (exp10 < 0 ? (double)mantissa / mb_json_exact_pow10[-exp10]
+            : (double)mantissa * mb_json_exact_pow10[exp10]);
+
+        if (negative)
+            *real = -*real;
+    } else
+        *real = strtod(start, NULL);
+
+    /* jansson rejects reals overflowing a double */
+    if (isinf(*real))
+        return (MB_NOK);
+
+    return (MB_OK);
+/* }}} */
+}
+
+static int mb_json_skip_container(const char **, int);
+
+/* Validate and skip any JSON value, for keys the check result schema doesn't know about */
+static int mb_json_skip_value(const char **pp, int depth) {
+/* {{{ */
+    const char  *p = *pp;
+    bool        is_real;
+    long long   integer;
+    double      real;
+    int         ret;
+
+    if (depth > MB_JSON_MAX_DEPTH)
+        return (MB_JSON_UNSUPPORTED);
+
+    switch (*p) {
+        case '"':
+            ret = mb_json_decode_string(&p, NULL, NULL);
+            break;
+
+        case '{':
+        case '[':
+            ret = mb_json_skip_container(&p, depth + 1);
+            break;
+
+        case 't':
+            ret = (strncmp(p, "true", 4) == 0 ? MB_OK : MB_NOK);
+            p += 4;
+            break;
+
+        case 'f':
+            ret = (strncmp(p, "false", 5) == 0 ? MB_OK : MB_NOK);
+            p += 5;
+            break;
+
+        case 'n':
+            ret = (strncmp(p, "null", 4) == 0 ? MB_OK : MB_NOK);
+            p += 4;
+            break;
+
+        default:
+            ret = mb_json_decode_number(&p, &is_real, &integer, &real);
+    }
+
+    *pp = p;
+
+    return (ret);
+/* }}} */
+}
+
+static int mb_json_skip_container(const char **pp, int depth) {
+/* {{{ */
+    const char  *p = *pp;
+    bool        object = (*p == '{');
+    char        close = (object ? '}' : ']');
+    int         ret;
+
+    p = mb_json_skip_ws(p + 1);
+
+    if (*p == close) {
+        *pp = p + 1;
+        return (MB_OK);
+    }
+
+    while (true) {
+        if (object) {
+            if (*p != '"' || !mb_json_decode_string(&p, NULL, NULL))
+                return (MB_NOK);
+
+            p = mb_json_skip_ws(p);
+
+            if (*p != ':')
+                return (MB_NOK);
+
+            p = mb_json_skip_ws(p + 1);
+        }
+
+        if ((ret = mb_json_skip_value(&p, depth)) != MB_OK)
+            return (ret);
+
+        p = mb_json_skip_ws(p);
+
+        if (*p == close) {
+            *pp = p + 1;
+            return (MB_OK);
+        } else if (*p != ',')
+            return (MB_NOK);
+
+        p = mb_json_skip_ws(p + 1);
+    }
+/* }}} */
+}
+
+static int mb_json_decode_result_field(const char **pp, check_result *cr, const mb_json_result_field_t *field) {
+/* {{{ */
+    const char  *p = *pp;
+    char        *str = NULL;
+    size_t      len = 0;
+    bool        is_real;
+    long long   integer = 0;
+    double      real = 0.0;
+
+    /* Values jansson would silently turn into 0 or NULL are left to it */
+    if (field->type == MB_JSON_TYPE_STRING) {
+        if (strncmp(p, "null", 4) == 0)
+            p += 4;
+        else if (*p != '"')
+            return (MB_JSON_UNSUPPORTED);
+        else if (!mb_json_decode_string(&p, &str, &len))
+            return (MB_NOK);
+    } else {
+        if (*p != '-' && (*p < '0' || *p > '9'))
+            return (MB_JSON_UNSUPPORTED);
+
+        if (!mb_json_decode_number(&p, &is_real, &integer, &real))
+            return (MB_NOK);
+
+        if (is_real != (field->type == MB_JSON_TYPE_REAL))
+            return (MB_JSON_UNSUPPORTED);
+    }
+
+    *pp = p;
+
+    /* The last occurrence of a duplicate key wins, like with jansson */
+    switch (field->id) {
+        case MB_JSON_FIELD_HOST_NAME:
+            free(cr->host_name);
+            cr->host_name = str;
+            break;
+
+        case MB_JSON_FIELD_SERVICE_DESCRIPTION:
+            free(cr->service_description);
+            cr->service_description = NULL;
+            cr->object_check_type = HOST_CHECK;
+
+            /* Only a non-empty service description makes it a service check result */
+            if (str && len > 0) {
+                cr->service_description = str;
+                cr->object_check_type = SERVICE_CHECK;
+            } else
+                free(str);
+            break;
+
+        case MB_JSON_FIELD_OUTPUT:
+            free(cr->output);
+            cr->output = str;
+            break;
+
+        case MB_JSON_FIELD_RETURN_CODE:
+            cr->return_code = integer;
+            break;
+
+        case MB_JSON_FIELD_CHECK_OPTIONS:
+            cr->check_options = integer;
+            break;
+
+        case MB_JSON_FIELD_SCHEDULED_CHECK:
+            cr->scheduled_check = integer;
+            break;
+
+        case MB_JSON_FIELD_RESCHEDULE_CHECK:
+            cr->reschedule_check = integer;
+            break;
+
+        case MB_JSON_FIELD_EXITED_OK:
+            cr->exited_ok = integer;
+            break;
+
+        case MB_JSON_FIELD_EARLY_TIMEOUT:
+            cr->early_timeout = integer;
+            break;
+
+        case MB_JSON_FIELD_START_TIME:
+            FLOAT_TO_TIMEVAL(real, cr->start_time);
+            break;
+
+        case MB_JSON_FIELD_FINISH_TIME:
+            FLOAT_TO_TIMEVAL(real, cr->finish_time);
+            break;
+
+        case MB_JSON_FIELD_LATENCY:
+            cr->latency = real;
+            break;
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static int mb_json_decode_check_result_object(const char **pp, check_result *cr, unsigned int *seen) {
+/* {{{ */
+    const mb_json_result_field_t    *field = NULL;
+    const char                      *p = *pp;
+    const char                      *key = NULL;
+    size_t                          key_len;
+    int                             ret;
+
+    *seen = 0;
+
+    if (*p != '{')
+        return (MB_NOK);
+
+    p = mb_json_skip_ws(p + 1);
+
+    if (*p == '}') {
+        *pp = p + 1;
+        return (MB_OK);
+    }
+
+    while (true) {
+        if (*p != '"')
+            return (MB_NOK);
+
+        key = p + 1;
+
+        if (!mb_json_decode_string(&p, NULL, &key_len))
+            return (MB_NOK);
+
+        /* Escaped keys are rare enough to leave them to jansson */
+        if ((size_t)(p - key - 1) != key_len)
+            return (MB_JSON_UNSUPPORTED);
+
+        for (field = mb_json_result_fields; field->name; field++) {
+            if (field->len == key_len && memcmp(field->name, key, key_len) == 0)
+                break;
+        }
+
+        p = mb_json_skip_ws(p);
+
+        if (*p != ':')
+            return (MB_NOK);
+
+        p = mb_json_skip_ws(p + 1);
+
+        if (field->name) {
+            if ((ret = mb_json_decode_result_field(&p, cr, field)) != MB_OK)
+                return (ret);
+
+            *seen |= (1U << field->id);
+        } else if ((ret = mb_json_skip_value(&p, 1)) != MB_OK)
+            return (ret);
+
+        p = mb_json_skip_ws(p);
+
+        if (*p == '}') {
+            *pp = p + 1;
+            return (MB_OK);
+        } else if (*p != ',')
+            return (MB_NOK);
+
+        p = mb_json_skip_ws(p + 1);
+    }
+/* }}} */
+}
+
+check_result *mb_json_decode_check_result(char *msg) {
+/* {{{ */
+    check_result    *cr = NULL;
+    const char      *p = msg;
+    unsigned int    seen;
+    int             ret;
+
+    if (!(cr = mb_new_check_result())) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_decode_check_result: error: "
+        "unable to allocate memory");
+        return (NULL);
+    }
+
+    init_check_result(cr);
+    cr->output_file = NULL;
+
+    p = mb_json_skip_ws(p);
+
+    if ((ret = mb_json_decode_check_result_object(&p, cr, &seen)) == MB_OK) {
+        /* Nothing but whitespace may follow the object */
+        p = mb_json_skip_ws(p);
+
+        if (*p != '\0')
+            ret = MB_NOK;
+    }
+
+    if (ret == MB_JSON_UNSUPPORTED) {
+        free_check_result(cr);
+        free(cr);
+        return (mb_json_unpack_check_result(msg));
+    }
+
+    if (ret != MB_OK) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_decode_check_result: error: "
+        "unable to parse JSON data");
+        goto error;
+    }
+
+    for (int i = 0; i < MB_JSON_REQUIRED_FIELDS; i++) {
+        if (!(seen & (1U << mb_json_result_fields[i].id))) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_decode_check_result: error: "
+            "missing `%s` entry in received JSON data", mb_json_result_fields[i].name);
+            goto error;
+        }
+    }
+
+    return (cr);
 
     error:
+    free_check_result(cr);
     free(cr);
     return (NULL);
 /* }}} */
 }
 
+static int mb_json_decode_batch_entry(const char **pp, mb_json_batch_entry_t *entry) {
+/* {{{ */
+    const char  *p = *pp;
+    const char  *key = NULL;
+    size_t      key_len;
+    int         ret;
+
+    /* Entries that aren't objects are reported as missing their correlation ID */
+    if (*p != '{')
+        return (mb_json_skip_value(pp, 1));
+
+    p = mb_json_skip_ws(p + 1);
+
+    if (*p == '}') {
+        *pp = p + 1;
+        return (MB_OK);
+    }
+
+    while (true) {
+        if (*p != '"')
+            return (MB_NOK);
+
+        key = p + 1;
+
+        if (!mb_json_decode_string(&p, NULL, &key_len))
+            return (MB_NOK);
+
+        if ((size_t)(p - key - 1) != key_len)
+            return (MB_JSON_UNSUPPORTED);
+
+        p = mb_json_skip_ws(p);
+
+        if (*p != ':')
+            return (MB_NOK);
+
+        p = mb_json_skip_ws(p + 1);
+
+        /* The last occurrence of a duplicate key wins, like with jansson */
+        if (key_len == 14 && memcmp(key, "correlation_id", 14) == 0) {
+            free(entry->cid);
+            entry->cid = NULL;
+
+            if (*p == '"') {
+                if (!mb_json_decode_string(&p, &entry->cid, NULL))
+                    return (MB_NOK);
+            } else if ((ret = mb_json_skip_value(&p, 2)) != MB_OK)
+                return (ret);
+        } else if (key_len == 6 && memcmp(key, "result", 6) == 0) {
+            if (entry->cr) {
+                free_check_result(entry->cr);
+                free(entry->cr);
+                entry->cr = NULL;
+            }
+
+            if (*p == '{') {
+                if (!(entry->cr = mb_new_check_result())) {
+                    logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_decode_batch_entry: error: "
+                    "unable to allocate memory");
+                    return (MB_NOK);
+                }
+
+                init_check_result(entry->cr);
+                entry->cr->output_file = NULL;
+
+                if ((ret = mb_json_decode_check_result_object(&p, entry->cr, &entry->seen)) != MB_OK)
+                    return (ret);
+            } else if ((ret = mb_json_skip_value(&p, 2)) != MB_OK)
+                return (ret);
+        } else if ((ret = mb_json_skip_value(&p, 2)) != MB_OK)
+            return (ret);
+
+        p = mb_json_skip_ws(p);
+
+        if (*p == '}') {
+            *pp = p + 1;
+            return (MB_OK);
+        } else if (*p != ',')
+            return (MB_NOK);
+
+        p = mb_json_skip_ws(p + 1);
+    }
+/* }}} */
+}
+
+static void mb_json_free_batch_entries(mb_json_batch_entry_t *entries, size_t count) {
+/* {{{ */
+    for (size_t i = 0; i < count; i++) {
+        free(entries[i].cid);
+
+        if (entries[i].cr) {
+            free_check_result(entries[i].cr);
+            free(entries[i].cr);
+        }
+    }
+
+    free(entries);
+/* }}} */
+}
+
+/*
+    Fast decoder counterpart of mb_json_unpack_check_result_batch(): entries are decoded
+    in a single pass, then handed over once the whole batch is known to be valid just like
+    jansson would. Anything unexpected is left to mb_json_unpack_check_result_batch(),
+    which reports errors as usual.
+*/
+int mb_json_decode_check_result_batch(char *msg, void (*handler)(char *, check_result *)) {
+/* {{{ */
+    mb_json_batch_entry_t   *entries = NULL;
+    mb_json_batch_entry_t   *grown = NULL;
+    size_t                  count = 0;
+    size_t                  size = 0;
+    const char              *p = msg;
+    const char              *missing = NULL;
+    int                     ret = MB_OK;
+    int                     j;
+
+    p = mb_json_skip_ws(p);
+
+    if (*p != '[')
+        return (mb_json_unpack_check_result_batch(msg, handler));
+
+    p = mb_json_skip_ws(p + 1);
+
+    while (*p != ']') {
+        if (count == size) {
+            size = (size > 0 ? size * 2 : 16);
+
+            if (!(grown = realloc(entries, size * sizeof(mb_json_batch_entry_t)))) {
+                logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_decode_check_result_batch: error: "
+                "unable to allocate memory");
+                ret = MB_NOK;
+                break;
+            }
+
+            entries = grown;
+        }
+
+        memset(&entries[count], 0, sizeof(mb_json_batch_entry_t));
+        count++;
+
+        if ((ret = mb_json_decode_batch_entry(&p, &entries[count - 1])) != MB_OK)
+            break;
+
+        p = mb_json_skip_ws(p);
+
+        if (*p == ',') {
+            p = mb_json_skip_ws(p + 1);
+
+            if (*p == ']')
+                ret = MB_NOK;
+        } else if (*p != ']')
+            ret = MB_NOK;
+
+        if (ret != MB_OK)
+            break;
+    }
+
+    /* Nothing but whitespace may follow the array */
+    if (ret == MB_OK && *mb_json_skip_ws(p + 1) != '\0')
+        ret = MB_NOK;
+
+    if (ret != MB_OK) {
+        mb_json_free_batch_entries(entries, count);
+        return (mb_json_unpack_check_result_batch(msg, handler));
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (!entries[i].cid) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_json_decode_check_result_batch: error: "
+            "missing `correlation_id` entry in batch entry #%zu, skipping", i);
+            continue;
+        }
+
+        if (!entries[i].cr) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_json_decode_check_result_batch: error: "
+            "unable to unpack check result in batch entry #%zu, skipping", entries[i].cid, i);
+            continue;
+        }
+
+        for (missing = NULL, j = 0; j < MB_JSON_REQUIRED_FIELDS && !missing; j++) {
+            if (!(entries[i].seen & (1U << mb_json_result_fields[j].id)))
+                missing = mb_json_result_fields[j].name;
+        }
+
+        if (missing) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_json_decode_check_result_batch: error: "
+            "missing `%s` entry in batch entry #%zu, skipping", entries[i].cid, missing, i);
+            continue;
+        }
+
+        handler(entries[i].cid, entries[i].cr);
+        entries[i].cr = NULL;
+    }
+
+    mb_json_free_batch_entries(entries, count);
+
+    return (MB_OK);
+/* }}} */
+}
+
 // vim: ft=c ts=4 et foldmethod=marker
@@ -34,6 +34,46 @@ typedef struct mb_json_config_setting_s {
     int         (*check)(void *);
 } mb_json_config_setting_t;
 
+/* Returned by the fast check result decoder for valid input it leaves to jansson */
+#define MB_JSON_UNSUPPORTED     2
+#define MB_JSON_MAX_DEPTH       32
+#define MB_JSON_REQUIRED_FIELDS 4
+
+enum mb_json_types {
+    MB_JSON_TYPE_STRING,
+    MB_JSON_TYPE_INTEGER,
+    MB_JSON_TYPE_REAL,
+};
+
+enum mb_json_result_fields {
+    MB_JSON_FIELD_HOST_NAME,
+    MB_JSON_FIELD_RETURN_CODE,
+    MB_JSON_FIELD_START_TIME,
+    MB_JSON_FIELD_FINISH_TIME,
+    MB_JSON_FIELD_SERVICE_DESCRIPTION,
+    MB_JSON_FIELD_OUTPUT,
+    MB_JSON_FIELD_CHECK_OPTIONS,
+    MB_JSON_FIELD_SCHEDULED_CHECK,
+    MB_JSON_FIELD_RESCHEDULE_CHECK,
+    MB_JSON_FIELD_EXITED_OK,
+    MB_JSON_FIELD_EARLY_TIMEOUT,
+    MB_JSON_FIELD_LATENCY,
+};
+
+typedef struct mb_json_result_field_s {
+    const char  *name;
+    size_t      len;
+    int         id;
+    int         type;
+} mb_json_result_field_t;
+
+/* Batch entry met by the fast decoder, submitted once the whole batch is known to be valid */
+typedef struct mb_json_batch_entry_s {
+    char            *cid;
+    check_result    *cr;
+    unsigned int    seen;
+} mb_json_batch_entry_t;
+
 #endif
 
 // vim: ft=c ts=4 et foldmethod=marker
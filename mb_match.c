@@ -0,0 +1,249 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#include <limits.h>
+
+#include "mod_bunny.h"
+#include "mb_match.h"
+
+/*
+    Compiled set of group patterns answering "which pattern with the lowest priority
+    matches this name" without trying every pattern with fnmatch(): literal names are
+    looked up in a hash set, and only the globs sharing their literal prefix with the
+    name are actually matched.
+*/
+
+mb_matcher_t *mb_matcher_new(void) {
+/* {{{ */
+    mb_matcher_t *matcher = NULL;
+
+    if (!(matcher = calloc(1, sizeof(mb_matcher_t)))
+        || !(matcher->literals = calloc(MB_MATCH_MIN_SLOTS, sizeof(mb_match_entry_t)))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_matcher_new: error: "
+            "unable to allocate memory");
+        free(matcher);
+        return (NULL);
+    }
+
+    matcher->literals_mask = MB_MATCH_MIN_SLOTS - 1;
+
+    return (matcher);
+/* }}} */
+}
+
+static void mb_matcher_free_node(mb_match_node_t *node) {
+/* {{{ */
+    mb_match_node_t *child = NULL;
+
+    while ((child = node->child)) {
+        node->child = child->sibling;
+        mb_matcher_free_node(child);
+        free(child);
+    }
+
+    for (int i = 0; i < node->globs_count; i++)
+        free(node->globs[i].pattern);
+
+    free(node->globs);
+/* }}} */
+}
+
+void mb_matcher_free(mb_matcher_t *matcher) {
+/* {{{ */
+    if (!matcher)
+        return;
+
+    for (size_t i = 0; i <= matcher->literals_mask; i++)
+        free(matcher->literals[i].pattern);
+
+    free(matcher->literals);
+    mb_matcher_free_node(&matcher->root);
+    free(matcher);
+/* }}} */
+}
+
+static mb_match_entry_t *mb_matcher_literal_slot(mb_match_entry_t *literals, size_t mask, const char *name) {
+/* {{{ */
+    size_t i = mb_hash_str(name) & mask;
+
+    /* The table is never full, so probing always ends on the name or an empty slot */
+    while (literals[i].pattern && strcmp(literals[i].pattern, name) != 0)
+        i = (i + 1) & mask;
+
+    return (&literals[i]);
+/* }}} */
+}
+
+static int mb_matcher_add_literal(mb_matcher_t *matcher, const char *pattern, int priority, void *data) {
+/* {{{ */
+    mb_match_entry_t    *literals = NULL;
+    mb_match_entry_t    *slot = NULL;
+    size_t              mask;
+
+    /* Keep the load factor under 1/2 */
+    if ((matcher->literals_count + 1) * 2 > matcher->literals_mask + 1) {
+        mask = (matcher->literals_mask << 1) | 1;
+
+        if (!(literals = calloc(mask + 1, sizeof(mb_match_entry_t))))
+            return (MB_NOK);
+
+        for (size_t i = 0; i <= matcher->literals_mask; i++) {
+            if (matcher->literals[i].pattern)
+                *mb_matcher_literal_slot(literals, mask, matcher->literals[i].pattern) = matcher->literals[i];
+        }
+
+        free(matcher->literals);
+        matcher->literals = literals;
+        matcher->literals_mask = mask;
+    }
+
+    slot = mb_matcher_literal_slot(matcher->literals, matcher->literals_mask, pattern);
+
+    if (slot->pattern) {
+        /* Same name listed several times, only the best priority matters */
+        if (priority < slot->priority) {
+            slot->priority = priority;
+            slot->data = data;
+        }
+
+        return (MB_OK);
+    }
+
+    if (!(slot->pattern = strdup(pattern)))
+        return (MB_NOK);
+
+    slot->priority = priority;
+    slot->data = data;
+    matcher->literals_count++;
+
+    return (MB_OK);
+/* }}} */
+}
+
+static int mb_matcher_add_glob(mb_matcher_t *matcher, const char *pattern, size_t prefix_len, int priority,
+    void *data) {
+/* {{{ */
+    mb_match_node_t     *node = &matcher->root;
+    mb_match_node_t     *child = NULL;
+    mb_match_entry_t    *globs = NULL;
+    int                 i;
+
+    /* Walk down the literal prefix, creating missing nodes */
+    for (size_t n = 0; n < prefix_len; n++) {
+        for (child = node->child; child && child->c != (unsigned char)pattern[n]; child = child->sibling)
+            ;
+
+        if (!child) {
+            if (!(child = calloc(1, sizeof(mb_match_node_t))))
+                return (MB_NOK);
+
+            child->c = (unsigned char)pattern[n];
+            child->sibling = node->child;
+            node->child = child;
+        }
+
+        node = child;
+    }
+
+    if (!(globs = realloc(node->globs, (node->globs_count + 1) * sizeof(mb_match_entry_t))))
+        return (MB_NOK);
+
+    node->globs = globs;
+
+    /* Keep globs sorted by priority, so that the first match in a node is the best one */
+    for (i = node->globs_count; i > 0 && globs[i - 1].priority > priority; i--)
+        globs[i] = globs[i - 1];
+
+    if (!(globs[i].pattern = strdup(pattern))) {
+        memmove(&globs[i], &globs[i + 1], (node->globs_count - i) * sizeof(mb_match_entry_t));
+        return (MB_NOK);
+    }
+
+    globs[i].priority = priority;
+    globs[i].data = data;
+    node->globs_count++;
+
+    return (MB_OK);
+/* }}} */
+}
+
+int mb_matcher_add(mb_matcher_t *matcher, const char *pattern, int priority, void *data) {
+/* {{{ */
+    size_t  prefix_len = strcspn(pattern, MB_MATCH_GLOB_CHARS);
+    int     rc;
+
+    if (pattern[prefix_len] == '\0')
+        rc = mb_matcher_add_literal(matcher, pattern, priority, data);
+    else
+        rc = mb_matcher_add_glob(matcher, pattern, prefix_len, priority, data);
+
+    if (!rc)
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_matcher_add: error: "
+            "unable to allocate memory");
+
+    return (rc);
+/* }}} */
+}
+
+/* Returns the data of the matching pattern with the lowest priority, NULL if none matches */
+void *mb_matcher_lookup(mb_matcher_t *matcher, const char *name) {
+/* {{{ */
+    mb_match_node_t     *node = &matcher->root;
+    mb_match_entry_t    *slot = NULL;
+    const char          *p = name;
+    int                 best = INT_MAX;
+    void                *data = NULL;
+
+    if (matcher->literals_count > 0) {
+        slot = mb_matcher_literal_slot(matcher->literals, matcher->literals_mask, name);
+
+        if (slot->pattern) {
+            best = slot->priority;
+            data = slot->data;
+        }
+    }
+
+    /* Follow the name down the trie, trying the globs whose literal prefix it starts with */
+    while (node) {
+        for (int i = 0; i < node->globs_count && node->globs[i].priority < best; i++) {
+            if (fnmatch(node->globs[i].pattern, name, 0) == 0) {
+                best = node->globs[i].priority;
+                data = node->globs[i].data;
+                break;
+            }
+        }
+
+        if (*p == '\0')
+            break;
+
+        for (node = node->child; node && node->c != (unsigned char)*p; node = node->sibling)
+            ;
+
+        p++;
+    }
+
+    return (data);
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
@@ -0,0 +1,68 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#ifndef _MB_MATCH_H_
+#define _MB_MATCH_H_
+
+/* Characters making a group pattern a glob rather than a literal name (fnmatch() without flags) */
+#define MB_MATCH_GLOB_CHARS     "*?[\\"
+#define MB_MATCH_MIN_SLOTS      16
+
+/* Pattern compiled into a matcher: lower priorities win */
+typedef struct mb_match_entry_s {
+/* {{{ */
+    char    *pattern;
+    int     priority;
+    void    *data;
+/* }}} */
+} mb_match_entry_t;
+
+/*
+    Globs are stored in a trie keyed by their literal prefix (the characters before the
+    first wildcard), so only the globs whose prefix is a prefix of the name get tried.
+    Children are kept as a sibling list, tries built from group names being sparse.
+*/
+typedef struct mb_match_node_s {
+/* {{{ */
+    unsigned char           c;
+    struct mb_match_node_s  *child;
+    struct mb_match_node_s  *sibling;
+    mb_match_entry_t        *globs;
+    int                     globs_count;
+/* }}} */
+} mb_match_node_t;
+
+struct mb_matcher_s {
+/* {{{ */
+    /* Literal names, open addressing hash set */
+    mb_match_entry_t    *literals;
+    size_t              literals_mask;
+    size_t              literals_count;
+
+    mb_match_node_t     root;
+/* }}} */
+};
+
+#endif
+
+// vim: ft=c ts=4 et foldmethod=marker
@@ -0,0 +1,795 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+
+#include "mod_bunny.h"
+#include "mb_msgpack.h"
+
+/*
+    MessagePack encoding of check messages and check results: same keys as the JSON
+    format, but timestamps are integer microseconds since the Epoch instead of floating
+    point seconds.
+*/
+
+#define MB_MSGPACK_KEY_IS(k, l, s) ((l) == sizeof(s) - 1 && memcmp(k, s, sizeof(s) - 1) == 0)
+
+/* Only used from the Nagios event loop, so no locking needed */
+static mb_buf_t mb_msgpack_check_buf;
+
+static inline int mb_msgpack_write_header(mb_buf_t *buf, unsigned char type, uint64_t value, int size) {
+/* {{{ */
+    unsigned char   header[9];
+    int             len = 0;
+
+    header[len++] = type;
+
+    for (int shift = (size - 1) * 8; shift >= 0; shift -= 8)
+        header[len++] = (value >> shift) & 0xFF;
+
+    return (mb_buf_append(buf, (const char *)header, len));
+/* }}} */
+}
+
+int mb_msgpack_write_map(mb_buf_t *buf, uint32_t count) {
+/* {{{ */
+    unsigned char c;
+
+    if (count < 16) {
+        c = 0x80 | count;
+        return (mb_buf_append(buf, (const char *)&c, 1));
+    } else if (count <= 0xFFFF)
+        return (mb_msgpack_write_header(buf, MB_MSGPACK_MAP16, count, 2));
+
+    return (mb_msgpack_write_header(buf, MB_MSGPACK_MAP32, count, 4));
+/* }}} */
+}
+
+int mb_msgpack_write_array(mb_buf_t *buf, uint32_t count) {
+/* {{{ */
+    unsigned char c;
+
+    if (count < 16) {
+        c = 0x90 | count;
+        return (mb_buf_append(buf, (const char *)&c, 1));
+    } else if (count <= 0xFFFF)
+        return (mb_msgpack_write_header(buf, MB_MSGPACK_ARRAY16, count, 2));
+
+    return (mb_msgpack_write_header(buf, MB_MSGPACK_ARRAY32, count, 4));
+/* }}} */
+}
+
+int mb_msgpack_write_str(mb_buf_t *buf, const char *str, size_t len) {
+/* {{{ */
+    unsigned char   c;
+    int             rc;
+
+    if (!str)
+        return (MB_NOK);
+
+    if (len < 32) {
+        c = 0xA0 | len;
+        rc = mb_buf_append(buf, (const char *)&c, 1);
+    } else if (len <= 0xFF)
+        rc = mb_msgpack_write_header(buf, MB_MSGPACK_STR8, len, 1);
+    else if (len <= 0xFFFF)
+        rc = mb_msgpack_write_header(buf, MB_MSGPACK_STR16, len, 2);
+    else if (len <= 0xFFFFFFFF)
+        rc = mb_msgpack_write_header(buf, MB_MSGPACK_STR32, len, 4);
+    else
+        return (MB_NOK);
+
+    return (rc && mb_buf_append(buf, str, len));
+/* }}} */
+}
+
+int mb_msgpack_write_int(mb_buf_t *buf, int64_t value) {
+/* {{{ */
+    unsigned char c;
+
+    /* Use the smallest representation, like reference implementations do */
+    if (value >= 0) {
+        if (value < 128) {
+            c = value;
+            return (mb_buf_append(buf, (const char *)&c, 1));
+        } else if (value <= 0xFF)
+            return (mb_msgpack_write_header(buf, MB_MSGPACK_UINT8, value, 1));
+        else if (value <= 0xFFFF)
+            return (mb_msgpack_write_header(buf, MB_MSGPACK_UINT16, value, 2));
+        else if (value <= 0xFFFFFFFFLL)
+            return (mb_msgpack_write_header(buf, MB_MSGPACK_UINT32, value, 4));
+
+        return (mb_msgpack_write_header(buf, MB_MSGPACK_UINT64, value, 8));
+    }
+
+    if (value >= -32) {
+        c = (unsigned char)(int8_t)value;
+        return (mb_buf_append(buf, (const char *)&c, 1));
+    } else if (value >= INT8_MIN)
+        return (mb_msgpack_write_header(buf, MB_MSGPACK_INT8, (uint64_t)value, 1));
+    else if (value >= INT16_MIN)
+        return (mb_msgpack_write_header(buf, MB_MSGPACK_INT16, (uint64_t)value, 2));
+    else if (value >= INT32_MIN)
+        return (mb_msgpack_write_header(buf, MB_MSGPACK_INT32, (uint64_t)value, 4));
+
+    return (mb_msgpack_write_header(buf, MB_MSGPACK_INT64, (uint64_t)value, 8));
+/* }}} */
+}
+
+int mb_msgpack_write_float(mb_buf_t *buf, double value) {
+/* {{{ */
+    uint64_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+
+    return (mb_msgpack_write_header(buf, MB_MSGPACK_FLOAT64, bits, 8));
+/* }}} */
+}
+
+static inline int mb_msgpack_write_cstr(mb_buf_t *buf, const char *str) {
+/* {{{ */
+    return (str ? mb_msgpack_write_str(buf, str, strlen(str)) : MB_NOK);
+/* }}} */
+}
+
+static inline int64_t mb_msgpack_timeval_to_us(struct timeval *tv) {
+/* {{{ */
+    return ((int64_t)tv->tv_sec * 1000000 + tv->tv_usec);
+/* }}} */
+}
+
+/* Command line in full, or command template ID and arguments (one more map entry) */
+static int mb_msgpack_write_check_command(mb_buf_t *buf, mb_check_command_t *check_cmd) {
+/* {{{ */
+    if (!check_cmd->template_id)
+        return (mb_msgpack_write_cstr(buf, "command_line")
+            && mb_msgpack_write_cstr(buf, check_cmd->line));
+
+    if (!mb_msgpack_write_cstr(buf, "command_template")
+        || !mb_msgpack_write_str(buf, check_cmd->template_id, MB_COMMAND_TEMPLATE_ID_LEN)
+        || !mb_msgpack_write_cstr(buf, "command_args")
+        || !mb_msgpack_write_array(buf, check_cmd->nargs))
+        return (MB_NOK);
+
+    for (int i = 0; i < check_cmd->nargs; i++) {
+        if (!mb_msgpack_write_str(buf, check_cmd->args[i], check_cmd->args_len[i]))
+            return (MB_NOK);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+/*
+    Check packers write into a buffer reused from one check to the next, the message they
+    return is only valid until the next call.
+*/
+const char *mb_msgpack_pack_host_check(nebstruct_host_check_data *hst_check, int check_options,
+    mb_check_command_t *check_cmd, size_t *len) {
+/* {{{ */
+    mb_buf_t *buf = &mb_msgpack_check_buf;
+
+    if (!hst_check)
+        return (NULL);
+
+    mb_buf_reset(buf);
+
+    if (!mb_msgpack_write_map(buf, (check_cmd->template_id ? 8 : 7))
+        || !mb_msgpack_write_cstr(buf, "type")
+        || !mb_msgpack_write_cstr(buf, "host")
+        || !mb_msgpack_write_cstr(buf, "host_name")
+        || !mb_msgpack_write_cstr(buf, (hst_check->host_name ? hst_check->host_name : ""))
+        || !mb_msgpack_write_check_command(buf, check_cmd)
+        || !mb_msgpack_write_cstr(buf, "check_options")
+        || !mb_msgpack_write_int(buf, check_options)
+        || !mb_msgpack_write_cstr(buf, "start_time")
+        || !mb_msgpack_write_int(buf, mb_msgpack_timeval_to_us(&hst_check->start_time))
+        || !mb_msgpack_write_cstr(buf, "latency")
+        || !mb_msgpack_write_float(buf, hst_check->latency)
+        || !mb_msgpack_write_cstr(buf, "timeout")
+        || !mb_msgpack_write_int(buf, hst_check->timeout)) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_msgpack_pack_host_check: error: "
+            "unable to encode host check");
+        return (NULL);
+    }
+
+    *len = buf->len;
+
+    return (buf->data);
+/* }}} */
+}
+
+const char *mb_msgpack_pack_service_check(nebstruct_service_check_data *svc_check, int check_options,
+    mb_check_command_t *check_cmd, size_t *len) {
+/* {{{ */
+    mb_buf_t *buf = &mb_msgpack_check_buf;
+
+    if (!svc_check)
+        return (NULL);
+
+    mb_buf_reset(buf);
+
+    if (!mb_msgpack_write_map(buf, (check_cmd->template_id ? 9 : 8))
+        || !mb_msgpack_write_cstr(buf, "type")
+        || !mb_msgpack_write_cstr(buf, "service")
+        || !mb_msgpack_write_cstr(buf, "host_name")
+        || !mb_msgpack_write_cstr(buf, (svc_check->host_name ? svc_check->host_name : ""))
+        || !mb_msgpack_write_cstr(buf, "service_description")
+        || !mb_msgpack_write_cstr(buf,
+            (svc_check->service_description ? svc_check->service_description : ""))
+        || !mb_msgpack_write_check_command(buf, check_cmd)
+        || !mb_msgpack_write_cstr(buf, "check_options")
+        || !mb_msgpack_write_int(buf, check_options)
+        || !mb_msgpack_write_cstr(buf, "start_time")
+        || !mb_msgpack_write_int(buf, mb_msgpack_timeval_to_us(&svc_check->start_time))
+        || !mb_msgpack_write_cstr(buf, "latency")
+        || !mb_msgpack_write_float(buf, svc_check->latency)
+        || !mb_msgpack_write_cstr(buf, "timeout")
+        || !mb_msgpack_write_int(buf, svc_check->timeout)) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_msgpack_pack_service_check: error: "
+            "unable to encode service check");
+        return (NULL);
+    }
+
+    *len = buf->len;
+
+    return (buf->data);
+/* }}} */
+}
+
+/* Command template definition, its parts being joined with the values of the check arguments */
+const char *mb_msgpack_pack_command_template(mb_command_template_t *tmpl, size_t *len) {
+/* {{{ */
+    mb_buf_t    *buf = &mb_msgpack_check_buf;
+    const char  *part = tmpl->text;
+
+    mb_buf_reset(buf);
+
+    if (!mb_msgpack_write_map(buf, 3)
+        || !mb_msgpack_write_cstr(buf, "type")
+        || !mb_msgpack_write_cstr(buf, "command_template")
+        || !mb_msgpack_write_cstr(buf, "command_template")
+        || !mb_msgpack_write_str(buf, tmpl->id, MB_COMMAND_TEMPLATE_ID_LEN)
+        || !mb_msgpack_write_cstr(buf, "command_parts")
+        || !mb_msgpack_write_array(buf, tmpl->nargs + 1))
+        goto error;
+
+    for (int i = 0; i <= tmpl->nargs; part += tmpl->parts[i++] + 1) {
+        if (!mb_msgpack_write_str(buf, part, tmpl->parts[i]))
+            goto error;
+    }
+
+    *len = buf->len;
+
+    return (buf->data);
+
+    error:
+    logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_msgpack_pack_command_template: error: "
+        "unable to encode command template");
+
+    return (NULL);
+/* }}} */
+}
+
+void mb_msgpack_free_buffers(void) {
+/* {{{ */
+    mb_buf_free(&mb_msgpack_check_buf);
+/* }}} */
+}
+
+static inline int mb_msgpack_read_uint(mb_msgpack_reader_t *r, int size, uint64_t *value) {
+/* {{{ */
+    if (r->end - r->p < size)
+        return (MB_NOK);
+
+    *value = 0;
+
+    for (int i = 0; i < size; i++)
+        *value = (*value << 8) | *r->p++;
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline int mb_msgpack_read_type(mb_msgpack_reader_t *r, unsigned char *type) {
+/* {{{ */
+    if (r->p >= r->end)
+        return (MB_NOK);
+
+    *type = *r->p++;
+
+    return (MB_OK);
+/* }}} */
+}
+
+static int mb_msgpack_read_container(mb_msgpack_reader_t *r, bool map, uint32_t *count) {
+/* {{{ */
+    unsigned char   type;
+    uint64_t        value;
+
+    if (!mb_msgpack_read_type(r, &type))
+        return (MB_NOK);
+
+    if (map && type >= 0x80 && type <= 0x8F)
+        *count = type & 0x0F;
+    else if (!map && type >= 0x90 && type <= 0x9F)
+        *count = type & 0x0F;
+    else if (type == (map ? MB_MSGPACK_MAP16 : MB_MSGPACK_ARRAY16) && mb_msgpack_read_uint(r, 2, &value))
+        *count = value;
+    else if (type == (map ? MB_MSGPACK_MAP32 : MB_MSGPACK_ARRAY32) && mb_msgpack_read_uint(r, 4, &value))
+        *count = value;
+    else
+        return (MB_NOK);
+
+    return (MB_OK);
+/* }}} */
+}
+
+/* Read a string (or binary) value, pointing into the message buffer */
+static int mb_msgpack_read_str(mb_msgpack_reader_t *r, const char **str, size_t *len) {
+/* {{{ */
+    unsigned char   type;
+    uint64_t        value;
+
+    if (!mb_msgpack_read_type(r, &type))
+        return (MB_NOK);
+
+    if (type >= 0xA0 && type <= 0xBF)
+        value = type & 0x1F;
+    else if ((type == MB_MSGPACK_STR8 || type == MB_MSGPACK_BIN8) && mb_msgpack_read_uint(r, 1, &value))
+        ;
+    else if ((type == MB_MSGPACK_STR16 || type == MB_MSGPACK_BIN16) && mb_msgpack_read_uint(r, 2, &value))
+        ;
+    else if ((type == MB_MSGPACK_STR32 || type == MB_MSGPACK_BIN32) && mb_msgpack_read_uint(r, 4, &value))
+        ;
+    else
+        return (MB_NOK);
+
+    if ((uint64_t)(r->end - r->p) < value)
+        return (MB_NOK);
+
+    *str = (const char *)r->p;
+    *len = value;
+    r->p += value;
+
+    return (MB_OK);
+/* }}} */
+}
+
+/* Read an integer, booleans being accepted as 0 and 1 */
+static int mb_msgpack_read_int(mb_msgpack_reader_t *r, int64_t *integer) {
+/* {{{ */
+    unsigned char   type;
+    uint64_t        value;
+
+    if (!mb_msgpack_read_type(r, &type))
+        return (MB_NOK);
+
+    if (type <= 0x7F)
+        *integer = type;
+    else if (type >= 0xE0)
+        *integer = (int8_t)type;
+    else if (type == MB_MSGPACK_FALSE || type == MB_MSGPACK_TRUE)
+        *integer = (type == MB_MSGPACK_TRUE);
+    else if (type >= MB_MSGPACK_UINT8 && type <= MB_MSGPACK_UINT64) {
+        if (!mb_msgpack_read_uint(r, 1 << (type - MB_MSGPACK_UINT8), &value) || value > INT64_MAX)
+            return (MB_NOK);
+
+        *integer = value;
+    } else if (type >= MB_MSGPACK_INT8 && type <= MB_MSGPACK_INT64) {
+        if (!mb_msgpack_read_uint(r, 1 << (type - MB_MSGPACK_INT8), &value))
+            return (MB_NOK);
+
+        /* Sign-extend */
+        switch (type) {
+            case MB_MSGPACK_INT8:   *integer = (int8_t)value; break;
+            case MB_MSGPACK_INT16:  *integer = (int16_t)value; break;
+            case MB_MSGPACK_INT32:  *integer = (int32_t)value; break;
+            default:                *integer = (int64_t)value;
+        }
+    } else
+        return (MB_NOK);
+
+    return (MB_OK);
+/* }}} */
+}
+
+/* Read a floating point number, integers being accepted too */
+static int mb_msgpack_read_float(mb_msgpack_reader_t *r, double *real) {
+/* {{{ */
+    uint64_t    value;
+    int64_t     integer;
+    uint32_t    bits32;
+    float       f;
+
+    if (r->p >= r->end)
+        return (MB_NOK);
+
+    if (*r->p == MB_MSGPACK_FLOAT64) {
+        r->p++;
+
+        if (!mb_msgpack_read_uint(r, 8, &value))
+            return (MB_NOK);
+
+        memcpy(real, &value, sizeof(*real));
+    } else if (*r->p == MB_MSGPACK_FLOAT32) {
+        r->p++;
+
+        if (!mb_msgpack_read_uint(r, 4, &value))
+            return (MB_NOK);
+
+        bits32 = value;
+        memcpy(&f, &bits32, sizeof(f));
+        *real = f;
+    } else {
+        if (!mb_msgpack_read_int(r, &integer))
+            return (MB_NOK);
+
+        *real = integer;
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+static int mb_msgpack_skip(mb_msgpack_reader_t *r, int depth) {
+/* {{{ */
+    unsigned char   type;
+    uint64_t        value;
+    uint64_t        skip = 0;
+    uint32_t        count;
+
+    if (depth > MB_MSGPACK_MAX_DEPTH || r->p >= r->end)
+        return (MB_NOK);
+
+    type = *r->p;
+
+    /* Containers: skip each of their elements */
+    if ((type >= 0x80 && type <= 0x9F) || (type >= MB_MSGPACK_ARRAY16 && type <= MB_MSGPACK_MAP32)) {
+        bool map = ((type >= 0x80 && type <= 0x8F) || type == MB_MSGPACK_MAP16 || type == MB_MSGPACK_MAP32);
+
+        if (!mb_msgpack_read_container(r, map, &count))
+            return (MB_NOK);
+
+        for (uint64_t i = 0; i < (map ? 2 * (uint64_t)count : count); i++) {
+            if (!mb_msgpack_skip(r, depth + 1))
+                return (MB_NOK);
+        }
+
+        return (MB_OK);
+    }
+
+    r->p++;
+
+    if (type <= 0x7F || type >= 0xE0 || type == MB_MSGPACK_NIL
+        || type == MB_MSGPACK_FALSE || type == MB_MSGPACK_TRUE)
+        return (MB_OK);
+    else if (type >= 0xA0 && type <= 0xBF)
+        skip = type & 0x1F;
+    else if (type == MB_MSGPACK_STR8 || type == MB_MSGPACK_BIN8) {
+        if (!mb_msgpack_read_uint(r, 1, &skip))
+            return (MB_NOK);
+    } else if (type == MB_MSGPACK_STR16 || type == MB_MSGPACK_BIN16) {
+        if (!mb_msgpack_read_uint(r, 2, &skip))
+            return (MB_NOK);
+    } else if (type == MB_MSGPACK_STR32 || type == MB_MSGPACK_BIN32) {
+        if (!mb_msgpack_read_uint(r, 4, &skip))
+            return (MB_NOK);
+    } else if (type >= MB_MSGPACK_EXT8 && type <= MB_MSGPACK_EXT32) {
+        if (!mb_msgpack_read_uint(r, 1 << (type - MB_MSGPACK_EXT8), &value))
+            return (MB_NOK);
+
+        skip = value + 1; /* Extension type byte */
+    } else if (type == MB_MSGPACK_FLOAT32)
+        skip = 4;
+    else if (type == MB_MSGPACK_FLOAT64)
+        skip = 8;
+    else if (type >= MB_MSGPACK_UINT8 && type <= MB_MSGPACK_UINT64)
+        skip = 1 << (type - MB_MSGPACK_UINT8);
+    else if (type >= MB_MSGPACK_INT8 && type <= MB_MSGPACK_INT64)
+        skip = 1 << (type - MB_MSGPACK_INT8);
+    else if (type >= MB_MSGPACK_FIXEXT1 && type <= MB_MSGPACK_FIXEXT16)
+        skip = (1 << (type - MB_MSGPACK_FIXEXT1)) + 1;
+    else
+        return (MB_NOK);
+
+    if ((uint64_t)(r->end - r->p) < skip)
+        return (MB_NOK);
+
+    r->p += skip;
+
+    return (MB_OK);
+/* }}} */
+}
+
+/* Read a string value into a new allocation, nil giving NULL */
+static int mb_msgpack_read_strdup(mb_msgpack_reader_t *r, char **dst, size_t *len) {
+/* {{{ */
+    const char *str = NULL;
+
+    *dst = NULL;
+    *len = 0;
+
+    if (r->p < r->end && *r->p == MB_MSGPACK_NIL) {
+        r->p++;
+        return (MB_OK);
+    }
+
+    if (!mb_msgpack_read_str(r, &str, len))
+        return (MB_NOK);
+
+    if (!(*dst = malloc(*len + 1))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_msgpack_read_strdup: error: "
+            "unable to allocate memory");
+        return (MB_NOK);
+    }
+
+    memcpy(*dst, str, *len);
+    (*dst)[*len] = '\0';
+
+    return (MB_OK);
+/* }}} */
+}
+
+static inline void mb_msgpack_us_to_timeval(int64_t us, struct timeval *tv) {
+/* {{{ */
+    tv->tv_sec = us / 1000000;
+    tv->tv_usec = us % 1000000;
+
+    if (tv->tv_usec < 0) {
+        tv->tv_sec--;
+        tv->tv_usec += 1000000;
+    }
+/* }}} */
+}
+
+static check_result *mb_msgpack_read_check_result(mb_msgpack_reader_t *r) {
+/* {{{ */
+    check_result    *cr = NULL;
+    const char      *key = NULL;
+    size_t          key_len;
+    char            *str = NULL;
+    size_t          len;
+    int64_t         integer;
+    uint32_t        count;
+    bool            has_host_name = false;
+    bool            has_return_code = false;
+    bool            has_start_time = false;
+    bool            has_finish_time = false;
+
+    if (!mb_msgpack_read_container(r, true, &count)) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_msgpack_unpack_check_result: error: "
+            "received MessagePack data is not a map");
+        return (NULL);
+    }
+
+    if (!(cr = mb_new_check_result())) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_msgpack_unpack_check_result: error: "
+            "unable to allocate memory");
+        return (NULL);
+    }
+
+    init_check_result(cr);
+    cr->output_file = NULL;
+
+    for (uint32_t i = 0; i < count; i++) {
+        if (!mb_msgpack_read_str(r, &key, &key_len))
+            goto malformed;
+
+        if (MB_MSGPACK_KEY_IS(key, key_len, "host_name")) {
+            if (!mb_msgpack_read_strdup(r, &str, &len))
+                goto malformed;
+
+            free(cr->host_name);
+            cr->host_name = str;
+            has_host_name = true;
+        } else if (MB_MSGPACK_KEY_IS(key, key_len, "service_description")) {
+            if (!mb_msgpack_read_strdup(r, &str, &len))
+                goto malformed;
+
+            free(cr->service_description);
+            cr->service_description = NULL;
+            cr->object_check_type = HOST_CHECK;
+
+            /* Only a non-empty service description makes it a service check result */
+            if (str && len > 0) {
+                cr->service_description = str;
+                cr->object_check_type = SERVICE_CHECK;
+            } else
+                free(str);
+        } else if (MB_MSGPACK_KEY_IS(key, key_len, "output")) {
+            if (!mb_msgpack_read_strdup(r, &str, &len))
+                goto malformed;
+
+            free(cr->output);
+            cr->output = str;
+        } else if (MB_MSGPACK_KEY_IS(key, key_len, "return_code")) {
+            if (!mb_msgpack_read_int(r, &integer))
+                goto malformed;
+
+            cr->return_code = integer;
+            has_return_code = true;
+        } else if (MB_MSGPACK_KEY_IS(key, key_len, "start_time")) {
+            if (!mb_msgpack_read_int(r, &integer))
+                goto malformed;
+
+            mb_msgpack_us_to_timeval(integer, &cr->start_time);
+            has_start_time = true;
+        } else if (MB_MSGPACK_KEY_IS(key, key_len, "finish_time")) {
+            if (!mb_msgpack_read_int(r, &integer))
+                goto malformed;
+
+            mb_msgpack_us_to_timeval(integer, &cr->finish_time);
+            has_finish_time = true;
+        } else if (MB_MSGPACK_KEY_IS(key, key_len, "check_options")) {
+            if (!mb_msgpack_read_int(r, &integer))
+                goto malformed;
+
+            cr->check_options = integer;
+        } else if (MB_MSGPACK_KEY_IS(key, key_len, "scheduled_check")) {
+            if (!mb_msgpack_read_int(r, &integer))
+                goto malformed;
+
+            cr->scheduled_check = integer;
+        } else if (MB_MSGPACK_KEY_IS(key, key_len, "reschedule_check")) {
+            if (!mb_msgpack_read_int(r, &integer))
+                goto malformed;
+
+            cr->reschedule_check = integer;
+        } else if (MB_MSGPACK_KEY_IS(key, key_len, "exited_ok")) {
+            if (!mb_msgpack_read_int(r, &integer))
+                goto malformed;
+
+            cr->exited_ok = integer;
+        } else if (MB_MSGPACK_KEY_IS(key, key_len, "early_timeout")) {
+            if (!mb_msgpack_read_int(r, &integer))
+                goto malformed;
+
+            cr->early_timeout = integer;
+        } else if (MB_MSGPACK_KEY_IS(key, key_len, "latency")) {
+            if (!mb_msgpack_read_float(r, &cr->latency))
+                goto malformed;
+        } else if (!mb_msgpack_skip(r, 1))
+            goto malformed;
+    }
+
+    if (!has_host_name || !has_return_code || !has_start_time || !has_finish_time) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_msgpack_unpack_check_result: error: "
+            "missing `%s` entry in received MessagePack data",
+            (!has_host_name ? "host_name" : !has_return_code ? "return_code"
+                : !has_start_time ? "start_time" : "finish_time"));
+        goto error;
+    }
+
+    return (cr);
+
+    malformed:
+    logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_msgpack_unpack_check_result: error: "
+        "unable to parse MessagePack data");
+
+    error:
+    free_check_result(cr);
+    free(cr);
+    return (NULL);
+/* }}} */
+}
+
+check_result *mb_msgpack_unpack_check_result(char *msg, size_t len) {
+/* {{{ */
+    mb_msgpack_reader_t r = { (const unsigned char *)msg, (const unsigned char *)msg + len };
+    check_result        *cr = NULL;
+
+    if (!(cr = mb_msgpack_read_check_result(&r)))
+        return (NULL);
+
+    if (r.p != r.end) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_msgpack_unpack_check_result: error: "
+            "trailing data after check result");
+        free_check_result(cr);
+        free(cr);
+        return (NULL);
+    }
+
+    return (cr);
+/* }}} */
+}
+
+int mb_msgpack_unpack_check_result_batch(char *msg, size_t len, void (*handler)(char *, check_result *)) {
+/* {{{ */
+    mb_msgpack_reader_t r = { (const unsigned char *)msg, (const unsigned char *)msg + len };
+    check_result        *cr = NULL;
+    char                cid[MB_CID_BUF_LEN];
+    const char          *key = NULL;
+    const char          *str = NULL;
+    size_t              key_len;
+    size_t              str_len;
+    uint32_t            entries;
+    uint32_t            count;
+    uint32_t            i;
+
+    if (!mb_msgpack_read_container(&r, false, &entries)) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_msgpack_unpack_check_result_batch: error: "
+            "received MessagePack data is not an array");
+        return (MB_NOK);
+    }
+
+    /* Each batch entry is {"correlation_id": "<cid>", "result": {<check result>}} */
+    for (i = 0; i < entries; i++) {
+        cid[0] = '\0';
+        cr = NULL;
+
+        if (!mb_msgpack_read_container(&r, true, &count))
+            goto malformed;
+
+        for (uint32_t j = 0; j < count; j++) {
+            if (!mb_msgpack_read_str(&r, &key, &key_len))
+                goto malformed;
+
+            if (MB_MSGPACK_KEY_IS(key, key_len, "correlation_id")) {
+                if (!mb_msgpack_read_str(&r, &str, &str_len))
+                    goto malformed;
+
+                if (str_len >= MB_CID_BUF_LEN)
+                    str_len = MB_CID_BUF_LEN - 1;
+
+                memcpy(cid, str, str_len);
+                cid[str_len] = '\0';
+            } else if (MB_MSGPACK_KEY_IS(key, key_len, "result") && !cr) {
+                /* A broken result stops the batch, since we can't tell where it ends */
+                if (!(cr = mb_msgpack_read_check_result(&r)))
+                    return (MB_NOK);
+            } else if (!mb_msgpack_skip(&r, 1))
+                goto malformed;
+        }
+
+        if (!cid[0] || !cr) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_msgpack_unpack_check_result_batch: error: "
+                "missing `%s` entry in batch entry #%u, skipping",
+                (!cid[0] ? "correlation_id" : "result"), i);
+
+            if (cr) {
+                free_check_result(cr);
+                free(cr);
+            }
+
+            continue;
+        }
+
+        handler(cid, cr);
+    }
+
+    return (MB_OK);
+
+    malformed:
+    logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_msgpack_unpack_check_result_batch: error: "
+        "unable to parse MessagePack data in batch entry #%u", i);
+
+    if (cr) {
+        free_check_result(cr);
+        free(cr);
+    }
+
+    return (MB_NOK);
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
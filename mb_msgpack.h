@@ -0,0 +1,69 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#ifndef _MB_MSGPACK_H_
+#define _MB_MSGPACK_H_
+
+/* MessagePack format bytes (https://github.com/msgpack/msgpack/blob/master/spec.md) */
+#define MB_MSGPACK_NIL          0xC0
+#define MB_MSGPACK_FALSE        0xC2
+#define MB_MSGPACK_TRUE         0xC3
+#define MB_MSGPACK_BIN8         0xC4
+#define MB_MSGPACK_BIN16        0xC5
+#define MB_MSGPACK_BIN32        0xC6
+#define MB_MSGPACK_EXT8         0xC7
+#define MB_MSGPACK_EXT16        0xC8
+#define MB_MSGPACK_EXT32        0xC9
+#define MB_MSGPACK_FLOAT32      0xCA
+#define MB_MSGPACK_FLOAT64      0xCB
+#define MB_MSGPACK_UINT8        0xCC
+#define MB_MSGPACK_UINT16       0xCD
+#define MB_MSGPACK_UINT32       0xCE
+#define MB_MSGPACK_UINT64       0xCF
+#define MB_MSGPACK_INT8         0xD0
+#define MB_MSGPACK_INT16        0xD1
+#define MB_MSGPACK_INT32        0xD2
+#define MB_MSGPACK_INT64        0xD3
+#define MB_MSGPACK_FIXEXT1      0xD4
+#define MB_MSGPACK_FIXEXT16     0xD8
+#define MB_MSGPACK_STR8         0xD9
+#define MB_MSGPACK_STR16        0xDA
+#define MB_MSGPACK_STR32        0xDB
+#define MB_MSGPACK_ARRAY16      0xDC
+#define MB_MSGPACK_ARRAY32      0xDD
+#define MB_MSGPACK_MAP16        0xDE
+#define MB_MSGPACK_MAP32        0xDF
+
+/* Nesting limit when skipping values we don't know about */
+#define MB_MSGPACK_MAX_DEPTH    32
+
+typedef struct mb_msgpack_reader_s {
+/* {{{ */
+    const unsigned char *p;
+    const unsigned char *end;
+/* }}} */
+} mb_msgpack_reader_t;
+
+#endif
+
+// vim: ft=c ts=4 et foldmethod=marker
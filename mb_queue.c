@@ -0,0 +1,181 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#include "mod_bunny.h"
+#include "mb_queue.h"
+
+mb_queue_t *mb_queue_new(size_t size) {
+/* {{{ */
+    mb_queue_t  *queue = NULL;
+    size_t      capacity = 2;
+
+    /* Round up queue capacity to the next power of 2 so we can mask instead of modulo */
+    while (capacity < size)
+        capacity <<= 1;
+
+    if (!(queue = calloc(1, sizeof(mb_queue_t)))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_queue_new: error: "
+            "unable to allocate memory");
+        return (NULL);
+    }
+
+    if (!(queue->cells = calloc(capacity, sizeof(mb_queue_cell_t)))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_queue_new: error: "
+            "unable to allocate memory");
+        free(queue);
+        return (NULL);
+    }
+
+    for (size_t i = 0; i < capacity; i++)
+        queue->cells[i].seq = i;
+
+    queue->mask = capacity - 1;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->consumer_sleeping = 0;
+
+    if (sem_init(&queue->wakeup, 0, 0) != 0) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_queue_new: error: "
+            "sem_init() failed");
+        free(queue->cells);
+        free(queue);
+        return (NULL);
+    }
+
+    return (queue);
+/* }}} */
+}
+
+void mb_queue_free(mb_queue_t *queue) {
+/* {{{ */
+    if (!queue)
+        return;
+
+    sem_destroy(&queue->wakeup);
+    free(queue->cells);
+    free(queue);
+/* }}} */
+}
+
+int mb_queue_push(mb_queue_t *queue, void *data) {
+/* {{{ */
+    mb_queue_cell_t *cell = NULL;
+    size_t          pos;
+    intptr_t        diff;
+
+    pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+
+    for (;;) {
+        cell = &queue->cells[pos & queue->mask];
+        diff = (intptr_t)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (intptr_t)pos;
+
+        if (diff == 0) {
+            /* Cell is free for this lap: try to claim it */
+            if (__atomic_compare_exchange_n(&queue->head, &pos, pos + 1, true,
+                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+                break;
+        } else if (diff < 0) {
+            /* Queue is full */
+            return (MB_NOK);
+        } else
+            pos = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    }
+
+    cell->data = data;
+    __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+    /*
+        Order the store above before the load below, so that either the consumer sees the new
+        message when re-checking in mb_queue_wait(), or we see it announcing it is sleeping
+    */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    /* Only pay for a wake-up syscall if the consumer is actually waiting */
+    if (__atomic_load_n(&queue->consumer_sleeping, __ATOMIC_SEQ_CST)
+        && __atomic_exchange_n(&queue->consumer_sleeping, 0, __ATOMIC_SEQ_CST))
+        sem_post(&queue->wakeup);
+
+    return (MB_OK);
+/* }}} */
+}
+
+void *mb_queue_pop(mb_queue_t *queue) {
+/* {{{ */
+    mb_queue_cell_t *cell = NULL;
+    size_t          pos;
+    void            *data = NULL;
+
+    /* Single consumer: nobody else moves the tail, no CAS needed */
+    pos = queue->tail;
+    cell = &queue->cells[pos & queue->mask];
+
+    if ((intptr_t)__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) - (intptr_t)(pos + 1) < 0)
+        return (NULL);
+
+    data = cell->data;
+    __atomic_store_n(&cell->seq, pos + queue->mask + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&queue->tail, pos + 1, __ATOMIC_RELAXED);
+
+    return (data);
+/* }}} */
+}
+
+size_t mb_queue_length(mb_queue_t *queue) {
+/* {{{ */
+    size_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    size_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+
+    return (head > tail ? head - tail : 0);
+/* }}} */
+}
+
+void mb_queue_wait(mb_queue_t *queue, int timeout_ms) {
+/* {{{ */
+    struct timespec deadline;
+    mb_queue_cell_t *cell = NULL;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    __atomic_store_n(&queue->consumer_sleeping, 1, __ATOMIC_SEQ_CST);
+
+    /* Re-check after announcing we're going to sleep, a producer may have raced us */
+    cell = &queue->cells[queue->tail & queue->mask];
+    if ((intptr_t)__atomic_load_n(&cell->seq, __ATOMIC_SEQ_CST) - (intptr_t)(queue->tail + 1) >= 0) {
+        __atomic_store_n(&queue->consumer_sleeping, 0, __ATOMIC_SEQ_CST);
+        return;
+    }
+
+    while (sem_timedwait(&queue->wakeup, &deadline) != 0 && errno == EINTR)
+        ;
+
+    __atomic_store_n(&queue->consumer_sleeping, 0, __ATOMIC_SEQ_CST);
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
@@ -0,0 +1,60 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#ifndef _MB_QUEUE_H_
+#define _MB_QUEUE_H_
+
+#include <semaphore.h>
+
+/* Pad hot fields to their own cache line to avoid false sharing between producers and consumer */
+#define MB_CACHE_LINE_LEN 64
+
+/*
+    Bounded lock-free multi-producer/single-consumer queue (Dmitry Vyukov's bounded
+    queue algorithm): each cell carries a sequence number telling producers and the
+    consumer whether it is free or holds data for the current lap of the ring.
+*/
+typedef struct mb_queue_cell_s {
+/* {{{ */
+    size_t  seq;
+    void    *data;
+/* }}} */
+} mb_queue_cell_t;
+
+struct mb_queue_s {
+/* {{{ */
+    mb_queue_cell_t *cells;
+    size_t          mask;
+    char            pad0[MB_CACHE_LINE_LEN];
+    size_t          head;
+    char            pad1[MB_CACHE_LINE_LEN];
+    size_t          tail;
+    char            pad2[MB_CACHE_LINE_LEN];
+    int             consumer_sleeping;
+    sem_t           wakeup;
+/* }}} */
+};
+
+#endif
+
+// vim: ft=c ts=4 et foldmethod=marker
@@ -0,0 +1,112 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#include "mod_bunny.h"
+
+/* Check results are freed by Nagios once reaped, the receipt time must share their allocation */
+check_result *mb_new_check_result(void) {
+/* {{{ */
+    mb_check_result_t *mcr = NULL;
+
+    if (!(mcr = calloc(1, sizeof(mb_check_result_t))))
+        return (NULL);
+
+    return (&mcr->cr);
+/* }}} */
+}
+
+/* Same ordering as Nagios' add_check_result_to_list(): by finish time */
+static inline bool mb_check_result_before(check_result *a, check_result *b) {
+/* {{{ */
+    return (a->finish_time.tv_sec < b->finish_time.tv_sec
+        || (a->finish_time.tv_sec == b->finish_time.tv_sec && a->finish_time.tv_usec < b->finish_time.tv_usec));
+/* }}} */
+}
+
+/*
+    Merge two lists of check results sorted by finish time with a single linear pass,
+    returning the new list head. Elements of `a' go first on equal finish times, so
+    merging new results into the Nagios check result list puts them exactly where
+    add_check_result_to_list() would have, one by one.
+*/
+check_result *mb_merge_check_results(check_result *a, check_result *b) {
+/* {{{ */
+    check_result    *head = NULL;
+    check_result    **tail = &head;
+
+    while (a && b) {
+        if (mb_check_result_before(b, a)) {
+            *tail = b;
+            b = b->next;
+        } else {
+            *tail = a;
+            a = a->next;
+        }
+
+        tail = &(*tail)->next;
+    }
+
+    *tail = (a ? a : b);
+
+    return (head);
+/* }}} */
+}
+
+/* Bottom-up merge sort of a list of check results by finish time, preserving arrival order of ties */
+check_result *mb_sort_check_results(check_result *list) {
+/* {{{ */
+    check_result    *runs[64] = {NULL};
+    check_result    *cr = NULL;
+    int             max = 0;
+    int             i;
+
+    /* runs[i] holds a sorted run of 2^i results, older results in higher slots */
+    while (list) {
+        cr = list;
+        list = list->next;
+        cr->next = NULL;
+
+        for (i = 0; i < 64 && runs[i]; i++) {
+            cr = mb_merge_check_results(runs[i], cr);
+            runs[i] = NULL;
+        }
+
+        if (i == 64)
+            i--;
+
+        runs[i] = cr;
+
+        if (i >= max)
+            max = i + 1;
+    }
+
+    for (cr = NULL, i = 0; i < max; i++) {
+        if (runs[i])
+            cr = mb_merge_check_results(runs[i], cr);
+    }
+
+    return (cr);
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
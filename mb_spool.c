@@ -0,0 +1,409 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "mod_bunny.h"
+#include "mb_spool.h"
+
+/*
+    Disk-backed spool holding checks while no publisher is connected to the broker.
+    The spool is a fixed-size ring file mapped in memory: the Nagios thread appends
+    checks to it, publisher threads replay them in order once reconnected. Since the
+    mapping is shared, spooled checks survive a Nagios restart (but not a host crash,
+    the file is only synced on close).
+*/
+
+static inline uint64_t mb_spool_now_ns(void) {
+/* {{{ */
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec);
+/* }}} */
+}
+
+static inline mb_spool_record_t *mb_spool_record_at(mb_spool_t *spool, uint64_t pos) {
+/* {{{ */
+    return ((mb_spool_record_t *)(spool->data + pos % spool->header->size));
+/* }}} */
+}
+
+static void mb_spool_log_stats(mb_spool_t *spool, const char *event) {
+/* {{{ */
+    logit(NSLOG_INFO_MESSAGE, TRUE,
+        "mod_bunny: spool %s: %s (%lu spooled, %lu replayed, %lu expired, %lu rejected, %lu foreign, "
+        "%lu checks/%lu bytes pending)",
+        spool->path,
+        event,
+        spool->spooled,
+        spool->replayed,
+        spool->expired,
+        spool->rejected,
+        spool->foreign,
+        (unsigned long)spool->header->count,
+        (unsigned long)(spool->header->tail - spool->header->head));
+/* }}} */
+}
+
+static bool mb_spool_record_valid(mb_spool_t *spool, mb_spool_record_t *record) {
+/* {{{ */
+    uint64_t    offset = spool->header->head % spool->header->size;
+
+    if (record->len < 2 * sizeof(uint32_t) || record->len % 8 != 0
+        || record->len > spool->header->tail - spool->header->head
+        || offset + record->len > spool->header->size)
+        return (false);
+
+    if (record->type == MB_SPOOL_RECORD_PAD)
+        return (true);
+
+    return (record->type == MB_SPOOL_RECORD_CHECK
+        && record->len >= MB_SPOOL_ALIGN(sizeof(mb_spool_record_t) + record->cid_len
+            + record->routing_key_len + (uint64_t)record->body_len)
+        && record->cid_len > 0 && record->cid_len < MB_CID_BUF_LEN);
+/* }}} */
+}
+
+mb_spool_t *mb_spool_open(mb_config_t *config) {
+/* {{{ */
+    mb_spool_t  *spool = NULL;
+    struct stat st;
+    uint64_t    size;
+    void        *map = NULL;
+    int         rc;
+
+    size = (uint64_t)config->spool_max_size * 1024 * 1024;
+
+    if (!(spool = calloc(1, sizeof(mb_spool_t))) || !(spool->path = strdup(config->spool_file))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_spool_open: error: "
+            "unable to allocate memory");
+        free(spool);
+        return (NULL);
+    }
+
+    spool->map_len = MB_SPOOL_DATA_OFFSET + size;
+    spool->max_checks = config->spool_max_checks;
+    spool->replay_rate = config->spool_replay_rate;
+
+    if ((spool->fd = open(spool->path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0 || fstat(spool->fd, &st) != 0) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_spool_open: error: "
+            "unable to open spool file %s: %s",
+            spool->path,
+            strerror(errno));
+        goto error;
+    }
+
+    /*
+        Allocate the whole file upfront: writing to a hole of a shared mapping when
+        the filesystem is full would get us killed by SIGBUS
+    */
+    if ((uint64_t)st.st_size > spool->map_len && ftruncate(spool->fd, spool->map_len) != 0) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_spool_open: error: "
+            "unable to resize spool file %s: %s",
+            spool->path,
+            strerror(errno));
+        goto error;
+    }
+
+    if ((rc = posix_fallocate(spool->fd, 0, spool->map_len)) != 0) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_spool_open: error: "
+            "unable to allocate %lu bytes for spool file %s: %s",
+            (unsigned long)spool->map_len,
+            spool->path,
+            strerror(rc));
+        goto error;
+    }
+
+    if ((map = mmap(NULL, spool->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, spool->fd, 0)) == MAP_FAILED) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_spool_open: error: "
+            "unable to map spool file %s: %s",
+            spool->path,
+            strerror(errno));
+        goto error;
+    }
+
+    spool->header = (mb_spool_header_t *)map;
+    spool->data = (char *)map + MB_SPOOL_DATA_OFFSET;
+
+    /* Resume from a previous run, unless the file is new or was created with other settings */
+    if (spool->header->magic == MB_SPOOL_MAGIC && spool->header->version == MB_SPOOL_VERSION
+        && spool->header->size == size && spool->header->head <= spool->header->tail
+        && spool->header->tail - spool->header->head <= size) {
+        if (spool->header->count > 0)
+            mb_spool_log_stats(spool, "recovered checks spooled by a previous run");
+    } else {
+        if (spool->header->magic != 0 || spool->header->count != 0)
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_spool_open: error: "
+                "spool file %s is corrupted or has a different size, discarding its content",
+                spool->path);
+
+        spool->header->magic = MB_SPOOL_MAGIC;
+        spool->header->version = MB_SPOOL_VERSION;
+        spool->header->size = size;
+        spool->header->head = 0;
+        spool->header->tail = 0;
+        spool->header->count = 0;
+    }
+
+    pthread_mutex_init(&spool->lock, NULL);
+
+    spool->skip_foreign = (config->inflight != NULL);
+
+    if (config->debug_level > 0)
+        logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: mb_spool_open: opened spool file %s (%lu bytes)",
+            spool->path,
+            (unsigned long)size);
+
+    return (spool);
+
+    error:
+    if (spool->fd >= 0)
+        close(spool->fd);
+
+    free(spool->path);
+    free(spool);
+
+    return (NULL);
+/* }}} */
+}
+
+void mb_spool_close(mb_spool_t *spool) {
+/* {{{ */
+    if (!spool)
+        return;
+
+    if (spool->spooled > 0 || spool->header->count > 0)
+        mb_spool_log_stats(spool, "closing");
+
+    msync(spool->header, spool->map_len, MS_SYNC);
+    munmap(spool->header, spool->map_len);
+    close(spool->fd);
+
+    pthread_mutex_destroy(&spool->lock);
+    free(spool->path);
+    free(spool);
+/* }}} */
+}
+
+int mb_spool_push(mb_spool_t *spool, mb_check_msg_t *msg, unsigned long shard, time_t expires) {
+/* {{{ */
+    mb_spool_header_t   *header = spool->header;
+    mb_spool_record_t   *record = NULL;
+    size_t              cid_len = msg->cid_len;
+    size_t              routing_key_len = msg->routing_key_len;
+    uint64_t            len;
+    uint64_t            pad;
+    char                *p = NULL;
+
+    len = MB_SPOOL_ALIGN(sizeof(mb_spool_record_t) + cid_len + routing_key_len + msg->body_len);
+
+    pthread_mutex_lock(&spool->lock);
+
+    /* Records can't wrap around the end of the data area, skip the space left if needed */
+    pad = header->size - header->tail % header->size;
+
+    if (pad >= len)
+        pad = 0;
+
+    if (msg->body_len > UINT32_MAX || routing_key_len > UINT16_MAX
+        || header->count >= (uint64_t)spool->max_checks
+        || header->tail + pad + len - header->head > header->size) {
+        spool->rejected++;
+        pthread_mutex_unlock(&spool->lock);
+
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_spool_push: error: "
+            "spool is full (%lu checks, %lu bytes)",
+            msg->cid,
+            (unsigned long)header->count,
+            (unsigned long)(header->tail - header->head));
+
+        return (MB_NOK);
+    }
+
+    if (header->count == 0)
+        logit(NSLOG_INFO_MESSAGE, TRUE,
+            "mod_bunny: mb_spool_push: no publisher connected to the broker, spooling checks to %s",
+            spool->path);
+
+    if (pad > 0) {
+        record = mb_spool_record_at(spool, header->tail);
+        record->len = (uint32_t)pad;
+        record->type = MB_SPOOL_RECORD_PAD;
+        header->tail += pad;
+    }
+
+    record = mb_spool_record_at(spool, header->tail);
+    record->len = (uint32_t)len;
+    record->type = MB_SPOOL_RECORD_CHECK;
+    record->expires = (int64_t)expires;
+    record->shard = (uint64_t)shard;
+    record->body_len = (uint32_t)msg->body_len;
+    record->routing_key_len = (uint16_t)routing_key_len;
+    record->cid_len = (uint8_t)cid_len;
+    record->format = (MB_STR_MATCH(msg->content_type, MB_CONTENT_TYPE_MSGPACK)
+        ? MB_PUBLISHER_FORMAT_MSGPACK : MB_PUBLISHER_FORMAT_JSON);
+
+    p = (char *)(record + 1);
+    memcpy(p, msg->cid, cid_len);
+    memcpy(p + cid_len, msg->routing_key, routing_key_len);
+    memcpy(p + cid_len + routing_key_len, msg->body, msg->body_len);
+
+    /* Only account for the record once it has been completely written */
+    header->tail += len;
+    header->count++;
+    spool->spooled++;
+
+    pthread_mutex_unlock(&spool->lock);
+
+    return (MB_OK);
+/* }}} */
+}
+
+/*
+    Take the oldest spooled check out of the spool, skipping the ones whose timeout has
+    expired since Nagios already gave up on them, and the ones spooled by a previous Nagios
+    run if checks in flight are tracked, since their result would be discarded. Returns NULL if the spool is empty
+    (`wait_ms' set to -1) or if the replay rate limit is reached (`wait_ms' set to the
+    time left until the next check can be replayed).
+*/
+mb_check_msg_t *mb_spool_pop(mb_spool_t *spool, unsigned long *shard, int *wait_ms) {
+/* {{{ */
+    mb_spool_header_t   *header = spool->header;
+    mb_spool_record_t   *record = NULL;
+    mb_check_msg_t      *msg = NULL;
+    uint64_t            now_ns;
+    uint64_t            seq;
+    char                cid[MB_CID_BUF_LEN];
+    char                *p = NULL;
+
+    *wait_ms = -1;
+
+    /* Cheap check for the common case, the spool being only written when disconnected */
+    if (MB_ATOMIC_LOAD(&header->count) == 0)
+        return (NULL);
+
+    pthread_mutex_lock(&spool->lock);
+
+    while (header->head < header->tail) {
+        record = mb_spool_record_at(spool, header->head);
+
+        if (!mb_spool_record_valid(spool, record)) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_spool_pop: error: "
+                "corrupted record in spool file %s, discarding %lu spooled checks",
+                spool->path,
+                (unsigned long)header->count);
+
+            header->head = header->tail;
+            header->count = 0;
+            break;
+        }
+
+        if (record->type == MB_SPOOL_RECORD_PAD) {
+            header->head += record->len;
+            continue;
+        }
+
+        if (record->expires < (int64_t)time(NULL)) {
+            header->head += record->len;
+            header->count--;
+            spool->expired++;
+            continue;
+        }
+
+        if (spool->skip_foreign) {
+            cid[0] = '\0';
+
+            if (record->cid_len < MB_CID_BUF_LEN) {
+                memcpy(cid, record + 1, record->cid_len);
+                cid[record->cid_len] = '\0';
+            }
+
+            if (!mb_cid_decode(cid, &seq, NULL)) {
+                header->head += record->len;
+                header->count--;
+                spool->foreign++;
+                continue;
+            }
+        }
+
+        if (spool->replay_rate > 0) {
+            now_ns = mb_spool_now_ns();
+
+            if (spool->next_replay_ns > now_ns) {
+                *wait_ms = (int)((spool->next_replay_ns - now_ns) / 1000000) + 1;
+                break;
+            }
+
+            /* Don't let an idle period turn into a burst */
+            if (spool->next_replay_ns < now_ns)
+                spool->next_replay_ns = now_ns;
+
+            spool->next_replay_ns += 1000000000ULL / spool->replay_rate;
+        }
+
+        /* The routing key is stored right after the message, both are freed at once */
+        if (!(msg = calloc(1, sizeof(mb_check_msg_t) + record->routing_key_len + 1))
+            || !(msg->body = malloc(record->body_len + 1))) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_spool_pop: error: "
+                "unable to allocate memory");
+            free(msg);
+            msg = NULL;
+            *wait_ms = MB_PUBLISHER_IDLE_WAIT;
+            break;
+        }
+
+        p = (char *)(record + 1);
+        memcpy(msg->cid, p, record->cid_len);
+        msg->cid_len = record->cid_len;
+        msg->routing_key = (char *)(msg + 1);
+        memcpy(msg->routing_key, p + record->cid_len, record->routing_key_len);
+        msg->routing_key_len = record->routing_key_len;
+        memcpy(msg->body, p + record->cid_len + record->routing_key_len, record->body_len);
+        msg->body[record->body_len] = '\0';
+        msg->body_len = record->body_len;
+        msg->content_type = (record->format == MB_PUBLISHER_FORMAT_MSGPACK
+            ? MB_CONTENT_TYPE_MSGPACK : MB_CONTENT_TYPE_JSON);
+        *shard = (unsigned long)record->shard;
+
+        header->head += record->len;
+        header->count--;
+        spool->replayed++;
+        break;
+    }
+
+    if (header->count == 0) {
+        header->head = header->tail;
+        mb_spool_log_stats(spool, "drained");
+    }
+
+    pthread_mutex_unlock(&spool->lock);
+
+    return (msg);
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
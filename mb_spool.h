@@ -0,0 +1,95 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#ifndef _MB_SPOOL_H_
+#define _MB_SPOOL_H_
+
+#define MB_SPOOL_MAGIC          0x4d425350 /* "MBSP" */
+#define MB_SPOOL_VERSION        1
+
+/* Records start on their own page, after the file header */
+#define MB_SPOOL_DATA_OFFSET    4096
+#define MB_SPOOL_ALIGN(n)       (((n) + 7) & ~((uint64_t)7))
+
+enum mb_spool_record_types {
+    MB_SPOOL_RECORD_CHECK = 1,
+    MB_SPOOL_RECORD_PAD,
+};
+
+/*
+    Spool file header. Records are appended at `tail' and consumed from `head', both
+    being ever-increasing byte counters taken modulo the data area size. A record never
+    wraps around the end of the data area: the space left is filled with a pad record.
+*/
+typedef struct mb_spool_header_s {
+/* {{{ */
+    uint32_t    magic;
+    uint32_t    version;
+    uint64_t    size;
+    uint64_t    head;
+    uint64_t    tail;
+    uint64_t    count;
+/* }}} */
+} mb_spool_header_t;
+
+/* Spooled check, followed by its correlation ID, routing key and body */
+typedef struct mb_spool_record_s {
+/* {{{ */
+    uint32_t    len;
+    uint32_t    type;
+    int64_t     expires;
+    uint64_t    shard;
+    uint32_t    body_len;
+    uint16_t    routing_key_len;
+    uint8_t     cid_len;
+    uint8_t     format;
+/* }}} */
+} mb_spool_record_t;
+
+struct mb_spool_s {
+/* {{{ */
+    pthread_mutex_t     lock;
+    int                 fd;
+    char                *path;
+    mb_spool_header_t   *header;
+    char                *data;
+    size_t              map_len;
+    int                 max_checks;
+    int                 replay_rate;
+    uint64_t            next_replay_ns;
+
+    /* Results of checks spooled by a previous Nagios run would be discarded as unknown */
+    bool                skip_foreign;
+
+    /* Counters */
+    unsigned long       spooled;
+    unsigned long       replayed;
+    unsigned long       expired;
+    unsigned long       rejected;
+    unsigned long       foreign;
+/* }}} */
+};
+
+#endif
+
+// vim: ft=c ts=4 et foldmethod=marker
@@ -25,21 +25,25 @@
 
 static void mb_thread_publish_shutdown(void *args) {
 /* {{{ */
-    mb_config_t *mb_config = (mb_config_t *)args;
+    mb_publisher_t  *publisher = (mb_publisher_t *)args;
+    mb_config_t     *mb_config = publisher->config;
 
     if (mb_config->debug_level > 0)
-        logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: mb_thread_publish: received shutdown signal");
+        logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: mb_thread_publish: publisher #%d received shutdown signal",
+            publisher->id);
 
-    if (mb_config->publisher_connected) {
-        if (mb_amqp_disconnect_publisher(mb_config)) {
+    if (publisher->connected) {
+        if (mb_amqp_disconnect_publisher(publisher)) {
             if (mb_config->debug_level > 0)
                 logit(NSLOG_INFO_MESSAGE, TRUE,
-                    "mod_bunny: mb_thread_publish: successfully closed connection to AMQP broker");
+                    "mod_bunny: mb_thread_publish: publisher #%d successfully closed connection to AMQP broker",
+                    publisher->id);
         }
     }
 
     if (mb_config->debug_level > 0)
-        logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: mb_thread_publish: terminating");
+        logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: mb_thread_publish: publisher #%d terminating",
+            publisher->id);
 } /* }}} */
 
 static void mb_thread_consume_shutdown(void *args) {
@@ -61,48 +65,293 @@ static void mb_thread_consume_shutdown(void *args) {
         logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: mb_thread_consume: terminating");
 } /* }}} */
 
+static void mb_thread_publish_discard(void *args) {
+/* {{{ */
+    mb_check_msg_t **pending_msg = (mb_check_msg_t **)args;
+
+    mb_free_check_msg(*pending_msg);
+    *pending_msg = NULL;
+} /* }}} */
+
+static void mb_thread_publish_discard_batches(void *args) {
+/* {{{ */
+    mb_batch_free_all((mb_check_batches_t *)args);
+} /* }}} */
+
+static void mb_thread_publish_discard_msgs(void *args) {
+/* {{{ */
+    mb_check_msgs_t *msgs = (mb_check_msgs_t *)args;
+    mb_check_msg_t  *msg = NULL;
+
+    while ((msg = TAILQ_FIRST(msgs))) {
+        TAILQ_REMOVE(msgs, msg, tq);
+        mb_free_check_msg(msg);
+    }
+} /* }}} */
+
+static void mb_thread_publish_discard_windows(void *args) {
+/* {{{ */
+    mb_confirm_window_t **windows = *(mb_confirm_window_t ***)args;
+
+    if (!windows)
+        return;
+
+    for (int i = 0; windows[i]; i++)
+        mb_confirm_window_free(windows[i]);
+
+    free(windows);
+    *(mb_confirm_window_t ***)args = NULL;
+} /* }}} */
+
+static void mb_thread_publish_connection_lost(mb_publisher_t *publisher) {
+/* {{{ */
+    /* In case of AMQP error, disconnect from the broker as a safety measure */
+    mb_amqp_disconnect_publisher(publisher);
+
+    publisher->down_since = time(NULL);
+
+    logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_thread_publish: error: "
+        "publisher #%d lost its connection to the broker, its checks go through other publishers meanwhile",
+        publisher->id);
+} /* }}} */
+
+/* The first publisher thread fails or republishes checks whose deadline passed */
+static void mb_thread_publish_check_timeouts(mb_publisher_t *publisher) {
+/* {{{ */
+    int cancel_state;
+
+    if (publisher->id != 0 || !publisher->config->check_timeouts)
+        return;
+
+    /* Don't leave expired checks half-processed if the thread is canceled meanwhile */
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &cancel_state);
+    mb_queue_deferred_check_results();
+    mb_timer_wheel_advance(publisher->config->check_timeouts, mb_expire_check);
+    pthread_setcancelstate(cancel_state, NULL);
+} /* }}} */
+
+static void mb_thread_publish_connect(mb_publisher_t *publisher, mb_confirm_window_t **windows,
+    mb_check_msgs_t *retransmit) {
+/* {{{ */
+    mb_config_t *mb_config = publisher->config;
+
+    /* Loop until we successfully connect to AMQP broker */
+    while (!publisher->connected) {
+        if (!mb_amqp_connect_publisher(publisher)) {
+            publisher->connect_failures++;
+
+            if (mb_config->debug_level > 0)
+                logit(NSLOG_INFO_MESSAGE, TRUE,
+                    "mod_bunny: mb_thread_publish: publisher #%d waiting for %d seconds before retry connecting",
+                    publisher->id,
+                    mb_config->retry_wait_time);
+
+            sleep(mb_config->retry_wait_time);
+            mb_thread_publish_check_timeouts(publisher);
+            continue;
+        }
+
+        if (publisher->down_since > 0)
+            logit(NSLOG_INFO_MESSAGE, TRUE,
+                "mod_bunny: mb_thread_publish: publisher #%d reconnected after %ld seconds "
+                "(%lu failed attempts)",
+                publisher->id,
+                (long)(time(NULL) - publisher->down_since),
+                publisher->connect_failures);
+
+        publisher->down_since = 0;
+        publisher->connect_failures = 0;
+
+        /* Messages unconfirmed by the previous connection have to be sent again */
+        for (int i = 0; windows && windows[i]; i++)
+            mb_confirm_window_reset(windows[i], retransmit);
+    }
+} /* }}} */
+
 void *mb_thread_publish(void *args)
 { /* {{{ */
-    mb_config_t *mb_config = (mb_config_t *)args;
+    mb_publisher_t      *publisher = (mb_publisher_t *)args;
+    mb_config_t         *mb_config = publisher->config;
+    mb_check_msg_t      *msg = NULL;
+    mb_check_msg_t      *next_msg = NULL;
+    mb_check_batch_t    *batch = NULL;
+    mb_check_batches_t  batches;
+    mb_check_msgs_t     retransmit;
+    mb_confirm_window_t **windows = NULL;
+    bool                batching;
+    int                 wait_ms;
+    int                 spool_wait_ms = -1;
+    unsigned long       shard;
 
-    /* Set this thread cancelable at any time */
-    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+    TAILQ_INIT(&batches);
+    TAILQ_INIT(&retransmit);
 
-    /* Cleanup handler */
+    batching = (mb_config->max_batch_checks > 1);
+
+    /* In confirm mode, each channel has its own window of unconfirmed messages (NULL-terminated) */
+    if (mb_config->publisher_confirms) {
+        if (!(windows = calloc(mb_config->publisher_channels + 1, sizeof(mb_confirm_window_t *)))) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_thread_publish: error: "
+                "unable to allocate memory, publisher #%d terminating",
+                publisher->id);
+            return (NULL);
+        }
+
+        for (int i = 0; i < mb_config->publisher_channels; i++) {
+            if (!(windows[i] = mb_confirm_window_new(mb_config->publisher_confirm_window))) {
+                logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_thread_publish: error: "
+                    "unable to create publisher confirms window, publisher #%d terminating",
+                    publisher->id);
+                mb_thread_publish_discard_windows(&windows);
+                return (NULL);
+            }
+        }
+    }
+
+    /*
+        Only let this thread be canceled at cancellation points, never while it pops its
+        queue or updates batches and confirm windows. The socket reads and writes of
+        librabbitmq calls are cancellation points too: a message may be left half-sent,
+        the cleanup handlers below release it and tear the connection down anyway
+    */
+    pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+
+    /* Cleanup handlers */
     pthread_cleanup_push(mb_thread_publish_shutdown, args);
+    pthread_cleanup_push(mb_thread_publish_discard, &msg);
+    pthread_cleanup_push(mb_thread_publish_discard_batches, &batches);
+    pthread_cleanup_push(mb_thread_publish_discard_msgs, &retransmit);
+    pthread_cleanup_push(mb_thread_publish_discard_windows, &windows);
 
     while (true) {
-        /* Loop until we successfully connect to AMQP broker */
-        while (!mb_config->publisher_connected) {
-            if (!mb_amqp_connect_publisher(mb_config)) {
-                if (mb_config->debug_level > 0)
-                    logit(NSLOG_INFO_MESSAGE, TRUE,
-                        "mod_bunny: mb_thread_publish: waiting for %d seconds before retry connecting",
-                        mb_config->retry_wait_time);
+        mb_thread_publish_connect(publisher, windows, &retransmit);
 
-                sleep(mb_config->retry_wait_time);
+        mb_thread_publish_check_timeouts(publisher);
+
+        /* Messages rejected by the broker or left unconfirmed go first */
+        if (!msg && (msg = TAILQ_FIRST(&retransmit)))
+            TAILQ_REMOVE(&retransmit, msg, tq);
+
+        /* Then checks spooled while no publisher was connected, at the configured replay rate */
+        if (!msg && mb_config->spool && (msg = mb_spool_pop(mb_config->spool, &shard, &spool_wait_ms)))
+            msg->channel = mb_shard_channel(shard);
+
+        if (!msg) {
+            /* Flush the oldest batch if it has been lingering for too long */
+            if (batching && (batch = mb_batch_expired(&batches, mb_config->max_batch_linger_ms))) {
+                msg = mb_batch_pack(&batches, batch);
+                continue;
             }
+
+            if (!(next_msg = mb_queue_pop(publisher->queue))) {
+                /* Nothing to publish, sleep until Nagios hands us a check or a batch is due */
+                wait_ms = MB_PUBLISHER_IDLE_WAIT;
+
+                if (batching && !TAILQ_EMPTY(&batches))
+                    wait_ms = mb_batch_linger_left(&batches, mb_config->max_batch_linger_ms);
+
+                if (spool_wait_ms >= 0 && spool_wait_ms < wait_ms)
+                    wait_ms = spool_wait_ms;
+
+                /* Take the opportunity to process broker confirms, and come back for more soon */
+                if (windows) {
+                    if (!mb_amqp_wait_confirms(publisher, windows, &retransmit, 0)) {
+                        mb_thread_publish_connection_lost(publisher);
+                        continue;
+                    }
+
+                    for (int i = 0; windows[i]; i++) {
+                        if (windows[i]->count > 0 && wait_ms > MB_CONFIRM_POLL_INTERVAL)
+                            wait_ms = MB_CONFIRM_POLL_INTERVAL;
+                    }
+                }
+
+                if (wait_ms > 0)
+                    mb_queue_wait(publisher->queue, wait_ms);
+
+                continue;
+            }
+
+            /* Command templates go to their own exchange, they are never batched */
+            if (!batching || next_msg->command_template)
+                msg = next_msg;
+            /* Group checks by routing key, flush a batch as soon as it's full */
+            else if ((batch = mb_batch_add(&batches, next_msg, mb_config->max_batch_checks)))
+                msg = mb_batch_pack(&batches, batch);
+
+            continue;
         }
 
-        /* We are connected, idle for a while */
-        sleep(1);
+        if (windows) {
+            mb_confirm_window_t *window = windows[msg->channel - AMQP_CHANNEL];
+
+            /*
+                Process broker confirms without blocking once the channel window fills up,
+                and if it is full wait for acknowledgements before publishing on it
+            */
+            if (window->count >= window->size / 2) {
+                if (!mb_amqp_wait_confirms(publisher, windows, &retransmit,
+                    (mb_confirm_window_full(window) ? MB_PUBLISHER_IDLE_WAIT : 0))) {
+                    mb_thread_publish_connection_lost(publisher);
+                    continue;
+                }
+
+                if (mb_confirm_window_full(window))
+                    continue;
+            }
+        }
+
+        /* Compress large messages before their first publication, on failure they are sent as is */
+        mb_compress_msg(publisher->compressor, msg, mb_config->publisher_compression_mode,
+            mb_config->compression_threshold);
+
+        /* Publish the pending message, which is kept until it has been successfully sent */
+        if (!mb_amqp_publish(publisher, msg)) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE,
+                "mod_bunny: %s: mb_thread_publish: error occurred while publishing message, "
+                "will retry once reconnected",
+                msg->cid);
+
+            publisher->publish_failures++;
+            mb_thread_publish_connection_lost(publisher);
+
+            continue;
+        }
+
+        /* In confirm mode the message is kept until the broker acknowledges it */
+        if (windows)
+            mb_confirm_window_add(windows[msg->channel - AMQP_CHANNEL], msg);
+        else
+            mb_free_check_msg(msg);
+
+        msg = NULL;
     }
 
     pthread_cleanup_pop(0);
+    pthread_cleanup_pop(0);
+    pthread_cleanup_pop(0);
+    pthread_cleanup_pop(0);
+    pthread_cleanup_pop(0);
 } /* }}} */
 
 void *mb_thread_consume(void *args)
 { /* {{{ */
     mb_config_t *mb_config = (mb_config_t *)args;
 
-    /* Set this thread cancelable at any time */
-    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+    /*
+        Only stop while connecting to or waiting for the broker, never while a delivery or the
+        check results it carries are being handled (see mb_amqp_consume())
+    */
+    pthread_setcanceltype(PTHREAD_CANCEL_DEFERRED, NULL);
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
 
     /* Cleanup handler */
     pthread_cleanup_push(mb_thread_consume_shutdown, args);
 
     while (true) {
         /* Loop until we successfully connect to AMQP broker */
+        pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+
         while (!mb_config->consumer_connected) {
             if (!mb_amqp_connect_consumer(mb_config)) {
                 if (mb_config->debug_level > 0)
@@ -114,11 +363,13 @@ void *mb_thread_consume(void *args)
             }
         }
 
+        pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
         if (mb_config->debug_level > 0)
             logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: mb_thread_consume: start consuming");
 
         /* Process received check results */
-        mb_amqp_consume(mb_config, mb_process_check_result);
+        mb_amqp_consume(mb_config, mb_process_check_result, mb_flush_check_results);
 
         /* We get here if an error occurs while consuming, so explicitely close the connection */
         logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_thread_consume: error: "
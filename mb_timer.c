@@ -0,0 +1,191 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#include "mod_bunny.h"
+#include "mb_timer.h"
+
+static inline uint64_t mb_timer_now(void) {
+/* {{{ */
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec);
+/* }}} */
+}
+
+/* File a timer into the slot matching its remaining delay, the wheel being locked */
+static void mb_timer_wheel_place(mb_timer_wheel_t *wheel, mb_timer_t *timer) {
+/* {{{ */
+    uint64_t    delay = (timer->expires > wheel->now ? timer->expires - wheel->now : 0);
+    int         level = 0;
+
+    while (level < MB_TIMER_LEVELS - 1 && delay >= (1ULL << (MB_TIMER_SLOT_BITS * (level + 1))))
+        level++;
+
+    TAILQ_INSERT_TAIL(&wheel->slots[level][(timer->expires >> (MB_TIMER_SLOT_BITS * level)) & MB_TIMER_SLOT_MASK],
+        timer, tq);
+/* }}} */
+}
+
+mb_timer_wheel_t *mb_timer_wheel_new(void) {
+/* {{{ */
+    mb_timer_wheel_t *wheel = NULL;
+
+    if (!(wheel = calloc(1, sizeof(mb_timer_wheel_t)))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_timer_wheel_new: error: "
+            "unable to allocate memory");
+        return (NULL);
+    }
+
+    for (int level = 0; level < MB_TIMER_LEVELS; level++) {
+        for (int slot = 0; slot < MB_TIMER_SLOTS; slot++)
+            TAILQ_INIT(&wheel->slots[level][slot]);
+    }
+
+    TAILQ_INIT(&wheel->free_timers);
+    pthread_mutex_init(&wheel->lock, NULL);
+    wheel->now = mb_timer_now();
+
+    return (wheel);
+/* }}} */
+}
+
+static void mb_timer_wheel_purge(mb_timers_t *timers) {
+/* {{{ */
+    mb_timer_t *timer = NULL;
+
+    while ((timer = TAILQ_FIRST(timers))) {
+        TAILQ_REMOVE(timers, timer, tq);
+        free(timer);
+    }
+/* }}} */
+}
+
+void mb_timer_wheel_free(mb_timer_wheel_t *wheel) {
+/* {{{ */
+    if (!wheel)
+        return;
+
+    for (int level = 0; level < MB_TIMER_LEVELS; level++) {
+        for (int slot = 0; slot < MB_TIMER_SLOTS; slot++)
+            mb_timer_wheel_purge(&wheel->slots[level][slot]);
+    }
+
+    mb_timer_wheel_purge(&wheel->free_timers);
+    pthread_mutex_destroy(&wheel->lock);
+    free(wheel);
+/* }}} */
+}
+
+/* Arm a timer expiring in `delay' seconds, identified by `id' */
+int mb_timer_wheel_add(mb_timer_wheel_t *wheel, uint64_t id, int delay) {
+/* {{{ */
+    mb_timer_t *timer = NULL;
+
+    if (delay < 1)
+        delay = 1;
+    else if (delay > MB_TIMER_MAX_DELAY)
+        delay = MB_TIMER_MAX_DELAY;
+
+    pthread_mutex_lock(&wheel->lock);
+
+    if ((timer = TAILQ_FIRST(&wheel->free_timers)))
+        TAILQ_REMOVE(&wheel->free_timers, timer, tq);
+    else if (!(timer = malloc(sizeof(mb_timer_t)))) {
+        pthread_mutex_unlock(&wheel->lock);
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_timer_wheel_add: error: "
+            "unable to allocate memory");
+        return (MB_NOK);
+    }
+
+    timer->id = id;
+    timer->expires = wheel->now + (uint64_t)delay;
+    mb_timer_wheel_place(wheel, timer);
+    wheel->count++;
+
+    pthread_mutex_unlock(&wheel->lock);
+
+    return (MB_OK);
+/* }}} */
+}
+
+/*
+    Turn the wheel up to the current time and call `expired' for each timer that went
+    off. Callbacks are run once the wheel is unlocked, so they may arm new timers.
+*/
+void mb_timer_wheel_advance(mb_timer_wheel_t *wheel, void (*expired)(uint64_t)) {
+/* {{{ */
+    mb_timers_t due;
+    mb_timer_t  *timer = NULL;
+    uint64_t    now = mb_timer_now();
+    uint64_t    slot;
+
+    /* Most calls happen within the current tick, don't take the lock for nothing */
+    if (__atomic_load_n(&wheel->now, __ATOMIC_RELAXED) >= now)
+        return;
+
+    TAILQ_INIT(&due);
+
+    pthread_mutex_lock(&wheel->lock);
+
+    while (wheel->now < now) {
+        __atomic_store_n(&wheel->now, wheel->now + 1, __ATOMIC_RELAXED);
+
+        /* Each time a level completes a revolution, spread the next slot of the level above */
+        for (int level = 1; level < MB_TIMER_LEVELS; level++) {
+            if ((wheel->now & ((1ULL << (MB_TIMER_SLOT_BITS * level)) - 1)) != 0)
+                break;
+
+            slot = (wheel->now >> (MB_TIMER_SLOT_BITS * level)) & MB_TIMER_SLOT_MASK;
+
+            while ((timer = TAILQ_FIRST(&wheel->slots[level][slot]))) {
+                TAILQ_REMOVE(&wheel->slots[level][slot], timer, tq);
+                mb_timer_wheel_place(wheel, timer);
+            }
+        }
+
+        TAILQ_CONCAT(&due, &wheel->slots[0][wheel->now & MB_TIMER_SLOT_MASK], tq);
+    }
+
+    pthread_mutex_unlock(&wheel->lock);
+
+    if (TAILQ_EMPTY(&due))
+        return;
+
+    TAILQ_FOREACH(timer, &due, tq)
+        expired(timer->id);
+
+    pthread_mutex_lock(&wheel->lock);
+
+    while ((timer = TAILQ_FIRST(&due))) {
+        TAILQ_REMOVE(&due, timer, tq);
+        TAILQ_INSERT_HEAD(&wheel->free_timers, timer, tq);
+        wheel->count--;
+    }
+
+    pthread_mutex_unlock(&wheel->lock);
+/* }}} */
+}
+
+// vim: ft=c ts=4 et foldmethod=marker
@@ -0,0 +1,61 @@
+/*
+** Copyright (c) 2013 Marc Falzon / Cloudwatt
+**
+** Permission is hereby granted, free of charge, to any person obtaining a copy
+** of this software and associated documentation files (the "Software"), to deal
+** in the Software without restriction, including without limitation the rights
+** to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+** copies of the Software, and to permit persons to whom the Software is
+** furnished to do so, subject to the following conditions:
+**
+** The above copyright notice and this permission notice shall be included in all
+** copies or substantial portions of the Software.
+**
+** THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+** IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+** FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+** AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+** LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+** OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+** SOFTWARE.
+*/
+
+
+#ifndef _MB_TIMER_H_
+#define _MB_TIMER_H_
+
+/* Wheel geometry: 3 levels of 64 one-second slots span 64^3 seconds (~3 days) */
+#define MB_TIMER_LEVELS         3
+#define MB_TIMER_SLOT_BITS      6
+#define MB_TIMER_SLOTS          (1 << MB_TIMER_SLOT_BITS)
+#define MB_TIMER_SLOT_MASK      (MB_TIMER_SLOTS - 1)
+#define MB_TIMER_MAX_DELAY      ((1 << (MB_TIMER_SLOT_BITS * MB_TIMER_LEVELS)) - 1)
+
+typedef TAILQ_HEAD(mb_timers_s, mb_timer_s) mb_timers_t;
+typedef struct mb_timer_s {
+/* {{{ */
+    uint64_t    id;
+    uint64_t    expires;
+    TAILQ_ENTRY(mb_timer_s) tq;
+/* }}} */
+} mb_timer_t;
+
+/*
+    Hierarchical timing wheel with a one second tick. A timer sits in the first level
+    whose slots span its remaining delay, and cascades down to lower levels as the
+    wheel turns, so adding and expiring timers are O(1). Expired timers are recycled
+    through a free list.
+*/
+struct mb_timer_wheel_s {
+/* {{{ */
+    pthread_mutex_t lock;
+    uint64_t        now;
+    mb_timers_t     slots[MB_TIMER_LEVELS][MB_TIMER_SLOTS];
+    mb_timers_t     free_timers;
+    size_t          count;
+/* }}} */
+};
+
+#endif
+
+// vim: ft=c ts=4 et foldmethod=marker
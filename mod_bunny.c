@@ -21,18 +21,20 @@
 */
 
 #include "mod_bunny.h"
-#include "mb_hash.h"
 #include "mb_amqp.h"
 
 NEB_API_VERSION(CURRENT_NEB_API_VERSION);
 
 /* Nagios global variables */
 extern check_result *check_result_list;
+extern host         *host_list;
+extern service      *service_list;
 extern int          currently_running_host_checks;
 extern int          currently_running_service_checks;
 extern int          event_broker_options;
 extern int          host_check_timeout;
 extern int          service_check_timeout;
+extern int          max_check_reaper_time;
 
 /* Our module handle */
 static void *mod_bunny_handle;
@@ -43,21 +45,120 @@ static char *mod_bunny_args;
 /* mod_bunny instance configuration */
 static mb_config_t mod_bunny_config;
 
-/* mod_bunny internal threads */
+/* mod_bunny internal threads (publisher threads are owned by their publisher) */
 static pthread_t mb_consumer_thread;
-static pthread_t mb_publisher_thread;
+
+/* Nagios event loop thread, the only one allowed to touch Nagios structures */
+static pthread_t mb_nagios_thread;
+
+/* Upper bounds (in milliseconds) of the check result receipt to reap delay histogram buckets */
+static const unsigned long mb_reap_delay_bounds[MB_REAP_DELAY_BUCKETS] = {
+    10, 50, 100, 250, 500, 1000, 2000, 5000, 10000, ULONG_MAX,
+};
+
+static inline uint64_t mb_now_us(void) {
+/* {{{ */
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((uint64_t)now.tv_sec * 1000000ULL + (uint64_t)now.tv_nsec / 1000);
+/* }}} */
+}
 
 void mb_stop_consumer_thread(void) {
 /* {{{ */
+    /* Don't let the consumer thread wait for room in the results queue, it is not drained anymore */
+    __atomic_store_n(&mod_bunny_config.consumer_stopping, true, __ATOMIC_RELEASE);
+
     pthread_cancel(mb_consumer_thread);
     pthread_join(mb_consumer_thread, NULL);
 /* }}} */
 }
 
-void mb_stop_publisher_thread(void) {
+void mb_stop_publisher_threads(void) {
+/* {{{ */
+    mb_publisher_t  *publisher = NULL;
+    mb_check_msg_t  *msg = NULL;
+
+    if (!mod_bunny_config.publishers)
+        return;
+
+    for (int i = 0; i < mod_bunny_config.publisher_connections; i++) {
+        publisher = &mod_bunny_config.publishers[i];
+
+        if (!publisher->queue)
+            continue;
+
+        pthread_cancel(publisher->thread);
+        pthread_join(publisher->thread, NULL);
+
+        /* Discard checks the publisher thread didn't get a chance to send */
+        while ((msg = mb_queue_pop(publisher->queue)))
+            mb_free_check_msg(msg);
+
+        mb_queue_free(publisher->queue);
+        publisher->queue = NULL;
+
+        mb_compressor_free(publisher->compressor);
+        publisher->compressor = NULL;
+    }
+
+    free(mod_bunny_config.publishers);
+    mod_bunny_config.publishers = NULL;
+/* }}} */
+}
+
+int mb_start_publisher_threads(void) {
 /* {{{ */
-    pthread_cancel(mb_publisher_thread);
-    pthread_join(mb_publisher_thread, NULL);
+    mb_publisher_t *publisher = NULL;
+
+    if (!(mod_bunny_config.publishers = calloc(mod_bunny_config.publisher_connections,
+        sizeof(mb_publisher_t)))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_start_publisher_threads: error: "
+            "unable to allocate memory");
+        return (MB_NOK);
+    }
+
+    for (int i = 0; i < mod_bunny_config.publisher_connections; i++) {
+        publisher = &mod_bunny_config.publishers[i];
+        publisher->id = i;
+        publisher->config = &mod_bunny_config;
+        publisher->connected = false;
+
+        /* Create the queue through which checks are handed over to the publisher thread */
+        if (!(publisher->queue = mb_queue_new(mod_bunny_config.publisher_queue_size))) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_start_publisher_threads: error: "
+                "unable to create queue for publisher #%d", i);
+            return (MB_NOK);
+        }
+
+        /* Compression contexts are reused across messages, one per publisher thread */
+        if (mod_bunny_config.publisher_compression_mode != MB_COMPRESSION_NONE
+            && !(publisher->compressor = mb_compressor_new())) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_start_publisher_threads: error: "
+                "unable to create compressor for publisher #%d", i);
+            mb_queue_free(publisher->queue);
+            publisher->queue = NULL;
+            return (MB_NOK);
+        }
+
+        if (pthread_create(&publisher->thread, NULL, mb_thread_publish, publisher) != 0) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_start_publisher_threads: error: "
+                "unable to start thread for publisher #%d", i);
+            mb_queue_free(publisher->queue);
+            publisher->queue = NULL;
+            mb_compressor_free(publisher->compressor);
+            publisher->compressor = NULL;
+            return (MB_NOK);
+        }
+
+        if (mod_bunny_config.debug_level > 0)
+            logit(NSLOG_INFO_MESSAGE, TRUE,
+                "mod_bunny: mb_start_publisher_threads: started thread for publisher #%d", i);
+    }
+
+    return (MB_OK);
 /* }}} */
 }
 
@@ -75,6 +176,9 @@ int nebmodule_init(int flags __attribute__((__unused__)), char *args, nebmodule
 
     logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: version %s", MB_VERSION);
 
+    /* Draw this instance's correlation ID prefix */
+    mb_cid_init();
+
     /* Check that the broker callbacks we need are available to us */
     if (!(event_broker_options & BROKER_PROGRAM_STATE)) {
         logit(NSLOG_RUNTIME_ERROR, TRUE,
@@ -116,16 +220,111 @@ int nebmodule_deinit(int flags __attribute__((__unused__)), int reason __attribu
     if (mod_bunny_config.debug_level > 0)
         logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: nebmodule_deinit: deregistered callbacks");
 
-    mb_stop_publisher_thread();
+    /* Stop consuming first, check results are no longer drained by the Nagios thread from now on */
+    mb_stop_consumer_thread();
+
+    mb_decoder_pool_free(mod_bunny_config.decoders);
+    mod_bunny_config.decoders = NULL;
 
-    if (mod_bunny_config.debug_level > 0)
-        logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: nebmodule_deinit: stopped publisher thread");
+    mb_amqp_acks_free(mod_bunny_config.acks);
+    mod_bunny_config.acks = NULL;
 
-    mb_stop_consumer_thread();
+    mb_delivery_pool_free(mod_bunny_config.deliveries);
+    mod_bunny_config.deliveries = NULL;
 
     if (mod_bunny_config.debug_level > 0)
         logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: nebmodule_deinit: stopped consumer thread");
 
+    mb_stop_publisher_threads();
+
+    if (mod_bunny_config.debug_level > 0)
+        logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: nebmodule_deinit: stopped publisher threads");
+
+    mb_spool_close(mod_bunny_config.spool);
+    mod_bunny_config.spool = NULL;
+
+    /* Nothing is published anymore, free the recycled messages for good */
+    if (mod_bunny_config.check_msgs) {
+        mb_queue_t      *check_msgs = mod_bunny_config.check_msgs;
+        mb_check_msg_t  *msg = NULL;
+
+        mod_bunny_config.check_msgs = NULL;
+
+        while ((msg = mb_queue_pop(check_msgs)))
+            mb_free_check_msg(msg);
+
+        mb_queue_free(check_msgs);
+    }
+
+    /* Check timeouts are driven by the first publisher thread */
+    mb_timer_wheel_free(mod_bunny_config.check_timeouts);
+    mod_bunny_config.check_timeouts = NULL;
+
+    /* Discard failed check results the first publisher thread didn't get a chance to queue */
+    while (mod_bunny_config.deferred_results) {
+        check_result *cr = mod_bunny_config.deferred_results;
+
+        mod_bunny_config.deferred_results = cr->next;
+        free_check_result(cr);
+        free(cr);
+    }
+
+    mb_compressor_free(mod_bunny_config.consumer_compressor);
+    mod_bunny_config.consumer_compressor = NULL;
+
+    /* Discard check results Nagios didn't get a chance to reap */
+    if (mod_bunny_config.results) {
+        check_result *cr = NULL;
+
+        while ((cr = mb_queue_pop(mod_bunny_config.results))) {
+            free_check_result(cr);
+            free(cr);
+        }
+
+        while ((cr = mod_bunny_config.pending_results)) {
+            mod_bunny_config.pending_results = cr->next;
+            free_check_result(cr);
+            free(cr);
+        }
+
+        mb_queue_free(mod_bunny_config.results);
+        mod_bunny_config.results = NULL;
+    }
+
+    if (mod_bunny_config.reaper_passes > 0) {
+        unsigned long *d = mod_bunny_config.reap_delays;
+
+        logit(NSLOG_INFO_MESSAGE, TRUE,
+            "mod_bunny: nebmodule_deinit: %lu reaper passes triggered, check results reaped within "
+            "10ms: %lu, 50ms: %lu, 100ms: %lu, 250ms: %lu, 500ms: %lu, 1s: %lu, 2s: %lu, 5s: %lu, 10s: %lu, "
+            "more: %lu",
+            mod_bunny_config.reaper_passes,
+            d[0], d[1], d[2], d[3], d[4], d[5], d[6], d[7], d[8], d[9]);
+    }
+
+    mb_inflight_free(mod_bunny_config.inflight);
+    mod_bunny_config.inflight = NULL;
+    mb_compress_deinit();
+
+    mb_json_free_buffers();
+    mb_msgpack_free_buffers();
+    mb_command_free_buffers();
+
+    mb_dispatch_free(mod_bunny_config.dispatch);
+    mod_bunny_config.dispatch = NULL;
+
+    mb_command_templates_free(mod_bunny_config.known_templates);
+    mod_bunny_config.known_templates = NULL;
+
+    mb_matcher_free(mod_bunny_config.hstgroups_routing_matcher);
+    mb_matcher_free(mod_bunny_config.svcgroups_routing_matcher);
+    mb_matcher_free(mod_bunny_config.local_hstgroups_matcher);
+    mb_matcher_free(mod_bunny_config.local_svcgroups_matcher);
+    mod_bunny_config.hstgroups_routing_matcher = NULL;
+    mod_bunny_config.svcgroups_routing_matcher = NULL;
+    mod_bunny_config.local_hstgroups_matcher = NULL;
+    mod_bunny_config.local_svcgroups_matcher = NULL;
+
     /* Purge hostgroups routing table */
     if (mod_bunny_config.hstgroups_routing_table) {
         mb_free_hostgroups_routing_table(mod_bunny_config.hstgroups_routing_table);
@@ -173,16 +372,85 @@ int mb_init(int event_type __attribute__((__unused__)), void *event_data) {
                 logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: mb_init: configuration initialized");
         }
 
-        /* Start publisher thread */
-        if (pthread_create(&mb_publisher_thread, NULL, mb_thread_publish, &mod_bunny_config) != 0) {
+        /* Objects are all known by now, precompute how their checks are dispatched */
+        mb_init_dispatch();
+
+        /* Load the compression dictionary and set up the consumer decompression contexts */
+        if (!mb_compress_init(&mod_bunny_config))
+            return (NEB_ERROR);
+
+        if (!(mod_bunny_config.consumer_compressor = mb_compressor_new())) {
             logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_init: error: "
-                "unable to start publisher thread");
+                "unable to create consumer compressor");
             return (NEB_ERROR);
-        } else {
-            if (mod_bunny_config.debug_level > 0)
-                logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: mb_init: started publisher thread");
         }
 
+        /* Checks in flight are shared between the Nagios thread and the consumer thread */
+        if (mod_bunny_config.inflight_tracking
+            && !(mod_bunny_config.inflight = mb_inflight_new(mod_bunny_config.inflight_table_size,
+                mod_bunny_config.check_timeout_slack)))
+            return (NEB_ERROR);
+
+        /* Check results are handed over from mod_bunny threads to the Nagios event loop */
+        mb_nagios_thread = pthread_self();
+
+        if (!(mod_bunny_config.results = mb_queue_new(mod_bunny_config.result_queue_size)))
+            return (NEB_ERROR);
+
+        schedule_new_event(EVENT_USER_FUNCTION, FALSE, time(NULL) + MB_RESULT_DRAIN_INTERVAL, TRUE,
+            MB_RESULT_DRAIN_INTERVAL, NULL, TRUE, (void *)mb_drain_check_results, NULL, 0);
+
+        /* Deadlines of checks in flight, checked by the first publisher thread */
+        if (mod_bunny_config.check_timeout_mode != MB_CHECK_TIMEOUT_NONE
+            && !(mod_bunny_config.check_timeouts = mb_timer_wheel_new()))
+            return (NEB_ERROR);
+
+        /* Open the spool before publisher threads start replaying it */
+        if (strlen(mod_bunny_config.spool_file) > 0
+            && !(mod_bunny_config.spool = mb_spool_open(&mod_bunny_config)))
+            return (NEB_ERROR);
+
+        /* Published messages, recycled by the Nagios thread */
+        if (!(mod_bunny_config.check_msgs = mb_queue_new(MB_CHECK_MSG_POOL_SIZE)))
+            return (NEB_ERROR);
+
+        /* Command templates published so far, republished regularly for workers that missed them */
+        if (mod_bunny_config.command_templates) {
+            if (!mod_bunny_config.fast_command_macros)
+                logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_init: error: "
+                    "`command_templates' requires `fast_command_macros', publishing full command lines");
+            else {
+                if (!(mod_bunny_config.known_templates = mb_command_templates_new()))
+                    return (NEB_ERROR);
+
+                schedule_new_event(EVENT_USER_FUNCTION, FALSE,
+                    time(NULL) + mod_bunny_config.command_templates_interval, TRUE,
+                    mod_bunny_config.command_templates_interval, NULL, TRUE,
+                    (void *)mb_republish_command_templates, NULL, 0);
+            }
+        }
+
+        /* Properties are the same for all published messages, only build them once */
+        mb_amqp_init_publisher_props(&mod_bunny_config);
+
+        /* Start publisher threads, each one owning a connection to the broker */
+        if (!mb_start_publisher_threads())
+            return (NEB_ERROR);
+
+        /* Received messages, recycled by the consumer thread */
+        if (!(mod_bunny_config.deliveries = mb_delivery_pool_new()))
+            return (NEB_ERROR);
+
+        /* Deliveries awaiting an acknowledgement, tracked by the consumer thread */
+        if (mod_bunny_config.consumer_acks
+            && !(mod_bunny_config.acks = mb_amqp_acks_new(mod_bunny_config.consumer_prefetch)))
+            return (NEB_ERROR);
+
+        /* Decoder threads taking check results decoding off the consumer thread */
+        if (mod_bunny_config.decode_workers > 0
+            && !(mod_bunny_config.decoders = mb_decoder_pool_new(mod_bunny_config.decode_workers)))
+            return (NEB_ERROR);
+
         /* Start consumer thread */
         if (pthread_create(&mb_consumer_thread, NULL, mb_thread_consume, &mod_bunny_config) != 0) {
             logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_init: error: "
@@ -209,6 +477,33 @@ int mb_init_config() {
     /* Set default configuration settings */
     mod_bunny_config.debug_level = MB_DEFAULT_DEBUG_LEVEL;
     mod_bunny_config.retry_wait_time = MB_DEFAULT_RETRY_WAIT_TIME;
+    mod_bunny_config.publisher_queue_size = MB_DEFAULT_PUBLISHER_QUEUE_SIZE;
+    mod_bunny_config.publisher_connections = MB_DEFAULT_PUBLISHER_CONNECTIONS;
+    mod_bunny_config.publisher_channels = MB_DEFAULT_PUBLISHER_CHANNELS;
+    strncpy(mod_bunny_config.publisher_sharding, MB_DEFAULT_PUBLISHER_SHARDING, MB_BUF_LEN - 1);
+    strncpy(mod_bunny_config.publisher_format, MB_DEFAULT_PUBLISHER_FORMAT, MB_BUF_LEN - 1);
+    strncpy(mod_bunny_config.publisher_compression, MB_DEFAULT_PUBLISHER_COMPRESSION, MB_BUF_LEN - 1);
+    mod_bunny_config.compression_threshold = MB_DEFAULT_COMPRESSION_THRESHOLD;
+    mod_bunny_config.compression_dictionary[0] = '\0';
+    mod_bunny_config.max_batch_checks = MB_DEFAULT_MAX_BATCH_CHECKS;
+    mod_bunny_config.max_batch_linger_ms = MB_DEFAULT_MAX_BATCH_LINGER_MS;
+    mod_bunny_config.publisher_confirms = false;
+    mod_bunny_config.fast_command_macros = true;
+    mod_bunny_config.command_templates = false;
+    strncpy(mod_bunny_config.command_templates_exchange, MB_DEFAULT_COMMAND_TEMPLATES_EXCHANGE, MB_BUF_LEN - 1);
+    mod_bunny_config.command_templates_interval = MB_DEFAULT_COMMAND_TEMPLATES_INTERVAL;
+    mod_bunny_config.known_templates = NULL;
+    mod_bunny_config.fast_result_decoder = true;
+    mod_bunny_config.inflight_tracking = true;
+    mod_bunny_config.inflight_table_size = MB_DEFAULT_INFLIGHT_TABLE_SIZE;
+    strncpy(mod_bunny_config.check_timeout_action, MB_DEFAULT_CHECK_TIMEOUT_ACTION, MB_BUF_LEN - 1);
+    mod_bunny_config.check_timeout_slack = MB_DEFAULT_CHECK_TIMEOUT_SLACK;
+    mod_bunny_config.check_timeout_routing_key[0] = '\0';
+    mod_bunny_config.publisher_confirm_window = MB_DEFAULT_PUBLISHER_CONFIRM_WINDOW;
+    mod_bunny_config.spool_file[0] = '\0';
+    mod_bunny_config.spool_max_size = MB_DEFAULT_SPOOL_MAX_SIZE;
+    mod_bunny_config.spool_max_checks = MB_DEFAULT_SPOOL_MAX_CHECKS;
+    mod_bunny_config.spool_replay_rate = MB_DEFAULT_SPOOL_REPLAY_RATE;
 
     strncpy(mod_bunny_config.host, MB_DEFAULT_HOST, MB_BUF_LEN - 1);
     mod_bunny_config.port = MB_DEFAULT_PORT;
@@ -225,18 +520,314 @@ int mb_init_config() {
     strncpy(mod_bunny_config.consumer_queue, MB_DEFAULT_CONSUMER_QUEUE, MB_BUF_LEN - 1);
     strncpy(mod_bunny_config.consumer_binding_key, MB_DEFAULT_CONSUMER_BINDING_KEY, MB_BUF_LEN - 1);
 
-    mod_bunny_config.publisher_connected = false;
+    mod_bunny_config.publishers = NULL;
+    mod_bunny_config.consumer_compressor = NULL;
     mod_bunny_config.consumer_connected = false;
+    mod_bunny_config.consumer_acks = false;
+    mod_bunny_config.consumer_prefetch = MB_DEFAULT_CONSUMER_PREFETCH;
+    mod_bunny_config.consumer_ack_batch = MB_DEFAULT_CONSUMER_ACK_BATCH;
+    mod_bunny_config.consumer_ack_linger_ms = MB_DEFAULT_CONSUMER_ACK_LINGER_MS;
+    mod_bunny_config.acks = NULL;
+    mod_bunny_config.results_submitted = 0;
+    mod_bunny_config.results_handed = 0;
+    mod_bunny_config.result_queue_size = MB_DEFAULT_RESULT_QUEUE_SIZE;
+    mod_bunny_config.decode_workers = MB_DEFAULT_DECODE_WORKERS;
+    mod_bunny_config.decoders = NULL;
+    mod_bunny_config.deliveries = NULL;
+    mod_bunny_config.results = NULL;
+    mod_bunny_config.reaper_trigger = false;
+    mod_bunny_config.reaper_trigger_results = MB_DEFAULT_REAPER_TRIGGER_RESULTS;
+    mod_bunny_config.reaper_trigger_age = MB_DEFAULT_REAPER_TRIGGER_AGE;
+    mod_bunny_config.pending_results = NULL;
+    mod_bunny_config.pending_results_tail = &mod_bunny_config.pending_results;
+    mod_bunny_config.pending_results_count = 0;
+    mod_bunny_config.pending_results_consumed = 0;
+    mod_bunny_config.reaper_backoff_until = 0;
 
     if (mod_bunny_args != NULL && strlen(mod_bunny_args) > 0) {
         if (!mb_json_parse_config(mod_bunny_args, &mod_bunny_config))
             return (MB_NOK);
     }
 
+    if (!mb_init_group_matchers())
+        return (MB_NOK);
+
+    /* Decisions cached for a previous configuration must not be used anymore */
+    mod_bunny_config.generation++;
+
+    if (MB_STR_MATCH(mod_bunny_config.publisher_format, "msgpack"))
+        mod_bunny_config.publisher_format_mode = MB_PUBLISHER_FORMAT_MSGPACK;
+    else
+        mod_bunny_config.publisher_format_mode = MB_PUBLISHER_FORMAT_JSON;
+
+    if (MB_STR_MATCH(mod_bunny_config.publisher_sharding, "object"))
+        mod_bunny_config.publisher_sharding_mode = MB_PUBLISHER_SHARDING_OBJECT;
+    else
+        mod_bunny_config.publisher_sharding_mode = MB_PUBLISHER_SHARDING_ROUTING_KEY;
+
+    if (MB_STR_MATCH(mod_bunny_config.publisher_compression, MB_CONTENT_ENCODING_ZSTD))
+        mod_bunny_config.publisher_compression_mode = MB_COMPRESSION_ZSTD;
+    else if (MB_STR_MATCH(mod_bunny_config.publisher_compression, MB_CONTENT_ENCODING_LZ4))
+        mod_bunny_config.publisher_compression_mode = MB_COMPRESSION_LZ4;
+    else
+        mod_bunny_config.publisher_compression_mode = MB_COMPRESSION_NONE;
+
+    if (MB_STR_MATCH(mod_bunny_config.check_timeout_action, "republish"))
+        mod_bunny_config.check_timeout_mode = MB_CHECK_TIMEOUT_REPUBLISH;
+    else if (MB_STR_MATCH(mod_bunny_config.check_timeout_action, "fail"))
+        mod_bunny_config.check_timeout_mode = MB_CHECK_TIMEOUT_FAIL;
+    else
+        mod_bunny_config.check_timeout_mode = MB_CHECK_TIMEOUT_NONE;
+
+    /* Check deadlines are kept along with the checks in flight */
+    if (mod_bunny_config.check_timeout_mode != MB_CHECK_TIMEOUT_NONE && !mod_bunny_config.inflight_tracking) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_init_config: error: "
+            "`check_timeout_action' setting ignored since `inflight_tracking' is disabled");
+        mod_bunny_config.check_timeout_mode = MB_CHECK_TIMEOUT_NONE;
+    }
+
+#ifdef LIBRABBITMQ_LEGACY
+    /* We need amqp_simple_wait_frame_noblock() to process publisher confirms asynchronously */
+    if (mod_bunny_config.publisher_confirms) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_init_config: error: "
+            "`publisher_confirms' setting requires librabbitmq >= 0.4.0");
+        return (MB_NOK);
+    }
+
+    /* Same goes for acknowledging consumed messages while no new ones come in */
+    if (mod_bunny_config.consumer_acks) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_init_config: error: "
+            "`consumer_acks' setting requires librabbitmq >= 0.4.0");
+        return (MB_NOK);
+    }
+#endif
+
+    return (MB_OK);
+/* }}} */
+}
+
+/*
+    Compile the group patterns of routing tables and local groups. Routes are given
+    increasing priorities in configuration order, so that a lookup returns the first
+    matching route just like walking the routing table would.
+*/
+int mb_init_group_matchers(void) {
+/* {{{ */
+    mb_hstgroup_route_t *hstgroup_route = NULL;
+    mb_svcgroup_route_t *svcgroup_route = NULL;
+    mb_hstgroup_t       *hstgroup = NULL;
+    mb_svcgroup_t       *svcgroup = NULL;
+    int                 priority;
+
+    if (mod_bunny_config.hstgroups_routing_table) {
+        if (!(mod_bunny_config.hstgroups_routing_matcher = mb_matcher_new()))
+            return (MB_NOK);
+
+        priority = 0;
+
+        TAILQ_FOREACH(hstgroup_route, mod_bunny_config.hstgroups_routing_table, tq) {
+            TAILQ_FOREACH(hstgroup, hstgroup_route->hstgroups, tq) {
+                if (!mb_matcher_add(mod_bunny_config.hstgroups_routing_matcher, hstgroup->pattern, priority,
+                    hstgroup_route->routing_key))
+                    return (MB_NOK);
+            }
+
+            priority++;
+        }
+    }
+
+    if (mod_bunny_config.svcgroups_routing_table) {
+        if (!(mod_bunny_config.svcgroups_routing_matcher = mb_matcher_new()))
+            return (MB_NOK);
+
+        priority = 0;
+
+        TAILQ_FOREACH(svcgroup_route, mod_bunny_config.svcgroups_routing_table, tq) {
+            TAILQ_FOREACH(svcgroup, svcgroup_route->svcgroups, tq) {
+                if (!mb_matcher_add(mod_bunny_config.svcgroups_routing_matcher, svcgroup->pattern, priority,
+                    svcgroup_route->routing_key))
+                    return (MB_NOK);
+            }
+
+            priority++;
+        }
+    }
+
+    if (mod_bunny_config.local_hstgroups) {
+        if (!(mod_bunny_config.local_hstgroups_matcher = mb_matcher_new()))
+            return (MB_NOK);
+
+        TAILQ_FOREACH(hstgroup, mod_bunny_config.local_hstgroups, tq) {
+            if (!mb_matcher_add(mod_bunny_config.local_hstgroups_matcher, hstgroup->pattern, 0, hstgroup))
+                return (MB_NOK);
+        }
+    }
+
+    if (mod_bunny_config.local_svcgroups) {
+        if (!(mod_bunny_config.local_svcgroups_matcher = mb_matcher_new()))
+            return (MB_NOK);
+
+        TAILQ_FOREACH(svcgroup, mod_bunny_config.local_svcgroups, tq) {
+            if (!mb_matcher_add(mod_bunny_config.local_svcgroups_matcher, svcgroup->pattern, 0, svcgroup))
+                return (MB_NOK);
+        }
+    }
+
     return (MB_OK);
 /* }}} */
 }
 
+mb_dispatch_entry_t *mb_host_dispatch(host *hst, mb_dispatch_entry_t *buf) {
+/* {{{ */
+    mb_dispatch_entry_t *entry = NULL;
+
+    /* Use the decision precomputed for this configuration, if any */
+    if ((entry = mb_dispatch_lookup(mod_bunny_config.dispatch, hst, mod_bunny_config.generation)))
+        return (entry);
+
+    buf->object = hst;
+    buf->command = NULL;
+    buf->local = (mod_bunny_config.local_hstgroups && mb_in_local_hostgroups(hst));
+    buf->routing_key = NULL;
+
+    if (mod_bunny_config.hstgroups_routing_table)
+        buf->routing_key = mb_lookup_hostgroups_routing_table(hst);
+
+    /* If no specific routing key defined, use the global routing key */
+    if (!buf->routing_key)
+        buf->routing_key = mod_bunny_config.publisher_routing_key;
+
+    buf->routing_key_len = strlen(buf->routing_key);
+
+    /* Spread checks over publisher connections and channels */
+    if (mod_bunny_config.publisher_sharding_mode == MB_PUBLISHER_SHARDING_OBJECT)
+        buf->shard = mb_hash_ptr(hst);
+    else
+        buf->shard = mb_hash_str(buf->routing_key);
+
+    return (buf);
+/* }}} */
+}
+
+mb_dispatch_entry_t *mb_service_dispatch(service *svc, mb_dispatch_entry_t *buf) {
+/* {{{ */
+    mb_dispatch_entry_t *entry = NULL;
+
+    /* Use the decision precomputed for this configuration, if any */
+    if ((entry = mb_dispatch_lookup(mod_bunny_config.dispatch, svc, mod_bunny_config.generation)))
+        return (entry);
+
+    buf->object = svc;
+    buf->command = NULL;
+    buf->local = (mod_bunny_config.local_svcgroups && mb_in_local_servicegroups(svc));
+    buf->routing_key = NULL;
+
+    if (mod_bunny_config.svcgroups_routing_table)
+        buf->routing_key = mb_lookup_servicegroups_routing_table(svc);
+
+    /* If no specific routing key defined, use the global routing key */
+    if (!buf->routing_key)
+        buf->routing_key = mod_bunny_config.publisher_routing_key;
+
+    buf->routing_key_len = strlen(buf->routing_key);
+
+    /* Spread checks over publisher connections and channels */
+    if (mod_bunny_config.publisher_sharding_mode == MB_PUBLISHER_SHARDING_OBJECT)
+        buf->shard = mb_hash_ptr(svc);
+    else
+        buf->shard = mb_hash_str(buf->routing_key);
+
+    return (buf);
+/* }}} */
+}
+
+/*
+    Expand the check command of a host or service from its pre-scanned form, compiled on the
+    first check of the object, either in full or as a command template and its arguments.
+    MB_NOK if the command has to be expanded by Nagios (objects not in the dispatch table,
+    macros not handled by mod_bunny, out of memory...).
+*/
+int mb_expand_check_command(mb_dispatch_entry_t *entry, command *cmd_ptr, char *check_command, host *hst,
+    service *svc, mb_check_command_t *check_cmd) {
+/* {{{ */
+    mb_command_template_t *tmpl = NULL;
+
+    if (!entry || !mod_bunny_config.fast_command_macros || !cmd_ptr || !check_command)
+        return (MB_NOK);
+
+    /* Check commands may be changed at run time through external commands */
+    if (entry->command && !mb_command_matches(entry->command, cmd_ptr, check_command)) {
+        mb_command_free(entry->command);
+        entry->command = NULL;
+    }
+
+    if (!entry->command) {
+        if (!(entry->command = mb_command_compile(cmd_ptr, check_command, (svc ? SERVICE_CHECK : HOST_CHECK))))
+            return (MB_NOK);
+
+        if (mod_bunny_config.debug_level > 0)
+            logit(NSLOG_INFO_MESSAGE, TRUE,
+                "mod_bunny: mb_expand_check_command: check command \"%s\" expanded by %s",
+                check_command,
+                (mb_command_expandable(entry->command) ? "mod_bunny" : "Nagios"));
+    }
+
+    /* Workers must know a template before checks reference it, it is published along with the first one */
+    if (mod_bunny_config.known_templates && (tmpl = mb_command_template(entry->command))
+        && (mb_command_templates_has(mod_bunny_config.known_templates, tmpl)
+            || (mb_publish_command_template(tmpl, entry->shard)
+                && mb_command_templates_add(mod_bunny_config.known_templates, tmpl)))
+        && mb_command_expand_args(entry->command, hst, svc, check_cmd))
+        return (MB_OK);
+
+    check_cmd->template_id = NULL;
+
+    return ((check_cmd->line = mb_command_expand(entry->command, hst, svc)) ? MB_OK : MB_NOK);
+/* }}} */
+}
+
+/*
+    Precompute how the checks of every host and service are dispatched: group memberships
+    and routes only change along with the configuration, so this saves walking the object
+    groups for each check. Objects missing from the table are resolved the slow way.
+*/
+void mb_init_dispatch(void) {
+/* {{{ */
+    mb_dispatch_t       *dispatch = NULL;
+    mb_dispatch_entry_t entry;
+    host                *hst = NULL;
+    service             *svc = NULL;
+    size_t              objects = 0;
+
+    mb_dispatch_free(mod_bunny_config.dispatch);
+    mod_bunny_config.dispatch = NULL;
+
+    for (hst = host_list; hst; hst = hst->next)
+        objects++;
+
+    for (svc = service_list; svc; svc = svc->next)
+        objects++;
+
+    if (!(dispatch = mb_dispatch_new(objects, mod_bunny_config.generation))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_init_dispatch: error: "
+            "unable to build dispatch table, group lookups will be done for each check");
+        return;
+    }
+
+    for (hst = host_list; hst; hst = hst->next)
+        mb_dispatch_add(dispatch, mb_host_dispatch(hst, &entry));
+
+    for (svc = service_list; svc; svc = svc->next)
+        mb_dispatch_add(dispatch, mb_service_dispatch(svc, &entry));
+
+    mod_bunny_config.dispatch = dispatch;
+
+    if (mod_bunny_config.debug_level > 0)
+        logit(NSLOG_INFO_MESSAGE, TRUE, "mod_bunny: mb_init_dispatch: built dispatch table for %lu objects",
+            (unsigned long)objects);
+/* }}} */
+}
+
 void mb_register_callbacks(void) {
 /* {{{ */
     /* Host checks */
@@ -261,9 +852,10 @@ int mb_handle_event(int event_type, void *event_data) {
     service                         *svc = NULL;
     nebstruct_host_check_data       *hstdata = NULL;
     nebstruct_service_check_data    *svcdata = NULL;
+    mb_dispatch_entry_t             dispatch;
 
-    /* Only handle events if we are able to publish them */
-    if (!mod_bunny_config.publisher_connected) {
+    /* Only handle events if we are able to publish them, or at least to spool them */
+    if (!mb_select_publisher(0, NULL) && !mod_bunny_config.spool) {
         return (NEB_OK);
     } else {
         switch (event_type) {
@@ -277,7 +869,7 @@ int mb_handle_event(int event_type, void *event_data) {
                 return (NEB_OK);
 
             /* Let Nagios handle this check if the host is member of local hostgroups */
-            if (mod_bunny_config.local_hstgroups && mb_in_local_hostgroups(hst)) {
+            if (mb_host_dispatch(hst, &dispatch)->local) {
                 if (mod_bunny_config.debug_level > 0)
                     logit(NSLOG_INFO_MESSAGE, TRUE,
                         "mod_bunny: mb_handle_event: host [%s] is member of local hostgroups, "
@@ -318,7 +910,7 @@ int mb_handle_event(int event_type, void *event_data) {
                 return (NEB_OK);
 
             /* Let Nagios handle this check if the service is member of local servicegroups */
-            if (mod_bunny_config.local_svcgroups && mb_in_local_servicegroups(svc)) {
+            if (mb_service_dispatch(svc, &dispatch)->local) {
                 if (mod_bunny_config.debug_level > 0)
                     logit(NSLOG_INFO_MESSAGE, TRUE,
                         "mod_bunny: mb_handle_event: service [%s/%s] is member of local servicegroups, "
@@ -363,17 +955,23 @@ int mb_handle_event(int event_type, void *event_data) {
 int mb_handle_host_check(nebstruct_host_check_data *hstdata) {
 /* {{{ */
     host    *hst = NULL;
-    char    cid[MB_HASH_BUF_LEN + 1] = {0};
-    char    *json_check = NULL;
+    char    cid[MB_CID_BUF_LEN] = {0};
+    const char *packed_check = NULL;
+    size_t  packed_check_len = 0;
     char    *raw_command = NULL;
     char    *processed_command = NULL;
+    mb_check_command_t check_cmd = { 0 };
     float   prev_latency;
     char    *routing_key = NULL;
+    unsigned long shard;
+    mb_dispatch_entry_t dispatch_buf;
+    mb_dispatch_entry_t *dispatch = NULL;
+    uint64_t inflight_seq = 0;
 
     hst = (host *)hstdata->object_ptr;
 
     /* Generate correlation ID used to track check processing */
-    mb_gen_cid(cid, MB_HASH_BUF_LEN + 1, hstdata->host_name, NULL);
+    mb_gen_cid(cid);
 
     if (mod_bunny_config.debug_level > 0)
         logit(NSLOG_INFO_MESSAGE, TRUE,
@@ -406,46 +1004,54 @@ int mb_handle_host_check(nebstruct_host_check_data *hstdata) {
     /* Adjust host check attempt */
     adjust_host_check_attempt_3x(hst, TRUE);
 
-    /* Grab the host macro variables */
-    clear_volatile_macros();
-    grab_host_macros(hst);
-
-    /* Get the raw command line */
-    get_raw_command_line(hst->check_command_ptr, hst->host_check_command, &raw_command, 0);
+    /* Get AMQP routing key and publisher shard for this host check */
+    dispatch = mb_host_dispatch(hst, &dispatch_buf);
+    routing_key = dispatch->routing_key;
+    shard = dispatch->shard;
+
+    /* Expand the command line ourselves when it only references the usual macros */
+    if (!mb_expand_check_command((dispatch != &dispatch_buf ? dispatch : NULL),
+        hst->check_command_ptr, hst->host_check_command, hst, NULL, &check_cmd)) {
+        /* Grab the host macro variables */
+        clear_volatile_macros();
+        grab_host_macros(hst);
+
+        /* Get the raw command line */
+        get_raw_command_line(hst->check_command_ptr, hst->host_check_command, &raw_command, 0);
+
+        if (!raw_command) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_handle_host_check: error: "
+                "host check command undefined",
+                cid);
+            goto error;
+        }
 
-    if (!raw_command) {
-        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_handle_host_check: error: "
-            "host check command undefined",
-            cid);
-        goto error;
-    }
+        /* Process any macros contained in the argument */
+        process_macros(raw_command, &processed_command, 0);
 
-    /* Process any macros contained in the argument */
-    process_macros(raw_command, &processed_command, 0);
+        if (!processed_command) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_handle_host_check: error: "
+                "unable to process check command line",
+                cid);
+            goto error;
+        }
 
-    if (!processed_command) {
-        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_handle_host_check: error: "
-            "unable to process check command line",
-            cid);
-        goto error;
+        check_cmd.line = processed_command;
     }
 
-    /* Serialize host check into JSON */
-    if (!(json_check = mb_json_pack_host_check(hstdata, hst->check_options, processed_command))) {
+    /* Serialize host check in the configured wire format */
+    if (mod_bunny_config.publisher_format_mode == MB_PUBLISHER_FORMAT_MSGPACK)
+        packed_check = mb_msgpack_pack_host_check(hstdata, hst->check_options, &check_cmd, &packed_check_len);
+    else
+        packed_check = mb_json_pack_host_check(hstdata, hst->check_options, &check_cmd, &packed_check_len);
+
+    if (!packed_check) {
         logit(NSLOG_RUNTIME_ERROR, TRUE,
-            "mod_bunny: %s: mb_handle_host_check: error occurred while packing JSON check data",
+            "mod_bunny: %s: mb_handle_host_check: error occurred while packing check data",
             cid);
         goto error;
     }
 
-    /* Get AMQP routing key for this host check */
-    if (mod_bunny_config.hstgroups_routing_table)
-        routing_key = mb_lookup_hostgroups_routing_table(hst);
-
-    /* If no specific routing key defined, use the global routing key */
-    if (!routing_key)
-        routing_key = mod_bunny_config.publisher_routing_key;
-
     if (mod_bunny_config.debug_level > 0)
         logit(NSLOG_INFO_MESSAGE, TRUE,
             "mod_bunny: %s: mb_handle_host_check: publishing host check [%s] with routing key \"%s\"",
@@ -453,21 +1059,38 @@ int mb_handle_host_check(nebstruct_host_check_data *hstdata) {
             hstdata->host_name,
             routing_key);
 
+    /* Track the check until its result comes back */
+    if (mod_bunny_config.inflight)
+        inflight_seq = mb_inflight_add(mod_bunny_config.inflight, cid, hst, HOST_CHECK, routing_key,
+            hstdata->current_attempt, hstdata->timeout);
+
+    if (inflight_seq)
+        mb_watch_check(inflight_seq, packed_check, packed_check_len, hstdata->timeout);
+
     /* Send the JSON-formatted host check message to the broker */
-    if (!mb_publish_check(cid, json_check, routing_key)) {
+    if (!mb_publish_check(cid, packed_check, packed_check_len, routing_key, dispatch->routing_key_len, shard,
+        hstdata->timeout)) {
         logit(NSLOG_RUNTIME_ERROR, TRUE,"mod_bunny: %s: mb_handle_host_check: error: "
             "could not publish host check message",
             cid);
+
+        if (inflight_seq)
+            mb_inflight_cancel(mod_bunny_config.inflight, inflight_seq);
+
         goto error;
     }
 
+    /* Now that it is on its way, the previous check of this host is superseded */
+    if (inflight_seq)
+        mb_inflight_supersede(mod_bunny_config.inflight, hst, inflight_seq);
+
     /* Set the execution flag */
     hst->is_executing = TRUE;
 
     /* Increment the number of host checks that are currently running */
     currently_running_host_checks++;
 
-    free(json_check);
+    /* The publisher thread got its own copy of the check message */
     free(raw_command);
     free(processed_command);
 
@@ -476,9 +1099,6 @@ int mb_handle_host_check(nebstruct_host_check_data *hstdata) {
     error:
     hst->latency = prev_latency;
 
-    if (json_check)
-        free(json_check);
-
     if (raw_command)
         free(raw_command);
 
@@ -493,15 +1113,21 @@ int mb_handle_service_check(nebstruct_service_check_data *svcdata) {
 /* {{{ */
     host    *hst = NULL;
     service *svc = NULL;
-    char    cid[MB_HASH_BUF_LEN + 1] = {0};
-    char    *json_check = NULL;
+    char    cid[MB_CID_BUF_LEN] = {0};
+    const char *packed_check = NULL;
+    size_t  packed_check_len = 0;
     char    *raw_command = NULL;
     char    *processed_command = NULL;
+    mb_check_command_t check_cmd = { 0 };
     float   prev_latency;
     char    *routing_key = NULL;
+    unsigned long shard;
+    mb_dispatch_entry_t dispatch_buf;
+    mb_dispatch_entry_t *dispatch = NULL;
+    uint64_t inflight_seq = 0;
 
     /* Generate correlation ID used to track check processing */
-    mb_gen_cid(cid, MB_HASH_BUF_LEN + 1, svcdata->host_name, svcdata->service_description);
+    mb_gen_cid(cid);
 
     if (mod_bunny_config.debug_level > 0)
         logit(NSLOG_INFO_MESSAGE, TRUE,
@@ -535,47 +1161,56 @@ int mb_handle_service_check(nebstruct_service_check_data *svcdata) {
     /* Nagios doesn't set the check timeout value prior to "INITIATE" stage, so we'll help ourselves */
     svcdata->timeout = service_check_timeout;
 
-    /* Grab the host and service macro variables */
-    clear_volatile_macros();
-    grab_host_macros(hst);
-    grab_service_macros(svc);
+    /* Get AMQP routing key and publisher shard for this service check */
+    dispatch = mb_service_dispatch(svc, &dispatch_buf);
+    routing_key = dispatch->routing_key;
+    shard = dispatch->shard;
+
+    /* Expand the command line ourselves when it only references the usual macros */
+    if (!mb_expand_check_command((dispatch != &dispatch_buf ? dispatch : NULL),
+        svc->check_command_ptr, svc->service_check_command, hst, svc, &check_cmd)) {
+        /* Grab the host and service macro variables */
+        clear_volatile_macros();
+        grab_host_macros(hst);
+        grab_service_macros(svc);
+
+        /* Get the raw command line */
+        get_raw_command_line(svc->check_command_ptr, svc->service_check_command, &raw_command, 0);
+
+        if (!raw_command) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_handle_service_check: error: "
+                "service check command undefined",
+                cid);
+            goto error;
+        }
 
-    /* Get the raw command line */
-    get_raw_command_line(svc->check_command_ptr, svc->service_check_command, &raw_command, 0);
+        /* Process any macros contained in the argument */
+        process_macros(raw_command, &processed_command, 0);
 
-    if (!raw_command) {
-        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_handle_service_check: error: "
-            "service check command undefined",
-            cid);
-        goto error;
+        if (!processed_command) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_handle_service_check: error: "
+                "unable to process check command line",
+                cid);
+            goto error;
+        }
+
+        check_cmd.line = processed_command;
     }
 
-    /* Process any macros contained in the argument */
-    process_macros(raw_command, &processed_command, 0);
+    /* Serialize service check in the configured wire format */
+    if (mod_bunny_config.publisher_format_mode == MB_PUBLISHER_FORMAT_MSGPACK)
+        packed_check = mb_msgpack_pack_service_check(svcdata, svc->check_options, &check_cmd,
+            &packed_check_len);
+    else
+        packed_check = mb_json_pack_service_check(svcdata, svc->check_options, &check_cmd, &packed_check_len);
 
-    if (!processed_command) {
-        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_handle_service_check: error: "
-            "unable to process check command line",
+    if (!packed_check) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE,
+            "mod_bunny: %s: mb_handle_service_check: error occurred while packing check data",
             cid);
         goto error;
     }
 
-    /* Serialize service check into JSON */
-    if (!(json_check = mb_json_pack_service_check(svcdata, svc->check_options, processed_command))) {
-        logit(NSLOG_RUNTIME_ERROR, TRUE,
-            "mod_bunny: %s: mb_handle_service_check: error occurred while packing JSON check data",
-            cid);
-        goto error;
-    }
-
-    /* Get AMQP routing key for this service check */
-    if (mod_bunny_config.svcgroups_routing_table)
-        routing_key = mb_lookup_servicegroups_routing_table(svc);
-
-    /* If no specific routing key defined, use the global routing key */
-    if (!routing_key)
-        routing_key = mod_bunny_config.publisher_routing_key;
-
     if (mod_bunny_config.debug_level > 0)
         logit(NSLOG_INFO_MESSAGE, TRUE,
             "mod_bunny: %s: mb_handle_service_check: publishing service check [%s/%s] with routing key \"%s\"",
@@ -584,21 +1219,38 @@ int mb_handle_service_check(nebstruct_service_check_data *svcdata) {
             svcdata->service_description,
             routing_key);
 
+    /* Track the check until its result comes back */
+    if (mod_bunny_config.inflight)
+        inflight_seq = mb_inflight_add(mod_bunny_config.inflight, cid, svc, SERVICE_CHECK, routing_key,
+            svcdata->current_attempt, svcdata->timeout);
+
+    if (inflight_seq)
+        mb_watch_check(inflight_seq, packed_check, packed_check_len, svcdata->timeout);
+
     /* Publish the service check through the AMQP broker */
-    if (!mb_publish_check(cid, json_check, routing_key)) {
+    if (!mb_publish_check(cid, packed_check, packed_check_len, routing_key, dispatch->routing_key_len, shard,
+        svcdata->timeout)) {
         logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_handle_service_check: error: "
             "could not publish service check message",
             cid);
+
+        if (inflight_seq)
+            mb_inflight_cancel(mod_bunny_config.inflight, inflight_seq);
+
         goto error;
     }
 
+    /* Now that it is on its way, the previous check of this service is superseded */
+    if (inflight_seq)
+        mb_inflight_supersede(mod_bunny_config.inflight, svc, inflight_seq);
+
     /* Set the execution flag */
     svc->is_executing = TRUE;
 
     /* Increment the number of service checks that are currently running */
     currently_running_service_checks++;
 
-    free(json_check);
+    /* The publisher thread got its own copy of the check message */
     free(raw_command);
     free(processed_command);
 
@@ -607,9 +1259,6 @@ int mb_handle_service_check(nebstruct_service_check_data *svcdata) {
     error:
     svc->latency = prev_latency;
 
-    if (json_check)
-        free(json_check);
-
     if (raw_command)
         free(raw_command);
 
@@ -620,15 +1269,128 @@ int mb_handle_service_check(nebstruct_service_check_data *svcdata) {
 /* }}} */
 }
 
-int mb_publish_check(char *cid, char *check, char *routing_key) {
+mb_publisher_t *mb_select_publisher(unsigned long shard, int *channel) {
 /* {{{ */
-    if (!mb_amqp_publish(&mod_bunny_config, cid, check, routing_key)) {
-        logit(NSLOG_RUNTIME_ERROR, TRUE,
-            "mod_bunny: %s: mb_amqp_publish_check: error occurred while publishing message",
+    mb_publisher_t  *publisher = NULL;
+    int             n = mod_bunny_config.publisher_connections;
+
+    if (!mod_bunny_config.publishers)
+        return (NULL);
+
+    /* If the publisher this shard maps to is down, fail over to the next healthy one */
+    for (int i = 0; i < n; i++) {
+        publisher = &mod_bunny_config.publishers[(shard + i) % n];
+
+        if (MB_ATOMIC_LOAD(&publisher->connected)) {
+            if (channel)
+                *channel = mb_shard_channel(shard);
+
+            return (publisher);
+        }
+    }
+
+    return (NULL);
+/* }}} */
+}
+
+int mb_shard_channel(unsigned long shard) {
+/* {{{ */
+    return (AMQP_CHANNEL + (int)((shard / mod_bunny_config.publisher_connections)
+        % mod_bunny_config.publisher_channels));
+/* }}} */
+}
+
+/*
+    Get a message holding a copy of `body'. Only the Nagios thread takes messages back from
+    the recycled ones, whose body buffer is reused as long as it is large enough.
+*/
+static mb_check_msg_t *mb_new_check_msg(const char *body, size_t body_len) {
+/* {{{ */
+    mb_check_msg_t  *msg = NULL;
+    char            *buf = NULL;
+
+    if (mod_bunny_config.check_msgs && pthread_equal(pthread_self(), mb_nagios_thread))
+        msg = mb_queue_pop(mod_bunny_config.check_msgs);
+
+    if (!msg && !(msg = calloc(1, sizeof(mb_check_msg_t))))
+        return (NULL);
+
+    /* Keep room for a trailing NUL byte, message bodies are logged as strings */
+    if (msg->body_size < body_len + 1) {
+        if (!(buf = realloc(msg->body, body_len + 1))) {
+            free(msg->body);
+            free(msg);
+            return (NULL);
+        }
+
+        msg->body = buf;
+        msg->body_size = body_len + 1;
+    }
+
+    memcpy(msg->body, body, body_len);
+    msg->body[body_len] = '\0';
+    msg->body_len = body_len;
+    msg->content_encoding = NULL;
+    msg->command_template = false;
+
+    return (msg);
+/* }}} */
+}
+
+/* Hand a copy of a check message over to a publisher thread, or to the spool */
+int mb_publish_check(char *cid, const char *check, size_t check_len, char *routing_key, size_t routing_key_len,
+    unsigned long shard, int timeout) {
+/* {{{ */
+    mb_publisher_t  *publisher = NULL;
+    mb_check_msg_t  *msg = NULL;
+    int             channel;
+
+    if (!(msg = mb_new_check_msg(check, check_len))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_publish_check: error: "
+            "unable to allocate memory",
             cid);
+        return (MB_NOK);
+    }
 
-        /* In case of AMQP publishing error, disconnect from the broker as a safety measure */
-        mb_amqp_disconnect_publisher(&mod_bunny_config);
+    /* Correlation IDs are all generated by mb_gen_cid(), with the same length */
+    memcpy(msg->cid, cid, MB_CID_BUF_LEN);
+    msg->cid_len = MB_CID_BUF_LEN - 1;
+    msg->routing_key = routing_key;
+    msg->routing_key_len = routing_key_len;
+    msg->content_type = (mod_bunny_config.publisher_format_mode == MB_PUBLISHER_FORMAT_MSGPACK
+        ? MB_CONTENT_TYPE_MSGPACK : MB_CONTENT_TYPE_JSON);
+
+    if (!(publisher = mb_select_publisher(shard, &channel))) {
+        /* Keep the check on disk until a publisher reconnects, if it times out meanwhile it is dropped */
+        if (mod_bunny_config.spool
+            && mb_spool_push(mod_bunny_config.spool, msg, shard, time(NULL) + timeout)) {
+            mb_free_check_msg(msg);
+            return (MB_OK);
+        }
+
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_publish_check: error: "
+            "no publisher connected to the broker",
+            cid);
+
+        mb_free_check_msg(msg);
+
+        return (MB_NOK);
+    }
+
+    msg->channel = channel;
+
+    /*
+        Hand the check over to the publisher thread: we must never block the Nagios
+        event loop on the broker, so if the queue is full let Nagios reschedule the check
+    */
+    if (!mb_queue_push(publisher->queue, msg)) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE,
+            "mod_bunny: %s: mb_publish_check: error: publisher #%d queue is full (%d messages)",
+            cid,
+            publisher->id,
+            mod_bunny_config.publisher_queue_size);
+
+        mb_free_check_msg(msg);
 
         return (MB_NOK);
     }
@@ -637,49 +1399,529 @@ int mb_publish_check(char *cid, char *check, char *routing_key) {
 /* }}} */
 }
 
-void mb_process_check_result(char *cid, char *msg) {
+/*
+    Hand a command template definition over to a publisher thread. Templates are never
+    spooled: until one has been published, checks using it are published in full.
+*/
+int mb_publish_command_template(mb_command_template_t *tmpl, unsigned long shard) {
 /* {{{ */
-    check_result *cr = NULL;
+    mb_publisher_t  *publisher = NULL;
+    mb_check_msg_t  *msg = NULL;
+    const char      *packed_template = NULL;
+    size_t          packed_template_len = 0;
+    int             channel;
+
+    if (!(publisher = mb_select_publisher(shard, &channel)))
+        return (MB_NOK);
+
+    if (mod_bunny_config.publisher_format_mode == MB_PUBLISHER_FORMAT_MSGPACK)
+        packed_template = mb_msgpack_pack_command_template(tmpl, &packed_template_len);
+    else
+        packed_template = mb_json_pack_command_template(tmpl, &packed_template_len);
+
+    if (!packed_template)
+        return (MB_NOK);
+
+    if (!(msg = mb_new_check_msg(packed_template, packed_template_len))) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_publish_command_template: error: "
+            "unable to allocate memory");
+        return (MB_NOK);
+    }
+
+    /* The template ID is both the correlation ID and the routing key, the message owning a copy of it */
+    memcpy(msg->cid, tmpl->id, MB_COMMAND_TEMPLATE_ID_LEN + 1);
+    msg->cid_len = MB_COMMAND_TEMPLATE_ID_LEN;
+    msg->routing_key = msg->cid;
+    msg->routing_key_len = MB_COMMAND_TEMPLATE_ID_LEN;
+    msg->content_type = (mod_bunny_config.publisher_format_mode == MB_PUBLISHER_FORMAT_MSGPACK
+        ? MB_CONTENT_TYPE_MSGPACK : MB_CONTENT_TYPE_JSON);
+    msg->command_template = true;
+    msg->channel = channel;
+
+    if (!mb_queue_push(publisher->queue, msg)) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE,
+            "mod_bunny: %s: mb_publish_command_template: error: publisher #%d queue is full (%d messages)",
+            tmpl->id,
+            publisher->id,
+            mod_bunny_config.publisher_queue_size);
+
+        mb_free_check_msg(msg);
+
+        return (MB_NOK);
+    }
+
+    if (mod_bunny_config.debug_level > 0)
+        logit(NSLOG_INFO_MESSAGE, TRUE,
+            "mod_bunny: %s: mb_publish_command_template: publishing command template with %d arguments",
+            tmpl->id,
+            tmpl->nargs);
+
+    return (MB_OK);
+/* }}} */
+}
+
+static void mb_republish_command_template(mb_command_template_t *tmpl) {
+/* {{{ */
+    mb_publish_command_template(tmpl, (unsigned long)tmpl->hash);
+/* }}} */
+}
+
+/* Timed event run by the Nagios event loop, for workers that missed template definitions */
+void mb_republish_command_templates(void *args __attribute__((__unused__))) {
+/* {{{ */
+    if (mod_bunny_config.known_templates)
+        mb_command_templates_foreach(mod_bunny_config.known_templates, mb_republish_command_template);
+/* }}} */
+}
+
+/* Recycle a message done with, unless its body buffer is of unknown or large size */
+void mb_free_check_msg(mb_check_msg_t *msg) {
+/* {{{ */
+    if (!msg)
+        return;
+
+    if (mod_bunny_config.check_msgs && msg->body_size > 0 && msg->body_size <= MB_CHECK_MSG_MAX_KEPT
+        && mb_queue_push(mod_bunny_config.check_msgs, msg))
+        return;
+
+    free(msg->body);
+    free(msg);
+/* }}} */
+}
+
+bool mb_content_type_is_binary(const char *content_type) {
+/* {{{ */
+    return (MB_STR_MATCH(content_type, MB_CONTENT_TYPE_MSGPACK)
+        || MB_STR_MATCH(content_type, MB_CONTENT_TYPE_MSGPACK_BATCH));
+/* }}} */
+}
+
+/* Decode a received message, passing the check results it holds to `submit' */
+void mb_decode_check_result(char *cid, char *content_type, char *msg, size_t msg_len,
+    void (*submit)(char *, check_result *)) {
+/* {{{ */
+    check_result    *cr = NULL;
+    int             rc;
 
     assert(msg);
 
-    if (!(cr = mb_json_unpack_check_result(msg))) {
-        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_process_check_result: error: "
+    /* Workers may send back several check results at once */
+    if (MB_STR_MATCH(content_type, MB_CONTENT_TYPE_JSON_BATCH)
+        || MB_STR_MATCH(content_type, MB_CONTENT_TYPE_MSGPACK_BATCH)) {
+        if (MB_STR_MATCH(content_type, MB_CONTENT_TYPE_MSGPACK_BATCH))
+            rc = mb_msgpack_unpack_check_result_batch(msg, msg_len, submit);
+        else if (mod_bunny_config.fast_result_decoder)
+            rc = mb_json_decode_check_result_batch(msg, submit);
+        else
+            rc = mb_json_unpack_check_result_batch(msg, submit);
+
+        if (!rc)
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_decode_check_result: error: "
+                "unable to unpack received check results batch, discarding",
+                cid);
+        return;
+    }
+
+    if (MB_STR_MATCH(content_type, MB_CONTENT_TYPE_MSGPACK))
+        cr = mb_msgpack_unpack_check_result(msg, msg_len);
+    /* The fast decoder falls back on jansson by itself for input it doesn't handle */
+    else if (mod_bunny_config.fast_result_decoder)
+        cr = mb_json_decode_check_result(msg);
+    else
+        cr = mb_json_unpack_check_result(msg);
+
+    if (!cr) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_decode_check_result: error: "
             "unable to unpack received check result, discarding",
             cid);
         return;
     }
 
-    /* Inject check result into internal Nagios check result list */
-#if NAGIOS_3_5_X
-    add_check_result_to_list(&check_result_list, cr);
-#else
-    add_check_result_to_list(cr);
-#endif
+    submit(cid, cr);
+/* }}} */
+}
+
+/*
+    Handle a received message, owning `delivery' from now on: it is either decoded right
+    away, or handed over to the decoder threads if there are any.
+*/
+void mb_process_check_result(mb_delivery_t *delivery) {
+/* {{{ */
+    if (mod_bunny_config.decoders) {
+        mb_decoder_pool_submit(mod_bunny_config.decoders, delivery);
+        mb_decoder_pool_flush(mod_bunny_config.decoders, false);
+        return;
+    }
+
+    mb_decode_check_result(delivery->cid, delivery->content_type, delivery->body, delivery->body_len,
+        mb_submit_check_result);
+    mb_delivery_done(delivery);
+/* }}} */
+}
+
+/*
+    Called by the consumer thread once all check results of a message are submitted, in
+    delivery order: the message may be acknowledged, and its delivery recycled.
+*/
+void mb_delivery_done(mb_delivery_t *delivery) {
+/* {{{ */
+    if (mod_bunny_config.consumer_acks)
+        mb_amqp_delivery_done(&mod_bunny_config, delivery->tag);
+
+    mb_delivery_release(mod_bunny_config.deliveries, delivery);
+/* }}} */
+}
+
+/* Called by the consumer thread before waiting for messages, results decoded so far must not linger */
+void mb_flush_check_results(void) {
+/* {{{ */
+    if (mod_bunny_config.decoders)
+        mb_decoder_pool_flush(mod_bunny_config.decoders, true);
+/* }}} */
+}
+
+void mb_submit_check_result(char *cid, check_result *cr) {
+/* {{{ */
+    uint64_t    rtt_us = 0;
+    int         rc;
+
+    /* Only accept results of checks we are waiting for */
+    if (mod_bunny_config.inflight
+        && (rc = mb_inflight_remove(mod_bunny_config.inflight, cid, cr, &rtt_us)) != MB_INFLIGHT_RESULT_MATCHED) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: %s: mb_submit_check_result: error: "
+            "discarding %s check result for [%s%s%s]",
+            cid,
+            mb_inflight_result_str(rc),
+            (cr->host_name ? cr->host_name : ""),
+            (cr->service_description ? "/" : ""),
+            (cr->service_description ? cr->service_description : ""));
+
+        free_check_result(cr);
+        free(cr);
+
+        return;
+    }
 
     if (cr->object_check_type == HOST_CHECK) {
         if (mod_bunny_config.debug_level > 0)
             logit(NSLOG_INFO_MESSAGE, TRUE,
-                "mod_bunny: %s: mb_process_check_result: processed host check result for [%s]",
+                "mod_bunny: %s: mb_submit_check_result: processed host check result for [%s] "
+                "(round-trip %lu ms)",
                 cid,
-                cr->host_name);
+                cr->host_name,
+                (unsigned long)(rtt_us / 1000));
     } else {
         if (mod_bunny_config.debug_level > 0)
             logit(NSLOG_INFO_MESSAGE, TRUE,
-                "mod_bunny: %s: mb_process_check_result: processed service check result for [%s/%s]",
+                "mod_bunny: %s: mb_submit_check_result: processed service check result for [%s/%s] "
+                "(round-trip %lu ms)",
                 cid,
                 cr->host_name,
-                cr->service_description);
+                cr->service_description,
+                (unsigned long)(rtt_us / 1000));
+    }
+
+    /* Counted so that messages are only acknowledged once Nagios got their results */
+    ((mb_check_result_t *)cr)->consumed = true;
+    mod_bunny_config.results_submitted++;
+
+    if (!mb_queue_check_result(cr, true)) {
+        free_check_result(cr);
+        free(cr);
+    }
+/* }}} */
+}
+
+/*
+    Hand a check result over to Nagios. Nagios structures may only be touched from its
+    event loop thread, other threads queue their results for mb_drain_check_results().
+    Returns MB_NOK if the results queue is full and `wait' is false or the consumer thread
+    is being stopped, the caller still owning the result.
+*/
+int mb_queue_check_result(check_result *cr, bool wait) {
+/* {{{ */
+    bool stalled = false;
+
+    if (pthread_equal(pthread_self(), mb_nagios_thread)) {
+#if NAGIOS_3_5_X
+        add_check_result_to_list(&check_result_list, cr);
+#else
+        add_check_result_to_list(cr);
+#endif
+        return (MB_OK);
+    }
+
+    ((mb_check_result_t *)cr)->received_us = mb_now_us();
+
+    /* Never drop a result: hold on until Nagios catches up, results pile up on the broker meanwhile */
+    while (!mb_queue_push(mod_bunny_config.results, cr)) {
+        if (!wait || __atomic_load_n(&mod_bunny_config.consumer_stopping, __ATOMIC_ACQUIRE))
+            return (MB_NOK);
+
+        if (!stalled) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_queue_check_result: error: "
+                "check results queue is full (%d results), waiting for Nagios to catch up",
+                mod_bunny_config.result_queue_size);
+            stalled = true;
+        }
+
+        usleep(MB_RESULT_QUEUE_FULL_WAIT * 1000);
+    }
+
+    return (MB_OK);
+/* }}} */
+}
+
+/*
+    Called from the first publisher thread on each tick of check timers, to queue the
+    results of failed checks the results queue had no room for so far
+*/
+void mb_queue_deferred_check_results(void) {
+/* {{{ */
+    check_result *cr = NULL;
+    check_result *next = NULL;
+
+    while ((cr = mod_bunny_config.deferred_results)) {
+        next = cr->next;
+
+        if (!mb_queue_check_result(cr, false))
+            return;
+
+        mod_bunny_config.deferred_results = next;
+    }
+/* }}} */
+}
+
+/*
+    Timed event run by the Nagios event loop, moving queued check results into the reaper
+    list. Nagios inserts results one by one in a list sorted by finish time, which gets
+    quadratic when a backlog of results comes in at once: results received since the
+    last run are sorted on their own and merged into the list in one pass instead.
+*/
+void mb_drain_check_results(void *args __attribute__((__unused__))) {
+/* {{{ */
+    check_result    *cr = NULL;
+    uint64_t        now_us;
+    bool            reap = false;
+
+    if (!mod_bunny_config.results)
+        return;
+
+    while ((cr = mb_queue_pop(mod_bunny_config.results))) {
+        *mod_bunny_config.pending_results_tail = cr;
+        mod_bunny_config.pending_results_tail = &cr->next;
+        mod_bunny_config.pending_results_count++;
+
+        if (((mb_check_result_t *)cr)->consumed)
+            mod_bunny_config.pending_results_consumed++;
+    }
+
+    if (!mod_bunny_config.pending_results)
+        return;
+
+    *mod_bunny_config.pending_results_tail = NULL;
+
+    /*
+        Nagios only reaps results every `check_result_reaper_interval' seconds, so when
+        asked to, hold them until enough of them are pending or the oldest one waited long enough,
+        then run a reaper pass right away. Results are only drained once per second, so the
+        oldest one may wait up to a second more than `reaper_trigger_age'.
+    */
+    if (mod_bunny_config.reaper_trigger) {
+        now_us = mb_now_us();
+
+        if (mod_bunny_config.pending_results_count < (unsigned long)mod_bunny_config.reaper_trigger_results
+            && now_us - ((mb_check_result_t *)mod_bunny_config.pending_results)->received_us
+                < (uint64_t)mod_bunny_config.reaper_trigger_age * 1000000ULL)
+            return;
+
+        /* If the last pass hit the reaper time limit, leave these results to the Nagios reaper */
+        if ((reap = (time(NULL) >= mod_bunny_config.reaper_backoff_until))) {
+            for (cr = mod_bunny_config.pending_results; cr; cr = cr->next)
+                mb_record_reap_delay((now_us - ((mb_check_result_t *)cr)->received_us) / 1000);
+        }
+    }
+
+    check_result_list = mb_merge_check_results(check_result_list,
+        mb_sort_check_results(mod_bunny_config.pending_results));
+
+    mod_bunny_config.pending_results = NULL;
+    mod_bunny_config.pending_results_tail = &mod_bunny_config.pending_results;
+
+    /* Nagios has these results now, the consumer thread may acknowledge their messages */
+    __atomic_add_fetch(&mod_bunny_config.results_handed, mod_bunny_config.pending_results_consumed,
+        __ATOMIC_RELEASE);
+    mod_bunny_config.pending_results_consumed = 0;
+
+    if (reap)
+        mb_trigger_reaper();
+
+    mod_bunny_config.pending_results_count = 0;
+/* }}} */
+}
+
+/* Run a reaper pass, Nagios itself stops it after `max_check_result_reaper_time' seconds */
+void mb_trigger_reaper(void) {
+/* {{{ */
+    time_t started = time(NULL);
+    time_t elapsed;
+
+    reap_check_results();
+
+    mod_bunny_config.reaper_passes++;
+
+    if ((elapsed = time(NULL) - started) >= max_check_reaper_time) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_trigger_reaper: error: "
+            "reaper pass hit the %d seconds time limit, pausing triggered passes for as long",
+            max_check_reaper_time);
+        mod_bunny_config.reaper_backoff_until = time(NULL) + elapsed;
+    }
+
+    if (mod_bunny_config.debug_level > 0)
+        logit(NSLOG_INFO_MESSAGE, TRUE,
+            "mod_bunny: mb_trigger_reaper: reaper pass triggered for %lu check results",
+            mod_bunny_config.pending_results_count);
+/* }}} */
+}
+
+void mb_record_reap_delay(unsigned long delay_ms) {
+/* {{{ */
+    int i = 0;
+
+    while (delay_ms > mb_reap_delay_bounds[i])
+        i++;
+
+    mod_bunny_config.reap_delays[i]++;
+/* }}} */
+}
+
+/* Arm the deadline of a check in flight, keeping a copy of its message if it may be republished */
+void mb_watch_check(uint64_t inflight_seq, const char *check, size_t check_len, int timeout) {
+/* {{{ */
+    mb_check_msg_t *copy = NULL;
+
+    if (!mod_bunny_config.check_timeouts)
+        return;
+
+    /* The copy is a recycled message too, handed back to the pool once the check is done with */
+    if (mod_bunny_config.check_timeout_mode == MB_CHECK_TIMEOUT_REPUBLISH) {
+        if (!(copy = mb_new_check_msg(check, check_len))) {
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_watch_check: error: "
+                "unable to allocate memory");
+            return;
+        }
+
+        mb_inflight_retain(mod_bunny_config.inflight, inflight_seq, copy, 0);
+    }
+
+    mb_timer_wheel_add(mod_bunny_config.check_timeouts, inflight_seq,
+        timeout + mod_bunny_config.check_timeout_slack);
+/* }}} */
+}
+
+/* Publish a timed out check again, to the fallback routing key if one is configured */
+int mb_republish_check(mb_inflight_check_t *check) {
+/* {{{ */
+    char        cid[MB_CID_BUF_LEN] = {0};
+    char        *routing_key = NULL;
+    uint64_t    inflight_seq;
+
+    routing_key = (strlen(mod_bunny_config.check_timeout_routing_key) > 0
+        ? mod_bunny_config.check_timeout_routing_key : check->routing_key);
+
+    mb_gen_cid(cid);
+
+    if (!(inflight_seq = mb_inflight_add(mod_bunny_config.inflight, cid, check->object, check->object_type,
+        routing_key, check->attempt, check->timeout)))
+        return (MB_NOK);
+
+    if (!mb_publish_check(cid, check->msg->body, check->msg->body_len, routing_key, strlen(routing_key),
+        mb_hash_str(routing_key), check->timeout)) {
+        mb_inflight_cancel(mod_bunny_config.inflight, inflight_seq);
+        return (MB_NOK);
+    }
+
+    /* The publisher got its own copy, the table keeps this one if the check may be republished again */
+    if (check->republished + 1 < MB_MAX_CHECK_REPUBLISH)
+        mb_inflight_retain(mod_bunny_config.inflight, inflight_seq, check->msg, check->republished + 1);
+    else {
+        mb_inflight_retain(mod_bunny_config.inflight, inflight_seq, NULL, check->republished + 1);
+        mb_free_check_msg(check->msg);
+    }
+
+    check->msg = NULL;
+
+    /* Results of the timed out check are late anyway, but the next check must supersede this one */
+    mb_inflight_supersede(mod_bunny_config.inflight, check->object, inflight_seq);
+
+    mb_timer_wheel_add(mod_bunny_config.check_timeouts, inflight_seq,
+        check->timeout + mod_bunny_config.check_timeout_slack);
+
+    if (mod_bunny_config.debug_level > 0)
+        logit(NSLOG_INFO_MESSAGE, TRUE,
+            "mod_bunny: %s: mb_republish_check: republished timed out check with routing key \"%s\"",
+            cid,
+            routing_key);
+
+    return (MB_OK);
+/* }}} */
+}
+
+/*
+    Called from the first publisher thread when the deadline of a check passes. If its
+    result is still awaited, the check is published again or failed, whichever comes
+    first of the Nagios orphaned checks sweep.
+*/
+void mb_expire_check(uint64_t inflight_seq) {
+/* {{{ */
+    mb_inflight_check_t check;
+    char                output[MB_BUF_LEN];
+    char                *host_name = NULL;
+    char                *service_description = NULL;
+
+    if (!mb_inflight_expire(mod_bunny_config.inflight, inflight_seq, &check))
+        return;
+
+    if (check.object_type == HOST_CHECK)
+        host_name = ((host *)check.object)->name;
+    else {
+        host_name = ((service *)check.object)->host_name;
+        service_description = ((service *)check.object)->description;
     }
+
+    logit(NSLOG_RUNTIME_ERROR, TRUE,
+        "mod_bunny: mb_expire_check: error: no result received for %s check [%s%s%s] within %d seconds",
+        (check.object_type == HOST_CHECK ? "host" : "service"),
+        host_name,
+        (service_description ? "/" : ""),
+        (service_description ? service_description : ""),
+        check.timeout + mod_bunny_config.check_timeout_slack);
+
+    if (check.msg && check.republished < MB_MAX_CHECK_REPUBLISH && mb_republish_check(&check))
+        return;
+
+    mb_free_check_msg(check.msg);
+
+    snprintf(output, sizeof(output), "[mod_bunny] error: no check result received within %d seconds",
+        check.timeout + mod_bunny_config.check_timeout_slack);
+
+    mb_fail_check(host_name, service_description, output);
 /* }}} */
 }
 
 void mb_mark_check_orphaned(char *host, char *service) {
+/* {{{ */
+    mb_fail_check(host, service, "[mod_bunny] error: check is orphaned (no workers running?)");
+/* }}} */
+}
+
+/* Fake a critical result for a check, reported with the given output */
+void mb_fail_check(char *host, char *service, char *output) {
 /* {{{ */
     check_result *cr = NULL;
 
-    if (!(cr = (check_result *)calloc(1, sizeof(check_result)))) {
-        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_mark_check_orphaned: error: "
+    if (!(cr = mb_new_check_result())) {
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_fail_check: error: "
         "unable to allocate memory");
         return;
     }
@@ -690,7 +1932,7 @@ void mb_mark_check_orphaned(char *host, char *service) {
     cr->reschedule_check = TRUE;
     cr->exited_ok = TRUE;
     cr->early_timeout = FALSE;
-    cr->output = strdup("[mod_bunny] error: check is orphaned (no workers running?)");
+    cr->output = strdup(output);
     cr->output_file = NULL;
     cr->output_file_fp = NULL;
     cr->check_options = CHECK_OPTION_NONE;
@@ -699,7 +1941,7 @@ void mb_mark_check_orphaned(char *host, char *service) {
     cr->latency = 0;
 
     if (!host) {
-        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_mark_check_orphaned: error: "
+        logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_fail_check: error: "
         "host name unspecified");
         goto error;
     } else
@@ -716,11 +1958,16 @@ void mb_mark_check_orphaned(char *host, char *service) {
         cr->return_code = HOST_UNREACHABLE;
     }
 
-#if NAGIOS_3_5_X
-    add_check_result_to_list(&check_result_list, cr);
-#else
-    add_check_result_to_list(cr);
-#endif
+    /* Don't hold check timers up until Nagios catches up, try again on their next tick instead */
+    if (!mb_queue_check_result(cr, false)) {
+        if (!mod_bunny_config.deferred_results)
+            logit(NSLOG_RUNTIME_ERROR, TRUE, "mod_bunny: mb_fail_check: error: "
+                "check results queue is full (%d results), deferring failed check results",
+                mod_bunny_config.result_queue_size);
+
+        cr->next = mod_bunny_config.deferred_results;
+        mod_bunny_config.deferred_results = cr;
+    }
 
     return;
 
@@ -734,18 +1981,14 @@ void mb_mark_check_orphaned(char *host, char *service) {
 
 char *mb_lookup_hostgroups_routing_table(host *hst) {
 /* {{{ */
-    objectlist          *obj = NULL;
-    mb_hstgroup_route_t *hstgroup_route = NULL;
-    mb_hstgroup_t       *hstgroup = NULL;
+    objectlist  *obj = NULL;
+    char        *routing_key = NULL;
 
+    /* The first hostgroup matching a route wins, then the first route it matches */
     for (obj = hst->hostgroups_ptr; obj != NULL; obj = obj->next) {
-        TAILQ_FOREACH(hstgroup_route, mod_bunny_config.hstgroups_routing_table, tq) {
-            TAILQ_FOREACH(hstgroup, hstgroup_route->hstgroups, tq) {
-                if ((fnmatch(hstgroup->pattern, ((hostgroup *)obj->object_ptr)->group_name, 0) == 0)) {
-                    return (hstgroup_route->routing_key);
-                }
-            }
-        }
+        if ((routing_key = mb_matcher_lookup(mod_bunny_config.hstgroups_routing_matcher,
+            ((hostgroup *)obj->object_ptr)->group_name)))
+            return (routing_key);
     }
 
     return (NULL);
@@ -754,18 +1997,14 @@ char *mb_lookup_hostgroups_routing_table(host *hst) {
 
 char *mb_lookup_servicegroups_routing_table(service *svc) {
 /* {{{ */
-    objectlist          *obj = NULL;
-    mb_svcgroup_route_t *svcgroup_route = NULL;
-    mb_svcgroup_t       *svcgroup = NULL;
+    objectlist  *obj = NULL;
+    char        *routing_key = NULL;
 
+    /* The first servicegroup matching a route wins, then the first route it matches */
     for (obj = svc->servicegroups_ptr; obj != NULL; obj = obj->next) {
-        TAILQ_FOREACH(svcgroup_route, mod_bunny_config.svcgroups_routing_table, tq) {
-            TAILQ_FOREACH(svcgroup, svcgroup_route->svcgroups, tq) {
-                if ((fnmatch(svcgroup->pattern, ((servicegroup *)obj->object_ptr)->group_name, 0) == 0)) {
-                    return (svcgroup_route->routing_key);
-                }
-            }
-        }
+        if ((routing_key = mb_matcher_lookup(mod_bunny_config.svcgroups_routing_matcher,
+            ((servicegroup *)obj->object_ptr)->group_name)))
+            return (routing_key);
     }
 
     return (NULL);
@@ -774,15 +2013,12 @@ char *mb_lookup_servicegroups_routing_table(service *svc) {
 
 int mb_in_local_hostgroups(host *hst) {
 /* {{{ */
-    objectlist      *obj = NULL;
-    mb_hstgroup_t   *hstgroup = NULL;
+    objectlist *obj = NULL;
 
     for (obj = hst->hostgroups_ptr; obj != NULL; obj = obj->next) {
-        TAILQ_FOREACH(hstgroup, mod_bunny_config.local_hstgroups, tq) {
-            if ((fnmatch(hstgroup->pattern, ((hostgroup *)obj->object_ptr)->group_name, 0) == 0)) {
-                return (MB_OK);
-            }
-        }
+        if (mb_matcher_lookup(mod_bunny_config.local_hstgroups_matcher,
+            ((hostgroup *)obj->object_ptr)->group_name))
+            return (MB_OK);
     }
 
     return (MB_NOK);
@@ -791,15 +2027,12 @@ int mb_in_local_hostgroups(host *hst) {
 
 int mb_in_local_servicegroups(service *svc) {
 /* {{{ */
-    objectlist      *obj = NULL;
-    mb_svcgroup_t   *svcgroup = NULL;
+    objectlist *obj = NULL;
 
     for (obj = svc->servicegroups_ptr; obj != NULL; obj = obj->next) {
-        TAILQ_FOREACH(svcgroup, mod_bunny_config.local_svcgroups, tq) {
-            if ((fnmatch(svcgroup->pattern, ((servicegroup *)obj->object_ptr)->group_name, 0) == 0)) {
-                return (MB_OK);
-            }
-        }
+        if (mb_matcher_lookup(mod_bunny_config.local_svcgroups_matcher,
+            ((servicegroup *)obj->object_ptr)->group_name))
+            return (MB_OK);
     }
 
     return (MB_NOK);
@@ -30,9 +30,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <limits.h>
+#include <errno.h>
 #include <unistd.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
 #include <assert.h>
 #include <pthread.h>
 #include <sys/queue.h>
@@ -60,6 +64,7 @@
 #define MB_OK                               1
 #define MB_NOK                              0
 #define MB_BUF_LEN                          1024
+#define MB_CID_BUF_LEN                      33 /* 128-bit correlation ID, hex-encoded */
 #define MB_MAX_PATH_LEN                     PATH_MAX
 #define MB_DEFAULT_DEBUG_LEVEL              0
 #define MB_DEFAULT_HOST                     "localhost"
@@ -76,9 +81,285 @@
 #define MB_DEFAULT_CONSUMER_BINDING_KEY     "nagios_results"
 #define MB_DEFAULT_RETRY_WAIT_TIME          3
 #define MB_MAX_RETRY_WAIT_TIME              30
+#define MB_DEFAULT_PUBLISHER_QUEUE_SIZE     8192
+#define MB_MAX_PUBLISHER_QUEUE_SIZE         1048576
+#define MB_DEFAULT_RESULT_QUEUE_SIZE        65536
+#define MB_MAX_RESULT_QUEUE_SIZE            16777216
+#define MB_RESULT_QUEUE_FULL_WAIT           10
+#define MB_RESULT_DRAIN_INTERVAL            1
+#define MB_DEFAULT_DECODE_WORKERS           0
+#define MB_MAX_DECODE_WORKERS               64
+#define MB_DEFAULT_CONSUMER_PREFETCH        10000
+#define MB_MAX_CONSUMER_PREFETCH            65535
+#define MB_DEFAULT_CONSUMER_ACK_BATCH       100
+#define MB_MAX_CONSUMER_ACK_BATCH           65535
+#define MB_DEFAULT_CONSUMER_ACK_LINGER_MS   100
+#define MB_MAX_CONSUMER_ACK_LINGER_MS       60000
+#define MB_DEFAULT_REAPER_TRIGGER_RESULTS   100
+#define MB_MAX_REAPER_TRIGGER_RESULTS       1000000
+#define MB_DEFAULT_REAPER_TRIGGER_AGE       1
+#define MB_MAX_REAPER_TRIGGER_AGE           3600
+#define MB_REAP_DELAY_BUCKETS               10
+#define MB_PUBLISHER_IDLE_WAIT              1000
+#define MB_DEFAULT_MAX_BATCH_CHECKS         1
+#define MB_MAX_MAX_BATCH_CHECKS             10000
+#define MB_DEFAULT_MAX_BATCH_LINGER_MS      100
+#define MB_MAX_MAX_BATCH_LINGER_MS          60000
+
+#define MB_DEFAULT_PUBLISHER_CONNECTIONS    1
+#define MB_MAX_PUBLISHER_CONNECTIONS        64
+#define MB_DEFAULT_PUBLISHER_CHANNELS       1
+#define MB_MAX_PUBLISHER_CHANNELS           64
+#define MB_DEFAULT_PUBLISHER_SHARDING       "routing_key"
+#define MB_DEFAULT_PUBLISHER_CONFIRM_WINDOW 1024
+#define MB_MAX_PUBLISHER_CONFIRM_WINDOW     65536
+#define MB_CONFIRM_POLL_INTERVAL            10
+#define MB_CHECK_MSG_POOL_SIZE              1024
+#define MB_CHECK_MSG_MAX_KEPT               (64 * 1024)
+
+#define MB_CONTENT_TYPE_JSON                "application/json"
+#define MB_CONTENT_TYPE_JSON_BATCH          "application/vnd.mod-bunny.batch+json"
+#define MB_CONTENT_TYPE_MSGPACK             "application/x-msgpack"
+#define MB_CONTENT_TYPE_MSGPACK_BATCH       "application/vnd.mod-bunny.batch+msgpack"
+
+#define MB_CONTENT_ENCODING_LZ4             "lz4"
+#define MB_CONTENT_ENCODING_ZSTD            "zstd"
+
+#define MB_DEFAULT_PUBLISHER_FORMAT         "json"
+#define MB_DEFAULT_PUBLISHER_COMPRESSION    "none"
+#define MB_DEFAULT_COMPRESSION_THRESHOLD    4096
+#define MB_MAX_COMPRESSION_THRESHOLD        (64 * 1024 * 1024)
+
+#define MB_DEFAULT_SPOOL_MAX_SIZE           64
+#define MB_MAX_SPOOL_MAX_SIZE               65536
+#define MB_DEFAULT_SPOOL_MAX_CHECKS         100000
+#define MB_MAX_SPOOL_MAX_CHECKS             100000000
+#define MB_DEFAULT_SPOOL_REPLAY_RATE        100
+#define MB_MAX_SPOOL_REPLAY_RATE            1000000
+
+#define MB_DEFAULT_INFLIGHT_TABLE_SIZE      65536
+#define MB_MAX_INFLIGHT_TABLE_SIZE          16777216
+
+#define MB_DEFAULT_CHECK_TIMEOUT_ACTION     "fail"
+#define MB_DEFAULT_CHECK_TIMEOUT_SLACK      10
+#define MB_MAX_CHECK_TIMEOUT_SLACK          3600
+#define MB_MAX_CHECK_REPUBLISH              1
+
+#define MB_DEFAULT_COMMAND_TEMPLATES_EXCHANGE "nagios_command_templates"
+#define MB_DEFAULT_COMMAND_TEMPLATES_INTERVAL 300
+#define MB_MAX_COMMAND_TEMPLATES_INTERVAL   86400
+#define MB_COMMAND_TEMPLATE_ID_LEN          16 /* 64-bit hash of the template, hex-encoded */
+
+#define MB_BUF_MIN_SIZE                     1024
+
+#define MB_BUF_APPEND_LITERAL(b, s)         mb_buf_append(b, s, sizeof(s) - 1)
 
 #define MB_STR_MATCH(a, b) ((strlen(a) == strlen(b)) && strncmp(a, b, strlen(b)) == 0 ? true : false)
 
+/* Flags shared between Nagios and mod_bunny threads */
+#define MB_ATOMIC_LOAD(p)       __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define MB_ATOMIC_STORE(p, v)   __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+typedef struct mb_queue_s mb_queue_t;
+typedef struct mb_compressor_s mb_compressor_t;
+typedef struct mb_spool_s mb_spool_t;
+typedef struct mb_matcher_s mb_matcher_t;
+typedef struct mb_dispatch_s mb_dispatch_t;
+typedef struct mb_inflight_s mb_inflight_t;
+typedef struct mb_timer_wheel_s mb_timer_wheel_t;
+typedef struct mb_decoder_pool_s mb_decoder_pool_t;
+typedef struct mb_consumer_acks_s mb_consumer_acks_t;
+typedef struct mb_arena_chunk_s mb_arena_chunk_t;
+typedef struct mb_delivery_pool_s mb_delivery_pool_t;
+typedef struct mb_command_s mb_command_t;
+typedef struct mb_command_templates_s mb_command_templates_t;
+
+/* Growable byte buffer, reused across messages to avoid allocating for each field */
+typedef struct mb_buf_s {
+/* {{{ */
+    char    *data;
+    size_t  len;
+    size_t  size;
+/* }}} */
+} mb_buf_t;
+
+/* Bump allocator for data living as long as a received message */
+typedef struct mb_arena_s {
+/* {{{ */
+    mb_arena_chunk_t    *chunks;
+/* }}} */
+} mb_arena_t;
+
+/*
+    Received message, its header fields and body are allocated from its arena, unless the
+    body is left in the librabbitmq frame buffers or was inflated into `body_alloc'.
+*/
+typedef struct mb_delivery_s {
+/* {{{ */
+    char                    *cid;
+    char                    *content_type;
+    char                    *content_encoding;
+    char                    *body;
+    char                    *body_alloc;
+    size_t                  body_len;
+    uint64_t                tag;
+    mb_arena_t              arena;
+    struct mb_delivery_s    *next;
+/* }}} */
+} mb_delivery_t;
+
+/* How checks are spread over publisher connections and channels */
+enum mb_publisher_sharding_modes {
+    MB_PUBLISHER_SHARDING_ROUTING_KEY,
+    MB_PUBLISHER_SHARDING_OBJECT,
+};
+
+/* Wire format of published check messages */
+enum mb_publisher_formats {
+    MB_PUBLISHER_FORMAT_JSON,
+    MB_PUBLISHER_FORMAT_MSGPACK,
+};
+
+/* Compression of published message bodies */
+enum mb_compression_algorithms {
+    MB_COMPRESSION_NONE,
+    MB_COMPRESSION_LZ4,
+    MB_COMPRESSION_ZSTD,
+};
+
+/* What happens to checks whose result doesn't come back in time */
+enum mb_check_timeout_actions {
+    MB_CHECK_TIMEOUT_NONE,
+    MB_CHECK_TIMEOUT_FAIL,
+    MB_CHECK_TIMEOUT_REPUBLISH,
+};
+
+/* Fate of a received check result, according to the checks in flight */
+enum mb_inflight_results {
+    MB_INFLIGHT_RESULT_MATCHED,
+    MB_INFLIGHT_RESULT_UNKNOWN,
+    MB_INFLIGHT_RESULT_SUPERSEDED,
+    MB_INFLIGHT_RESULT_LATE,
+    MB_INFLIGHT_RESULT_MISMATCHED,
+};
+
+/* How checks of a host or service are dispatched, only depends on the configuration */
+typedef struct mb_dispatch_entry_s {
+/* {{{ */
+    void            *object;
+    char            *routing_key;
+    size_t          routing_key_len;
+    unsigned long   shard;
+    bool            local;
+
+    /* Pre-scanned check command, compiled on the object's first check */
+    mb_command_t    *command;
+/* }}} */
+} mb_dispatch_entry_t;
+
+/*
+    Check command line as it goes in check messages: either expanded in full, or as the ID
+    of a command template and the values of its arguments
+*/
+typedef struct mb_check_command_s {
+/* {{{ */
+    const char  *line;
+    const char  *template_id;
+    const char  **args;
+    size_t      *args_len;
+    int         nargs;
+/* }}} */
+} mb_check_command_t;
+
+/*
+    Command line split around the parts expanded for each object, so that workers can put
+    it back together from the values of its `nargs' arguments: `text' is the concatenation
+    of the `nargs + 1' parts whose lengths are in `parts'
+*/
+typedef struct mb_command_template_s {
+/* {{{ */
+    char        id[MB_COMMAND_TEMPLATE_ID_LEN + 1];
+    uint64_t    hash;
+    char        *text;
+    size_t      *parts;
+    int         nargs;
+/* }}} */
+} mb_command_template_t;
+
+/* Check result allocated by mod_bunny, Nagios only knowing about its first member */
+typedef struct mb_check_result_s {
+/* {{{ */
+    check_result    cr;
+    uint64_t        received_us;
+    bool            consumed;
+/* }}} */
+} mb_check_result_t;
+
+/*
+    Serialized check message handed over from Nagios callbacks to the publisher thread, or
+    kept by the in-flight table for republishing. Messages whose body buffer size is known
+    are recycled once done with.
+*/
+typedef TAILQ_HEAD(mb_check_msgs_s, mb_check_msg_s) mb_check_msgs_t;
+typedef struct mb_check_msg_s {
+/* {{{ */
+    char        cid[MB_CID_BUF_LEN];
+    size_t      cid_len;
+    char        *routing_key;
+    size_t      routing_key_len;
+    int         channel;
+    const char  *content_type;
+    const char  *content_encoding;
+    char        *body;
+    size_t      body_len;
+    size_t      body_size;
+
+    /* Command template definition, published to the command templates exchange and never batched */
+    bool        command_template;
+    TAILQ_ENTRY(mb_check_msg_s) tq;
+/* }}} */
+} mb_check_msg_t;
+
+/* Check whose deadline passed before its result came back */
+typedef struct mb_inflight_check_s {
+/* {{{ */
+    void        *object;
+    int         object_type;
+    int         attempt;
+    char        *routing_key;
+    int         timeout;
+    int         republished;
+
+    /* Message kept to be published again, if any */
+    mb_check_msg_t *msg;
+/* }}} */
+} mb_inflight_check_t;
+
+/* Messages published in confirm mode, waiting for the broker acknowledgement */
+typedef struct mb_confirm_window_s {
+/* {{{ */
+    mb_check_msg_t  **msgs;
+    int             size;
+    int             first;
+    int             count;
+    uint64_t        first_tag;
+/* }}} */
+} mb_confirm_window_t;
+
+/* Checks waiting in the publisher thread to be sent together with the same routing key */
+typedef TAILQ_HEAD(mb_check_batches_s, mb_check_batch_s) mb_check_batches_t;
+typedef struct mb_check_batch_s {
+/* {{{ */
+    char            *routing_key;
+    int             channel;
+    const char      *content_type;
+    mb_check_msg_t  **msgs;
+    int             count;
+    struct timespec opened;
+    TAILQ_ENTRY(mb_check_batch_s) tq;
+/* }}} */
+} mb_check_batch_t;
+
 typedef TAILQ_HEAD(mb_hstgroups_s, mb_hstgroup_s) mb_hstgroups_t;
 typedef struct mb_hstgroup_s {
 /* {{{ */
@@ -113,7 +394,33 @@ typedef struct mb_svcgroup_route_s {
 /* }}} */
 } mb_svcgroup_route_t;
 
-typedef struct mb_config_s {
+typedef struct mb_config_s mb_config_t;
+
+/* Publisher connection, owned by its own publisher thread */
+typedef struct mb_publisher_s {
+/* {{{ */
+    int                     id;
+    mb_config_t             *config;
+    pthread_t               thread;
+    mb_queue_t              *queue;
+    mb_compressor_t         *compressor;
+
+    amqp_connection_state_t amqp_conn;
+#ifdef LIBRABBITMQ_LEGACY
+    int                     amqp_sockfd;
+#else
+    amqp_socket_t           *amqp_socket;
+#endif
+    bool                    connected;
+
+    /* Health tracking */
+    time_t                  down_since;
+    unsigned long           connect_failures;
+    unsigned long           publish_failures;
+/* }}} */
+} mb_publisher_t;
+
+struct mb_config_s {
 /* {{{ */
     int                     debug_level;
     int                     retry_wait_time;
@@ -122,22 +429,59 @@ typedef struct mb_config_s {
     mb_hstgroups_t          *local_hstgroups;
     mb_svcgroups_t          *local_svcgroups;
 
+    /* Group patterns above, compiled for lookups */
+    mb_matcher_t            *hstgroups_routing_matcher;
+    mb_matcher_t            *svcgroups_routing_matcher;
+    mb_matcher_t            *local_hstgroups_matcher;
+    mb_matcher_t            *local_svcgroups_matcher;
+
+    /* Per-object dispatch decisions, valid for the configuration generation they were built for */
+    unsigned long           generation;
+    mb_dispatch_t           *dispatch;
+
     char                    host[MB_BUF_LEN];
     int                     port;
     char                    vhost[MB_BUF_LEN];
     char                    user[MB_BUF_LEN];
     char                    password[MB_BUF_LEN];
 
-    amqp_connection_state_t publisher_amqp_conn;
-#ifdef LIBRABBITMQ_LEGACY
-    int                     publisher_amqp_sockfd;
-#else
-    amqp_socket_t           *publisher_amqp_socket;
-#endif
+    mb_publisher_t          *publishers;
+    int                     publisher_connections;
+    int                     publisher_channels;
+    char                    publisher_sharding[MB_BUF_LEN];
+    int                     publisher_sharding_mode;
+    char                    publisher_format[MB_BUF_LEN];
+    int                     publisher_format_mode;
+    char                    publisher_compression[MB_BUF_LEN];
+    int                     publisher_compression_mode;
+    int                     compression_threshold;
+    char                    compression_dictionary[MB_BUF_LEN];
     char                    publisher_exchange[MB_BUF_LEN];
     char                    publisher_routing_key[MB_BUF_LEN];
     char                    publisher_exchange_type[MB_BUF_LEN];
-    bool                    publisher_connected;
+    int                     publisher_queue_size;
+    mb_queue_t              *check_msgs;
+    int                     max_batch_checks;
+    int                     max_batch_linger_ms;
+    bool                    publisher_confirms;
+    int                     publisher_confirm_window;
+
+    /* Message properties and exchange shared by all published checks */
+    amqp_basic_properties_t publisher_props;
+    amqp_bytes_t            publisher_exchange_bytes;
+
+    /* Command templates published so far, only used by the Nagios thread */
+    bool                    command_templates;
+    char                    command_templates_exchange[MB_BUF_LEN];
+    int                     command_templates_interval;
+    amqp_bytes_t            command_templates_exchange_bytes;
+    mb_command_templates_t  *known_templates;
+
+    char                    spool_file[MB_BUF_LEN];
+    int                     spool_max_size;
+    int                     spool_max_checks;
+    int                     spool_replay_rate;
+    mb_spool_t              *spool;
 
     amqp_connection_state_t consumer_amqp_conn;
 #ifdef LIBRABBITMQ_LEGACY
@@ -149,12 +493,62 @@ typedef struct mb_config_s {
     char                    consumer_exchange_type[MB_BUF_LEN];
     char                    consumer_queue[MB_BUF_LEN];
     char                    consumer_binding_key[MB_BUF_LEN];
+    bool                    fast_command_macros;
+    bool                    fast_result_decoder;
+    int                     decode_workers;
+    mb_decoder_pool_t       *decoders;
+    mb_delivery_pool_t      *deliveries;
+    bool                    inflight_tracking;
+    int                     inflight_table_size;
+    mb_inflight_t           *inflight;
+    char                    check_timeout_action[MB_BUF_LEN];
+    int                     check_timeout_mode;
+    int                     check_timeout_slack;
+    char                    check_timeout_routing_key[MB_BUF_LEN];
+    mb_timer_wheel_t        *check_timeouts;
+    mb_compressor_t         *consumer_compressor;
     bool                    consumer_connected;
+    bool                    consumer_stopping;
+
+    /* Manual acknowledgements of consumed messages */
+    bool                    consumer_acks;
+    int                     consumer_prefetch;
+    int                     consumer_ack_batch;
+    int                     consumer_ack_linger_ms;
+    mb_consumer_acks_t      *acks;
+    unsigned long           results_submitted;
+    unsigned long           results_handed;
+
+    /* Check results handed over to the Nagios thread */
+    int                     result_queue_size;
+    mb_queue_t              *results;
+
+    /* Failed check results the queue had no room for, only touched by the first publisher thread */
+    check_result            *deferred_results;
+
+    /* Reaper passes run by mod_bunny, only touched by the Nagios thread */
+    bool                    reaper_trigger;
+    int                     reaper_trigger_results;
+    int                     reaper_trigger_age;
+    check_result            *pending_results;
+    check_result            **pending_results_tail;
+    unsigned long           pending_results_count;
+    unsigned long           pending_results_consumed;
+    time_t                  reaper_backoff_until;
+    unsigned long           reaper_passes;
+    unsigned long           reap_delays[MB_REAP_DELAY_BUCKETS];
 /* }}} */
-} mb_config_t;
+};
 
 /* mod_bunny.c */
+void    mb_decode_check_result(char *, char *, char *, size_t, void (*)(char *, check_result *));
+void    mb_delivery_done(mb_delivery_t *);
 void    mb_deregister_callbacks(void);
+void    mb_drain_check_results(void *);
+void    mb_expire_check(uint64_t);
+void    mb_fail_check(char *, char *, char *);
+void    mb_flush_check_results(void);
+void    mb_free_check_msg(mb_check_msg_t *);
 void    mb_free_hostgroups(mb_hstgroups_t *);
 void    mb_free_hostgroups_routing_table(mb_hstgroup_routes_t *);
 void    mb_free_servicegroups(mb_svcgroups_t *);
@@ -166,33 +560,194 @@ int     mb_in_local_hostgroups(host *);
 int     mb_in_local_servicegroups(service *);
 int     mb_init(int, void *);
 int     mb_init_config();
+int     mb_init_group_matchers(void);
+void    mb_init_dispatch(void);
+int     mb_expand_check_command(mb_dispatch_entry_t *, command *, char *, host *, service *, mb_check_command_t *);
+mb_dispatch_entry_t *mb_host_dispatch(host *, mb_dispatch_entry_t *);
+mb_dispatch_entry_t *mb_service_dispatch(service *, mb_dispatch_entry_t *);
+int     mb_start_publisher_threads(void);
+void    mb_stop_publisher_threads(void);
 char    *mb_lookup_hostgroups_routing_table(host *);
 char    *mb_lookup_servicegroups_routing_table(service *);
 void    mb_mark_check_orphaned(char *, char *);
 void    mb_register_callbacks(void);
-void    mb_process_check_result(char *, char *);
-int     mb_publish_check(char *, char *, char *);
+int     mb_republish_check(mb_inflight_check_t *);
+bool    mb_content_type_is_binary(const char *);
+void    mb_process_check_result(mb_delivery_t *);
+int     mb_publish_check(char *, const char *, size_t, char *, size_t, unsigned long, int);
+int     mb_publish_command_template(mb_command_template_t *, unsigned long);
+void    mb_republish_command_templates(void *);
+int     mb_queue_check_result(check_result *, bool);
+void    mb_queue_deferred_check_results(void);
+void    mb_record_reap_delay(unsigned long);
+mb_publisher_t  *mb_select_publisher(unsigned long, int *);
+int     mb_shard_channel(unsigned long);
+void    mb_submit_check_result(char *, check_result *);
+void    mb_trigger_reaper(void);
+void    mb_watch_check(uint64_t, const char *, size_t, int);
 
 /* mb_hash.c */
-void    mb_gen_cid(char *, size_t, char *, char *);
+unsigned long   mb_hash_ptr(void *);
+unsigned long   mb_hash_str(const char *);
 
 /* mb_thread.c */
 void    *mb_thread_consume(void *);
 void    *mb_thread_publish(void *);
 
+/* mb_batch.c */
+mb_check_batch_t    *mb_batch_add(mb_check_batches_t *, mb_check_msg_t *, int);
+mb_check_batch_t    *mb_batch_expired(mb_check_batches_t *, int);
+void                mb_batch_free_all(mb_check_batches_t *);
+int                 mb_batch_linger_left(mb_check_batches_t *, int);
+mb_check_msg_t      *mb_batch_pack(mb_check_batches_t *, mb_check_batch_t *);
+
+/* mb_confirm.c */
+uint64_t            mb_confirm_window_add(mb_confirm_window_t *, mb_check_msg_t *);
+void                mb_confirm_window_ack(mb_confirm_window_t *, uint64_t, bool);
+void                mb_confirm_window_free(mb_confirm_window_t *);
+bool                mb_confirm_window_full(mb_confirm_window_t *);
+void                mb_confirm_window_nack(mb_confirm_window_t *, uint64_t, bool, mb_check_msgs_t *);
+mb_confirm_window_t *mb_confirm_window_new(int);
+void                mb_confirm_window_reset(mb_confirm_window_t *, mb_check_msgs_t *);
+
+/* mb_arena.c */
+void    *mb_arena_alloc(mb_arena_t *, size_t);
+void    mb_arena_free(mb_arena_t *);
+void    mb_arena_reset(mb_arena_t *);
+char    *mb_arena_strndup(mb_arena_t *, const char *, size_t);
+
+/* mb_buf.c */
+int     mb_buf_append(mb_buf_t *, const char *, size_t);
+void    mb_buf_free(mb_buf_t *);
+int     mb_buf_reserve(mb_buf_t *, size_t);
+void    mb_buf_reset(mb_buf_t *);
+
+/* mb_cid.c */
+int             mb_cid_decode(const char *, uint64_t *, time_t *);
+void            mb_cid_init(void);
+void            mb_gen_cid(char *);
+
+/* mb_compress.c */
+bool            mb_compression_supported(const char *);
+int             mb_compress_init(mb_config_t *);
+void            mb_compress_deinit(void);
+int             mb_compress_msg(mb_compressor_t *, mb_check_msg_t *, int, int);
+mb_compressor_t *mb_compressor_new(void);
+void            mb_compressor_free(mb_compressor_t *);
+int             mb_decompress(mb_compressor_t *, const char *, char *, size_t, char **, size_t *);
+
+/* mb_queue.c */
+void        mb_queue_free(mb_queue_t *);
+size_t      mb_queue_length(mb_queue_t *);
+mb_queue_t  *mb_queue_new(size_t);
+void        *mb_queue_pop(mb_queue_t *);
+int         mb_queue_push(mb_queue_t *, void *);
+void        mb_queue_wait(mb_queue_t *, int);
+
+/* mb_command.c */
+mb_command_t    *mb_command_compile(command *, char *, int);
+char            *mb_command_expand(mb_command_t *, host *, service *);
+int             mb_command_expand_args(mb_command_t *, host *, service *, mb_check_command_t *);
+void            mb_command_free(mb_command_t *);
+void            mb_command_free_buffers(void);
+bool            mb_command_expandable(mb_command_t *);
+bool            mb_command_matches(mb_command_t *, command *, char *);
+mb_command_template_t   *mb_command_template(mb_command_t *);
+int             mb_command_templates_add(mb_command_templates_t *, mb_command_template_t *);
+void            mb_command_templates_foreach(mb_command_templates_t *, void (*)(mb_command_template_t *));
+void            mb_command_templates_free(mb_command_templates_t *);
+bool            mb_command_templates_has(mb_command_templates_t *, mb_command_template_t *);
+mb_command_templates_t  *mb_command_templates_new(void);
+
+/* mb_decoder.c */
+void                mb_decoder_pool_flush(mb_decoder_pool_t *, bool);
+void                mb_decoder_pool_free(mb_decoder_pool_t *);
+mb_decoder_pool_t   *mb_decoder_pool_new(int);
+void                mb_decoder_pool_submit(mb_decoder_pool_t *, mb_delivery_t *);
+
+/* mb_delivery.c */
+void                mb_delivery_free(mb_delivery_t *);
+mb_delivery_t       *mb_delivery_new(mb_delivery_pool_t *);
+void                mb_delivery_pool_free(mb_delivery_pool_t *);
+mb_delivery_pool_t  *mb_delivery_pool_new(void);
+void                mb_delivery_release(mb_delivery_pool_t *, mb_delivery_t *);
+
+/* mb_dispatch.c */
+int                 mb_dispatch_add(mb_dispatch_t *, mb_dispatch_entry_t *);
+void                mb_dispatch_free(mb_dispatch_t *);
+mb_dispatch_entry_t *mb_dispatch_lookup(mb_dispatch_t *, void *, unsigned long);
+mb_dispatch_t       *mb_dispatch_new(size_t, unsigned long);
+
+/* mb_inflight.c */
+uint64_t        mb_inflight_add(mb_inflight_t *, const char *, void *, int, char *, int, int);
+void            mb_inflight_cancel(mb_inflight_t *, uint64_t);
+bool            mb_inflight_expire(mb_inflight_t *, uint64_t, mb_inflight_check_t *);
+void            mb_inflight_free(mb_inflight_t *);
+mb_inflight_t   *mb_inflight_new(size_t, int);
+int             mb_inflight_remove(mb_inflight_t *, const char *, check_result *, uint64_t *);
+const char      *mb_inflight_result_str(int);
+void            mb_inflight_retain(mb_inflight_t *, uint64_t, mb_check_msg_t *, int);
+void            mb_inflight_supersede(mb_inflight_t *, void *, uint64_t);
+
+/* mb_timer.c */
+int                 mb_timer_wheel_add(mb_timer_wheel_t *, uint64_t, int);
+void                mb_timer_wheel_advance(mb_timer_wheel_t *, void (*)(uint64_t));
+void                mb_timer_wheel_free(mb_timer_wheel_t *);
+mb_timer_wheel_t    *mb_timer_wheel_new(void);
+
+/* mb_match.c */
+int             mb_matcher_add(mb_matcher_t *, const char *, int, void *);
+void            mb_matcher_free(mb_matcher_t *);
+void            *mb_matcher_lookup(mb_matcher_t *, const char *);
+mb_matcher_t    *mb_matcher_new(void);
+
+/* mb_result.c */
+check_result    *mb_merge_check_results(check_result *, check_result *);
+check_result    *mb_new_check_result(void);
+check_result    *mb_sort_check_results(check_result *);
+
+/* mb_spool.c */
+void            mb_spool_close(mb_spool_t *);
+mb_spool_t      *mb_spool_open(mb_config_t *);
+mb_check_msg_t  *mb_spool_pop(mb_spool_t *, unsigned long *, int *);
+int             mb_spool_push(mb_spool_t *, mb_check_msg_t *, unsigned long, time_t);
+
 /* mb_amqp.c */
+mb_consumer_acks_t  *mb_amqp_acks_new(int);
+void    mb_amqp_acks_free(mb_consumer_acks_t *);
 int     mb_amqp_connect_consumer(mb_config_t *);
-int     mb_amqp_connect_publisher(mb_config_t *);
-void    mb_amqp_consume(mb_config_t *, void (*)(char *, char *));
+int     mb_amqp_connect_publisher(mb_publisher_t *);
+void    mb_amqp_consume(mb_config_t *, void (*)(mb_delivery_t *), void (*)(void));
+void    mb_amqp_delivery_done(mb_config_t *, uint64_t);
 int     mb_amqp_disconnect_consumer(mb_config_t *);
-int     mb_amqp_disconnect_publisher(mb_config_t *);
-int     mb_amqp_publish(mb_config_t *, char *, char *, char *);
+int     mb_amqp_disconnect_publisher(mb_publisher_t *);
+void    mb_amqp_init_publisher_props(mb_config_t *);
+int     mb_amqp_publish(mb_publisher_t *, mb_check_msg_t *);
+int     mb_amqp_wait_confirms(mb_publisher_t *, mb_confirm_window_t **, mb_check_msgs_t *, int);
+
+/* mb_msgpack.c */
+void            mb_msgpack_free_buffers(void);
+const char      *mb_msgpack_pack_command_template(mb_command_template_t *, size_t *);
+const char      *mb_msgpack_pack_host_check(nebstruct_host_check_data *, int, mb_check_command_t *, size_t *);
+const char      *mb_msgpack_pack_service_check(nebstruct_service_check_data *, int, mb_check_command_t *, size_t *);
+check_result    *mb_msgpack_unpack_check_result(char *, size_t);
+int             mb_msgpack_unpack_check_result_batch(char *, size_t, void (*)(char *, check_result *));
+int             mb_msgpack_write_array(mb_buf_t *, uint32_t);
+int             mb_msgpack_write_float(mb_buf_t *, double);
+int             mb_msgpack_write_int(mb_buf_t *, int64_t);
+int             mb_msgpack_write_map(mb_buf_t *, uint32_t);
+int             mb_msgpack_write_str(mb_buf_t *, const char *, size_t);
 
 /* mb_json.c */
 int             mb_json_parse_config(char *, mb_config_t *);
-char            *mb_json_pack_host_check(nebstruct_host_check_data *, int, char *);
-char            *mb_json_pack_service_check(nebstruct_service_check_data *, int, char *);
+void            mb_json_free_buffers(void);
+const char      *mb_json_pack_command_template(mb_command_template_t *, size_t *);
+const char      *mb_json_pack_host_check(nebstruct_host_check_data *, int, mb_check_command_t *, size_t *);
+const char      *mb_json_pack_service_check(nebstruct_service_check_data *, int, mb_check_command_t *, size_t *);
+check_result    *mb_json_decode_check_result(char *);
+int             mb_json_decode_check_result_batch(char *, void (*)(char *, check_result *));
 check_result    *mb_json_unpack_check_result(char *);
+int             mb_json_unpack_check_result_batch(char *, void (*)(char *, check_result *));
 
 #endif
 